@@ -18,7 +18,11 @@
 #include "access/printtup.h"
 #include "libpq/libpq.h"
 #include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
 #include "tcop/pquery.h"
+#include "tcop/tcopprot.h"
+#include "utils/fmgroids.h"
+#include "utils/jsonstream.h"
 #include "utils/lsyscache.h"
 #include "utils/memdebug.h"
 #include "utils/memutils.h"
@@ -32,6 +36,9 @@ static bool printtup_internal_20(TupleTableSlot *slot, DestReceiver *self);
 static void printtup_shutdown(DestReceiver *self);
 static void printtup_destroy(DestReceiver *self);
 
+static void printtup_send_streams(StringInfo buf, JsonStream **streams,
+					 int *offsets, int nstreams);
+
 static void SendRowDescriptionCols_2(StringInfo buf, TupleDesc typeinfo,
 						 List *targetlist, int16 *formats);
 static void SendRowDescriptionCols_3(StringInfo buf, TupleDesc typeinfo,
@@ -382,6 +389,9 @@ printtup(TupleTableSlot *slot, DestReceiver *self)
 	MemoryContext oldcontext;
 	StringInfo	buf = &myState->buf;
 	int			natts = typeinfo->natts;
+	JsonStream **streams = NULL;
+	int		   *stream_offsets = NULL;
+	int			nstreams = 0;
 	int			i;
 
 	/* Set or update my derived attribute info, if needed */
@@ -426,6 +436,39 @@ printtup(TupleTableSlot *slot, DestReceiver *self)
 			VALGRIND_CHECK_MEM_IS_DEFINED(DatumGetPointer(attr),
 										  VARSIZE_ANY(attr));
 
+		/*
+		 * The text of a json stream is what both output functions of json
+		 * produce, unless it needs an encoding conversion.  It is not put
+		 * in the buffer, but sent from the stream along with the buffer.
+		 */
+		if (thisState->typisvarlena &&
+			(thisState->finfo.fn_oid == F_JSON_OUT ||
+			 thisState->finfo.fn_oid == F_JSON_SEND) &&
+			(pg_get_client_encoding() == GetDatabaseEncoding() ||
+			 pg_get_client_encoding() == PG_SQL_ASCII))
+		{
+			JsonStream *js = DatumGetJsonStream(attr);
+
+			if (js)
+			{
+				if (JsonStreamGetSize(js) > PG_INT32_MAX)
+					ereport(ERROR,
+							(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+							 errmsg("json value is too large to be sent")));
+
+				if (streams == NULL)
+				{
+					streams = palloc(sizeof(JsonStream *) * natts);
+					stream_offsets = palloc(sizeof(int) * natts);
+				}
+
+				pq_sendint32(buf, JsonStreamGetSize(js));
+				streams[nstreams] = js;
+				stream_offsets[nstreams++] = buf->len;
+				continue;
+			}
+		}
+
 		if (thisState->format == 0)
 		{
 			/* Text output */
@@ -446,7 +489,10 @@ printtup(TupleTableSlot *slot, DestReceiver *self)
 		}
 	}
 
-	pq_endmessage_reuse(buf);
+	if (nstreams > 0)
+		printtup_send_streams(buf, streams, stream_offsets, nstreams);
+	else
+		pq_endmessage_reuse(buf);
 
 	/* Return to caller's context, and flush row's temporary memory */
 	MemoryContextSwitchTo(oldcontext);
@@ -533,6 +579,72 @@ printtup_20(TupleTableSlot *slot, DestReceiver *self)
 	return true;
 }
 
+/*
+ * Send a DataRow message prepared in 'buf' without the text of the json
+ * streams, which is read from the streams in pieces.  The text of each
+ * stream is sent after the part of the buffer up to the offset it belongs
+ * at.
+ */
+static void
+printtup_send_streams(StringInfo buf, JsonStream **streams, int *offsets,
+					  int nstreams)
+{
+	int64		len = buf->len;
+	char	   *chunk;
+	int			i;
+
+	for (i = 0; i < nstreams; i++)
+		len += JsonStreamGetSize(streams[i]);
+
+	if (len > PG_INT32_MAX - 4)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("row is too large to be sent")));
+
+	chunk = palloc(JSON_STREAM_CHUNK_SIZE);
+
+	PG_TRY();
+	{
+		int			start = 0;
+
+		/* buf->cursor holds the message type, see pq_beginmessage_reuse */
+		(void) pq_putmessage_start(buf->cursor, len);
+
+		for (i = 0; i < nstreams; i++)
+		{
+			int64		size = JsonStreamGetSize(streams[i]);
+			int64		offset;
+
+			(void) pq_putmessage_bytes(buf->data + start, offsets[i] - start);
+			start = offsets[i];
+
+			for (offset = 0; offset < size; offset += JSON_STREAM_CHUNK_SIZE)
+			{
+				int			chunklen = Min(size - offset, JSON_STREAM_CHUNK_SIZE);
+
+				JsonStreamRead(streams[i], offset, chunk, chunklen);
+				(void) pq_putmessage_bytes(chunk, chunklen);
+			}
+		}
+
+		(void) pq_putmessage_bytes(buf->data + start, buf->len - start);
+	}
+	PG_CATCH();
+	{
+		/*
+		 * The client has got only a part of the message, so there is no way
+		 * to report the error to it.
+		 */
+		whereToSendOutput = DestNone;
+		ereport(FATAL,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("terminating connection because protocol synchronization was lost")));
+	}
+	PG_END_TRY();
+
+	pfree(chunk);
+}
+
 /* ----------------
  *		printtup_shutdown
  * ----------------
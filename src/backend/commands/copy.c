@@ -50,6 +50,8 @@
 #include "storage/fd.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/jsonstream.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/partcache.h"
@@ -374,6 +376,7 @@ static Datum CopyReadBinaryAttribute(CopyState cstate,
 						Oid typioparam, int32 typmod,
 						bool *isnull);
 static void CopyAttributeOutText(CopyState cstate, char *string);
+static void CopyAttributeOutJsonStream(CopyState cstate, JsonStream *js);
 static void CopyAttributeOutCSV(CopyState cstate, char *string,
 					bool use_quote, bool single_attr);
 static List *CopyGetAttnums(TupleDesc tupDesc, Relation rel,
@@ -388,6 +391,7 @@ static void CopySendData(CopyState cstate, const void *databuf, int datasize);
 static void CopySendString(CopyState cstate, const char *str);
 static void CopySendChar(CopyState cstate, char c);
 static void CopySendEndOfRow(CopyState cstate);
+static void CopySendPartOfRow(CopyState cstate);
 static int CopyGetData(CopyState cstate, void *databuf,
 			int minread, int maxread);
 static void CopySendInt32(CopyState cstate, int32 val);
@@ -493,7 +497,8 @@ SendCopyEnd(CopyState cstate)
  * CopySendString does the same for null-terminated strings
  * CopySendChar does the same for single characters
  * CopySendEndOfRow does the appropriate thing at end of each data row
- *	(data is not actually flushed except by CopySendEndOfRow)
+ *	(data is not actually flushed except by CopySendEndOfRow and
+ *	CopySendPartOfRow)
  *
  * NB: no data conversion is applied by these functions
  *----------
@@ -519,8 +524,6 @@ CopySendChar(CopyState cstate, char c)
 static void
 CopySendEndOfRow(CopyState cstate)
 {
-	StringInfo	fe_msgbuf = cstate->fe_msgbuf;
-
 	switch (cstate->copy_dest)
 	{
 		case COPY_FILE:
@@ -534,6 +537,45 @@ CopySendEndOfRow(CopyState cstate)
 #endif
 			}
 
+			CopySendPartOfRow(cstate);
+			break;
+		case COPY_OLD_FE:
+			/* The FE/BE protocol uses \n as newline for all platforms */
+			if (!cstate->binary)
+				CopySendChar(cstate, '\n');
+
+			CopySendPartOfRow(cstate);
+			break;
+		case COPY_NEW_FE:
+			/* The FE/BE protocol uses \n as newline for all platforms */
+			if (!cstate->binary)
+				CopySendChar(cstate, '\n');
+
+			/* Dump the accumulated row as one CopyData message */
+			(void) pq_putmessage('d', cstate->fe_msgbuf->data,
+								 cstate->fe_msgbuf->len);
+			break;
+		case COPY_CALLBACK:
+			Assert(false);		/* Not yet supported. */
+			break;
+	}
+
+	resetStringInfo(cstate->fe_msgbuf);
+}
+
+/*
+ * CopySendPartOfRow writes out the data accumulated so far, for the
+ * destinations that do not need the rows to be sent as a whole.  This is
+ * used for values too large to be built in memory.
+ */
+static void
+CopySendPartOfRow(CopyState cstate)
+{
+	StringInfo	fe_msgbuf = cstate->fe_msgbuf;
+
+	switch (cstate->copy_dest)
+	{
+		case COPY_FILE:
 			if (fwrite(fe_msgbuf->data, fe_msgbuf->len, 1,
 					   cstate->copy_file) != 1 ||
 				ferror(cstate->copy_file))
@@ -568,10 +610,6 @@ CopySendEndOfRow(CopyState cstate)
 			}
 			break;
 		case COPY_OLD_FE:
-			/* The FE/BE protocol uses \n as newline for all platforms */
-			if (!cstate->binary)
-				CopySendChar(cstate, '\n');
-
 			if (pq_putbytes(fe_msgbuf->data, fe_msgbuf->len))
 			{
 				/* no hope of recovering connection sync, so FATAL */
@@ -581,13 +619,8 @@ CopySendEndOfRow(CopyState cstate)
 			}
 			break;
 		case COPY_NEW_FE:
-			/* The FE/BE protocol uses \n as newline for all platforms */
-			if (!cstate->binary)
-				CopySendChar(cstate, '\n');
-
-			/* Dump the accumulated row as one CopyData message */
-			(void) pq_putmessage('d', fe_msgbuf->data, fe_msgbuf->len);
-			break;
+			/* Each row is sent as one CopyData message */
+			return;
 		case COPY_CALLBACK:
 			Assert(false);		/* Not yet supported. */
 			break;
@@ -2204,6 +2237,19 @@ CopyOneRowTo(CopyState cstate, TupleTableSlot *slot)
 		{
 			if (!cstate->binary)
 			{
+				JsonStream *js = NULL;
+
+				/* json streams are escaped and sent in pieces */
+				if (!cstate->csv_mode &&
+					out_functions[attnum - 1].fn_oid == F_JSON_OUT)
+					js = DatumGetJsonStream(value);
+
+				if (js)
+				{
+					CopyAttributeOutJsonStream(cstate, js);
+					continue;
+				}
+
 				string = OutputFunctionCall(&out_functions[attnum - 1],
 											value);
 				if (cstate->csv_mode)
@@ -4975,6 +5021,62 @@ CopyAttributeOutText(CopyState cstate, char *string)
 	DUMPSOFAR();
 }
 
+/*
+ * Send the text of a json stream as CopyAttributeOutText does, reading and
+ * escaping it in pieces cut at character boundaries.  Unless the row has to
+ * be sent as a whole, each piece is written out right away.
+ */
+static void
+CopyAttributeOutJsonStream(CopyState cstate, JsonStream *js)
+{
+	int64		size = JsonStreamGetSize(js);
+	int64		offset = 0;
+	char	   *chunk = palloc(JSON_STREAM_CHUNK_SIZE + 1);
+	int			pending = 0;
+	MemoryContext chunkcontext;
+	MemoryContext oldcontext;
+
+	/* for the encoding conversion of each piece */
+	chunkcontext = AllocSetContextCreate(CurrentMemoryContext,
+										 "COPY TO json stream",
+										 ALLOCSET_DEFAULT_SIZES);
+	oldcontext = MemoryContextSwitchTo(chunkcontext);
+
+	while (offset < size)
+	{
+		int			len = Min(size - offset, JSON_STREAM_CHUNK_SIZE - pending);
+		int			cliplen;
+
+		/* the incomplete character of the previous piece goes first */
+		JsonStreamRead(js, offset, chunk + pending, len);
+		offset += len;
+		len += pending;
+
+		cliplen = offset < size ? pg_mbcliplen(chunk, len, len) : len;
+		pending = len - cliplen;
+
+		chunk[len] = '\0';
+		if (pending > 0)
+		{
+			char		c = chunk[cliplen];
+
+			chunk[cliplen] = '\0';
+			CopyAttributeOutText(cstate, chunk);
+			chunk[cliplen] = c;
+			memmove(chunk, chunk + cliplen, pending);
+		}
+		else
+			CopyAttributeOutText(cstate, chunk);
+
+		CopySendPartOfRow(cstate);
+		MemoryContextReset(chunkcontext);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(chunkcontext);
+	pfree(chunk);
+}
+
 /*
  * Send text representation of one attribute, with conversion and
  * CSV-style escaping
@@ -44,6 +44,7 @@
 #include "pgstat.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
+#include "utils/fmgroids.h"
 #include "utils/jsonpath.h"
 #include "utils/lsyscache.h"
 #include "utils/typcache.h"
@@ -56,6 +57,16 @@ typedef struct LastAttnumInfo
 	AttrNumber	last_scan;
 } LastAttnumInfo;
 
+/* Element of ExprState.detoast_vars */
+typedef struct DetoastVarInfo
+{
+	Index		varno;
+	AttrNumber	varattno;
+	int			nrefs;			/* number of uses as a function argument */
+	int			nslicerefs;		/* ... of them by functions fetching slices */
+	ExprVarDetoastCache *cache;
+} DetoastVarInfo;
+
 static void ExecReadyExpr(ExprState *state);
 static void ExecInitExprRec(Expr *node, ExprState *state,
 				Datum *resv, bool *resnull);
@@ -65,6 +76,9 @@ static void ExecInitFunc(ExprEvalStep *scratch, Expr *node, List *args,
 static void ExecInitExprSlots(ExprState *state, Node *node);
 static void ExecPushExprSlots(ExprState *state, LastAttnumInfo *info);
 static bool get_last_attnums_walker(Node *node, LastAttnumInfo *info);
+static bool get_detoast_vars_walker(Node *node, List **vars);
+static ExprVarDetoastCache *ExecGetVarDetoastCache(ExprState *state,
+					   Var *variable);
 static void ExecComputeSlotInfo(ExprState *state, ExprEvalStep *op);
 static void ExecInitWholeRowVar(ExprEvalStep *scratch, Var *variable,
 					ExprState *state);
@@ -80,6 +94,7 @@ static void ExecBuildAggTransCall(ExprState *state, AggState *aggstate,
 					  ExprEvalStep *scratch,
 					  FunctionCallInfo fcinfo, AggStatePerTrans pertrans,
 					  int transno, int setno, int setoff, bool ishash);
+static JsonSafeCoercion ExecInitJsonSafeCoercion(Expr *expr);
 
 
 static ExprState *
@@ -687,21 +702,29 @@ ExecInitExprRec(Expr *node, ExprState *state,
 				else
 				{
 					/* regular user column */
+					ExprVarDetoastCache *detoast;
+
+					detoast = ExecGetVarDetoastCache(state, variable);
+
 					scratch.d.var.attnum = variable->varattno - 1;
 					scratch.d.var.vartype = variable->vartype;
+					scratch.d.var.detoast = detoast;
 					switch (variable->varno)
 					{
 						case INNER_VAR:
-							scratch.opcode = EEOP_INNER_VAR;
+							scratch.opcode = detoast ?
+								EEOP_INNER_VAR_DETOAST : EEOP_INNER_VAR;
 							break;
 						case OUTER_VAR:
-							scratch.opcode = EEOP_OUTER_VAR;
+							scratch.opcode = detoast ?
+								EEOP_OUTER_VAR_DETOAST : EEOP_OUTER_VAR;
 							break;
 
 							/* INDEX_VAR is handled by default case */
 
 						default:
-							scratch.opcode = EEOP_SCAN_VAR;
+							scratch.opcode = detoast ?
+								EEOP_SCAN_VAR_DETOAST : EEOP_SCAN_VAR;
 							break;
 					}
 				}
@@ -2148,6 +2171,13 @@ ExecInitExprRec(Expr *node, ExprState *state,
 												&scratch.d.jsonexpr.res_expr->isnull)
 					: NULL;
 
+				scratch.d.jsonexpr.safe_format =
+					ExecInitJsonSafeCoercion((Expr *) jexpr->formatted_expr);
+				scratch.d.jsonexpr.safe_result =
+					ExecInitJsonSafeCoercion(jexpr->result_coercion ?
+											 (Expr *) jexpr->result_coercion->expr :
+											 NULL);
+
 				scratch.d.jsonexpr.default_on_empty =
 					ExecInitExpr((Expr *) jexpr->on_empty.default_expr,
 								 state->parent);
@@ -2183,6 +2213,7 @@ ExecInitExprRec(Expr *node, ExprState *state,
 					var->econtext = NULL;
 					var->mcxt = NULL;
 					var->evaluated = false;
+					var->constant = IsA(argexpr, Const);
 					var->value = (Datum) 0;
 					var->isnull = true;
 
@@ -2190,6 +2221,7 @@ ExecInitExprRec(Expr *node, ExprState *state,
 						lappend(scratch.d.jsonexpr.args, var);
 				}
 
+				scratch.d.jsonexpr.compiled_path = NULL;
 				scratch.d.jsonexpr.cache = NULL;
 
 				if (jexpr->coercions)
@@ -2215,6 +2247,8 @@ ExecInitExprRec(Expr *node, ExprState *state,
 							ExecInitExprWithCaseValue((Expr *)(*coercion)->expr,
 													  state->parent,
 													  caseval, casenull) : NULL;
+						cstate->safe = ExecInitJsonSafeCoercion(*coercion ?
+											(Expr *) (*coercion)->expr : NULL);
 					}
 				}
 
@@ -2229,6 +2263,70 @@ ExecInitExprRec(Expr *node, ExprState *state,
 	}
 }
 
+/*
+ * Check whether a SQL/JSON formatting or coercion expression of a CaseTestExpr
+ * is one of those that can be evaluated without throwing errors.
+ */
+static JsonSafeCoercion
+ExecInitJsonSafeCoercion(Expr *expr)
+{
+	JsonSafeCoercion res;
+
+	res.kind = JSC_UNSAFE;
+	res.typmod = -1;
+
+	if (!expr)
+		res.kind = JSC_NONE;
+	else if (IsA(expr, FuncExpr))
+	{
+		FuncExpr   *func = (FuncExpr *) expr;
+
+		if (!IsA(linitial(func->args), CaseTestExpr))
+			return res;
+
+		switch (func->funcid)
+		{
+			case F_NUMERIC_INT2:
+				res.kind = JSC_NUMERIC_INT2;
+				break;
+			case F_NUMERIC_INT4:
+				res.kind = JSC_NUMERIC_INT4;
+				break;
+			case F_NUMERIC_INT8:
+				res.kind = JSC_NUMERIC_INT8;
+				break;
+			case F_NUMERIC_FLOAT8:
+				res.kind = JSC_NUMERIC_FLOAT8;
+				break;
+			case F_NUMERIC:
+				{
+					Const	   *typmod = lsecond(func->args);
+
+					if (IsA(typmod, Const) && !typmod->constisnull)
+					{
+						res.kind = JSC_NUMERIC_TYPMOD;
+						res.typmod = DatumGetInt32(typmod->constvalue);
+					}
+					break;
+				}
+			default:
+				break;
+		}
+	}
+	else if (IsA(expr, CoerceViaIO))
+	{
+		CoerceViaIO *iocoerce = (CoerceViaIO *) expr;
+
+		if (iocoerce->resulttype == JSONOID &&
+			IsA(iocoerce->arg, CaseTestExpr) &&
+			(exprType((Node *) iocoerce->arg) == TEXTOID ||
+			 exprType((Node *) iocoerce->arg) == VARCHAROID))
+			res.kind = JSC_TEXT_JSON;
+	}
+
+	return res;
+}
+
 /*
  * Add another expression evaluation step to ExprState->steps.
  *
@@ -2365,11 +2463,21 @@ ExecInitFunc(ExprEvalStep *scratch, Expr *node, List *args, Oid funcid,
 /*
  * Add expression steps deforming the ExprState's inner/outer/scan slots
  * as much as required by the expression.
+ *
+ * Also find the toastable Vars passed to more than one function within the
+ * expression.  Each of those functions would detoast the value on its own,
+ * so we rather fetch such Vars by EEOP_*_VAR_DETOAST steps, which detoast
+ * the value once per row and share it between all the references.  Vars
+ * used only by jsonb field accessors are left alone, because these fetch
+ * just the slices of out-of-line values they need, which is cheaper than
+ * detoasting the whole value for large documents.
  */
 static void
 ExecInitExprSlots(ExprState *state, Node *node)
 {
 	LastAttnumInfo info = {0, 0, 0};
+	List	   *vars = NIL;
+	ListCell   *lc;
 
 	/*
 	 * Figure out which attributes we're going to need.
@@ -2377,6 +2485,23 @@ ExecInitExprSlots(ExprState *state, Node *node)
 	get_last_attnums_walker(node, &info);
 
 	ExecPushExprSlots(state, &info);
+
+	get_detoast_vars_walker(node, &vars);
+
+	foreach(lc, vars)
+	{
+		DetoastVarInfo *var = lfirst(lc);
+
+		if (var->nrefs > 1 && var->nrefs > var->nslicerefs)
+		{
+			var->cache = palloc0(sizeof(ExprVarDetoastCache));
+			state->detoast_vars = lappend(state->detoast_vars, var);
+		}
+		else
+			pfree(var);
+	}
+
+	list_free(vars);
 }
 
 /*
@@ -2473,6 +2598,115 @@ get_last_attnums_walker(Node *node, LastAttnumInfo *info)
 								  (void *) info);
 }
 
+/*
+ * get_detoast_vars_walker: expression walker for ExecInitExprSlots
+ *
+ * Counts the references to toastable Vars as arguments of function calls.
+ */
+static bool
+get_detoast_vars_walker(Node *node, List **vars)
+{
+	List	   *args;
+	Oid			funcid;
+	ListCell   *lc;
+
+	if (node == NULL)
+		return false;
+
+	/*
+	 * As in get_last_attnums_walker(), skip the expressions not evaluated
+	 * within the calling expression.
+	 */
+	if (IsA(node, Aggref))
+		return false;
+	if (IsA(node, WindowFunc))
+		return false;
+	if (IsA(node, GroupingFunc))
+		return false;
+	if (IsA(node, SubPlan) || IsA(node, AlternativeSubPlan))
+		return false;
+
+	if (IsA(node, FuncExpr))
+	{
+		args = ((FuncExpr *) node)->args;
+		funcid = ((FuncExpr *) node)->funcid;
+	}
+	else if (IsA(node, OpExpr))
+	{
+		set_opfuncid((OpExpr *) node);
+		args = ((OpExpr *) node)->args;
+		funcid = ((OpExpr *) node)->opfuncid;
+	}
+	else
+	{
+		args = NIL;
+		funcid = InvalidOid;
+	}
+
+	foreach(lc, args)
+	{
+		Var		   *variable = lfirst(lc);
+		DetoastVarInfo *var = NULL;
+		ListCell   *lc2;
+
+		if (!IsA(variable, Var) ||
+			variable->varattno <= 0 ||
+			get_typlen(variable->vartype) != -1)
+			continue;
+
+		foreach(lc2, *vars)
+		{
+			var = lfirst(lc2);
+
+			if (var->varno == variable->varno &&
+				var->varattno == variable->varattno)
+				break;
+
+			var = NULL;
+		}
+
+		if (!var)
+		{
+			var = palloc0(sizeof(*var));
+			var->varno = variable->varno;
+			var->varattno = variable->varattno;
+			*vars = lappend(*vars, var);
+		}
+
+		var->nrefs++;
+
+		/* jsonb -> and ->> look up keys in out-of-line values by slices */
+		if (lc == list_head(args) &&
+			(funcid == F_JSONB_OBJECT_FIELD ||
+			 funcid == F_JSONB_OBJECT_FIELD_TEXT))
+			var->nslicerefs++;
+	}
+
+	return expression_tree_walker(node, get_detoast_vars_walker,
+								  (void *) vars);
+}
+
+/*
+ * Return the shared detoast cache for a user column Var, or NULL if the Var
+ * should be fetched as is.
+ */
+static ExprVarDetoastCache *
+ExecGetVarDetoastCache(ExprState *state, Var *variable)
+{
+	ListCell   *lc;
+
+	foreach(lc, state->detoast_vars)
+	{
+		DetoastVarInfo *var = lfirst(lc);
+
+		if (var->varno == variable->varno &&
+			var->varattno == variable->varattno)
+			return var->cache;
+	}
+
+	return NULL;
+}
+
 /*
  * Compute additional information for EEOP_*_FETCHSOME ops.
  *
@@ -79,6 +79,7 @@
 #include "utils/jsonb.h"
 #include "utils/jsonpath.h"
 #include "utils/lsyscache.h"
+#include "utils/numeric.h"
 #include "utils/resowner.h"
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
@@ -323,6 +324,9 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 		&&CASE_EEOP_INNER_VAR,
 		&&CASE_EEOP_OUTER_VAR,
 		&&CASE_EEOP_SCAN_VAR,
+		&&CASE_EEOP_INNER_VAR_DETOAST,
+		&&CASE_EEOP_OUTER_VAR_DETOAST,
+		&&CASE_EEOP_SCAN_VAR_DETOAST,
 		&&CASE_EEOP_INNER_SYSVAR,
 		&&CASE_EEOP_OUTER_SYSVAR,
 		&&CASE_EEOP_SCAN_SYSVAR,
@@ -504,6 +508,24 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 			EEO_NEXT();
 		}
 
+		EEO_CASE(EEOP_INNER_VAR_DETOAST)
+		{
+			ExecEvalVarDetoast(state, op, econtext, innerslot);
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_OUTER_VAR_DETOAST)
+		{
+			ExecEvalVarDetoast(state, op, econtext, outerslot);
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_SCAN_VAR_DETOAST)
+		{
+			ExecEvalVarDetoast(state, op, econtext, scanslot);
+			EEO_NEXT();
+		}
+
 		EEO_CASE(EEOP_INNER_SYSVAR)
 		{
 			ExecEvalSysVar(state, op, econtext, innerslot);
@@ -1807,6 +1829,7 @@ CheckExprStillValid(ExprState *state, ExprContext *econtext)
 		switch (ExecEvalStepOp(state, op))
 		{
 			case EEOP_INNER_VAR:
+			case EEOP_INNER_VAR_DETOAST:
 				{
 					int			attnum = op->d.var.attnum;
 
@@ -1815,6 +1838,7 @@ CheckExprStillValid(ExprState *state, ExprContext *econtext)
 				}
 
 			case EEOP_OUTER_VAR:
+			case EEOP_OUTER_VAR_DETOAST:
 				{
 					int			attnum = op->d.var.attnum;
 
@@ -1823,6 +1847,7 @@ CheckExprStillValid(ExprState *state, ExprContext *econtext)
 				}
 
 			case EEOP_SCAN_VAR:
+			case EEOP_SCAN_VAR_DETOAST:
 				{
 					int			attnum = op->d.var.attnum;
 
@@ -4065,6 +4090,81 @@ ExecEvalSysVar(ExprState *state, ExprEvalStep *op, ExprContext *econtext,
 		elog(ERROR, "failed to fetch attribute from slot");
 }
 
+/* Memory context reset callback invalidating ExprVarDetoastCache */
+static void
+ExecVarDetoastCacheReset(void *arg)
+{
+	ExprVarDetoastCache *cache = (ExprVarDetoastCache *) arg;
+
+	cache->valid = false;
+}
+
+/*
+ * Evaluate a non-system Var referenced by several functions of the
+ * expression.  Out-of-line values are detoasted into the per-tuple memory
+ * once, and the detoasted copy is returned by all EEOP_*_VAR_DETOAST steps
+ * of the Var until the TOAST pointer changes or the memory is reset.  Other
+ * values are returned as is.
+ */
+void
+ExecEvalVarDetoast(ExprState *state, ExprEvalStep *op, ExprContext *econtext,
+				   TupleTableSlot *slot)
+{
+	ExprVarDetoastCache *cache = op->d.var.detoast;
+	int			attnum = op->d.var.attnum;
+	struct varatt_external toast;
+	Datum		value;
+
+	/* See EEOP_INNER_VAR comments */
+	Assert(attnum >= 0 && attnum < slot->tts_nvalid);
+	value = slot->tts_values[attnum];
+	*op->resnull = slot->tts_isnull[attnum];
+
+	if (*op->resnull ||
+		!VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(value)))
+	{
+		*op->resvalue = value;
+		return;
+	}
+
+	/*
+	 * TOAST value OIDs are unique within the TOAST relation while the value
+	 * may be visible to us, so the pointer identifies the value.
+	 */
+	VARATT_EXTERNAL_GET_POINTER(toast, DatumGetPointer(value));
+
+	if (!cache->valid ||
+		cache->toast.va_valueid != toast.va_valueid ||
+		cache->toast.va_toastrelid != toast.va_toastrelid)
+	{
+		MemoryContext oldcontext;
+		struct varlena *detoasted;
+
+		if (!cache->valid)
+		{
+			/* the callback was removed by the last reset, if any */
+			cache->context = econtext->ecxt_per_tuple_memory;
+			cache->callback.func = ExecVarDetoastCacheReset;
+			cache->callback.arg = (void *) cache;
+			MemoryContextRegisterResetCallback(cache->context,
+											   &cache->callback);
+		}
+
+		/* keep the value in the context the callback is registered in */
+		oldcontext = MemoryContextSwitchTo(cache->context);
+		detoasted = heap_tuple_untoast_attr((struct varlena *)
+											DatumGetPointer(value));
+		MemoryContextSwitchTo(oldcontext);
+
+		cache->value = PointerGetDatum(detoasted);
+
+		cache->toast = toast;
+		cache->valid = true;
+	}
+
+	*op->resvalue = cache->value;
+}
+
 /*
  * Transition value has not been initialized. This is the first non-NULL input
  * value for a group. We use it as the initial value for transValue.
@@ -4256,6 +4356,63 @@ ExecEvalJsonExprCoercion(ExprEvalStep *op, ExprContext *econtext,
 	}
 }
 
+/*
+ * Evaluate an error-safe SQL/JSON formatting or coercion expression.
+ * Sets *error instead of throwing an error if the value cannot be coerced.
+ */
+static Datum
+ExecEvalJsonSafeCoercion(JsonSafeCoercion *coercion, Datum val, bool isnull,
+						 bool *error)
+{
+	if (isnull)
+		return (Datum) 0;
+
+	switch (coercion->kind)
+	{
+		case JSC_NONE:
+			return val;
+
+		case JSC_NUMERIC_INT2:
+			return Int16GetDatum(numeric_int2_opt_error(DatumGetNumeric(val),
+														error));
+
+		case JSC_NUMERIC_INT4:
+			return Int32GetDatum(numeric_int4_opt_error(DatumGetNumeric(val),
+														error));
+
+		case JSC_NUMERIC_INT8:
+			return Int64GetDatum(numeric_int8_opt_error(DatumGetNumeric(val),
+														error));
+
+		case JSC_NUMERIC_FLOAT8:
+			return Float8GetDatum(numeric_float8_opt_error(DatumGetNumeric(val),
+														   error));
+
+		case JSC_NUMERIC_TYPMOD:
+			return NumericGetDatum(numeric_typmod_opt_error(DatumGetNumeric(val),
+															coercion->typmod,
+															error));
+
+		case JSC_TEXT_JSON:
+			{
+				/* json has the same representation as text */
+				text	   *json = DatumGetTextPP(val);
+
+				if (!json_validate(json, false))
+				{
+					*error = true;
+					return (Datum) 0;
+				}
+
+				return PointerGetDatum(json);
+			}
+
+		default:
+			elog(ERROR, "unexpected SQL/JSON coercion kind %d", coercion->kind);
+			return (Datum) 0;
+	}
+}
+
 /*
  * Evaluate a JSON path variable caching computed value.
  */
@@ -4275,7 +4432,8 @@ EvalJsonPathVar(void *cxt, bool isJsonb, char *varName, int varNameLen,
 	{
 		var = lfirst(lc);
 
-		if (!strncmp(var->name, varName, varNameLen))
+		if (!strncmp(var->name, varName, varNameLen) &&
+			var->name[varNameLen] == '\0')
 			break;
 
 		var = NULL;
@@ -4473,7 +4631,7 @@ ExecEvalJsonExprSubtrans(JsonFunc func, ExprEvalStep *op,
 
 typedef struct
 {
-	JsonPath   *path;
+	JsonPathCompiled *path;
 	bool	   *error;
 	bool		coercionInSubtrans;
 } ExecEvalJsonExprContext;
@@ -4485,9 +4643,10 @@ ExecEvalJsonExpr(ExprEvalStep *op, ExprContext *econtext,
 {
 	ExecEvalJsonExprContext *cxt = pcxt;
 	//bool	   *error = cxt->error;
-	JsonPath   *path = cxt->path;
+	JsonPathCompiled *path = cxt->path;
 	JsonExpr   *jexpr = op->d.jsonexpr.jsexpr;
 	ExprState  *estate = NULL;
+	JsonSafeCoercion *safe = NULL;
 	bool		throwErrors = !!error;//expr->on_error.btype == JSON_BEHAVIOR_ERROR;
 	bool		empty = false;
 	Datum		res = (Datum) 0;
@@ -4496,12 +4655,25 @@ ExecEvalJsonExpr(ExprEvalStep *op, ExprContext *econtext,
 	{
 		bool		isnull;
 
-		Assert(!cxt->coercionInSubtrans);
-
 		op->d.jsonexpr.raw_expr->value = item;
 		op->d.jsonexpr.raw_expr->isnull = false;
 
-		item = ExecEvalExpr(op->d.jsonexpr.formatted_expr, econtext, &isnull);
+		if (error && op->d.jsonexpr.safe_format.kind != JSC_UNSAFE)
+		{
+			item = ExecEvalJsonSafeCoercion(&op->d.jsonexpr.safe_format,
+											item, false, error);
+			if (*error)
+				return (Datum) 0;
+
+			isnull = false;
+		}
+		else
+		{
+			Assert(!cxt->coercionInSubtrans);
+			item = ExecEvalExpr(op->d.jsonexpr.formatted_expr, econtext,
+								&isnull);
+		}
+
 		if (isnull)
 		{
 			/* execute domain checks for NULLs */
@@ -4579,6 +4751,7 @@ ExecEvalJsonExpr(ExprEvalStep *op, ExprContext *econtext,
 				else if (jcstate->estate)
 				{
 					estate = jcstate->estate;	/* coerce using expression */
+					safe = &jcstate->safe;
 					break;
 				}
 				/* else no coercion */
@@ -4633,6 +4806,17 @@ ExecEvalJsonExpr(ExprEvalStep *op, ExprContext *econtext,
 									   isjsonb, resnull);
 	}
 
+	/* result coercion, if any */
+	if (!estate && !jexpr->omit_quotes &&
+		!(jexpr->result_coercion &&
+		  (jexpr->result_coercion->via_io ||
+		   jexpr->result_coercion->via_populate)))
+		safe = &op->d.jsonexpr.safe_result;
+
+	/* errors of error-safe coercions are caught without a subtransaction */
+	if (error && safe && safe->kind != JSC_UNSAFE)
+		return ExecEvalJsonSafeCoercion(safe, res, *resnull, error);
+
 	return ExecEvalJsonExprSubtrans(ExecEvalJsonExprCoercion, op, econtext,
 									res, resnull, isjsonb, estate, error,
 									cxt->coercionInSubtrans);
@@ -4668,7 +4852,7 @@ ExecEvalJson(ExprState *state, ExprEvalStep *op, ExprContext *econtext)
 	JsonExpr   *jexpr = op->d.jsonexpr.jsexpr;
 	Datum		item;
 	Datum		res = (Datum) 0;
-	JsonPath   *path;
+	JsonPathCompiled *path;
 	ListCell   *lc;
 	Oid			formattedType = exprType(jexpr->formatted_expr ?
 										 jexpr->formatted_expr :
@@ -4695,18 +4879,30 @@ ExecEvalJson(ExprState *state, ExprEvalStep *op, ExprContext *econtext)
 	}
 
 	item = op->d.jsonexpr.raw_expr->value;
-	path = DatumGetJsonPathP(op->d.jsonexpr.pathspec->value);
+	/* path_spec is usually a constant, so it is compiled once per query */
+	path = jspGetCompiled(&op->d.jsonexpr.compiled_path,
+						  DatumGetJsonPathP(op->d.jsonexpr.pathspec->value),
+						  econtext->ecxt_per_query_memory);
 
-	/* reset JSON path variable contexts */
+	/*
+	 * Reset JSON path variable contexts.  Constant variables are evaluated
+	 * only once per query.
+	 */
 	foreach(lc, op->d.jsonexpr.args)
 	{
 		JsonPathVariableEvalContext *var = lfirst(lc);
 
 		var->econtext = econtext;
-		var->evaluated = false;
+		if (!var->constant)
+			var->evaluated = false;
 	}
 
-	needSubtrans = ExecEvalJsonNeedsSubTransaction(jexpr, &op->d.jsonexpr.coercions);
+	/*
+	 * Errors of context item formatting can be caught only in a subtransaction
+	 * covering the whole expression, unless formatting is error-safe.
+	 */
+	needSubtrans = !throwErrors && jexpr->formatted_expr &&
+		op->d.jsonexpr.safe_format.kind == JSC_UNSAFE;
 
 	cxt.path = path;
 	cxt.error = throwErrors ? NULL : &error;
@@ -40,8 +40,12 @@ static TupleTableSlot *TableFuncNext(TableFuncScanState *node);
 static bool TableFuncRecheck(TableFuncScanState *node, TupleTableSlot *slot);
 
 static void tfuncFetchRows(TableFuncScanState *tstate, ExprContext *econtext);
+static TupleTableSlot *tfuncNextRow(TableFuncScanState *tstate, ExprContext *econtext);
+static void tfuncEndRows(TableFuncScanState *tstate);
+static bool tfuncBegin(TableFuncScanState *tstate, ExprContext *econtext);
 static void tfuncInitialize(TableFuncScanState *tstate, ExprContext *econtext, Datum doc);
 static void tfuncLoadRows(TableFuncScanState *tstate, ExprContext *econtext);
+static void tfuncGetValues(TableFuncScanState *tstate, ExprContext *econtext);
 
 /* ----------------------------------------------------------------
  *						Scan Support
@@ -60,6 +64,10 @@ TableFuncNext(TableFuncScanState *node)
 
 	scanslot = node->ss.ss_ScanTupleSlot;
 
+	/* In pipelined mode, rows are fetched from the table builder one by one */
+	if (node->pipelined)
+		return tfuncNextRow(node, node->ss.ps.ps_ExprContext);
+
 	/*
 	 * If first time through, read all tuples from function and put them in a
 	 * tuplestore. Subsequent calls just fetch tuples from tuplestore.
@@ -119,7 +127,7 @@ ExecInitTableFuncScan(TableFuncScan *node, EState *estate, int eflags)
 	int			i;
 
 	/* check for unsupported flags */
-	Assert(!(eflags & EXEC_FLAG_MARK));
+	Assert(!(eflags & (EXEC_FLAG_MARK | EXEC_FLAG_BACKWARD)));
 
 	/*
 	 * TableFuncscan should not have any children.
@@ -135,6 +143,17 @@ ExecInitTableFuncScan(TableFuncScan *node, EState *estate, int eflags)
 	scanstate->ss.ps.state = estate;
 	scanstate->ss.ps.ExecProcNode = ExecTableFuncScan;
 
+	/*
+	 * JSON_TABLE rows can be produced on demand, so that the first rows are
+	 * returned without expanding the whole document, unless efficient rescans
+	 * are requested.  XMLTABLE always loads the rows into a tuplestore, since
+	 * its builder must be destroyed within the same PG_TRY block in which it
+	 * was created.
+	 */
+	scanstate->pipelined = tf->functype == TFT_JSON_TABLE &&
+		!(eflags & EXEC_FLAG_REWIND);
+	scanstate->finished = false;
+
 	/*
 	 * Miscellaneous initialization
 	 *
@@ -151,7 +170,8 @@ ExecInitTableFuncScan(TableFuncScan *node, EState *estate, int eflags)
 								 tf->colcollations);
 	/* and the corresponding scan slot */
 	ExecInitScanTupleSlot(estate, &scanstate->ss, tupdesc,
-						  &TTSOpsMinimalTuple);
+						  scanstate->pipelined ?
+						  &TTSOpsVirtual : &TTSOpsMinimalTuple);
 
 	/*
 	 * Initialize result type and projection.
@@ -232,8 +252,11 @@ ExecEndTableFuncScan(TableFuncScanState *node)
 	ExecClearTuple(node->ss.ss_ScanTupleSlot);
 
 	/*
-	 * Release tuplestore resources
+	 * Release table builder and tuplestore resources
 	 */
+	if (node->pipelined)
+		tfuncEndRows(node);
+
 	if (node->tupstore != NULL)
 		tuplestore_end(node->tupstore);
 	node->tupstore = NULL;
@@ -254,6 +277,16 @@ ExecReScanTableFuncScan(TableFuncScanState *node)
 		ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
 	ExecScanReScan(&node->ss);
 
+	/*
+	 * In pipelined mode, the rows are always recomputed from scratch.
+	 */
+	if (node->pipelined)
+	{
+		tfuncEndRows(node);
+		node->finished = false;
+		return;
+	}
+
 	/*
 	 * Recompute when parameters are changed.
 	 */
@@ -281,8 +314,6 @@ tfuncFetchRows(TableFuncScanState *tstate, ExprContext *econtext)
 {
 	const TableFuncRoutine *routine = tstate->routine;
 	MemoryContext oldcxt;
-	Datum		value;
-	bool		isnull;
 
 	Assert(tstate->opaque == NULL);
 
@@ -302,26 +333,9 @@ tfuncFetchRows(TableFuncScanState *tstate, ExprContext *econtext)
 
 	PG_TRY();
 	{
-		routine->InitOpaque(tstate,
-							tstate->ss.ss_ScanTupleSlot->tts_tupleDescriptor->natts);
-
-		/*
-		 * If evaluating the document expression returns NULL, the table
-		 * expression is empty and we return immediately.
-		 */
-		value = ExecEvalExpr(tstate->docexpr, econtext, &isnull);
-
-		if (!isnull)
-		{
-			/* otherwise, pass the document value to the table builder */
-			tfuncInitialize(tstate, econtext, value);
-
-			/* initialize ordinality counter */
-			tstate->ordinal = 1;
-
-			/* Load all rows into the tuplestore, and we're done */
+		/* Load all rows into the tuplestore, and we're done */
+		if (tfuncBegin(tstate, econtext))
 			tfuncLoadRows(tstate, econtext);
-		}
 	}
 	PG_CATCH();
 	{
@@ -345,6 +359,115 @@ tfuncFetchRows(TableFuncScanState *tstate, ExprContext *econtext)
 	return;
 }
 
+/* ----------------------------------------------------------------
+ *		tfuncNextRow
+ *
+ *		Fetch the next row from a TableFunc producer in pipelined mode
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+tfuncNextRow(TableFuncScanState *tstate, ExprContext *econtext)
+{
+	TupleTableSlot *slot = tstate->ss.ss_ScanTupleSlot;
+	MemoryContext oldcxt;
+
+	ExecClearTuple(slot);
+
+	if (tstate->finished)
+		return slot;
+
+	if (tstate->opaque == NULL)
+	{
+		/*
+		 * Initialize the table builder on the first call.  Its state lives in
+		 * perTableCxt until the rows are exhausted or the scan is restarted.
+		 */
+		oldcxt = MemoryContextSwitchTo(tstate->perTableCxt);
+
+		if (!tfuncBegin(tstate, econtext))
+		{
+			/* the document is NULL, so the table is empty */
+			MemoryContextSwitchTo(oldcxt);
+			tfuncEndRows(tstate);
+			tstate->finished = true;
+			return slot;
+		}
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	/*
+	 * The row is built in the per-tuple context, which ExecScan() resets
+	 * before fetching the next one.
+	 */
+	oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	CHECK_FOR_INTERRUPTS();
+
+	if (tstate->routine->FetchRow(tstate))
+	{
+		tfuncGetValues(tstate, econtext);
+		ExecStoreVirtualTuple(slot);
+	}
+	else
+	{
+		tfuncEndRows(tstate);
+		tstate->finished = true;
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+
+	return slot;
+}
+
+/*
+ * Release the table builder used in pipelined mode, if any.
+ */
+static void
+tfuncEndRows(TableFuncScanState *tstate)
+{
+	if (tstate->opaque != NULL)
+	{
+		tstate->routine->DestroyOpaque(tstate);
+		tstate->opaque = NULL;
+	}
+
+	MemoryContextReset(tstate->perTableCxt);
+}
+
+/*
+ * Initialize the table builder and pass the document to it.
+ *
+ * Returns false if the document is NULL, which means the table is empty.
+ */
+static bool
+tfuncBegin(TableFuncScanState *tstate, ExprContext *econtext)
+{
+	const TableFuncRoutine *routine = tstate->routine;
+	Datum		value;
+	bool		isnull;
+
+	routine->InitOpaque(tstate,
+						tstate->ss.ss_ScanTupleSlot->tts_tupleDescriptor->natts);
+
+	/*
+	 * If evaluating the document expression returns NULL, the table
+	 * expression is empty and we return immediately.
+	 */
+	value = ExecEvalExpr(tstate->docexpr, econtext, &isnull);
+
+	if (isnull)
+		return false;
+
+	/* otherwise, pass the document value to the table builder */
+	tfuncInitialize(tstate, econtext, value);
+
+	/* initialize ordinality counter */
+	tstate->ordinal = 1;
+
+	return true;
+}
+
 /*
  * Fill in namespace declarations, the row filter, and column filters in a
  * table expression builder context.
@@ -449,12 +572,7 @@ tfuncLoadRows(TableFuncScanState *tstate, ExprContext *econtext)
 	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
 	Datum	   *values = slot->tts_values;
 	bool	   *nulls = slot->tts_isnull;
-	int			natts = tupdesc->natts;
 	MemoryContext oldcxt;
-	int			ordinalitycol;
-
-	ordinalitycol =
-		((TableFuncScan *) (tstate->ss.ps.plan))->tablefunc->ordinalitycol;
 
 	/*
 	 * We need a short-lived memory context that we can clean up each time
@@ -469,66 +587,82 @@ tfuncLoadRows(TableFuncScanState *tstate, ExprContext *econtext)
 	 */
 	while (routine->FetchRow(tstate))
 	{
-		ListCell   *cell = list_head(tstate->coldefexprs);
-		int			colno;
-
 		CHECK_FOR_INTERRUPTS();
 
 		ExecClearTuple(tstate->ss.ss_ScanTupleSlot);
 
-		/*
-		 * Obtain the value of each column for this row, installing them into
-		 * the slot; then add the tuple to the tuplestore.
-		 */
-		for (colno = 0; colno < natts; colno++)
+		tfuncGetValues(tstate, econtext);
+
+		tuplestore_putvalues(tstate->tupstore, tupdesc, values, nulls);
+
+		MemoryContextReset(econtext->ecxt_per_tuple_memory);
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Obtain the value of each column for the current row of the table builder,
+ * installing them into the scan slot.
+ */
+static void
+tfuncGetValues(TableFuncScanState *tstate, ExprContext *econtext)
+{
+	const TableFuncRoutine *routine = tstate->routine;
+	TupleTableSlot *slot = tstate->ss.ss_ScanTupleSlot;
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
+	Datum	   *values = slot->tts_values;
+	bool	   *nulls = slot->tts_isnull;
+	int			natts = tupdesc->natts;
+	ListCell   *cell = list_head(tstate->coldefexprs);
+	int			ordinalitycol;
+	int			colno;
+
+	ordinalitycol =
+		((TableFuncScan *) (tstate->ss.ps.plan))->tablefunc->ordinalitycol;
+
+	for (colno = 0; colno < natts; colno++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, colno);
+
+		if (colno == ordinalitycol)
+		{
+			/* Fast path for ordinality column */
+			values[colno] = Int32GetDatum(tstate->ordinal++);
+			nulls[colno] = false;
+		}
+		else
 		{
-			Form_pg_attribute att = TupleDescAttr(tupdesc, colno);
+			bool		isnull;
 
-			if (colno == ordinalitycol)
-			{
-				/* Fast path for ordinality column */
-				values[colno] = Int32GetDatum(tstate->ordinal++);
-				nulls[colno] = false;
-			}
-			else
+			values[colno] = routine->GetValue(tstate,
+											  colno,
+											  att->atttypid,
+											  att->atttypmod,
+											  &isnull);
+
+			/* No value?  Evaluate and apply the default, if any */
+			if (isnull && cell != NULL)
 			{
-				bool		isnull;
-
-				values[colno] = routine->GetValue(tstate,
-												  colno,
-												  att->atttypid,
-												  att->atttypmod,
-												  &isnull);
-
-				/* No value?  Evaluate and apply the default, if any */
-				if (isnull && cell != NULL)
-				{
-					ExprState  *coldefexpr = (ExprState *) lfirst(cell);
-
-					if (coldefexpr != NULL)
-						values[colno] = ExecEvalExpr(coldefexpr, econtext,
-													 &isnull);
-				}
-
-				/* Verify a possible NOT NULL constraint */
-				if (isnull && bms_is_member(colno, tstate->notnulls))
-					ereport(ERROR,
-							(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-							 errmsg("null is not allowed in column \"%s\"",
-									NameStr(att->attname))));
+				ExprState  *coldefexpr = (ExprState *) lfirst(cell);
 
-				nulls[colno] = isnull;
+				if (coldefexpr != NULL)
+					values[colno] = ExecEvalExpr(coldefexpr, econtext,
+												 &isnull);
 			}
 
-			/* advance list of default expressions */
-			if (cell != NULL)
-				cell = lnext(cell);
-		}
+			/* Verify a possible NOT NULL constraint */
+			if (isnull && bms_is_member(colno, tstate->notnulls))
+				ereport(ERROR,
+						(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						 errmsg("null is not allowed in column \"%s\"",
+								NameStr(att->attname))));
 
-		tuplestore_putvalues(tstate->tupstore, tupdesc, values, nulls);
+			nulls[colno] = isnull;
+		}
 
-		MemoryContextReset(econtext->ecxt_per_tuple_memory);
+		/* advance list of default expressions */
+		if (cell != NULL)
+			cell = lnext(cell);
 	}
-
-	MemoryContextSwitchTo(oldcxt);
 }
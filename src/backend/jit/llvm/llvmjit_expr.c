@@ -415,6 +415,33 @@ llvm_compile_expr(ExprState *state)
 					break;
 				}
 
+			case EEOP_INNER_VAR_DETOAST:
+			case EEOP_OUTER_VAR_DETOAST:
+			case EEOP_SCAN_VAR_DETOAST:
+				{
+					LLVMValueRef v_slot;
+					LLVMValueRef v_params[4];
+
+					if (opcode == EEOP_INNER_VAR_DETOAST)
+						v_slot = v_innerslot;
+					else if (opcode == EEOP_OUTER_VAR_DETOAST)
+						v_slot = v_outerslot;
+					else
+						v_slot = v_scanslot;
+
+					v_params[0] = v_state;
+					v_params[1] = l_ptr_const(op, l_ptr(StructExprEvalStep));
+					v_params[2] = v_econtext;
+					v_params[3] = v_slot;
+
+					LLVMBuildCall(b,
+								  llvm_get_decl(mod, FuncExecEvalVarDetoast),
+								  v_params, lengthof(v_params), "");
+
+					LLVMBuildBr(b, opblocks[i + 1]);
+					break;
+				}
+
 			case EEOP_WHOLEROW:
 				build_EvalXFunc(b, mod, "ExecEvalWholeRowVar",
 								v_state, v_econtext, op);
@@ -105,6 +105,7 @@ void	   *referenced_functions[] =
 	MakeExpandedObjectReadOnlyInternal,
 	ExecEvalSubscriptingRef,
 	ExecEvalSysVar,
+	ExecEvalVarDetoast,
 	ExecAggTransReparent,
 	ExecAggInitGroup
 };
@@ -61,6 +61,8 @@
  * message-level I/O (and old-style-COPY-OUT cruft):
  *		pq_putmessage	- send a normal message (suppressed in COPY OUT mode)
  *		pq_putmessage_noblock - buffer a normal message (suppressed in COPY OUT)
+ *		pq_putmessage_start - start sending a message in pieces
+ *		pq_putmessage_bytes - send a piece of a message started in pieces
  *		pq_startcopyout - inform libpq that a COPY OUT transfer is beginning
  *		pq_endcopyout	- end a COPY OUT transfer
  *
@@ -1391,6 +1393,58 @@ internal_putbytes(const char *s, size_t len)
 	return 0;
 }
 
+/* --------------------------------
+ *		pq_putmessage_start - start sending a message in pieces
+ *
+ *		This sends the type and the length word of a message of 'len' bytes,
+ *		whose contents must then be sent by pq_putmessage_bytes.  It is meant
+ *		only for messages too large to be built in memory.  The connection is
+ *		out of sync until the whole message is sent, so the caller must not
+ *		let an error escape before that; see the notes at the top of the file.
+ *
+ *		returns 0 if OK, EOF if trouble
+ * --------------------------------
+ */
+int
+pq_putmessage_start(char msgtype, size_t len)
+{
+	uint32		n32;
+	int			res;
+
+	Assert(PqCommMethods == &PqCommSocketMethods);
+	Assert(PG_PROTOCOL_MAJOR(FrontendProtocol) >= 3);
+	Assert(len <= PG_INT32_MAX - 4);
+
+	if (DoingCopyOut || PqCommBusy)
+		return 0;
+	PqCommBusy = true;
+	n32 = pg_hton32((uint32) (len + 4));
+	res = internal_putbytes(&msgtype, 1);
+	if (res == 0)
+		res = internal_putbytes((char *) &n32, 4);
+	PqCommBusy = false;
+	return res;
+}
+
+/* --------------------------------
+ *		pq_putmessage_bytes - send a piece of a message started in pieces
+ *
+ *		returns 0 if OK, EOF if trouble
+ * --------------------------------
+ */
+int
+pq_putmessage_bytes(const char *s, size_t len)
+{
+	int			res;
+
+	if (DoingCopyOut || PqCommBusy)
+		return 0;
+	PqCommBusy = true;
+	res = internal_putbytes(s, len);
+	PqCommBusy = false;
+	return res;
+}
+
 /* --------------------------------
  *		socket_flush		- flush pending output
  *
@@ -13,10 +13,14 @@
  */
 #include "postgres.h"
 
-#include "access/hash.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "access/htup_details.h"
 #include "access/transam.h"
 #include "catalog/pg_type.h"
+#include "commands/tablespace.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 #include "lib/stringinfo.h"
@@ -24,13 +28,17 @@
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "parser/parse_coerce.h"
+#include "port/pg_bitutils.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/date.h"
 #include "utils/datetime.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/json.h"
 #include "utils/jsonapi.h"
+#include "utils/jsonkeyset.h"
+#include "utils/jsonstream.h"
 #include "utils/typcache.h"
 #include "utils/syscache.h"
 
@@ -81,12 +89,15 @@ typedef struct JsonUniqueCheckContext
 	int			nallocated;				/* number of allocated keys in array */
 	StringInfo	result;					/* resulting json */
 	StringInfoData skipped_keys;		/* skipped keys with NULL values */
+	JsonKeySet *set;					/* texts of the keys for lookups */
 	MemoryContext mcxt;					/* context for saving skipped keys */
 } JsonUniqueCheckContext;
 
 typedef struct JsonAggState
 {
 	StringInfo	str;
+	BufFile    *spill;			/* file with the head of json_agg text */
+	int64		spilled;		/* length of the text in the file */
 	JsonTypeCategory key_category;
 	Oid			key_output_func;
 	JsonTypeCategory val_category;
@@ -94,24 +105,15 @@ typedef struct JsonAggState
 	JsonUniqueCheckContext unique_check;
 } JsonAggState;
 
-/* Element of object stack for key uniqueness check */
-typedef struct JsonObjectFields
-{
-	struct JsonObjectFields *parent;
-	HTAB	   *fields;
-} JsonObjectFields;
-
-/* State for key uniqueness check */
-typedef struct JsonUniqueState
-{
-	JsonLexContext *lex;
-	JsonObjectFields *stack;
-} JsonUniqueState;
+/* initial size of the container stack of json_validate_lex() */
+#define JSON_VALIDATE_STACK_SIZE	64
 
 static inline bool json_lex(JsonLexContext *lex);
 static inline void json_lex_string(JsonLexContext *lex);
 static inline void json_lex_number(JsonLexContext *lex, char *s,
 				bool *num_err, int *total_len);
+static bool json_validate_lex(JsonLexContext *lex, bool unique_keys,
+				  JsonTokenType *first);
 static inline void parse_scalar(JsonLexContext *lex, JsonSemAction *sem);
 static bool parse_object_field(JsonLexContext *lex, JsonSemAction *sem);
 static void parse_object(JsonLexContext *lex, JsonSemAction *sem);
@@ -241,6 +243,73 @@ lex_expect(JsonParseContext ctx, JsonLexContext *lex, JsonTokenType token)
 	 (c) == '_' || \
 	 IS_HIGHBIT_SET(c))
 
+/* chars of a string token that need no special processing */
+#define JSON_PLAIN_STRING_CHAR(c) \
+	((unsigned char) (c) >= 32 && (c) != '"' && (c) != '\\')
+
+/*
+ * Return the length of the run of plain string characters starting at 's'
+ * and ending before 'end'.
+ *
+ * Strings make up most of the bytes of a typical json document, so we scan
+ * them in blocks: 16 bytes at a time using SSE2 where it is available (it is
+ * a baseline of x86-64, so no runtime check is needed), and 8 bytes at a time
+ * with bit tricks on a 64-bit word otherwise.  The tail and the block
+ * containing a special character are processed byte by byte.
+ */
+static inline int
+json_lex_string_plain_run(const char *s, const char *end)
+{
+	const char *p = s;
+
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i ctrl = _mm_set1_epi8(31);
+
+	for (; end - p >= sizeof(__m128i); p += sizeof(__m128i))
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) p);
+		__m128i		special;
+		int			mask;
+
+		/* unsigned byte <= 31 iff max(byte, 31) == 31 */
+		special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+											_mm_cmpeq_epi8(chunk, backslash)),
+							   _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+		mask = _mm_movemask_epi8(special);
+
+		if (mask)
+			return p - s + pg_rightmost_one_pos32(mask);
+	}
+#else
+#define JSON_BYTES(c)	(UINT64CONST(0x0101010101010101) * (c))
+#define JSON_HAS_ZERO_BYTE(v) \
+	(((v) - JSON_BYTES(1)) & ~(v) & JSON_BYTES(0x80))
+
+	for (; end - p >= sizeof(uint64); p += sizeof(uint64))
+	{
+		uint64		word;
+
+		memcpy(&word, p, sizeof(word));
+
+		/* stop at the first word containing any special character */
+		if (JSON_HAS_ZERO_BYTE(word ^ JSON_BYTES('"')) ||
+			JSON_HAS_ZERO_BYTE(word ^ JSON_BYTES('\\')) ||
+			((word - JSON_BYTES(32)) & ~word & JSON_BYTES(0x80)))
+			break;
+	}
+
+#undef JSON_HAS_ZERO_BYTE
+#undef JSON_BYTES
+#endif
+
+	while (p < end && JSON_PLAIN_STRING_CHAR(*p))
+		p++;
+
+	return p - s;
+}
+
 /*
  * Utility function to check if a string is a valid JSON number.
  *
@@ -286,16 +355,28 @@ json_in(PG_FUNCTION_ARGS)
 {
 	char	   *json = PG_GETARG_CSTRING(0);
 	text	   *result = cstring_to_text(json);
-	JsonLexContext *lex;
 
 	/* validate it */
-	lex = makeJsonLexContext(result, false);
-	(void) pg_parse_json(lex, &nullSemAction);
+	(void) json_validate(result, true);
 
 	/* Internal representation is the same as text, for now */
 	PG_RETURN_TEXT_P(result);
 }
 
+/*
+ * Check that json text is valid.  If throw_error is false, return false
+ * instead of throwing an error on invalid json.
+ */
+bool
+json_validate(text *json, bool throw_error)
+{
+	JsonLexContext *lex = makeJsonLexContext(json, false);
+
+	lex->throw_errors = throw_error;
+
+	return json_validate_lex(lex, false, NULL);
+}
+
 /*
  * Output.
  */
@@ -337,7 +418,7 @@ json_recv(PG_FUNCTION_ARGS)
 
 	/* Validate it. */
 	lex = makeJsonLexContextCstringLen(str, nbytes, false);
-	(void) pg_parse_json(lex, &nullSemAction);
+	(void) json_validate_lex(lex, false, NULL);
 
 	PG_RETURN_TEXT_P(cstring_to_text_with_len(str, nbytes));
 }
@@ -453,6 +534,236 @@ json_count_array_elements(JsonLexContext *lex)
 	return count;
 }
 
+/*
+ * Accept an object key and the colon following it.  The key, which must be
+ * the current token, has been de-escaped into 'keybuf' if 'set' is not NULL,
+ * and is checked not to be in the set of the keys of the object yet.
+ */
+static inline bool
+json_validate_key(JsonLexContext *lex, JsonParseContext ctx,
+				  JsonKeySet *set, StringInfo keybuf)
+{
+	if (lex_peek(lex) != JSON_TOKEN_STRING)
+	{
+		if (!lex_set_error(lex))
+			report_parse_error(ctx, lex);
+		return false;
+	}
+
+	if (!json_lex(lex) ||
+		!lex_expect(JSON_PARSE_OBJECT_LABEL, lex, JSON_TOKEN_COLON))
+		return false;
+
+	if (set && !JsonKeySetAdd(set, keybuf->data, keybuf->len))
+	{
+		if (!lex_set_error(lex))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("duplicate JSON key \"%s\"", keybuf->data),
+					 report_json_context(lex)));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Lex the next token, which may be an object key, de-escaping it into 'key'
+ * if that is not NULL.
+ */
+static inline bool
+json_validate_lex_key(JsonLexContext *lex, StringInfo key)
+{
+	bool		result;
+
+	lex->strval = key;
+	result = json_lex(lex);
+	lex->strval = NULL;
+
+	return result;
+}
+
+/*
+ * json_validate_lex
+ *
+ * Check that the input of a lexing context is valid json, and also that no
+ * object in it has duplicate keys if 'unique_keys' is true.  The type of the
+ * first token, which tells the type of the whole value, is returned in
+ * '*first' unless it is NULL.
+ *
+ * Unlike pg_parse_json() with null semantic actions, this is a loop keeping
+ * the types of the enclosing containers in an explicit stack, so it needs
+ * neither recursion nor stack depth checks, and it does not allocate memory
+ * while lexing, except to grow the stack past JSON_VALIDATE_STACK_SIZE
+ * levels.  The key uniqueness check uses a key set per nesting level, reused
+ * for all the objects at that level, and de-escapes only the keys into a
+ * single buffer.  Errors are reported as pg_parse_json() reports them, also
+ * when lex->throw_errors is false.
+ */
+static bool
+json_validate_lex(JsonLexContext *lex, bool unique_keys, JsonTokenType *first)
+{
+	bool		stackbuf[JSON_VALIDATE_STACK_SIZE];
+	bool	   *is_object = stackbuf;	/* types of the open containers */
+	JsonKeySet **sets = NULL;	/* key sets of the open objects */
+	int			stacksize = JSON_VALIDATE_STACK_SIZE;
+	int			depth = 0;
+	StringInfoData keybuf;
+	StringInfo	key = NULL;
+	bool		result = false;
+	int			i;
+
+	Assert(lex->strval == NULL);
+
+	if (unique_keys)
+	{
+		initStringInfo(&keybuf);
+		key = &keybuf;
+		sets = palloc0(sizeof(*sets) * stacksize);
+	}
+
+	if (!json_lex(lex))
+		goto done;
+
+	if (first)
+		*first = lex_peek(lex);
+
+	for (;;)
+	{
+		JsonTokenType tok = lex_peek(lex);
+
+		/* a value is expected here */
+		if (tok == JSON_TOKEN_OBJECT_START || tok == JSON_TOKEN_ARRAY_START)
+		{
+			bool		object = tok == JSON_TOKEN_OBJECT_START;
+
+			if (depth >= stacksize)
+			{
+				int			newsize = stacksize * 2;
+
+				if (is_object == stackbuf)
+				{
+					is_object = palloc(sizeof(*is_object) * newsize);
+					memcpy(is_object, stackbuf, sizeof(stackbuf));
+				}
+				else
+					is_object = repalloc(is_object,
+										 sizeof(*is_object) * newsize);
+
+				if (sets)
+				{
+					sets = repalloc(sets, sizeof(*sets) * newsize);
+					memset(&sets[stacksize], 0,
+						   sizeof(*sets) * (newsize - stacksize));
+				}
+
+				stacksize = newsize;
+			}
+
+			is_object[depth] = object;
+
+			/* reuse the key set of the previous object at the same level */
+			if (object && sets)
+			{
+				if (sets[depth])
+					JsonKeySetReset(sets[depth]);
+				else
+					sets[depth] = JsonKeySetCreate(CurrentMemoryContext, 32);
+			}
+
+			depth++;
+			lex->lex_level++;
+
+			if (!json_validate_lex_key(lex, object ? key : NULL))
+				goto done;
+
+			tok = lex_peek(lex);
+
+			if (object && tok != JSON_TOKEN_OBJECT_END)
+			{
+				if (!json_validate_key(lex, JSON_PARSE_OBJECT_START,
+									   sets ? sets[depth - 1] : NULL, key))
+					goto done;
+
+				continue;		/* parse the value of the first field */
+			}
+
+			if (!object && tok != JSON_TOKEN_ARRAY_END)
+				continue;		/* parse the first element */
+
+			/* the container is empty, close it below */
+		}
+		else
+		{
+			/* a scalar must be a string, a number, true, false, or null */
+			switch (tok)
+			{
+				case JSON_TOKEN_STRING:
+				case JSON_TOKEN_NUMBER:
+				case JSON_TOKEN_TRUE:
+				case JSON_TOKEN_FALSE:
+				case JSON_TOKEN_NULL:
+					break;
+				default:
+					if (!lex_set_error(lex))
+						report_parse_error(JSON_PARSE_VALUE, lex);
+					goto done;
+			}
+
+			if (!json_lex(lex))
+				goto done;
+		}
+
+		/* a value is complete, close the containers ending after it */
+		for (;;)
+		{
+			if (depth == 0)
+			{
+				result = lex_expect(JSON_PARSE_END, lex, JSON_TOKEN_END);
+				goto done;
+			}
+
+			if (lex_peek(lex) == JSON_TOKEN_COMMA)
+				break;
+
+			if (is_object[depth - 1]
+				? !lex_expect(JSON_PARSE_OBJECT_NEXT, lex, JSON_TOKEN_OBJECT_END)
+				: !lex_expect(JSON_PARSE_ARRAY_NEXT, lex, JSON_TOKEN_ARRAY_END))
+				goto done;
+
+			depth--;
+			lex->lex_level--;
+		}
+
+		/* a comma, followed by the next field or element */
+		if (is_object[depth - 1])
+		{
+			if (!json_validate_lex_key(lex, key) ||
+				!json_validate_key(lex, JSON_PARSE_STRING,
+								   sets ? sets[depth - 1] : NULL, key))
+				goto done;
+		}
+		else if (!json_lex(lex))
+			goto done;
+	}
+
+done:
+	if (is_object != stackbuf)
+		pfree(is_object);
+
+	if (sets)
+	{
+		for (i = 0; i < stacksize; i++)
+			if (sets[i])
+				JsonKeySetFree(sets[i]);
+
+		pfree(sets);
+		pfree(keybuf.data);
+	}
+
+	return result;
+}
+
 /*
  *	Recursive Descent parse routines. There is one for each structural
  *	element in a json document:
@@ -1114,8 +1425,10 @@ json_lex_string(JsonLexContext *lex)
 			}
 
 		}
-		else if (lex->strval != NULL)
+		else
 		{
+			int			run;
+
 			if (hi_surrogate != -1)
 			{
 				if (lex_set_error(lex))
@@ -1127,7 +1440,14 @@ json_lex_string(JsonLexContext *lex)
 						 report_json_context(lex)));
 			}
 
-			appendStringInfoChar(lex->strval, *s);
+			/* consume the whole run of plain characters at once */
+			run = json_lex_string_plain_run(s, lex->input + lex->input_length);
+
+			if (lex->strval != NULL)
+				appendBinaryStringInfo(lex->strval, s, run);
+
+			s += run - 1;
+			len += run - 1;
 		}
 
 	}
@@ -2105,6 +2425,88 @@ to_json(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(cstring_to_text_with_len(result->data, result->len));
 }
 
+/*
+ * Shutdown callback for json_agg states with spilled text.
+ */
+static void
+json_agg_spill_shutdown(Datum arg)
+{
+	JsonAggState *state = (JsonAggState *) DatumGetPointer(arg);
+
+	BufFileClose(state->spill);
+	state->spill = NULL;
+}
+
+/*
+ * Move the text of a json_agg state to a temporary file once it outgrows
+ * work_mem, so that json_agg_finalfn() can return it as a json stream (see
+ * jsonstream.c).
+ *
+ * The stream references the file of the state, so this is done only in
+ * plain aggregation, where the file is closed with the rest of the state by
+ * the end of the group.  Window aggregates keep their results, so they get
+ * the whole text in memory.
+ */
+static void
+json_agg_state_spill(FunctionCallInfo fcinfo, JsonAggState *state)
+{
+	MemoryContext aggcontext,
+				oldcontext;
+
+	if (state->str->len < work_mem * 1024L ||
+		AggCheckCallContext(fcinfo, &aggcontext) != AGG_CONTEXT_AGGREGATE)
+		return;
+
+	if (state->spill == NULL)
+	{
+		PrepareTempTablespaces();
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		state->spill = BufFileCreateTemp(false);
+		MemoryContextSwitchTo(oldcontext);
+
+		AggRegisterCallback(fcinfo, json_agg_spill_shutdown,
+							PointerGetDatum(state));
+	}
+
+	/* the file might have been read since the last write */
+	if (BufFileSeek(state->spill, 0, state->spilled, SEEK_SET) != 0 ||
+		BufFileWrite(state->spill, state->str->data,
+					 state->str->len) != state->str->len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to json_agg temporary file: %m")));
+
+	state->spilled += state->str->len;
+	resetStringInfo(state->str);
+}
+
+/*
+ * Read 'len' bytes of the spilled text of a json_agg state starting at
+ * 'offset' into 'buf'.
+ */
+static void
+json_agg_state_read_spilled(JsonAggState *state, int64 offset, char *buf,
+							int len)
+{
+	Assert(offset + len <= state->spilled);
+
+	if (BufFileSeek(state->spill, 0, offset, SEEK_SET) != 0 ||
+		BufFileRead(state->spill, buf, len) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from json_agg temporary file: %m")));
+}
+
+/*
+ * Total length of the text of a json_agg state.
+ */
+static inline int64
+json_agg_state_length(JsonAggState *state)
+{
+	return state->spilled + state->str->len;
+}
+
 /*
  * json_agg transition function
  *
@@ -2140,7 +2542,7 @@ json_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 		 * use the right context to enlarge the object if necessary.
 		 */
 		oldcontext = MemoryContextSwitchTo(aggcontext);
-		state = (JsonAggState *) palloc(sizeof(JsonAggState));
+		state = (JsonAggState *) palloc0(sizeof(JsonAggState));
 		state->str = makeStringInfo();
 		MemoryContextSwitchTo(oldcontext);
 
@@ -2156,7 +2558,7 @@ json_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 	if (absent_on_null && PG_ARGISNULL(1))
 		PG_RETURN_POINTER(state);
 
-	if (state->str->len > 1)
+	if (json_agg_state_length(state) > 1)
 		appendStringInfoString(state->str, ", ");
 
 	/* fast path for NULLs */
@@ -2164,13 +2566,14 @@ json_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 	{
 		datum_to_json((Datum) 0, true, state->str, JSONTYPE_NULL,
 					  InvalidOid, false);
+		json_agg_state_spill(fcinfo, state);
 		PG_RETURN_POINTER(state);
 	}
 
 	val = PG_GETARG_DATUM(1);
 
 	/* add some whitespace if structured type and not first item */
-	if (!PG_ARGISNULL(0) && state->str->len > 1 &&
+	if (!PG_ARGISNULL(0) && json_agg_state_length(state) > 1 &&
 		(state->val_category == JSONTYPE_ARRAY ||
 		 state->val_category == JSONTYPE_COMPOSITE))
 	{
@@ -2180,6 +2583,8 @@ json_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 	datum_to_json(val, false, state->str, state->val_category,
 				  state->val_output_func, false);
 
+	json_agg_state_spill(fcinfo, state);
+
 	/*
 	 * The transition type for json_agg() is declared to be "internal", which
 	 * is a pass-by-value type the same size as a pointer.  So we can safely
@@ -2226,6 +2631,11 @@ json_agg_finalfn(PG_FUNCTION_ARGS)
 	if (state == NULL)
 		PG_RETURN_NULL();
 
+	/* Stream the text from the file if it was spilled */
+	if (state->spill)
+		PG_RETURN_DATUM(JsonStreamMake(state->spill, state->spilled,
+									   state->str, "]"));
+
 	/* Else return state with appropriate array terminator added */
 	PG_RETURN_TEXT_P(catenate_stringinfo_string(state->str, "]"));
 }
@@ -2240,6 +2650,7 @@ json_unique_check_init(JsonUniqueCheckContext *cxt,
 	cxt->keys = palloc(sizeof(*cxt->keys) * cxt->nallocated);
 	cxt->result = result;
 	cxt->skipped_keys.data = NULL;
+	cxt->set = JsonKeySetCreate(cxt->mcxt, cxt->nallocated);
 }
 
 static inline void
@@ -2250,6 +2661,9 @@ json_unique_check_free(JsonUniqueCheckContext *cxt)
 
 	if (cxt->skipped_keys.data)
 		pfree(cxt->skipped_keys.data);
+
+	if (cxt->set)
+		JsonKeySetFree(cxt->set);
 }
 
 /* On-demand initialization of skipped_keys StringInfo structure */
@@ -2268,6 +2682,31 @@ json_unique_check_get_skipped_keys(JsonUniqueCheckContext *cxt)
 	return out;
 }
 
+/* Text of the key described by 'key' */
+static inline char *
+json_unique_check_key_text(JsonUniqueCheckContext *cxt,
+						   struct JsonKeyInfo *key)
+{
+	return key->offset > 0
+		? &cxt->result->data[key->offset]
+		: &cxt->skipped_keys.data[-key->offset];
+}
+
+/*
+ * Fill the key set with the keys of the key list, which are known to be
+ * unique, after the list has been restored from a copy.
+ */
+static void
+json_unique_check_fill_set(JsonUniqueCheckContext *cxt)
+{
+	int			i;
+
+	for (i = 0; i < cxt->nkeys; i++)
+		(void) JsonKeySetAdd(cxt->set,
+							 json_unique_check_key_text(cxt, &cxt->keys[i]),
+							 cxt->keys[i].length);
+}
+
 /*
  * Save current key offset (key is not yet appended) to the key list, key
  * length is saved later in json_unique_check_key() when the key is appended.
@@ -2295,7 +2734,6 @@ json_unique_check_key(JsonUniqueCheckContext *cxt, StringInfo out)
 	int			offset = keys[curr].offset;
 	int			length = out->len - offset;
 	char	   *curr_key = &out->data[offset];
-	int			i;
 
 	keys[curr].length = length; /* save current key length */
 
@@ -2304,24 +2742,10 @@ json_unique_check_key(JsonUniqueCheckContext *cxt, StringInfo out)
 		keys[curr].offset = -keys[curr].offset;
 
 	/* check collisions with previous keys */
-	for (i = 0; i < curr; i++)
-	{
-		char	   *prev_key;
-
-		if (cxt->keys[i].length != length)
-			continue;
-
-		offset = cxt->keys[i].offset;
-
-		prev_key = offset > 0
-				? &cxt->result->data[offset]
-				: &cxt->skipped_keys.data[-offset];
-
-		if (!memcmp(curr_key, prev_key, length))
-			ereport(ERROR,
-					(errcode(ERRCODE_DUPLICATE_JSON_OBJECT_KEY_VALUE),
-					 errmsg("duplicate JSON key %s", curr_key)));
-	}
+	if (!JsonKeySetAdd(cxt->set, curr_key, length))
+		ereport(ERROR,
+				(errcode(ERRCODE_DUPLICATE_JSON_OBJECT_KEY_VALUE),
+				 errmsg("duplicate JSON key %s", curr_key)));
 }
 
 /*
@@ -2357,7 +2781,7 @@ json_object_agg_transfn_worker(FunctionCallInfo fcinfo,
 		 * use the right context to enlarge the object if necessary.
 		 */
 		oldcontext = MemoryContextSwitchTo(aggcontext);
-		state = (JsonAggState *) palloc(sizeof(JsonAggState));
+		state = (JsonAggState *) palloc0(sizeof(JsonAggState));
 		state->str = makeStringInfo();
 		if (unique_keys)
 			json_unique_check_init(&state->unique_check, state->str, 0);
@@ -2490,55 +2914,457 @@ json_object_agg_finalfn(PG_FUNCTION_ARGS)
 	if (state == NULL)
 		PG_RETURN_NULL();
 
-	json_unique_check_free(&state->unique_check);
+	/*
+	 * The key uniqueness check state is not freed here, since the final
+	 * function is called repeatedly when used as a window function; it goes
+	 * away with the aggregate context.
+	 */
 
 	/* Else return state with appropriate object terminator added */
 	PG_RETURN_TEXT_P(catenate_stringinfo_string(state->str, " }"));
 }
 
 /*
- * Helper function for aggregates: return given StringInfo's contents plus
- * specified trailing string, as a text datum.  We need this because aggregate
- * final functions are not allowed to modify the aggregate state.
+ * Make a copy of a json_agg or json_object_agg state in the given context.
  */
-static text *
-catenate_stringinfo_string(StringInfo buffer, const char *addon)
+static JsonAggState *
+json_agg_state_copy(JsonAggState *state, bool is_object, MemoryContext mcxt)
 {
-	/* custom version of cstring_to_text_with_len */
-	int			buflen = buffer->len;
-	int			addlen = strlen(addon);
-	text	   *result = (text *) palloc(buflen + addlen + VARHDRSZ);
+	MemoryContext oldcontext = MemoryContextSwitchTo(mcxt);
+	JsonAggState *result = palloc0(sizeof(JsonAggState));
 
-	SET_VARSIZE(result, buflen + addlen + VARHDRSZ);
-	memcpy(VARDATA(result), buffer->data, buflen);
-	memcpy(VARDATA(result) + buflen, addon, addlen);
+	result->str = makeStringInfo();
+	appendBinaryStringInfo(result->str, state->str->data, state->str->len);
+	result->val_category = state->val_category;
+	result->val_output_func = state->val_output_func;
+
+	if (is_object)
+	{
+		JsonUniqueCheckContext *cxt = &state->unique_check;
+
+		result->key_category = state->key_category;
+		result->key_output_func = state->key_output_func;
+
+		if (cxt->keys)
+		{
+			json_unique_check_init(&result->unique_check, result->str,
+								   cxt->nallocated);
+			memcpy(result->unique_check.keys, cxt->keys,
+				   sizeof(*cxt->keys) * cxt->nkeys);
+			result->unique_check.nkeys = cxt->nkeys;
+
+			if (cxt->skipped_keys.data)
+				appendBinaryStringInfo(json_unique_check_get_skipped_keys(&result->unique_check),
+									   cxt->skipped_keys.data,
+									   cxt->skipped_keys.len);
+
+			json_unique_check_fill_set(&result->unique_check);
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
 
 	return result;
 }
 
-static Datum
-json_build_object_worker(FunctionCallInfo fcinfo, int first_vararg,
-						 bool absent_on_null, bool unique_keys)
+/*
+ * Serialize a json_agg or json_object_agg state.
+ */
+static bytea *
+json_agg_state_serialize(JsonAggState *state, bool is_object)
 {
-	int			nargs = PG_NARGS();
-	int			i;
-	const char *sep = "";
-	StringInfo	result;
-	Datum	   *args;
-	bool	   *nulls;
-	Oid		   *types;
-	JsonUniqueCheckContext unique_check;
+	StringInfoData buf;
 
-	/* fetch argument values to build the object */
-	nargs = extract_variadic_args(fcinfo, first_vararg, false,
-								  &args, &types, &nulls);
+	pq_begintypsend(&buf);
 
-	if (nargs < 0)
-		PG_RETURN_NULL();
+	pq_sendint32(&buf, state->val_category);
+	pq_sendint32(&buf, state->val_output_func);
 
-	if (nargs % 2 != 0)
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+	if (is_object)
+	{
+		JsonUniqueCheckContext *cxt = &state->unique_check;
+
+		pq_sendint32(&buf, state->key_category);
+		pq_sendint32(&buf, state->key_output_func);
+
+		/* key uniqueness check state */
+		pq_sendbyte(&buf, cxt->keys != NULL);
+
+		if (cxt->keys)
+		{
+			int			i;
+
+			pq_sendint32(&buf, cxt->nkeys);
+
+			for (i = 0; i < cxt->nkeys; i++)
+			{
+				pq_sendint32(&buf, cxt->keys[i].offset);
+				pq_sendint32(&buf, cxt->keys[i].length);
+			}
+
+			if (cxt->skipped_keys.data)
+			{
+				pq_sendint32(&buf, cxt->skipped_keys.len);
+				pq_sendbytes(&buf, cxt->skipped_keys.data,
+							 cxt->skipped_keys.len);
+			}
+			else
+				pq_sendint32(&buf, 0);
+		}
+	}
+
+	if (json_agg_state_length(state) > MaxAllocSize)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("json aggregate state is too large to be serialized")));
+
+	pq_sendint32(&buf, json_agg_state_length(state));
+
+	if (state->spill)
+	{
+		enlargeStringInfo(&buf, state->spilled);
+		json_agg_state_read_spilled(state, 0, buf.data + buf.len,
+									state->spilled);
+		buf.len += state->spilled;
+	}
+
+	pq_sendbytes(&buf, state->str->data, state->str->len);
+
+	return pq_endtypsend(&buf);
+}
+
+/*
+ * Deserialize a json_agg or json_object_agg state in the current memory
+ * context.
+ */
+static JsonAggState *
+json_agg_state_deserialize(bytea *sstate, bool is_object)
+{
+	JsonAggState *state = palloc0(sizeof(JsonAggState));
+	StringInfoData buf;
+	int			len;
+
+	/*
+	 * Copy the bytea into a StringInfo so that we can "receive" it using the
+	 * standard recv-function infrastructure.
+	 */
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf,
+						   VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+
+	state->str = makeStringInfo();
+	state->val_category = (JsonTypeCategory) pq_getmsgint(&buf, 4);
+	state->val_output_func = pq_getmsgint(&buf, 4);
+
+	if (is_object)
+	{
+		state->key_category = (JsonTypeCategory) pq_getmsgint(&buf, 4);
+		state->key_output_func = pq_getmsgint(&buf, 4);
+
+		if (pq_getmsgbyte(&buf))
+		{
+			JsonUniqueCheckContext *cxt = &state->unique_check;
+			int			nkeys = pq_getmsgint(&buf, 4);
+			int			i;
+
+			json_unique_check_init(cxt, state->str, nkeys);
+
+			for (i = 0; i < nkeys; i++)
+			{
+				cxt->keys[i].offset = pq_getmsgint(&buf, 4);
+				cxt->keys[i].length = pq_getmsgint(&buf, 4);
+			}
+
+			cxt->nkeys = nkeys;
+
+			len = pq_getmsgint(&buf, 4);
+
+			if (len > 0)
+				appendBinaryStringInfo(json_unique_check_get_skipped_keys(cxt),
+									   pq_getmsgbytes(&buf, len), len);
+		}
+	}
+
+	len = pq_getmsgint(&buf, 4);
+	appendBinaryStringInfo(state->str, pq_getmsgbytes(&buf, len), len);
+
+	if (state->unique_check.keys)
+		json_unique_check_fill_set(&state->unique_check);
+
+	pq_getmsgend(&buf);
+	pfree(buf.data);
+
+	return state;
+}
+
+/*
+ * json_agg combine function
+ *
+ * Appends the elements of the second partial array to the first one, so
+ * the order of elements between the partial arrays is unspecified, as it
+ * is without ORDER BY anyway.
+ */
+Datum
+json_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext,
+				oldcontext;
+	JsonAggState *state1;
+	JsonAggState *state2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "aggregate function called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (JsonAggState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+		PG_RETURN_POINTER(state1);
+
+	if (state1 == NULL)
+	{
+		if (state2->spill == NULL)
+			PG_RETURN_POINTER(json_agg_state_copy(state2, false, aggcontext));
+
+		/* start with an empty array, the text is appended below */
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		state1 = palloc0(sizeof(JsonAggState));
+		state1->str = makeStringInfo();
+		MemoryContextSwitchTo(oldcontext);
+
+		appendStringInfoChar(state1->str, '[');
+		state1->val_category = state2->val_category;
+		state1->val_output_func = state2->val_output_func;
+	}
+
+	/* skip the opening bracket of the second array */
+	if (json_agg_state_length(state2) > 1)
+	{
+		int64		offset = 1;
+
+		if (json_agg_state_length(state1) > 1)
+		{
+			appendStringInfoString(state1->str, ", ");
+
+			/* add some whitespace as json_agg_transfn does */
+			if (state1->val_category == JSONTYPE_ARRAY ||
+				state1->val_category == JSONTYPE_COMPOSITE)
+				appendStringInfoString(state1->str, "\n ");
+		}
+
+		/* copy the spilled text in pieces, spilling it again if needed */
+		while (offset < state2->spilled)
+		{
+			int			len = Min(state2->spilled - offset,
+								  JSON_STREAM_CHUNK_SIZE);
+
+			enlargeStringInfo(state1->str, len);
+			json_agg_state_read_spilled(state2, offset,
+										state1->str->data + state1->str->len,
+										len);
+			state1->str->len += len;
+			state1->str->data[state1->str->len] = '\0';
+			offset += len;
+
+			json_agg_state_spill(fcinfo, state1);
+		}
+
+		offset -= state2->spilled;
+		appendBinaryStringInfo(state1->str, state2->str->data + offset,
+							   state2->str->len - offset);
+
+		json_agg_state_spill(fcinfo, state1);
+	}
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * json_agg serial function
+ */
+Datum
+json_agg_serialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_BYTEA_P(json_agg_state_serialize((JsonAggState *) PG_GETARG_POINTER(0),
+											   false));
+}
+
+/*
+ * json_agg deserial function
+ */
+Datum
+json_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_POINTER(json_agg_state_deserialize(PG_GETARG_BYTEA_PP(0), false));
+}
+
+/*
+ * Check that the keys of the second partial object are not among the keys of
+ * the first one, and add them to the first one.  The text of the second
+ * object is appended at 'offset' of the first one, and its skipped keys at
+ * 'skipped_offset' of the skipped keys of the first one.
+ */
+static void
+json_unique_check_merge(JsonUniqueCheckContext *cxt,
+						JsonUniqueCheckContext *cxt2,
+						int offset, int skipped_offset)
+{
+	int			i;
+
+	for (i = 0; i < cxt2->nkeys; i++)
+	{
+		struct JsonKeyInfo *key = &cxt2->keys[i];
+		char	   *keystr = json_unique_check_key_text(cxt2, key);
+
+		if (!JsonKeySetAdd(cxt->set, keystr, key->length))
+			ereport(ERROR,
+					(errcode(ERRCODE_DUPLICATE_JSON_OBJECT_KEY_VALUE),
+					 errmsg("duplicate JSON key %.*s",
+							key->length, keystr)));
+
+		if (cxt->nkeys >= cxt->nallocated)
+		{
+			cxt->nallocated *= 2;
+			cxt->keys = repalloc(cxt->keys,
+								 sizeof(*cxt->keys) * cxt->nallocated);
+		}
+
+		cxt->keys[cxt->nkeys].offset = key->offset > 0
+			? key->offset + offset
+			: key->offset - skipped_offset;
+		cxt->keys[cxt->nkeys].length = key->length;
+		cxt->nkeys++;
+	}
+}
+
+/*
+ * json_object_agg combine function
+ *
+ * Appends the fields of the second partial object to the first one, checking
+ * the uniqueness of keys across both objects if needed.
+ */
+Datum
+json_object_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	JsonAggState *state1;
+	JsonAggState *state2;
+	JsonUniqueCheckContext *cxt;
+	int			skipped_offset = 0;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "aggregate function called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (JsonAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (JsonAggState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+		PG_RETURN_POINTER(state1);
+
+	if (state1 == NULL)
+		PG_RETURN_POINTER(json_agg_state_copy(state2, true, aggcontext));
+
+	cxt = &state1->unique_check;
+
+	/* skipped keys of the second object go after the ones of the first */
+	if (cxt->keys && state2->unique_check.skipped_keys.data)
+	{
+		StringInfo	skipped_keys = json_unique_check_get_skipped_keys(cxt);
+
+		skipped_offset = skipped_keys->len;
+		appendBinaryStringInfo(skipped_keys,
+							   state2->unique_check.skipped_keys.data,
+							   state2->unique_check.skipped_keys.len);
+	}
+
+	if (state1->str->len > 2 && state2->str->len > 2)
+		appendStringInfoString(state1->str, ", ");
+
+	/* the text of the second object goes without its opening "{ " */
+	if (cxt->keys && state2->unique_check.keys)
+		json_unique_check_merge(cxt, &state2->unique_check,
+								state1->str->len - 2, skipped_offset);
+
+	appendBinaryStringInfo(state1->str, state2->str->data + 2,
+						   state2->str->len - 2);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * json_object_agg serial function
+ */
+Datum
+json_object_agg_serialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_BYTEA_P(json_agg_state_serialize((JsonAggState *) PG_GETARG_POINTER(0),
+											   true));
+}
+
+/*
+ * json_object_agg deserial function
+ */
+Datum
+json_object_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_POINTER(json_agg_state_deserialize(PG_GETARG_BYTEA_PP(0), true));
+}
+
+/*
+ * Helper function for aggregates: return given StringInfo's contents plus
+ * specified trailing string, as a text datum.  We need this because aggregate
+ * final functions are not allowed to modify the aggregate state.
+ */
+static text *
+catenate_stringinfo_string(StringInfo buffer, const char *addon)
+{
+	/* custom version of cstring_to_text_with_len */
+	int			buflen = buffer->len;
+	int			addlen = strlen(addon);
+	text	   *result = (text *) palloc(buflen + addlen + VARHDRSZ);
+
+	SET_VARSIZE(result, buflen + addlen + VARHDRSZ);
+	memcpy(VARDATA(result), buffer->data, buflen);
+	memcpy(VARDATA(result) + buflen, addon, addlen);
+
+	return result;
+}
+
+static Datum
+json_build_object_worker(FunctionCallInfo fcinfo, int first_vararg,
+						 bool absent_on_null, bool unique_keys)
+{
+	int			nargs = PG_NARGS();
+	int			i;
+	const char *sep = "";
+	StringInfo	result;
+	Datum	   *args;
+	bool	   *nulls;
+	Oid		   *types;
+	JsonUniqueCheckContext unique_check;
+
+	/* fetch argument values to build the object */
+	nargs = extract_variadic_args(fcinfo, first_vararg, false,
+								  &args, &types, &nulls);
+
+	if (nargs < 0)
+		PG_RETURN_NULL();
+
+	if (nargs % 2 != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("argument list must have even number of elements"),
 				 /* translator: %s is a SQL function name */
 				 errhint("The arguments of %s must consist of alternating keys and values.",
@@ -2925,80 +3751,6 @@ escape_json(StringInfo buf, const char *str)
 	appendStringInfoCharMacro(buf, '"');
 }
 
-/* Functions implementing hash table for key uniqueness check */
-static int
-json_unique_hash_match(const void *key1, const void *key2, Size keysize)
-{
-	return strcmp(*(const char **) key1, *(const char **) key2);
-}
-
-static void *
-json_unique_hash_keycopy(void *dest, const void *src, Size keysize)
-{
-	*(const char **) dest = pstrdup(*(const char **) src);
-
-	return dest;
-}
-
-static uint32
-json_unique_hash(const void *key, Size keysize)
-{
-	const char *s = *(const char **) key;
-
-	return DatumGetUInt32(hash_any((const unsigned char *) s, (int) strlen(s)));
-}
-
-/* Semantic actions for key uniqueness check */
-static void
-json_unique_object_start(void *_state)
-{
-	JsonUniqueState *state = _state;
-	JsonObjectFields *obj = palloc(sizeof(*obj));
-	HASHCTL		ctl;
-
-	memset(&ctl, 0, sizeof(ctl));
-	ctl.keysize = sizeof(char *);
-	ctl.entrysize = sizeof(char *);
-	ctl.hcxt = CurrentMemoryContext;
-	ctl.hash = json_unique_hash;
-	ctl.keycopy = json_unique_hash_keycopy;
-	ctl.match = json_unique_hash_match;
-	obj->fields = hash_create("json object hashtable",
-							  32,
-							  &ctl,
-							  HASH_ELEM | HASH_CONTEXT |
-							  HASH_FUNCTION | HASH_COMPARE | HASH_KEYCOPY);
-	obj->parent = state->stack;		/* push object to stack */
-
-	state->stack = obj;
-}
-
-static void
-json_unique_object_end(void *_state)
-{
-	JsonUniqueState *state = _state;
-
-	hash_destroy(state->stack->fields);
-
-	state->stack = state->stack->parent;	/* pop object from stack */
-}
-
-static void
-json_unique_object_field_start(void *_state, char *field, bool isnull)
-{
-	JsonUniqueState *state = _state;
-	bool		found;
-
-	/* find key collision in the current object */
-	(void) hash_search(state->stack->fields, &field, HASH_ENTER, &found);
-
-	if (found && !lex_set_error(state->lex))
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-				 errmsg("duplicate JSON key \"%s\"", field),
-				 report_json_context(state->lex)));
-}
-
 /*
  * json_is_valid -- check json text validity, its value type and key uniqueness
  */
@@ -3008,25 +3760,43 @@ json_is_valid(PG_FUNCTION_ARGS)
 	text	   *json = PG_GETARG_TEXT_P(0);
 	text	   *type = PG_GETARG_TEXT_P(1);
 	bool		unique = PG_GETARG_BOOL(2);
+	bool		check_type;
+	JsonLexContext *lex;
+	JsonTokenType tok;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();
 
-	if (!PG_ARGISNULL(1) &&
-		strncmp("any", VARDATA(type), VARSIZE_ANY_EXHDR(type)))
-	{
-		JsonLexContext *lex;
-		JsonTokenType tok;
+	check_type = !PG_ARGISNULL(1) &&
+		strncmp("any", VARDATA(type), VARSIZE_ANY_EXHDR(type));
 
-		lex = makeJsonLexContext(json, false);
-		lex->throw_errors = false;
+	lex = makeJsonLexContext(json, false);
+	lex->throw_errors = false;
 
-		/* Lex exactly one token from the input and check its type. */
+	/*
+	 * Do full parsing pass only for uniqueness check or JSON text validation,
+	 * it also returns the first token.  Otherwise, lex exactly one token from
+	 * the input.
+	 */
+	if (unique ||
+		get_fn_expr_argtype(fcinfo->flinfo, 0) != JSONOID)
+	{
+		if (!json_validate_lex(lex, unique, &tok))
+			PG_RETURN_BOOL(false);	/* invalid json or key collision found */
+	}
+	else if (!check_type)
+		PG_RETURN_BOOL(true);
+	else
+	{
 		if (!json_lex(lex))
 			PG_RETURN_BOOL(false);	/* invalid json */
 
 		tok = lex_peek(lex);
+	}
 
+	/* check the type of the value by its first token */
+	if (check_type)
+	{
 		if (!strncmp("object", VARDATA(type), VARSIZE_ANY_EXHDR(type)))
 		{
 			if (tok != JSON_TOKEN_OBJECT_START)
@@ -3045,31 +3815,6 @@ json_is_valid(PG_FUNCTION_ARGS)
 		}
 	}
 
-	/* do full parsing pass only for uniqueness check or JSON text validation */
-	if (unique ||
-		get_fn_expr_argtype(fcinfo->flinfo, 0) != JSONOID)
-	{
-		JsonLexContext *lex = makeJsonLexContext(json, unique);
-		JsonSemAction uniqueSemAction = {0};
-		JsonUniqueState state;
-
-		if (unique)
-		{
-			state.lex = lex;
-			state.stack = NULL;
-
-			uniqueSemAction.semstate = &state;
-			uniqueSemAction.object_start = json_unique_object_start;
-			uniqueSemAction.object_field_start = json_unique_object_field_start;
-			uniqueSemAction.object_end = json_unique_object_end;
-		}
-
-		lex->throw_errors = false;
-
-		if (!pg_parse_json(lex, unique ? &uniqueSemAction : &nullSemAction))
-			PG_RETURN_BOOL(false);	/* invalid json or key collision found */
-	}
-
 	PG_RETURN_BOOL(true);	/* ok */
 }
 
@@ -3143,6 +3888,8 @@ jsonInitContainer(JsonContainerData *jc, char *json, int len, int type,
 	jc->data = json;
 	jc->len = len;
 	jc->header = type | size;
+	jc->tape = NULL;
+	jc->tapeEntry = 0;
 }
 
 /*
@@ -3626,6 +4373,10 @@ JsonbValueToJson(JsonbValue *jbv)
 		*dst = *src;
 		dst->data = memcpy(palloc(src->len), src->data, src->len);
 
+		/* the tape of the source may not live as long as the copy */
+		dst->tape = NULL;
+		dst->tapeEntry = 0;
+
 		return json;
 	}
 
@@ -3657,56 +4408,312 @@ JsonbValueToJson(JsonbValue *jbv)
 	return json;
 }
 
-/* Context and semantic actions for JsonGetArraySize() */
-typedef struct JsonGetArraySizeState
+/*
+ * Structural index ("tape") of a json text.
+ *
+ * The tape contains an entry for each value of a json document, including
+ * object keys, in the document order.  Each object pair is represented by the
+ * key's entry immediately followed by the value's entry.  Entries of the
+ * container's members follow the container's own entry, and "next" links
+ * each entry to the entry following its subtree, so members of a container
+ * can be enumerated and extracted without re-lexing the text.
+ *
+ * The tape is built on the first lookup into a container and it is shared
+ * with all the nested containers extracted from it.  Offsets are relative to
+ * the text of the container the tape was built for.
+ */
+typedef struct JsonTapeEntry
 {
-	int		level;
-	uint32	size;
-} JsonGetArraySizeState;
+	int			start;			/* offset of the first byte of the value */
+	int			end;			/* offset of the byte following the value */
+	int			next;			/* index of the entry following the subtree */
+	int			size;			/* number of elements/pairs in container */
+	JsonTokenType type;			/* type of the value's first token */
+	bool		escaped;		/* string contains escape sequences */
+} JsonTapeEntry;
+
+typedef struct JsonTape
+{
+	JsonTapeEntry *entries;
+	int			nentries;
+	int			nallocated;
+} JsonTape;
 
+/*
+ * Append the value starting at the current token to the tape.
+ */
 static void
-JsonGetArraySize_array_start(void *state)
+jsonTapeAppendValue(JsonTape *tape, JsonLexContext *lex)
+{
+	JsonTokenType tok = lex_peek(lex);
+	JsonTapeEntry *entry;
+	int			idx;
+	int			start = lex->token_start - lex->input;
+	int			end;
+	int			size = 0;
+	bool		escaped = false;
+
+	check_stack_depth();
+
+	if (tape->nentries >= tape->nallocated)
+	{
+		tape->nallocated *= 2;
+		tape->entries = repalloc(tape->entries,
+								 sizeof(JsonTapeEntry) * tape->nallocated);
+	}
+
+	idx = tape->nentries++;
+
+	switch (tok)
+	{
+		case JSON_TOKEN_OBJECT_START:
+			lex_accept(lex, tok, NULL);
+
+			if (lex_peek(lex) != JSON_TOKEN_OBJECT_END)
+			{
+				do
+				{
+					if (lex_peek(lex) != JSON_TOKEN_STRING)
+						report_parse_error(JSON_PARSE_STRING, lex);
+
+					jsonTapeAppendValue(tape, lex);
+					lex_expect(JSON_PARSE_OBJECT_LABEL, lex, JSON_TOKEN_COLON);
+					jsonTapeAppendValue(tape, lex);
+					size++;
+				} while (lex_accept(lex, JSON_TOKEN_COMMA, NULL));
+			}
+
+			end = lex->token_terminator - lex->input;
+			lex_expect(JSON_PARSE_OBJECT_NEXT, lex, JSON_TOKEN_OBJECT_END);
+			break;
+
+		case JSON_TOKEN_ARRAY_START:
+			lex_accept(lex, tok, NULL);
+
+			if (lex_peek(lex) != JSON_TOKEN_ARRAY_END)
+			{
+				do
+				{
+					jsonTapeAppendValue(tape, lex);
+					size++;
+				} while (lex_accept(lex, JSON_TOKEN_COMMA, NULL));
+			}
+
+			end = lex->token_terminator - lex->input;
+			lex_expect(JSON_PARSE_ARRAY_NEXT, lex, JSON_TOKEN_ARRAY_END);
+			break;
+
+		case JSON_TOKEN_STRING:
+			end = lex->token_terminator - lex->input;
+			escaped = memchr(lex->token_start, '\\', end - start) != NULL;
+			lex_accept(lex, tok, NULL);
+			break;
+
+		case JSON_TOKEN_NUMBER:
+		case JSON_TOKEN_TRUE:
+		case JSON_TOKEN_FALSE:
+		case JSON_TOKEN_NULL:
+			end = lex->token_terminator - lex->input;
+			lex_accept(lex, tok, NULL);
+			break;
+
+		default:
+			report_parse_error(JSON_PARSE_VALUE, lex);
+			end = start;		/* keep compiler quiet */
+			break;
+	}
+
+	/* entries could have been reallocated by recursive calls */
+	entry = &tape->entries[idx];
+	entry->start = start;
+	entry->end = end;
+	entry->next = tape->nentries;
+	entry->size = size;
+	entry->type = tok;
+	entry->escaped = escaped;
+}
+
+/*
+ * Get the tape of a json container, building it if it does not exist yet.
+ *
+ * The tape is allocated in the memory context of the container, so it lives
+ * as long as the container itself.
+ */
+static JsonTape *
+jsonGetTape(JsonContainer *jc)
 {
-	((JsonGetArraySizeState *) state)->level++;
+	JsonContainerData *cont = (JsonContainerData *) jc;
+	JsonLexContext *lex;
+	JsonTape   *tape;
+	MemoryContext oldcxt;
+
+	if (cont->tape)
+		return cont->tape;
+
+	oldcxt = MemoryContextSwitchTo(GetMemoryChunkContext(cont));
+
+	tape = palloc(sizeof(*tape));
+	tape->nentries = 0;
+	tape->nallocated = Max(cont->len / 16, 8);
+	tape->entries = palloc(sizeof(JsonTapeEntry) * tape->nallocated);
+
+	lex = makeJsonLexContextCstringLen(cont->data, cont->len, false);
+	json_lex(lex);
+	jsonTapeAppendValue(tape, lex);
+	pfree(lex);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	cont->tape = tape;
+	cont->tapeEntry = 0;
+
+	return tape;
 }
 
-static void
-JsonGetArraySize_array_end(void *state)
+/*
+ * Get the pointer to the text of a tape entry of the container.
+ */
+static inline char *
+jsonTapeEntryText(JsonContainer *jc, JsonTapeEntry *entry)
 {
-	((JsonGetArraySizeState *) state)->level--;
+	int			base = jc->tapeEntry ? jc->tape->entries[jc->tapeEntry].start : 0;
+
+	return jc->data + (entry->start - base);
 }
 
+/*
+ * Fill JsonbValue from the tape entry of the container.
+ *
+ * Unescaped strings point directly into the json text, nested containers
+ * share the tape of the parent container.
+ */
 static void
-JsonGetArraySize_array_element_start(void *state, bool isnull)
+jsonTapeGetValue(JsonContainer *jc, int idx, JsonbValue *res)
 {
-	JsonGetArraySizeState *s = state;
-	if (s->level == 1)
-		s->size++;
+	JsonTapeEntry *entry = &jc->tape->entries[idx];
+	char	   *text = jsonTapeEntryText(jc, entry);
+	int			len = entry->end - entry->start;
+
+	switch (entry->type)
+	{
+		case JSON_TOKEN_NULL:
+			res->type = jbvNull;
+			break;
+
+		case JSON_TOKEN_TRUE:
+			res->type = jbvBool;
+			res->val.boolean = true;
+			break;
+
+		case JSON_TOKEN_FALSE:
+			res->type = jbvBool;
+			res->val.boolean = false;
+			break;
+
+		case JSON_TOKEN_STRING:
+			res->type = jbvString;
+
+			if (!entry->escaped)
+			{
+				/* skip quotes */
+				res->val.string.val = text + 1;
+				res->val.string.len = len - 2;
+			}
+			else
+			{
+				JsonLexContext *lex =
+					makeJsonLexContextCstringLen(text, len, true);
+
+				json_lex(lex);
+				res->val.string.val = lex->strval->data;
+				res->val.string.len = lex->strval->len;
+				pfree(lex);
+			}
+			break;
+
+		case JSON_TOKEN_NUMBER:
+			res->type = jbvNumeric;
+			res->val.numeric = DatumGetNumeric(DirectFunctionCall3(
+					numeric_in, CStringGetDatum(pnstrdup(text, len)), 0, -1));
+			break;
+
+		case JSON_TOKEN_OBJECT_START:
+		case JSON_TOKEN_ARRAY_START:
+		{
+			JsonContainerData *cont = palloc(sizeof(*cont));
+
+			jsonInitContainer(cont, text, len,
+							  entry->type == JSON_TOKEN_OBJECT_START ?
+									JB_FOBJECT : JB_FARRAY,
+							  entry->size);
+			cont->tape = jc->tape;
+			cont->tapeEntry = idx;
+
+			res->type = jbvBinary;
+			res->val.binary.data = (JsonbContainer *) cont;
+			res->val.binary.len = len;
+			break;
+		}
+
+		default:
+			elog(ERROR, "unexpected json token: %d", entry->type);
+	}
+}
+
+/*
+ * Check whether the string tape entry of the container is equal to the given
+ * string.
+ */
+static bool
+jsonTapeStringEquals(JsonContainer *jc, int idx, const JsonbValue *str)
+{
+	JsonTapeEntry *entry = &jc->tape->entries[idx];
+	JsonbValue	val;
+
+	Assert(entry->type == JSON_TOKEN_STRING);
+
+	if (!entry->escaped)
+		return entry->end - entry->start - 2 == str->val.string.len &&
+			!memcmp(jsonTapeEntryText(jc, entry) + 1, str->val.string.val,
+					str->val.string.len);
+
+	jsonTapeGetValue(jc, idx, &val);
+
+	return !lengthCompareJsonbStringValue(str, &val);
 }
 
 /*
- * Calculate the size of a json array by iterating through its elements.
+ * Calculate the size of a json array.
  */
 uint32
 JsonGetArraySize(JsonContainer *jc)
 {
-	JsonLexContext *lex = makeJsonLexContextCstringLen(jc->data, jc->len, false);
-	JsonSemAction	sem;
-	JsonGetArraySizeState state;
+	JsonTape   *tape = jsonGetTape(jc);
 
-	state.level = 0;
-	state.size = 0;
+	Assert(tape->entries[jc->tapeEntry].type == JSON_TOKEN_ARRAY_START);
 
-	memset(&sem, 0, sizeof(sem));
-	sem.semstate = &state;
-	sem.array_start			= JsonGetArraySize_array_start;
-	sem.array_end 			= JsonGetArraySize_array_end;
-	sem.array_element_end	= JsonGetArraySize_array_element_start;
+	return tape->entries[jc->tapeEntry].size;
+}
 
-	json_lex(lex);
-	parse_array(lex, &sem);
+/*
+ * Get the tape index of the first element of a json array and the number of
+ * its elements.  Raw scalar is treated as an one-element array.
+ */
+static int
+jsonTapeGetArrayElements(JsonContainer *array, int *nelems)
+{
+	JsonTape   *tape = jsonGetTape(array);
+
+	Assert(JsonContainerIsArray(array));
+
+	if (JsonContainerIsScalar(array))
+	{
+		*nelems = 1;
+		return array->tapeEntry;
+	}
 
-	return state.size;
+	*nelems = tape->entries[array->tapeEntry].size;
+	return array->tapeEntry + 1;
 }
 
 /*
@@ -3716,31 +4723,56 @@ JsonGetArraySize(JsonContainer *jc)
 static inline JsonbValue *
 jsonFindLastKeyInObject(JsonContainer *obj, const JsonbValue *key)
 {
-	JsonbValue *res = NULL;
-	JsonbValue	jbv;
-	JsonIterator *it;
-	JsonbIteratorToken tok;
+	JsonbValue *res;
+	JsonTape   *tape;
+	int			end;
+	int			found = -1;
+	int			i;
 
 	Assert(JsonContainerIsObject(obj));
 	Assert(key->type == jbvString);
 
-	it = JsonIteratorInit(obj);
+	tape = jsonGetTape(obj);
+	end = tape->entries[obj->tapeEntry].next;
 
-	while ((tok = JsonIteratorNext(&it, &jbv, true)) != WJB_DONE)
+	/* walk through key entries, values are skipped using their links */
+	for (i = obj->tapeEntry + 1; i < end; i = tape->entries[i + 1].next)
 	{
-		if (tok == WJB_KEY && !lengthCompareJsonbStringValue(key, &jbv))
-		{
-			if (!res)
-				res = palloc(sizeof(*res));
-
-			tok = JsonIteratorNext(&it, res, true);
-			Assert(tok == WJB_VALUE);
-		}
+		if (jsonTapeStringEquals(obj, i, key))
+			found = i + 1;
 	}
 
+	if (found < 0)
+		return NULL;
+
+	res = palloc(sizeof(*res));
+	jsonTapeGetValue(obj, found, res);
+
 	return res;
 }
 
+/*
+ * Map json token type to the type of the JsonbValue it will be turned into.
+ */
+static inline enum jbvType
+jsonTokenTypeToJsonbValueType(JsonTokenType tok)
+{
+	switch (tok)
+	{
+		case JSON_TOKEN_STRING:
+			return jbvString;
+		case JSON_TOKEN_NUMBER:
+			return jbvNumeric;
+		case JSON_TOKEN_TRUE:
+		case JSON_TOKEN_FALSE:
+			return jbvBool;
+		case JSON_TOKEN_NULL:
+			return jbvNull;
+		default:
+			return jbvBinary;
+	}
+}
+
 /*
  * Find scalar element in a array.  Returns palloc()'d copy of value or NULL.
  */
@@ -3748,22 +4780,34 @@ static JsonbValue *
 jsonFindValueInArray(JsonContainer *array, const JsonbValue *elem)
 {
 	JsonbValue *val = palloc(sizeof(*val));
-	JsonIterator *it;
-	JsonbIteratorToken tok;
+	JsonTape   *tape;
+	int			nelems;
+	int			i;
 
 	Assert(JsonContainerIsArray(array));
 	Assert(IsAJsonbScalar(elem));
 
-	it = JsonIteratorInit(array);
+	i = jsonTapeGetArrayElements(array, &nelems);
+	tape = array->tape;
 
-	while ((tok = JsonIteratorNext(&it, val, true)) != WJB_DONE)
+	for (; nelems > 0; nelems--, i = tape->entries[i].next)
 	{
-		if (tok == WJB_ELEM && val->type == elem->type &&
-			equalsJsonbScalarValue(val, (JsonbValue *) elem))
+		if (jsonTokenTypeToJsonbValueType(tape->entries[i].type) != elem->type)
+			continue;
+
+		if (elem->type == jbvString)
 		{
-			JsonIteratorFree(it);
+			if (!jsonTapeStringEquals(array, i, elem))
+				continue;
+
+			jsonTapeGetValue(array, i, val);
 			return val;
 		}
+
+		jsonTapeGetValue(array, i, val);
+
+		if (equalsJsonbScalarValue(val, (JsonbValue *) elem))
+			return val;
 	}
 
 	pfree(val);
@@ -3805,29 +4849,27 @@ findJsonValueFromContainer(JsonContainer *jc, uint32 flags, JsonbValue *key)
 JsonbValue *
 getIthJsonValueFromContainer(JsonContainer *array, uint32 index)
 {
-	JsonbValue *val = palloc(sizeof(JsonbValue));
-	JsonIterator *it;
-	JsonbIteratorToken tok;
+	JsonbValue *val;
+	JsonTape   *tape;
+	int			nelems;
+	int			i;
 
 	Assert(JsonContainerIsArray(array));
 
-	it = JsonIteratorInit(array);
+	i = jsonTapeGetArrayElements(array, &nelems);
 
-	while ((tok = JsonIteratorNext(&it, val, true)) != WJB_DONE)
-	{
-		if (tok == WJB_ELEM)
-		{
-			if (index-- == 0)
-			{
-				JsonIteratorFree(it);
-				return val;
-			}
-		}
-	}
+	if (index >= nelems)
+		return NULL;
 
-	pfree(val);
+	tape = array->tape;
 
-	return NULL;
+	while (index-- > 0)
+		i = tape->entries[i].next;
+
+	val = palloc(sizeof(JsonbValue));
+	jsonTapeGetValue(array, i, val);
+
+	return val;
 }
 
 /*
@@ -18,6 +18,7 @@
 #include "catalog/pg_type.h"
 #include "funcapi.h"
 #include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
 #include "parser/parse_coerce.h"
 #include "utils/builtins.h"
 #include "utils/date.h"
@@ -26,6 +27,7 @@
 #include "utils/json.h"
 #include "utils/jsonapi.h"
 #include "utils/jsonb.h"
+#include "utils/jsonkeyset.h"
 #include "utils/syscache.h"
 #include "utils/typcache.h"
 
@@ -52,6 +54,9 @@ typedef enum					/* type categories for datum_to_jsonb */
 	JSONBTYPE_OTHER				/* all else */
 } JsonbTypeCategory;
 
+/* GUC parameter */
+int			jsonb_send_version = 1;
+
 /* Context for key uniqueness check */
 typedef struct JsonbUniqueCheckContext
 {
@@ -59,6 +64,7 @@ typedef struct JsonbUniqueCheckContext
 	int		   *skipped_keys;		/* array of skipped key-value pair indices */
 	int			skipped_keys_allocated;
 	int			skipped_keys_count;
+	JsonKeySet *set;				/* keys of the object for lookups */
 	MemoryContext mcxt;				/* context for saving skipped keys */
 } JsonbUniqueCheckContext;
 
@@ -72,6 +78,17 @@ typedef struct JsonbAggState
 	JsonbUniqueCheckContext unique_check;
 } JsonbAggState;
 
+/*
+ * jsonb_agg state: the elements are encoded right away into the open
+ * top-level array of the encoder
+ */
+typedef struct JsonbArrayAggState
+{
+	JsonbEncoder *enc;
+	JsonbTypeCategory val_category;
+	Oid			val_output_func;
+} JsonbArrayAggState;
+
 static inline Datum jsonb_from_cstring(char *json, int len);
 static size_t checkStringLen(size_t len);
 static void jsonb_in_object_start(void *pstate);
@@ -80,7 +97,16 @@ static void jsonb_in_array_start(void *pstate);
 static void jsonb_in_array_end(void *pstate);
 static void jsonb_in_object_field_start(void *pstate, char *fname, bool isnull);
 static void jsonb_put_escaped_value(StringInfo out, JsonbValue *scalarVal);
+static void jsonb_in_scalar_value(char *token, JsonTokenType tokentype,
+					  JsonbValue *v);
 static void jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype);
+static void jsonb_encode_object_start(void *pstate);
+static void jsonb_encode_array_start(void *pstate);
+static void jsonb_encode_container_end(void *pstate);
+static void jsonb_encode_object_field_start(void *pstate, char *fname,
+								bool isnull);
+static void jsonb_encode_scalar(void *pstate, char *token,
+					JsonTokenType tokentype);
 static void jsonb_categorize_type(Oid typoid,
 					  JsonbTypeCategory *tcategory,
 					  Oid *outfuncoid);
@@ -130,6 +156,19 @@ jsonb_recv(PG_FUNCTION_ARGS)
 
 	if (version == 1)
 		str = pq_getmsgtext(buf, buf->len - buf->cursor, &nbytes);
+	else if (version == 2)
+	{
+		/* the strings of the value cannot be converted in place */
+		if (pg_get_client_encoding() != GetDatabaseEncoding())
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("jsonb binary format version 2 requires the client encoding to match the server encoding")));
+
+		nbytes = buf->len - buf->cursor;
+
+		PG_RETURN_JSONB_P(JsonbFromWireFormat(pq_getmsgbytes(buf, nbytes),
+											  nbytes));
+	}
 	else
 		elog(ERROR, "unsupported jsonb version number %d", version);
 
@@ -153,23 +192,36 @@ jsonb_out(PG_FUNCTION_ARGS)
 /*
  * jsonb type send function
  *
- * Just send jsonb as a version number, then a string of text
+ * Send jsonb as a version number, then either a string of text (version 1)
+ * or the storage format of the value (version 2, see JsonbToWireFormat()).
+ * Version 2 is sent only if jsonb_send_version asks for it, and the strings
+ * need no encoding conversion.
  */
 Datum
 jsonb_send(PG_FUNCTION_ARGS)
 {
 	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
 	StringInfoData buf;
-	StringInfo	jtext = makeStringInfo();
-	int			version = 1;
-
-	(void) JsonbToCString(jtext, &jb->root, VARSIZE(jb));
 
 	pq_begintypsend(&buf);
-	pq_sendint8(&buf, version);
-	pq_sendtext(&buf, jtext->data, jtext->len);
-	pfree(jtext->data);
-	pfree(jtext);
+
+	if (jsonb_send_version >= 2 &&
+		pg_get_client_encoding() == GetDatabaseEncoding())
+	{
+		pq_sendint8(&buf, 2);
+		JsonbToWireFormat(&buf, jb);
+	}
+	else
+	{
+		StringInfo	jtext = makeStringInfo();
+
+		(void) JsonbToCString(jtext, &jb->root, VARSIZE(jb));
+
+		pq_sendint8(&buf, 1);
+		pq_sendtext(&buf, jtext->data, jtext->len);
+		pfree(jtext->data);
+		pfree(jtext);
+	}
 
 	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
@@ -243,32 +295,31 @@ jsonb_typeof(PG_FUNCTION_ARGS)
  *
  * Turns json string into a jsonb Datum.
  *
- * Uses the json parser (with hooks) to construct a jsonb.
+ * Uses the json parser (with hooks) to encode a jsonb directly, without
+ * building the intermediate JsonbValue tree.
  */
 static inline Datum
 jsonb_from_cstring(char *json, int len)
 {
 	JsonLexContext *lex;
-	JsonbInState state;
+	JsonbEncoder *enc = JsonbEncoderInit();
 	JsonSemAction sem;
 
-	memset(&state, 0, sizeof(state));
 	memset(&sem, 0, sizeof(sem));
 	lex = makeJsonLexContextCstringLen(json, len, true);
 
-	sem.semstate = (void *) &state;
+	sem.semstate = (void *) enc;
 
-	sem.object_start = jsonb_in_object_start;
-	sem.array_start = jsonb_in_array_start;
-	sem.object_end = jsonb_in_object_end;
-	sem.array_end = jsonb_in_array_end;
-	sem.scalar = jsonb_in_scalar;
-	sem.object_field_start = jsonb_in_object_field_start;
+	sem.object_start = jsonb_encode_object_start;
+	sem.array_start = jsonb_encode_array_start;
+	sem.object_end = jsonb_encode_container_end;
+	sem.array_end = jsonb_encode_container_end;
+	sem.scalar = jsonb_encode_scalar;
+	sem.object_field_start = jsonb_encode_object_field_start;
 
 	pg_parse_json(lex, &sem);
 
-	/* after parsing, the item member has the composed jsonb structure */
-	PG_RETURN_POINTER(JsonbValueToJsonb(state.res));
+	PG_RETURN_POINTER(JsonbEncoderFinish(enc));
 }
 
 static size_t
@@ -358,13 +409,13 @@ jsonb_put_escaped_value(StringInfo out, JsonbValue *scalarVal)
 }
 
 /*
+ * Make a JsonbValue from a scalar token.
+ *
  * For jsonb we always want the de-escaped value - that's what's in token
  */
 static void
-jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
+jsonb_in_scalar_value(char *token, JsonTokenType tokentype, JsonbValue *v)
 {
-	JsonbInState *_state = (JsonbInState *) pstate;
-	JsonbValue	v;
 	Datum		numd;
 
 	switch (tokentype)
@@ -372,9 +423,9 @@ jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 
 		case JSON_TOKEN_STRING:
 			Assert(token != NULL);
-			v.type = jbvString;
-			v.val.string.len = checkStringLen(strlen(token));
-			v.val.string.val = token;
+			v->type = jbvString;
+			v->val.string.len = checkStringLen(strlen(token));
+			v->val.string.val = token;
 			break;
 		case JSON_TOKEN_NUMBER:
 
@@ -383,29 +434,38 @@ jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 			 * numeric size is well below the JsonbValue restriction
 			 */
 			Assert(token != NULL);
-			v.type = jbvNumeric;
+			v->type = jbvNumeric;
 			numd = DirectFunctionCall3(numeric_in,
 									   CStringGetDatum(token),
 									   ObjectIdGetDatum(InvalidOid),
 									   Int32GetDatum(-1));
-			v.val.numeric = DatumGetNumeric(numd);
+			v->val.numeric = DatumGetNumeric(numd);
 			break;
 		case JSON_TOKEN_TRUE:
-			v.type = jbvBool;
-			v.val.boolean = true;
+			v->type = jbvBool;
+			v->val.boolean = true;
 			break;
 		case JSON_TOKEN_FALSE:
-			v.type = jbvBool;
-			v.val.boolean = false;
+			v->type = jbvBool;
+			v->val.boolean = false;
 			break;
 		case JSON_TOKEN_NULL:
-			v.type = jbvNull;
+			v->type = jbvNull;
 			break;
 		default:
 			/* should not be possible */
 			elog(ERROR, "invalid json token type");
 			break;
 	}
+}
+
+static void
+jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
+{
+	JsonbInState *_state = (JsonbInState *) pstate;
+	JsonbValue	v;
+
+	jsonb_in_scalar_value(token, tokentype, &v);
 
 	if (_state->parseState == NULL)
 	{
@@ -438,6 +498,45 @@ jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype)
 	}
 }
 
+/*
+ * Semantic actions for jsonb_from_cstring(), they feed the parsed values
+ * directly into the JsonbEncoder passed as the state.
+ */
+static void
+jsonb_encode_object_start(void *pstate)
+{
+	JsonbEncoderBeginContainer((JsonbEncoder *) pstate, true);
+}
+
+static void
+jsonb_encode_array_start(void *pstate)
+{
+	JsonbEncoderBeginContainer((JsonbEncoder *) pstate, false);
+}
+
+static void
+jsonb_encode_container_end(void *pstate)
+{
+	JsonbEncoderEndContainer((JsonbEncoder *) pstate);
+}
+
+static void
+jsonb_encode_object_field_start(void *pstate, char *fname, bool isnull)
+{
+	Assert(fname != NULL);
+	JsonbEncoderKey((JsonbEncoder *) pstate, fname,
+					checkStringLen(strlen(fname)));
+}
+
+static void
+jsonb_encode_scalar(void *pstate, char *token, JsonTokenType tokentype)
+{
+	JsonbValue	v;
+
+	jsonb_in_scalar_value(token, tokentype, &v);
+	JsonbEncoderScalar((JsonbEncoder *) pstate, &v);
+}
+
 /*
  * JsonbToCString
  *	   Converts jsonb value to a C-string.
@@ -1155,6 +1254,7 @@ jsonb_unique_check_init(JsonbUniqueCheckContext *cxt, JsonbValue *obj,
 	cxt->skipped_keys = NULL;
 	cxt->skipped_keys_count = 0;
 	cxt->skipped_keys_allocated = 0;
+	cxt->set = JsonKeySetCreate(mcxt, 0);
 }
 
 /*
@@ -1195,21 +1295,16 @@ jsonb_unique_check_add_skipped(JsonbUniqueCheckContext *cxt)
 static inline void
 jsonb_unique_check_key(JsonbUniqueCheckContext *cxt, bool skip)
 {
-	JsonbPair *pair = cxt->obj->val.object.pairs;
 	/* nPairs is incremented only after the value is appended */
-	JsonbPair *last = &pair[cxt->obj->val.object.nPairs];
-
-	for (; pair < last; pair++)
-		if (pair->key.val.string.len ==
-			last->key.val.string.len &&
-			!memcmp(pair->key.val.string.val,
-					last->key.val.string.val,
-					last->key.val.string.len))
-			ereport(ERROR,
-					(errcode(ERRCODE_DUPLICATE_JSON_OBJECT_KEY_VALUE),
-					 errmsg("duplicate JSON key \"%*s\"",
-							last->key.val.string.len,
-							last->key.val.string.val)));
+	JsonbPair *last = &cxt->obj->val.object.pairs[cxt->obj->val.object.nPairs];
+
+	if (!JsonKeySetAdd(cxt->set, last->key.val.string.val,
+					   last->key.val.string.len))
+		ereport(ERROR,
+				(errcode(ERRCODE_DUPLICATE_JSON_OBJECT_KEY_VALUE),
+				 errmsg("duplicate JSON key \"%*s\"",
+						last->key.val.string.len,
+						last->key.val.string.val)));
 
 	if (skip)
 	{
@@ -1289,8 +1384,11 @@ jsonb_build_object_worker(FunctionCallInfo fcinfo, int first_vararg,
 
 	result.res = pushJsonbValue(&result.parseState, WJB_BEGIN_OBJECT, NULL);
 
-	/* if (unique_keys) */
-	jsonb_unique_check_init(&unique_check, result.res, CurrentMemoryContext);
+	if (unique_keys)
+		jsonb_unique_check_init(&unique_check, result.res,
+								CurrentMemoryContext);
+	else
+		memset(&unique_check, 0, sizeof(unique_check));
 
 	for (i = 0; i < nargs; i += 2)
 	{
@@ -1671,20 +1769,31 @@ clone_parse_state(JsonbParseState *state)
 	return result;
 }
 
+/*
+ * Create an empty jsonb_agg state in the current memory context.
+ */
+static JsonbArrayAggState *
+jsonb_array_agg_state_create(JsonbTypeCategory val_category,
+							 Oid val_output_func)
+{
+	JsonbArrayAggState *state = palloc(sizeof(JsonbArrayAggState));
+
+	state->enc = JsonbEncoderInit();
+	state->val_category = val_category;
+	state->val_output_func = val_output_func;
+
+	JsonbEncoderBeginContainer(state->enc, false);
+
+	return state;
+}
+
 static Datum
 jsonb_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 {
 	MemoryContext oldcontext,
 				aggcontext;
-	JsonbAggState *state;
-	JsonbInState elem;
-	Datum		val;
-	JsonbInState *result;
-	bool		single_scalar = false;
-	JsonbIterator *it;
+	JsonbArrayAggState *state;
 	Jsonb	   *jbelem;
-	JsonbValue	v;
-	JsonbIteratorToken type;
 
 	if (!AggCheckCallContext(fcinfo, &aggcontext))
 	{
@@ -1697,97 +1806,56 @@ jsonb_agg_transfn_worker(FunctionCallInfo fcinfo, bool absent_on_null)
 	if (PG_ARGISNULL(0))
 	{
 		Oid			arg_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+		JsonbTypeCategory val_category;
+		Oid			val_output_func;
 
 		if (arg_type == InvalidOid)
 			ereport(ERROR,
 					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 					 errmsg("could not determine input data type")));
 
+		jsonb_categorize_type(arg_type, &val_category, &val_output_func);
+
 		oldcontext = MemoryContextSwitchTo(aggcontext);
-		state = palloc(sizeof(JsonbAggState));
-		result = palloc0(sizeof(JsonbInState));
-		state->res = result;
-		result->res = pushJsonbValue(&result->parseState,
-									 WJB_BEGIN_ARRAY, NULL);
+		state = jsonb_array_agg_state_create(val_category, val_output_func);
 		MemoryContextSwitchTo(oldcontext);
-
-		jsonb_categorize_type(arg_type, &state->val_category,
-							  &state->val_output_func);
 	}
 	else
-	{
-		state = (JsonbAggState *) PG_GETARG_POINTER(0);
-		result = state->res;
-	}
-
-	if (absent_on_null && PG_ARGISNULL(1))
-		PG_RETURN_POINTER(state);
+		state = (JsonbArrayAggState *) PG_GETARG_POINTER(0);
 
-	/* turn the argument into jsonb in the normal function context */
-
-	val = PG_ARGISNULL(1) ? (Datum) 0 : PG_GETARG_DATUM(1);
-
-	memset(&elem, 0, sizeof(JsonbInState));
-
-	datum_to_jsonb(val, PG_ARGISNULL(1), &elem, state->val_category,
-				   state->val_output_func, false);
+	if (PG_ARGISNULL(1))
+	{
+		if (!absent_on_null)
+		{
+			JsonbValue	null;
 
-	jbelem = JsonbValueToJsonb(elem.res);
+			null.type = jbvNull;
+			JsonbEncoderScalar(state->enc, &null);
+		}
 
-	/* switch to the aggregate context for accumulation operations */
+		PG_RETURN_POINTER(state);
+	}
 
-	oldcontext = MemoryContextSwitchTo(aggcontext);
+	/*
+	 * Turn the argument into jsonb in the normal function context, unless it
+	 * is jsonb already, and append it to the encoded elements.  The encoder
+	 * keeps its buffers in the aggregate context.
+	 */
+	if (state->val_category == JSONBTYPE_JSONB)
+		jbelem = DatumGetJsonbP(PG_GETARG_DATUM(1));
+	else
+	{
+		JsonbInState elem;
 
-	it = JsonbIteratorInit(&jbelem->root);
+		memset(&elem, 0, sizeof(JsonbInState));
 
-	while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
-	{
-		switch (type)
-		{
-			case WJB_BEGIN_ARRAY:
-				if (v.val.array.rawScalar)
-					single_scalar = true;
-				else
-					result->res = pushJsonbValue(&result->parseState,
-												 type, NULL);
-				break;
-			case WJB_END_ARRAY:
-				if (!single_scalar)
-					result->res = pushJsonbValue(&result->parseState,
-												 type, NULL);
-				break;
-			case WJB_BEGIN_OBJECT:
-			case WJB_END_OBJECT:
-				result->res = pushJsonbValue(&result->parseState,
-											 type, NULL);
-				break;
-			case WJB_ELEM:
-			case WJB_KEY:
-			case WJB_VALUE:
-				if (v.type == jbvString)
-				{
-					/* copy string values in the aggregate context */
-					char	   *buf = palloc(v.val.string.len + 1);
+		datum_to_jsonb(PG_GETARG_DATUM(1), false, &elem, state->val_category,
+					   state->val_output_func, false);
 
-					snprintf(buf, v.val.string.len + 1, "%s", v.val.string.val);
-					v.val.string.val = buf;
-				}
-				else if (v.type == jbvNumeric)
-				{
-					/* same for numeric */
-					v.val.numeric =
-						DatumGetNumeric(DirectFunctionCall1(numeric_uplus,
-															NumericGetDatum(v.val.numeric)));
-				}
-				result->res = pushJsonbValue(&result->parseState,
-											 type, &v);
-				break;
-			default:
-				elog(ERROR, "unknown jsonb iterator token type");
-		}
+		jbelem = JsonbValueToJsonb(elem.res);
 	}
 
-	MemoryContextSwitchTo(oldcontext);
+	JsonbEncoderJsonb(state->enc, jbelem);
 
 	PG_RETURN_POINTER(state);
 }
@@ -1813,9 +1881,7 @@ jsonb_agg_strict_transfn(PG_FUNCTION_ARGS)
 Datum
 jsonb_agg_finalfn(PG_FUNCTION_ARGS)
 {
-	JsonbAggState *arg;
-	JsonbInState result;
-	Jsonb	   *out;
+	JsonbArrayAggState *arg;
 
 	/* cannot be called directly because of internal-type argument */
 	Assert(AggCheckCallContext(fcinfo, NULL));
@@ -1823,23 +1889,14 @@ jsonb_agg_finalfn(PG_FUNCTION_ARGS)
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();		/* returns null iff no input values */
 
-	arg = (JsonbAggState *) PG_GETARG_POINTER(0);
+	arg = (JsonbArrayAggState *) PG_GETARG_POINTER(0);
 
 	/*
-	 * We need to do a shallow clone of the argument in case the final
-	 * function is called more than once, so we avoid changing the argument. A
-	 * shallow clone is sufficient as we aren't going to change any of the
-	 * values, just add the final array end marker.
+	 * The array is built without closing it in the encoder, in case the
+	 * final function is called more than once.  Only the header and the
+	 * JEntries are written here, the elements are already encoded.
 	 */
-
-	result.parseState = clone_parse_state(arg->res->parseState);
-
-	result.res = pushJsonbValue(&result.parseState,
-								WJB_END_ARRAY, NULL);
-
-	out = JsonbValueToJsonb(result.res);
-
-	PG_RETURN_POINTER(out);
+	PG_RETURN_JSONB_P(JsonbEncoderBuildArray(arg->enc));
 }
 
 static Datum
@@ -2119,6 +2176,427 @@ jsonb_object_agg_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(out);
 }
 
+/*
+ * Push a copy of a value accumulated by a jsonb aggregate into its parse
+ * state.  Strings and numerics are copied into the current memory context
+ * as the transition functions do, and nested arrays and objects, which are
+ * kept unpacked in the state, are pushed element by element.
+ */
+static void
+jsonb_agg_push_value_copy(JsonbInState *result, JsonbIteratorToken seq,
+						  JsonbValue *val)
+{
+	JsonbValue	v;
+	int			i;
+
+	switch (val->type)
+	{
+		case jbvArray:
+			result->res = pushJsonbValue(&result->parseState,
+										 WJB_BEGIN_ARRAY, NULL);
+			for (i = 0; i < val->val.array.nElems; i++)
+				jsonb_agg_push_value_copy(result, WJB_ELEM,
+										  &val->val.array.elems[i]);
+			result->res = pushJsonbValue(&result->parseState,
+										 WJB_END_ARRAY, NULL);
+			break;
+
+		case jbvObject:
+			result->res = pushJsonbValue(&result->parseState,
+										 WJB_BEGIN_OBJECT, NULL);
+			for (i = 0; i < val->val.object.nPairs; i++)
+			{
+				jsonb_agg_push_value_copy(result, WJB_KEY,
+										  &val->val.object.pairs[i].key);
+				jsonb_agg_push_value_copy(result, WJB_VALUE,
+										  &val->val.object.pairs[i].value);
+			}
+			result->res = pushJsonbValue(&result->parseState,
+										 WJB_END_OBJECT, NULL);
+			break;
+
+		default:
+			Assert(IsAJsonbScalar(val));
+
+			v = *val;
+
+			if (v.type == jbvString)
+				v.val.string.val = pnstrdup(v.val.string.val,
+											v.val.string.len);
+			else if (v.type == jbvNumeric)
+				v.val.numeric =
+					DatumGetNumeric(DirectFunctionCall1(numeric_uplus,
+														NumericGetDatum(v.val.numeric)));
+
+			result->res = pushJsonbValue(&result->parseState, seq, &v);
+			break;
+	}
+}
+
+/*
+ * Create an empty jsonb_object_agg state in the current memory context, with
+ * the same types of inputs as 'proto' has.
+ */
+static JsonbAggState *
+jsonb_object_agg_state_create(JsonbAggState *proto, bool unique_keys)
+{
+	JsonbAggState *state = palloc0(sizeof(JsonbAggState));
+	JsonbInState *result = palloc0(sizeof(JsonbInState));
+
+	state->res = result;
+	state->key_category = proto->key_category;
+	state->key_output_func = proto->key_output_func;
+	state->val_category = proto->val_category;
+	state->val_output_func = proto->val_output_func;
+
+	result->res = pushJsonbValue(&result->parseState, WJB_BEGIN_OBJECT, NULL);
+
+	if (unique_keys)
+		jsonb_unique_check_init(&state->unique_check, result->res,
+								CurrentMemoryContext);
+
+	return state;
+}
+
+/*
+ * Append the fields of the second partial jsonb_object_agg state to the first
+ * one, copying them into the current memory context.  The uniqueness of keys
+ * is checked across both objects if the first state needs it; the skipped
+ * keys of the second object keep their dummy values in the first one.
+ */
+static void
+jsonb_object_agg_state_append(JsonbAggState *state, JsonbAggState *state2)
+{
+	JsonbValue *cont = &state2->res->parseState->contVal;
+	JsonbUniqueCheckContext *cxt2 = &state2->unique_check;
+	int			skipped = 0;
+	int			i;
+
+	Assert(cont->type == jbvObject);
+
+	for (i = 0; i < cont->val.object.nPairs; i++)
+	{
+		bool		skip = skipped < cxt2->skipped_keys_count &&
+			cxt2->skipped_keys[skipped] == i;
+
+		if (skip)
+			skipped++;
+
+		jsonb_agg_push_value_copy(state->res, WJB_KEY,
+								  &cont->val.object.pairs[i].key);
+
+		if (state->unique_check.obj)
+		{
+			jsonb_unique_check_key(&state->unique_check, skip);
+
+			/* jsonb_unique_check_key() added the dummy value */
+			if (skip)
+				continue;
+		}
+
+		jsonb_agg_push_value_copy(state->res, WJB_VALUE,
+								  &cont->val.object.pairs[i].value);
+	}
+}
+
+/*
+ * Serialize a jsonb_object_agg state.
+ *
+ * The fields are sent as a jsonb array of their alternating keys and values,
+ * so that their order, needed for the skipped keys of the key uniqueness
+ * check, is kept.
+ */
+static bytea *
+jsonb_object_agg_state_serialize(JsonbAggState *state)
+{
+	JsonbValue *cont = &state->res->parseState->contVal;
+	JsonbUniqueCheckContext *cxt = &state->unique_check;
+	JsonbInState elems;
+	Jsonb	   *jb;
+	StringInfoData buf;
+	int			i;
+
+	memset(&elems, 0, sizeof(elems));
+	elems.res = pushJsonbValue(&elems.parseState, WJB_BEGIN_ARRAY, NULL);
+
+	for (i = 0; i < cont->val.object.nPairs; i++)
+	{
+		jsonb_agg_push_value_copy(&elems, WJB_ELEM,
+								  &cont->val.object.pairs[i].key);
+		jsonb_agg_push_value_copy(&elems, WJB_ELEM,
+								  &cont->val.object.pairs[i].value);
+	}
+
+	elems.res = pushJsonbValue(&elems.parseState, WJB_END_ARRAY, NULL);
+
+	jb = JsonbValueToJsonb(elems.res);
+
+	pq_begintypsend(&buf);
+
+	pq_sendint32(&buf, state->val_category);
+	pq_sendint32(&buf, state->val_output_func);
+	pq_sendint32(&buf, state->key_category);
+	pq_sendint32(&buf, state->key_output_func);
+
+	/* key uniqueness check state */
+	pq_sendbyte(&buf, cxt->obj != NULL);
+
+	if (cxt->obj)
+	{
+		pq_sendint32(&buf, cxt->skipped_keys_count);
+
+		for (i = 0; i < cxt->skipped_keys_count; i++)
+			pq_sendint32(&buf, cxt->skipped_keys[i]);
+	}
+
+	pq_sendbytes(&buf, (char *) jb, VARSIZE(jb));
+
+	return pq_endtypsend(&buf);
+}
+
+/*
+ * Read the jsonb at the end of a serialized aggregate state, copying it to
+ * have it aligned.
+ */
+static Jsonb *
+jsonb_agg_state_getmsgjsonb(StringInfo buf)
+{
+	int			len = buf->len - buf->cursor;
+	Jsonb	   *jb = palloc(len);
+
+	pq_copymsgbytes(buf, (char *) jb, len);
+
+	if (len < VARHDRSZ || VARSIZE(jb) != len)
+		elog(ERROR, "invalid jsonb aggregate state");
+
+	return jb;
+}
+
+/*
+ * Deserialize a jsonb_object_agg state in the current memory context.
+ */
+static JsonbAggState *
+jsonb_object_agg_state_deserialize(bytea *sstate)
+{
+	JsonbAggState proto;
+	JsonbAggState *state;
+	StringInfoData buf;
+	Jsonb	   *jb;
+	JsonbIterator *it;
+	JsonbValue	v;
+	JsonbIteratorToken type;
+	bool		unique_keys;
+	int			nskipped = 0;
+	int		   *skipped_keys = NULL;
+	int			i;
+
+	/*
+	 * Copy the bytea into a StringInfo so that we can "receive" it using the
+	 * standard recv-function infrastructure.
+	 */
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf,
+						   VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+
+	memset(&proto, 0, sizeof(proto));
+	proto.val_category = (JsonbTypeCategory) pq_getmsgint(&buf, 4);
+	proto.val_output_func = pq_getmsgint(&buf, 4);
+	proto.key_category = (JsonbTypeCategory) pq_getmsgint(&buf, 4);
+	proto.key_output_func = pq_getmsgint(&buf, 4);
+
+	unique_keys = pq_getmsgbyte(&buf);
+
+	if (unique_keys)
+	{
+		nskipped = pq_getmsgint(&buf, 4);
+
+		/* one more element is needed to remove skipped keys */
+		skipped_keys = palloc(sizeof(int) * (nskipped + 1));
+
+		for (i = 0; i < nskipped; i++)
+			skipped_keys[i] = pq_getmsgint(&buf, 4);
+	}
+
+	jb = jsonb_agg_state_getmsgjsonb(&buf);
+
+	pfree(buf.data);
+
+	state = jsonb_object_agg_state_create(&proto, unique_keys);
+
+	if (unique_keys)
+	{
+		state->unique_check.skipped_keys = skipped_keys;
+		state->unique_check.skipped_keys_count = nskipped;
+		state->unique_check.skipped_keys_allocated = nskipped + 1;
+	}
+
+	/* the state references the values of the jsonb without copying them */
+	it = JsonbIteratorInit(&jb->root);
+	i = 0;
+
+	while ((type = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		if (type != WJB_ELEM)
+			continue;
+
+		type = i++ % 2 ? WJB_VALUE : WJB_KEY;
+
+		/* the keys of a serialized state are known to be unique */
+		if (type == WJB_KEY && unique_keys)
+			(void) JsonKeySetAdd(state->unique_check.set,
+								 v.val.string.val, v.val.string.len);
+
+		state->res->res = pushJsonbValue(&state->res->parseState, type, &v);
+	}
+
+	return state;
+}
+
+Datum
+jsonb_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext,
+				oldcontext;
+	JsonbArrayAggState *state1;
+	JsonbArrayAggState *state2;
+	Jsonb	   *jb;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "aggregate function called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (JsonbArrayAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (JsonbArrayAggState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+		PG_RETURN_POINTER(state1);
+
+	if (state1 == NULL)
+	{
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		state1 = jsonb_array_agg_state_create(state2->val_category,
+											  state2->val_output_func);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* the encoded elements of the second state are copied as they are */
+	jb = JsonbEncoderBuildArray(state2->enc);
+	JsonbEncoderArrayElements(state1->enc, &jb->root);
+	pfree(jb);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * Serialize a jsonb_agg state.  The elements are sent as the jsonb array
+ * jsonb_agg_finalfn() would produce.
+ */
+Datum
+jsonb_agg_serialize(PG_FUNCTION_ARGS)
+{
+	JsonbArrayAggState *state;
+	Jsonb	   *jb;
+	StringInfoData buf;
+
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	state = (JsonbArrayAggState *) PG_GETARG_POINTER(0);
+	jb = JsonbEncoderBuildArray(state->enc);
+
+	pq_begintypsend(&buf);
+
+	pq_sendint32(&buf, state->val_category);
+	pq_sendint32(&buf, state->val_output_func);
+	pq_sendbytes(&buf, (char *) jb, VARSIZE(jb));
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+jsonb_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	JsonbArrayAggState *state;
+	StringInfoData buf;
+	JsonbTypeCategory val_category;
+	Oid			val_output_func;
+	Jsonb	   *jb;
+
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	/*
+	 * Copy the bytea into a StringInfo so that we can "receive" it using the
+	 * standard recv-function infrastructure.
+	 */
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf,
+						   VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+
+	val_category = (JsonbTypeCategory) pq_getmsgint(&buf, 4);
+	val_output_func = pq_getmsgint(&buf, 4);
+
+	jb = jsonb_agg_state_getmsgjsonb(&buf);
+
+	state = jsonb_array_agg_state_create(val_category, val_output_func);
+	JsonbEncoderArrayElements(state->enc, &jb->root);
+
+	pfree(jb);
+	pfree(buf.data);
+
+	PG_RETURN_POINTER(state);
+}
+
+Datum
+jsonb_object_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext,
+				oldcontext;
+	JsonbAggState *state1;
+	JsonbAggState *state2;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "aggregate function called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (JsonbAggState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (JsonbAggState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+		PG_RETURN_POINTER(state1);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+
+	if (state1 == NULL)
+		state1 = jsonb_object_agg_state_create(state2,
+											   state2->unique_check.obj != NULL);
+
+	jsonb_object_agg_state_append(state1, state2);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_POINTER(state1);
+}
+
+Datum
+jsonb_object_agg_serialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_BYTEA_P(jsonb_object_agg_state_serialize((JsonbAggState *) PG_GETARG_POINTER(0)));
+}
+
+Datum
+jsonb_object_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	/* cannot be called directly because of internal-type argument */
+	Assert(AggCheckCallContext(fcinfo, NULL));
+
+	PG_RETURN_POINTER(jsonb_object_agg_state_deserialize(PG_GETARG_BYTEA_PP(0)));
+}
+
 
 /*
  * jsonb_is_valid -- check jsonb value type
@@ -2126,7 +2604,6 @@ jsonb_object_agg_finalfn(PG_FUNCTION_ARGS)
 Datum
 jsonb_is_valid(PG_FUNCTION_ARGS)
 {
-	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
 	text	   *type = PG_GETARG_TEXT_P(1);
 
 	if (PG_ARGISNULL(0))
@@ -2135,6 +2612,10 @@ jsonb_is_valid(PG_FUNCTION_ARGS)
 	if (!PG_ARGISNULL(1) &&
 		strncmp("any", VARDATA(type), VARSIZE_ANY_EXHDR(type)))
 	{
+		/* only the root header is needed, so don't detoast the whole value */
+		Jsonb	   *jb = (Jsonb *)
+			PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(0), 0, sizeof(uint32));
+
 		if (!strncmp("object", VARDATA(type), VARSIZE_ANY_EXHDR(type)))
 		{
 			if (!JB_ROOT_IS_OBJECT(jb))
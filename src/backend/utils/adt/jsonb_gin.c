@@ -5,8 +5,9 @@
  *
  * Copyright (c) 2014-2019, PostgreSQL Global Development Group
  *
- * We provide two opclasses for jsonb indexing: jsonb_ops and jsonb_path_ops.
- * For their description see json.sgml and comments in jsonb.h.
+ * We provide three opclasses for jsonb indexing: jsonb_ops, jsonb_path_ops
+ * and jsonb_path_value_ops.  For their description see json.sgml and
+ * comments in jsonb.h.
  *
  * The operators support, among the others, "jsonb @? jsonpath" and
  * "jsonb @@ jsonpath".  Expressions containing these operators are easily
@@ -51,6 +52,17 @@
  * jsonb_path_ops, EXISTS(path) expressions might be still supported,
  * when statements of 1st kind could be extracted out of their filters.
  *
+ * jsonb_path_value_ops keys consist of the same path hash followed by the
+ * type and an order-preserving image of the value, so in addition to the
+ * statements of the 1st kind it supports
+ *
+ *	3) "accessors_chain < const" (also >, <= and >=),
+ *	4) "accessors_chain STARTS WITH string" and "accessors_chain LIKE_REGEX
+ *	   pattern", when the pattern is anchored and begins with a literal.
+ *
+ * Each statement of the 3rd or 4th kind becomes a single partial match entry,
+ * which scans the range of keys of the path and value type satisfying it.
+ *
  * IDENTIFICATION
  *	  src/backend/utils/adt/jsonb_gin.c
  *
@@ -63,11 +75,13 @@
 #include "access/stratnum.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
+#include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "utils/builtins.h"
 #include "utils/hashutils.h"
 #include "utils/jsonb.h"
 #include "utils/jsonpath.h"
+#include "utils/pg_locale.h"
 #include "utils/varlena.h"
 
 typedef struct PathHashStack
@@ -93,10 +107,23 @@ typedef enum JsonPathGinNodeType
 
 typedef struct JsonPathGinNode JsonPathGinNode;
 
+/*
+ * Range of keys matched by a partial match entry (jsonb_path_value_ops).
+ * The entry itself is the lower bound of the range.
+ */
+typedef struct JsonPathGinBound
+{
+	int			prefixlen;		/* length of the prefix of the entry shared
+								 * by all matching keys */
+	bytea	   *upper;			/* inclusive upper bound, or NULL */
+} JsonPathGinBound;
+
 /* Node in jsonpath expression tree */
 struct JsonPathGinNode
 {
 	JsonPathGinNodeType type;
+	JsonPathGinBound *bound;	/* key range of partial match ENTRY nodes,
+								 * NULL otherwise */
 	union
 	{
 		int			nargs;		/* valid for OR and AND nodes */
@@ -128,6 +155,17 @@ typedef union JsonPathGinPath
 	uint32		hash;			/* hash of the path (jsonb_path_ops) */
 } JsonPathGinPath;
 
+/* Extra data passed for each entry of a jsonpath query */
+typedef struct JsonPathGinEntryData
+{
+	JsonPathGinNode *root;		/* root of the expression tree */
+	JsonPathGinBound *bound;	/* key range of partial match entry, or NULL */
+} JsonPathGinEntryData;
+
+/* Root expression node of a jsonpath query, see extract_jsp_query() */
+#define JSP_GIN_ROOT_NODE(extra_data) \
+	(((JsonPathGinEntryData *) (extra_data)[0])->root)
+
 typedef struct JsonPathGinContext JsonPathGinContext;
 
 /* Callback, which stores information about path item into JsonPathGinPath */
@@ -135,11 +173,13 @@ typedef bool (*JsonPathGinAddPathItemFunc) (JsonPathGinPath *path,
 											JsonPathItem *jsp);
 
 /*
- * Callback, which extracts set of nodes from statement of 1st kind
- * (scalar != NULL) or statement of 2nd kind (scalar == NULL).
+ * Callback, which extracts set of nodes from statement "path op scalar"
+ * (scalar != NULL) or statement of 2nd kind (scalar == NULL).  'op' is
+ * jpiEqual for statements of 1st kind.
  */
 typedef List *(*JsonPathGinExtractNodesFunc) (JsonPathGinContext *cxt,
 											  JsonPathGinPath path,
+											  JsonPathItemType op,
 											  JsonbValue *scalar,
 											  List *nodes);
 
@@ -153,6 +193,8 @@ struct JsonPathGinContext
 
 static Datum make_text_key(char flag, const char *str, int len);
 static Datum make_scalar_key(const JsonbValue *scalarVal, bool is_key);
+static bytea *make_path_value_key(uint32 hash, const JsonbValue *scalarVal,
+					bool type_only);
 
 static JsonPathGinNode *extract_jsp_bool_expr(JsonPathGinContext *cxt,
 					  JsonPathGinPath path, JsonPathItem *jsp, bool not);
@@ -355,6 +397,7 @@ make_jsp_entry_node(Datum entry)
 	JsonPathGinNode *node = palloc(offsetof(JsonPathGinNode, args));
 
 	node->type = JSP_GIN_ENTRY;
+	node->bound = NULL;
 	node->val.entryDatum = entry;
 
 	return node;
@@ -373,6 +416,7 @@ make_jsp_expr_node(JsonPathGinNodeType type, int nargs)
 								   sizeof(node->args[0]) * nargs);
 
 	node->type = type;
+	node->bound = NULL;
 	node->val.nargs = nargs;
 
 	return node;
@@ -406,11 +450,11 @@ make_jsp_expr_node_binary(JsonPathGinNodeType type,
 /* Append a list of nodes from the jsonpath (jsonb_ops). */
 static List *
 jsonb_ops__extract_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
-						 JsonbValue *scalar, List *nodes)
+						 JsonPathItemType op, JsonbValue *scalar, List *nodes)
 {
 	JsonPathGinPathItem *pentry;
 
-	if (scalar)
+	if (scalar && op == jpiEqual)
 	{
 		JsonPathGinNode *node;
 
@@ -476,9 +520,10 @@ jsonb_ops__extract_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
 /* Append a list of nodes from the jsonpath (jsonb_path_ops). */
 static List *
 jsonb_path_ops__extract_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
-							  JsonbValue *scalar, List *nodes)
+							  JsonPathItemType op, JsonbValue *scalar,
+							  List *nodes)
 {
-	if (scalar)
+	if (scalar && op == jpiEqual)
 	{
 		/* append path hash node for equality queries */
 		uint32		hash = path.hash;
@@ -490,19 +535,97 @@ jsonb_path_ops__extract_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
 	}
 	else
 	{
-		/* jsonb_path_ops doesn't support EXISTS queries => nothing to append */
+		/*
+		 * jsonb_path_ops doesn't support EXISTS and range queries => nothing
+		 * to append
+		 */
+		return nodes;
+	}
+}
+
+/* Append a list of nodes from the jsonpath (jsonb_path_value_ops). */
+static List *
+jsonb_path_value_ops__extract_nodes(JsonPathGinContext *cxt,
+									JsonPathGinPath path, JsonPathItemType op,
+									JsonbValue *scalar, List *nodes)
+{
+	JsonPathGinNode *node;
+	JsonPathGinBound *bound;
+	bool		ordered;
+
+	/* EXISTS queries are not supported, as with jsonb_path_ops */
+	if (!scalar)
 		return nodes;
+
+	if (op == jpiEqual)
+		return lappend(nodes, make_jsp_entry_node(
+						PointerGetDatum(make_path_value_key(path.hash, scalar,
+															false))));
+
+	/*
+	 * Strings are compared using the default collation, while the keys are
+	 * ordered bytewise.  So unless the default collation is "C", string range
+	 * queries can only be narrowed down to the strings found at the path.
+	 */
+	ordered = scalar->type != jbvString ||
+		lc_collate_is_c(DEFAULT_COLLATION_OID);
+
+	bound = palloc(sizeof(*bound));
+	bound->prefixlen = JGIN_PATH_VALUE_PREFIXLEN;
+	bound->upper = NULL;
+
+	switch (op)
+	{
+		case jpiGreater:
+		case jpiGreaterOrEqual:
+			node = make_jsp_entry_node(
+				PointerGetDatum(make_path_value_key(path.hash, scalar,
+													!ordered)));
+			break;
+
+		case jpiLess:
+		case jpiLessOrEqual:
+			node = make_jsp_entry_node(
+				PointerGetDatum(make_path_value_key(path.hash, scalar, true)));
+			if (ordered)
+				bound->upper = make_path_value_key(path.hash, scalar, false);
+			break;
+
+		case jpiStartsWith:
+			{
+				/* byte prefix matching doesn't depend on the collation */
+				bytea	   *key = make_path_value_key(path.hash, scalar, false);
+
+				Assert(scalar->type == jbvString);
+				node = make_jsp_entry_node(PointerGetDatum(key));
+				bound->prefixlen = VARSIZE(key) - VARHDRSZ;
+				break;
+			}
+
+		default:
+			elog(ERROR, "unrecognized jsonpath operation: %d", op);
+			return NIL;			/* keep compiler quiet */
 	}
+
+	/*
+	 * Values are stored in a lossy form (see make_path_value_key()), so keys
+	 * equal to the bound may still satisfy a strict inequality.  Hence the
+	 * bounds are always inclusive.
+	 */
+	node->bound = bound;
+
+	return lappend(nodes, node);
 }
 
 /*
  * Extract a list of expression nodes that need to be AND-ed by the caller.
- * Extracted expression is 'path == scalar' if 'scalar' is non-NULL, and
+ * Extracted expression is 'path op scalar' if 'scalar' is non-NULL, and
  * 'EXISTS(path)' otherwise.
  */
 static List *
 extract_jsp_path_expr_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
-							JsonPathItem *jsp, JsonbValue *scalar)
+							JsonPathItem *jsp, JsonPathItemType op,
+							JsonbValue *scalar)
 {
 	JsonPathItem next;
 	List	   *nodes = NIL;
@@ -550,22 +673,23 @@ extract_jsp_path_expr_nodes(JsonPathGinContext *cxt, JsonPathGinPath path,
 	 * Append nodes from the path expression itself to the already extracted
 	 * list of filter nodes.
 	 */
-	return cxt->extract_nodes(cxt, path, scalar, nodes);
+	return cxt->extract_nodes(cxt, path, op, scalar, nodes);
 }
 
 /*
  * Extract an expression node from one of following jsonpath path expressions:
  *   EXISTS(jsp)    (when 'scalar' is NULL)
- *   jsp == scalar  (when 'scalar' is not NULL).
+ *   jsp op scalar  (when 'scalar' is not NULL).
  *
  * The current path (@) is passed in 'path'.
  */
 static JsonPathGinNode *
 extract_jsp_path_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
-					  JsonPathItem *jsp, JsonbValue *scalar)
+					  JsonPathItem *jsp, JsonPathItemType op,
+					  JsonbValue *scalar)
 {
 	/* extract a list of nodes to be AND-ed */
-	List	   *nodes = extract_jsp_path_expr_nodes(cxt, path, jsp, scalar);
+	List	   *nodes = extract_jsp_path_expr_nodes(cxt, path, jsp, op, scalar);
 
 	if (list_length(nodes) <= 0)
 		/* no nodes were extracted => full scan is needed for this path */
@@ -578,6 +702,48 @@ extract_jsp_path_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
 	return make_jsp_expr_node_args(JSP_GIN_AND, nodes);
 }
 
+/*
+ * Extract the literal prefix of a LIKE_REGEX pattern into 'prefix'.  Only
+ * patterns anchored with '^' are supported; the prefix may be empty, which
+ * still restricts matching values to strings.
+ */
+static bool
+extract_jsp_regex_prefix(JsonPathItem *jsp, JsonbValue *prefix)
+{
+	const char *pattern = jsp->content.like_regex.pattern;
+	int			len = jsp->content.like_regex.patternlen;
+	int			pos;
+	int			charlen = 0;
+
+	/* these flags change the meaning of '^' or of the literal characters */
+	if (jsp->content.like_regex.flags &
+		(JSP_REGEX_ICASE | JSP_REGEX_MLINE | JSP_REGEX_WSPACE))
+		return false;
+
+	/* any top-level alternative would not be anchored */
+	if (len < 1 || pattern[0] != '^' || memchr(pattern, '|', len))
+		return false;
+
+	for (pos = 1; pos < len; pos += charlen)
+	{
+		if (pattern[pos] == '\0' || strchr("\\^$.[]()*+?{}", pattern[pos]))
+			break;
+
+		charlen = pg_mblen(&pattern[pos]);
+	}
+
+	prefix->type = jbvString;
+	prefix->val.string.val = (char *) &pattern[1];
+	prefix->val.string.len = pos - 1;
+
+	/* a quantifier following the prefix may make its last character optional */
+	if (pos < len && pos > 1 &&
+		(pattern[pos] == '*' || pattern[pos] == '?' || pattern[pos] == '{'))
+		prefix->val.string.len -= charlen;
+
+	return true;
+}
+
 /* Recursively extract nodes from the boolean jsonpath expression. */
 static JsonPathGinNode *
 extract_jsp_bool_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
@@ -633,7 +799,7 @@ extract_jsp_bool_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
 
 				jspGetArg(jsp, &arg);
 
-				return extract_jsp_path_expr(cxt, path, &arg, NULL);
+				return extract_jsp_path_expr(cxt, path, &arg, jpiExists, NULL);
 			}
 
 		case jpiNotEqual:
@@ -654,13 +820,22 @@ extract_jsp_bool_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
 			return NULL;
 
 		case jpiEqual:			/* path == scalar */
+		case jpiLess:			/* path < scalar */
+		case jpiGreater:		/* path > scalar */
+		case jpiLessOrEqual:	/* path <= scalar */
+		case jpiGreaterOrEqual: /* path >= scalar */
 			{
 				JsonPathItem left_item;
 				JsonPathItem right_item;
 				JsonPathItem *path_item;
 				JsonPathItem *scalar_item;
+				JsonPathItemType op = jsp->type;
 				JsonbValue	scalar;
 
+				/*
+				 * '!(path < scalar)' is not equivalent to 'path >= scalar' for
+				 * the same reasons as for equality described above.
+				 */
 				if (not)
 					return NULL;
 
@@ -671,6 +846,25 @@ extract_jsp_bool_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
 				{
 					scalar_item = &left_item;
 					path_item = &right_item;
+
+					/* commute the operator: 'scalar < path' => 'path > scalar' */
+					switch (op)
+					{
+						case jpiLess:
+							op = jpiGreater;
+							break;
+						case jpiGreater:
+							op = jpiLess;
+							break;
+						case jpiLessOrEqual:
+							op = jpiGreaterOrEqual;
+							break;
+						case jpiGreaterOrEqual:
+							op = jpiLessOrEqual;
+							break;
+						default:
+							break;
+					}
 				}
 				else if (jspIsScalar(right_item.type))
 				{
@@ -706,7 +900,49 @@ extract_jsp_bool_expr(JsonPathGinContext *cxt, JsonPathGinPath path,
 						return NULL;
 				}
 
-				return extract_jsp_path_expr(cxt, path, path_item, &scalar);
+				return extract_jsp_path_expr(cxt, path, path_item, op, &scalar);
+			}
+
+		case jpiStartsWith:		/* path STARTS WITH string */
+			{
+				JsonPathItem path_item;
+				JsonPathItem prefix_item;
+				JsonbValue	prefix;
+
+				if (not)
+					return NULL;
+
+				jspGetRightArg(jsp, &prefix_item);
+
+				if (prefix_item.type != jpiString)
+					return NULL;	/* variables are not supported */
+
+				prefix.type = jbvString;
+				prefix.val.string.val = jspGetString(&prefix_item,
+													 &prefix.val.string.len);
+
+				jspGetLeftArg(jsp, &path_item);
+
+				return extract_jsp_path_expr(cxt, path, &path_item,
+											 jpiStartsWith, &prefix);
+			}
+
+		case jpiLikeRegex:		/* path LIKE_REGEX pattern */
+			{
+				JsonPathItem path_item;
+				JsonbValue	prefix;
+
+				if (not)
+					return NULL;
+
+				/* only patterns starting with a literal prefix are supported */
+				if (!extract_jsp_regex_prefix(jsp, &prefix))
+					return NULL;
+
+				jspGetArg(jsp, &path_item);
+
+				return extract_jsp_path_expr(cxt, path, &path_item,
+											 jpiStartsWith, &prefix);
 			}
 
 		default:
@@ -740,37 +976,76 @@ emit_jsp_gin_entries(JsonPathGinNode *node, GinEntries *entries)
 	}
 }
 
+/*
+ * Recursively set up extra data of partial match entries found in the node
+ * tree, marking them in 'pmatch' array, which is allocated on demand.
+ */
+static void
+emit_jsp_gin_partial_entries(JsonPathGinNode *node, JsonPathGinNode *root,
+							 int nentries, Pointer *extra_data, bool **pmatch)
+{
+	check_stack_depth();
+
+	switch (node->type)
+	{
+		case JSP_GIN_ENTRY:
+			if (node->bound)
+			{
+				JsonPathGinEntryData *data = palloc(sizeof(*data));
+
+				data->root = root;
+				data->bound = node->bound;
+
+				extra_data[node->val.entryIndex] = (Pointer) data;
+
+				if (!*pmatch)
+					*pmatch = palloc0(sizeof(**pmatch) * nentries);
+
+				(*pmatch)[node->val.entryIndex] = true;
+			}
+			break;
+
+		case JSP_GIN_OR:
+		case JSP_GIN_AND:
+			{
+				int			i;
+
+				for (i = 0; i < node->val.nargs; i++)
+					emit_jsp_gin_partial_entries(node->args[i], root, nentries,
+												 extra_data, pmatch);
+
+				break;
+			}
+	}
+}
+
 /*
  * Recursively extract GIN entries from jsonpath query.
- * Root expression node is put into (*extra_data)[0].
+ * Each of (*extra_data)[] points to JsonPathGinEntryData containing the
+ * root expression node.
  */
 static Datum *
-extract_jsp_query(JsonPath *jp, StrategyNumber strat, bool pathOps,
-				  int32 *nentries, Pointer **extra_data)
+extract_jsp_query(JsonPath *jp, StrategyNumber strat,
+				  JsonPathGinAddPathItemFunc add_path_item,
+				  JsonPathGinExtractNodesFunc extract_nodes,
+				  int32 *nentries, Pointer **extra_data, bool **pmatch)
 {
 	JsonPathGinContext cxt;
 	JsonPathItem root;
 	JsonPathGinNode *node;
 	JsonPathGinPath path = {0};
 	GinEntries	entries = {0};
+	JsonPathGinEntryData *data;
+	int			i;
 
 	cxt.lax = (jp->header & JSONPATH_LAX) != 0;
-
-	if (pathOps)
-	{
-		cxt.add_path_item = jsonb_path_ops__add_path_item;
-		cxt.extract_nodes = jsonb_path_ops__extract_nodes;
-	}
-	else
-	{
-		cxt.add_path_item = jsonb_ops__add_path_item;
-		cxt.extract_nodes = jsonb_ops__extract_nodes;
-	}
+	cxt.add_path_item = add_path_item;
+	cxt.extract_nodes = extract_nodes;
 
 	jspInit(&root, jp);
 
 	node = strat == JsonbJsonpathExistsStrategyNumber
-		? extract_jsp_path_expr(&cxt, path, &root, NULL)
+		? extract_jsp_path_expr(&cxt, path, &root, jpiExists, NULL)
 		: extract_jsp_bool_expr(&cxt, path, &root, false);
 
 	if (!node)
@@ -785,8 +1060,17 @@ extract_jsp_query(JsonPath *jp, StrategyNumber strat, bool pathOps,
 	if (!*nentries)
 		return NULL;
 
-	*extra_data = palloc0(sizeof(**extra_data) * entries.count);
-	**extra_data = (Pointer) node;
+	/* exact match entries share the same extra data */
+	data = palloc(sizeof(*data));
+	data->root = node;
+	data->bound = NULL;
+
+	*extra_data = palloc(sizeof(**extra_data) * entries.count);
+	for (i = 0; i < entries.count; i++)
+		(*extra_data)[i] = (Pointer) data;
+
+	emit_jsp_gin_partial_entries(node, node, entries.count, *extra_data,
+								 pmatch);
 
 	return entries.buf;
 }
@@ -911,8 +1195,12 @@ gin_extract_jsonb_query(PG_FUNCTION_ARGS)
 	{
 		JsonPath   *jp = PG_GETARG_JSONPATH_P(0);
 		Pointer   **extra_data = (Pointer **) PG_GETARG_POINTER(4);
+		bool	  **pmatch = (bool **) PG_GETARG_POINTER(5);
 
-		entries = extract_jsp_query(jp, strategy, false, nentries, extra_data);
+		entries = extract_jsp_query(jp, strategy,
+									jsonb_ops__add_path_item,
+									jsonb_ops__extract_nodes,
+									nentries, extra_data, pmatch);
 
 		if (!entries)
 			*searchMode = GIN_SEARCH_MODE_ALL;
@@ -1000,7 +1288,7 @@ gin_consistent_jsonb(PG_FUNCTION_ARGS)
 		if (nkeys > 0)
 		{
 			Assert(extra_data && extra_data[0]);
-			res = execute_jsp_gin_node((JsonPathGinNode *) extra_data[0], check,
+			res = execute_jsp_gin_node(JSP_GIN_ROOT_NODE(extra_data), check,
 									   false) != GIN_FALSE;
 		}
 	}
@@ -1061,7 +1349,7 @@ gin_triconsistent_jsonb(PG_FUNCTION_ARGS)
 		if (nkeys > 0)
 		{
 			Assert(extra_data && extra_data[0]);
-			res = execute_jsp_gin_node((JsonPathGinNode *) extra_data[0], check,
+			res = execute_jsp_gin_node(JSP_GIN_ROOT_NODE(extra_data), check,
 									   true);
 
 			/* Should always recheck the result */
@@ -1202,8 +1490,12 @@ gin_extract_jsonb_query_path(PG_FUNCTION_ARGS)
 	{
 		JsonPath   *jp = PG_GETARG_JSONPATH_P(0);
 		Pointer   **extra_data = (Pointer **) PG_GETARG_POINTER(4);
+		bool	  **pmatch = (bool **) PG_GETARG_POINTER(5);
 
-		entries = extract_jsp_query(jp, strategy, true, nentries, extra_data);
+		entries = extract_jsp_query(jp, strategy,
+									jsonb_path_ops__add_path_item,
+									jsonb_path_ops__extract_nodes,
+									nentries, extra_data, pmatch);
 
 		if (!entries)
 			*searchMode = GIN_SEARCH_MODE_ALL;
@@ -1259,7 +1551,7 @@ gin_consistent_jsonb_path(PG_FUNCTION_ARGS)
 		if (nkeys > 0)
 		{
 			Assert(extra_data && extra_data[0]);
-			res = execute_jsp_gin_node((JsonPathGinNode *) extra_data[0], check,
+			res = execute_jsp_gin_node(JSP_GIN_ROOT_NODE(extra_data), check,
 									   false) != GIN_FALSE;
 		}
 	}
@@ -1303,7 +1595,7 @@ gin_triconsistent_jsonb_path(PG_FUNCTION_ARGS)
 		if (nkeys > 0)
 		{
 			Assert(extra_data && extra_data[0]);
-			res = execute_jsp_gin_node((JsonPathGinNode *) extra_data[0], check,
+			res = execute_jsp_gin_node(JSP_GIN_ROOT_NODE(extra_data), check,
 									   true);
 
 			/* Should always recheck the result */
@@ -1317,6 +1609,178 @@ gin_triconsistent_jsonb_path(PG_FUNCTION_ARGS)
 	PG_RETURN_GIN_TERNARY_VALUE(res);
 }
 
+/*
+ *
+ * jsonb_path_value_ops GIN opclass support functions
+ *
+ * A jsonb_path_value_ops index has one bytea key per JSON value, like
+ * jsonb_path_ops, but the key consists of the hash of the JSON key(s) leading
+ * to the value followed by the value itself (see make_path_value_key()).
+ * Thus keys for the same path are ordered by value within each type, and
+ * range and prefix queries on a path become partial match scans.  The
+ * consistent functions are shared with jsonb_path_ops.
+ *
+ */
+
+Datum
+gin_extract_jsonb_value(PG_FUNCTION_ARGS)
+{
+	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
+	int32	   *nentries = (int32 *) PG_GETARG_POINTER(1);
+	int			total = JB_ROOT_COUNT(jb);
+	JsonbIterator *it;
+	JsonbValue	v;
+	JsonbIteratorToken r;
+	PathHashStack tail;
+	PathHashStack *stack;
+	GinEntries	entries;
+
+	/* If the root level is empty, we certainly have no keys */
+	if (total == 0)
+	{
+		*nentries = 0;
+		PG_RETURN_POINTER(NULL);
+	}
+
+	/* Otherwise, use 2 * root count as initial estimate of result size */
+	init_gin_entries(&entries, 2 * total);
+
+	/* Path hashes are computed exactly as in gin_extract_jsonb_path() */
+	tail.parent = NULL;
+	tail.hash = 0;
+	stack = &tail;
+
+	it = JsonbIteratorInit(&jb->root);
+
+	while ((r = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
+	{
+		PathHashStack *parent;
+
+		switch (r)
+		{
+			case WJB_BEGIN_ARRAY:
+			case WJB_BEGIN_OBJECT:
+				parent = stack;
+				stack = (PathHashStack *) palloc(sizeof(PathHashStack));
+				stack->hash = parent->hash;
+				stack->parent = parent;
+				break;
+			case WJB_KEY:
+				JsonbHashScalarValue(&v, &stack->hash);
+				break;
+			case WJB_ELEM:
+			case WJB_VALUE:
+				/* emit an index entry for the value under the current path */
+				add_gin_entry(&entries, PointerGetDatum(
+							  make_path_value_key(stack->hash, &v, false)));
+				/* reset hash for next key, value, or sub-object */
+				stack->hash = stack->parent->hash;
+				break;
+			case WJB_END_ARRAY:
+			case WJB_END_OBJECT:
+				parent = stack->parent;
+				pfree(stack);
+				stack = parent;
+				if (stack->parent)
+					stack->hash = stack->parent->hash;
+				else
+					stack->hash = 0;
+				break;
+			default:
+				elog(ERROR, "invalid JsonbIteratorNext rc: %d", (int) r);
+		}
+	}
+
+	*nentries = entries.count;
+
+	PG_RETURN_POINTER(entries.buf);
+}
+
+Datum
+gin_extract_jsonb_query_value(PG_FUNCTION_ARGS)
+{
+	int32	   *nentries = (int32 *) PG_GETARG_POINTER(1);
+	StrategyNumber strategy = PG_GETARG_UINT16(2);
+	int32	   *searchMode = (int32 *) PG_GETARG_POINTER(6);
+	Datum	   *entries;
+
+	if (strategy == JsonbContainsStrategyNumber)
+	{
+		/* Query is a jsonb, so just apply gin_extract_jsonb_value ... */
+		entries = (Datum *)
+			DatumGetPointer(DirectFunctionCall2(gin_extract_jsonb_value,
+												PG_GETARG_DATUM(0),
+												PointerGetDatum(nentries)));
+
+		/* ... although "contains {}" requires a full index scan */
+		if (*nentries == 0)
+			*searchMode = GIN_SEARCH_MODE_ALL;
+	}
+	else if (strategy == JsonbJsonpathPredicateStrategyNumber ||
+			 strategy == JsonbJsonpathExistsStrategyNumber)
+	{
+		JsonPath   *jp = PG_GETARG_JSONPATH_P(0);
+		Pointer   **extra_data = (Pointer **) PG_GETARG_POINTER(4);
+		bool	  **pmatch = (bool **) PG_GETARG_POINTER(5);
+
+		entries = extract_jsp_query(jp, strategy,
+									jsonb_path_ops__add_path_item,
+									jsonb_path_value_ops__extract_nodes,
+									nentries, extra_data, pmatch);
+
+		if (!entries)
+			*searchMode = GIN_SEARCH_MODE_ALL;
+	}
+	else
+	{
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+		entries = NULL;
+	}
+
+	PG_RETURN_POINTER(entries);
+}
+
+/*
+ * Check whether an index key falls into the range of a partial match entry.
+ * The scan starts at the entry itself, which is the lower bound of the range.
+ */
+Datum
+gin_compare_partial_jsonb_value(PG_FUNCTION_ARGS)
+{
+	bytea	   *partial_key = PG_GETARG_BYTEA_PP(0);
+	bytea	   *key = PG_GETARG_BYTEA_PP(1);
+
+	/* StrategyNumber strategy = PG_GETARG_UINT16(2); */
+	Pointer		extra_data = (Pointer) PG_GETARG_POINTER(3);
+	JsonPathGinBound *bound = ((JsonPathGinEntryData *) extra_data)->bound;
+	int			keylen = VARSIZE_ANY_EXHDR(key);
+	int32		result = 0;
+
+	Assert(bound);
+
+	/* all the keys sharing the prefix are adjacent, stop at the first other */
+	if (keylen < bound->prefixlen ||
+		memcmp(VARDATA_ANY(key), VARDATA_ANY(partial_key), bound->prefixlen))
+		result = 1;
+	else if (bound->upper)
+	{
+		int			upperlen = VARSIZE_ANY_EXHDR(bound->upper);
+		int			cmp;
+
+		/* compare as byteacmp() does */
+		cmp = memcmp(VARDATA_ANY(key), VARDATA_ANY(bound->upper),
+					 Min(keylen, upperlen));
+
+		if (cmp > 0 || (cmp == 0 && keylen > upperlen))
+			result = 1;
+	}
+
+	PG_FREE_IF_COPY(partial_key, 0);
+	PG_FREE_IF_COPY(key, 1);
+
+	PG_RETURN_INT32(result);
+}
+
 /*
  * Construct a jsonb_ops GIN key from a flag byte and a textual representation
  * (which need not be null-terminated).  This function is responsible
@@ -1408,3 +1872,106 @@ make_scalar_key(const JsonbValue *scalarVal, bool is_key)
 
 	return item;
 }
+
+/*
+ * Construct a jsonb_path_value_ops GIN key from a path hash and a scalar.
+ * The key consists of the big-endian path hash, the JGINFLAG_* flag of the
+ * scalar type and, unless 'type_only' is true, an image of the value
+ * preserving its order within the type:
+ *
+ *	- nothing for nulls,
+ *	- a byte 0 or 1 for booleans,
+ *	- the bits of the nearest float8, with the sign bit flipped for positive
+ *	  numbers and all bits flipped for negative ones, for numerics,
+ *	- the string itself, truncated to JGIN_MAXLENGTH bytes, for strings.
+ *
+ * The images of numerics and long strings are lossy, but never disorder the
+ * values, so that ranges of keys can be scanned for range queries.
+ */
+static bytea *
+make_path_value_key(uint32 hash, const JsonbValue *scalarVal, bool type_only)
+{
+	bytea	   *key;
+	char	   *ptr;
+	char		flag;
+	int			len;
+	uint64		bits = 0;
+
+	switch (scalarVal->type)
+	{
+		case jbvNull:
+			flag = JGINFLAG_NULL;
+			len = 0;
+			break;
+		case jbvBool:
+			flag = JGINFLAG_BOOL;
+			len = 1;
+			break;
+		case jbvNumeric:
+			{
+				Datum		num = NumericGetDatum(scalarVal->val.numeric);
+				float8		val;
+
+				flag = JGINFLAG_NUM;
+				len = sizeof(bits);
+
+				val = DatumGetFloat8(DirectFunctionCall1(numeric_float8_no_overflow,
+														 num));
+				memcpy(&bits, &val, sizeof(bits));
+
+				if (bits & (UINT64CONST(1) << 63))
+					bits = ~bits;
+				else
+					bits |= UINT64CONST(1) << 63;
+				break;
+			}
+		case jbvString:
+			flag = JGINFLAG_STR;
+			len = Min(scalarVal->val.string.len, JGIN_MAXLENGTH);
+			break;
+		default:
+			elog(ERROR, "unrecognized jsonb scalar type: %d", scalarVal->type);
+			return NULL;		/* keep compiler quiet */
+	}
+
+	if (type_only)
+		len = 0;
+
+	key = (bytea *) palloc(VARHDRSZ + JGIN_PATH_VALUE_PREFIXLEN + len);
+	SET_VARSIZE(key, VARHDRSZ + JGIN_PATH_VALUE_PREFIXLEN + len);
+
+	ptr = VARDATA(key);
+	*ptr++ = (char) (hash >> 24);
+	*ptr++ = (char) (hash >> 16);
+	*ptr++ = (char) (hash >> 8);
+	*ptr++ = (char) hash;
+	*ptr++ = flag;
+
+	if (len > 0)
+	{
+		switch (scalarVal->type)
+		{
+			case jbvBool:
+				*ptr = scalarVal->val.boolean ? 1 : 0;
+				break;
+			case jbvNumeric:
+				{
+					int			i;
+
+					for (i = len - 1; i >= 0; i--)
+					{
+						ptr[i] = (char) (bits & 0xFF);
+						bits >>= 8;
+					}
+					break;
+				}
+			case jbvString:
+				memcpy(ptr, scalarVal->val.string.val, len);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return key;
+}
@@ -0,0 +1,685 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonb_selfuncs.c
+ *	  Functions for selectivity estimation of jsonb operators
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/jsonb_selfuncs.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/jsonb.h"
+#include "utils/jsonpath.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+
+
+/*
+ * Selectivity used when there are no statistics.  This is what contsel(),
+ * the former estimator of these operators, returns.
+ */
+#define DEFAULT_JSONB_SEL 0.001
+
+/* MCELEM statistics of a jsonb column, see compute_jsonb_stats() */
+typedef struct
+{
+	Datum	   *values;			/* text entries, sorted */
+	float4	   *numbers;		/* their frequencies */
+	int			nvalues;
+	float4		minfreq;		/* lowest frequency of an entry */
+} JsonbStats;
+
+static Selectivity jsonb_contains_sel(JsonbStats *stats, Jsonb *jb);
+static void jsonb_contains_container_sel(JsonbStats *stats,
+							 JsonbContainer *jc, StringInfo path,
+							 Selectivity *sel);
+static Selectivity jsonb_exists_sel(JsonbStats *stats, text *key);
+static bool jsonpath_path_sel(JsonbStats *stats, StringInfo path,
+				  JsonPathItem *jsp, JsonbValue *scalar, Selectivity *sel,
+				  Selectivity *unknown);
+static bool jsonpath_bool_sel(JsonbStats *stats, StringInfo path,
+				  JsonPathItem *jsp, Selectivity *sel, Selectivity *unknown);
+static Selectivity jsonb_entry_sel(JsonbStats *stats, StringInfo entry,
+				bool *found);
+static Selectivity jsonb_mismatch_sel(JsonbStats *stats, StringInfo path,
+				   JsonbValue *scalar);
+static int	compare_entry_text(const void *key, const void *value);
+
+
+/*
+ *	jsonb_sel -- restriction selectivity of jsonb @>, <@, ?, ?|, ?&, @?, @@
+ *
+ * Estimates use the most common path entries collected by
+ * jsonb_typanalyze(), treating entries as independent.
+ */
+Datum
+jsonb_sel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	Oid			operator = PG_GETARG_OID(1);
+	List	   *args = (List *) PG_GETARG_POINTER(2);
+	int			varRelid = PG_GETARG_INT32(3);
+	VariableStatData vardata;
+	Node	   *other;
+	bool		varonleft;
+	Datum		constval;
+	Form_pg_statistic pgstats;
+	AttStatsSlot sslot;
+	JsonbStats	stats;
+	Selectivity selec;
+
+	/*
+	 * If expression is not variable op something or something op variable,
+	 * then punt and return a default estimate.
+	 */
+	if (!get_restriction_variable(root, args, varRelid,
+								  &vardata, &other, &varonleft))
+		PG_RETURN_FLOAT8(DEFAULT_JSONB_SEL);
+
+	/*
+	 * Can't do anything useful if the something is not a constant, either.
+	 */
+	if (!IsA(other, Const))
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(DEFAULT_JSONB_SEL);
+	}
+
+	/* All the operators are strict, so we can cope with NULL right away */
+	if (((Const *) other)->constisnull)
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(0.0);
+	}
+
+	/* We need the MCELEM statistics of the jsonb Var */
+	if (vardata.vartype != JSONBOID ||
+		!HeapTupleIsValid(vardata.statsTuple) ||
+		!get_attstatsslot(&sslot, vardata.statsTuple,
+						  STATISTIC_KIND_MCELEM, InvalidOid,
+						  ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS))
+	{
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(DEFAULT_JSONB_SEL);
+	}
+
+	/*
+	 * There should be two more Numbers than Values, because the last two
+	 * cells are taken for minimal and maximal frequency.  Punt if not.
+	 */
+	if (sslot.nnumbers != sslot.nvalues + 2)
+	{
+		free_attstatsslot(&sslot);
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(DEFAULT_JSONB_SEL);
+	}
+
+	stats.values = sslot.values;
+	stats.numbers = sslot.numbers;
+	stats.nvalues = sslot.nvalues;
+	stats.minfreq = sslot.numbers[sslot.nnumbers - 2];
+
+	constval = ((Const *) other)->constvalue;
+	selec = -1.0;
+
+	switch (get_opcode(operator))
+	{
+		case F_JSONB_CONTAINS:
+			if (varonleft)
+				selec = jsonb_contains_sel(&stats, DatumGetJsonbP(constval));
+			break;
+
+		case F_JSONB_CONTAINED:
+			if (!varonleft)
+				selec = jsonb_contains_sel(&stats, DatumGetJsonbP(constval));
+			break;
+
+		case F_JSONB_EXISTS:
+			selec = jsonb_exists_sel(&stats, DatumGetTextPP(constval));
+			break;
+
+		case F_JSONB_EXISTS_ANY:
+		case F_JSONB_EXISTS_ALL:
+			{
+				bool		any = get_opcode(operator) == F_JSONB_EXISTS_ANY;
+				Datum	   *keys;
+				bool	   *nulls;
+				int			nkeys;
+				int			i;
+
+				deconstruct_array(DatumGetArrayTypeP(constval), TEXTOID,
+								  -1, false, 'i', &keys, &nulls, &nkeys);
+
+				selec = any ? 0.0 : 1.0;
+
+				for (i = 0; i < nkeys; i++)
+				{
+					Selectivity s;
+
+					/* null keys are ignored by the operators */
+					if (nulls[i])
+						continue;
+
+					s = jsonb_exists_sel(&stats, DatumGetTextPP(keys[i]));
+
+					if (any)
+						selec = selec + s - selec * s;
+					else
+						selec *= s;
+				}
+				break;
+			}
+
+		case F_JSONB_PATH_EXISTS_OPR:
+		case F_JSONB_PATH_MATCH_OPR:
+			{
+				JsonPath   *jp = DatumGetJsonPathP(constval);
+				JsonPathItem jsp;
+				StringInfoData path;
+				Selectivity s;
+				Selectivity unknown;
+				bool		known;
+
+				initStringInfo(&path);
+				appendStringInfoChar(&path, '$');
+				jspInit(&jsp, jp);
+
+				if (get_opcode(operator) == F_JSONB_PATH_EXISTS_OPR)
+					known = jsonpath_path_sel(&stats, &path, &jsp, NULL, &s,
+											  NULL);
+				else
+					known = jsonpath_bool_sel(&stats, &path, &jsp, &s,
+											  &unknown);
+
+				if (known)
+					selec = s;
+				break;
+			}
+
+		default:
+			break;
+	}
+
+	pgstats = (Form_pg_statistic) GETSTRUCT(vardata.statsTuple);
+
+	if (selec < 0.0)
+		selec = DEFAULT_JSONB_SEL;
+	else
+	{
+		/* MCE stats count only non-null rows, so adjust for null rows. */
+		selec *= (1.0 - pgstats->stanullfrac);
+	}
+
+	free_attstatsslot(&sslot);
+	ReleaseVariableStats(vardata);
+
+	CLAMP_PROBABILITY(selec);
+
+	PG_RETURN_FLOAT8((float8) selec);
+}
+
+/*
+ * Selectivity of "var @> jb": the product of the selectivities of all
+ * scalars of jb at their paths, and of the paths of its empty containers.
+ */
+static Selectivity
+jsonb_contains_sel(JsonbStats *stats, Jsonb *jb)
+{
+	StringInfoData path;
+	Selectivity selec = 1.0;
+
+	initStringInfo(&path);
+	appendStringInfoChar(&path, '$');
+
+	jsonb_contains_container_sel(stats, &jb->root, &path, &selec);
+
+	return selec;
+}
+
+static void
+jsonb_contains_container_sel(JsonbStats *stats, JsonbContainer *jc,
+							 StringInfo path, Selectivity *sel)
+{
+	JsonbIterator *it;
+	JsonbIteratorToken r;
+	JsonbValue	v;
+	int			pathlen = path->len;
+	bool		found;
+
+	check_stack_depth();
+
+	/* an empty container only requires its path to exist */
+	if (JsonContainerSize(jc) == 0)
+	{
+		if (pathlen > 1)
+			*sel *= jsonb_entry_sel(stats, path, &found);
+		return;
+	}
+
+	it = JsonbIteratorInit(jc);
+
+	while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		switch (r)
+		{
+			case WJB_KEY:
+				path->len = pathlen;
+				JsonbStatsAppendKey(path, v.val.string.val, v.val.string.len);
+				break;
+
+			case WJB_ELEM:
+				path->len = pathlen;
+				path->data[pathlen] = '\0';
+				/* FALLTHROUGH */
+
+			case WJB_VALUE:
+				if (v.type == jbvBinary)
+					jsonb_contains_container_sel(stats, v.val.binary.data,
+												 path, sel);
+				else
+				{
+					int			len = path->len;
+
+					if (JsonbStatsAppendValue(path, &v))
+					{
+						*sel *= jsonb_entry_sel(stats, path, &found);
+						path->len = len;
+						path->data[len] = '\0';
+					}
+					else if (len > 1)
+						*sel *= jsonb_entry_sel(stats, path, &found);
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	path->len = pathlen;
+	path->data[pathlen] = '\0';
+}
+
+/*
+ * Selectivity of "var ? key": the key exists at the top level, or the
+ * document is (or is an array containing) the string.
+ */
+static Selectivity
+jsonb_exists_sel(JsonbStats *stats, text *key)
+{
+	StringInfoData entry;
+	JsonbValue	str;
+	Selectivity key_sel;
+	Selectivity elem_sel;
+	bool		key_found;
+	bool		elem_found;
+
+	initStringInfo(&entry);
+	appendStringInfoChar(&entry, '$');
+	JsonbStatsAppendKey(&entry, VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key));
+	key_sel = jsonb_entry_sel(stats, &entry, &key_found);
+
+	str.type = jbvString;
+	str.val.string.val = VARDATA_ANY(key);
+	str.val.string.len = VARSIZE_ANY_EXHDR(key);
+
+	resetStringInfo(&entry);
+	appendStringInfoChar(&entry, '$');
+	if (!JsonbStatsAppendValue(&entry, &str))
+		return key_sel;
+
+	elem_sel = jsonb_entry_sel(stats, &entry, &elem_found);
+
+	/* don't add up the guess for an unknown entry */
+	if (!key_found || !elem_found)
+		return key_found || !elem_found ? key_sel : elem_sel;
+
+	return key_sel + elem_sel - key_sel * elem_sel;
+}
+
+/*
+ * Estimate selectivity of jsonpath path expressions, "EXISTS(jsp)" when
+ * 'scalar' is NULL and "jsp == scalar" otherwise.  For the latter, the
+ * fraction of rows where the comparison is unknown is also returned in
+ * '*unknown'.
+ *
+ * The current path (@) is passed in 'path'.  Only paths consisting of keys,
+ * array accessors and filters can be estimated, returns false for others.
+ * This mirrors extract_jsp_path_expr_nodes() in jsonb_gin.c.
+ */
+static bool
+jsonpath_path_sel(JsonbStats *stats, StringInfo path, JsonPathItem *jsp,
+				  JsonbValue *scalar, Selectivity *sel, Selectivity *unknown)
+{
+	StringInfoData cur;
+	JsonPathItem next;
+	Selectivity selec = 1.0;
+	bool		filtered = false;
+	bool		found;
+
+	initStringInfo(&cur);
+	appendBinaryStringInfo(&cur, path->data, path->len);
+
+	for (;;)
+	{
+		switch (jsp->type)
+		{
+			case jpiRoot:
+				resetStringInfo(&cur);
+				appendStringInfoChar(&cur, '$');
+				break;
+
+			case jpiCurrent:
+			case jpiAnyArray:
+			case jpiIndexArray:
+				/* arrays do not add path steps */
+				break;
+
+			case jpiKey:
+				{
+					int			len;
+					char	   *key = jspGetString(jsp, &len);
+
+					JsonbStatsAppendKey(&cur, key, len);
+					break;
+				}
+
+			case jpiFilter:
+				{
+					JsonPathItem arg;
+					Selectivity s;
+					Selectivity u;
+
+					jspGetArg(jsp, &arg);
+
+					/* items with unknown filter results are skipped */
+					if (jsonpath_bool_sel(stats, &cur, &arg, &s, &u))
+					{
+						selec *= s;
+						filtered = true;
+					}
+					break;
+				}
+
+			default:
+				return false;
+		}
+
+		if (!jspGetNext(jsp, &next))
+			break;
+
+		jsp = &next;
+	}
+
+	if (scalar)
+	{
+		*unknown = selec * jsonb_mismatch_sel(stats, &cur, scalar);
+
+		if (JsonbStatsAppendValue(&cur, scalar))
+			selec *= jsonb_entry_sel(stats, &cur, &found);
+		else if (cur.len > 1)
+			selec *= jsonb_entry_sel(stats, &cur, &found);
+	}
+	else if (!filtered && cur.len > 1)
+	{
+		/* a filter on the path already implies that it exists */
+		selec *= jsonb_entry_sel(stats, &cur, &found);
+	}
+
+	*sel = selec;
+	return true;
+}
+
+/*
+ * Estimate selectivity of a boolean jsonpath expression, see
+ * extract_jsp_bool_expr() in jsonb_gin.c.
+ *
+ * The fraction of rows where the expression is unknown is returned in
+ * '*unknown', so that negation does not count these rows as matching.
+ */
+static bool
+jsonpath_bool_sel(JsonbStats *stats, StringInfo path, JsonPathItem *jsp,
+				  Selectivity *sel, Selectivity *unknown)
+{
+	check_stack_depth();
+
+	switch (jsp->type)
+	{
+		case jpiAnd:			/* expr && expr */
+		case jpiOr:				/* expr || expr */
+			{
+				JsonPathItem arg;
+				Selectivity lsel;
+				Selectivity rsel;
+				Selectivity lunknown;
+				Selectivity runknown;
+				Selectivity lfalse;
+				Selectivity rfalse;
+				Selectivity falsesel;
+				bool		lknown;
+				bool		rknown;
+
+				jspGetLeftArg(jsp, &arg);
+				lknown = jsonpath_bool_sel(stats, path, &arg, &lsel, &lunknown);
+
+				jspGetRightArg(jsp, &arg);
+				rknown = jsonpath_bool_sel(stats, path, &arg, &rsel, &runknown);
+
+				if (!lknown || !rknown)
+				{
+					if (jsp->type == jpiOr || (!lknown && !rknown))
+						return false;
+
+					*sel = lknown ? lsel : rsel;
+					*unknown = lknown ? lunknown : runknown;
+					return true;
+				}
+
+				/* three-valued logic, assuming the operands independent */
+				lfalse = Max(1.0 - lsel - lunknown, 0.0);
+				rfalse = Max(1.0 - rsel - runknown, 0.0);
+
+				if (jsp->type == jpiAnd)
+				{
+					*sel = lsel * rsel;
+					falsesel = lfalse + rfalse - lfalse * rfalse;
+				}
+				else
+				{
+					*sel = lsel + rsel - lsel * rsel;
+					falsesel = lfalse * rfalse;
+				}
+
+				*unknown = Max(1.0 - *sel - falsesel, 0.0);
+
+				return true;
+			}
+
+		case jpiNot:			/* !expr  */
+			{
+				JsonPathItem arg;
+				Selectivity s;
+
+				jspGetArg(jsp, &arg);
+
+				if (!jsonpath_bool_sel(stats, path, &arg, &s, unknown))
+					return false;
+
+				/* negation of unknown is unknown */
+				*sel = Max(1.0 - s - *unknown, 0.0);
+				return true;
+			}
+
+		case jpiExists:			/* EXISTS(path) */
+			{
+				JsonPathItem arg;
+
+				jspGetArg(jsp, &arg);
+
+				/* lax mode ignores errors in the path */
+				*unknown = 0.0;
+
+				return jsonpath_path_sel(stats, path, &arg, NULL, sel, NULL);
+			}
+
+		case jpiEqual:			/* path == scalar */
+			{
+				JsonPathItem left_item;
+				JsonPathItem right_item;
+				JsonPathItem *path_item;
+				JsonPathItem *scalar_item;
+				JsonbValue	scalar;
+
+				jspGetLeftArg(jsp, &left_item);
+				jspGetRightArg(jsp, &right_item);
+
+				if (jspIsScalar(left_item.type))
+				{
+					scalar_item = &left_item;
+					path_item = &right_item;
+				}
+				else if (jspIsScalar(right_item.type))
+				{
+					scalar_item = &right_item;
+					path_item = &left_item;
+				}
+				else
+					return false;	/* at least one operand should be a scalar */
+
+				switch (scalar_item->type)
+				{
+					case jpiNull:
+						scalar.type = jbvNull;
+						break;
+					case jpiBool:
+						scalar.type = jbvBool;
+						scalar.val.boolean = !!*scalar_item->content.value.data;
+						break;
+					case jpiNumeric:
+						scalar.type = jbvNumeric;
+						scalar.val.numeric =
+							(Numeric) scalar_item->content.value.data;
+						break;
+					case jpiString:
+						scalar.type = jbvString;
+						scalar.val.string.val = scalar_item->content.value.data;
+						scalar.val.string.len =
+							scalar_item->content.value.datalen;
+						break;
+					default:
+						elog(ERROR, "invalid scalar jsonpath item type: %d",
+							 scalar_item->type);
+						return false;
+				}
+
+				return jsonpath_path_sel(stats, path, path_item, &scalar, sel,
+										 unknown);
+			}
+
+		default:
+			return false;		/* not a boolean expression */
+	}
+}
+
+/*
+ * Look up the frequency of an entry.  Entries that are not among the most
+ * common ones are assumed to be half as frequent as the least common one,
+ * as tsquery_opr_selec() does for lexemes.
+ */
+static Selectivity
+jsonb_entry_sel(JsonbStats *stats, StringInfo entry, bool *found)
+{
+	Datum	   *value;
+
+	value = bsearch(entry, stats->values, stats->nvalues, sizeof(Datum),
+					compare_entry_text);
+
+	*found = value != NULL;
+
+	if (value)
+		return stats->numbers[value - stats->values];
+
+	return Min(DEFAULT_JSONB_SEL, stats->minfreq / 2);
+}
+
+/*
+ * Estimate the fraction of rows where "path == scalar" is unknown because
+ * the path holds a scalar of another type, which cannot be compared with it.
+ * Only null compares with any type.  Sums up the frequencies of the most
+ * common entries of the path, so rarer values are not accounted for.
+ */
+static Selectivity
+jsonb_mismatch_sel(JsonbStats *stats, StringInfo path, JsonbValue *scalar)
+{
+	Selectivity selec = 0.0;
+	int			i;
+
+	if (scalar->type == jbvNull)
+		return 0.0;
+
+	for (i = 0; i < stats->nvalues; i++)
+	{
+		text	   *elem = (text *) DatumGetPointer(stats->values[i]);
+		char	   *str = VARDATA_ANY(elem);
+		int			len = VARSIZE_ANY_EXHDR(elem);
+		enum jbvType type;
+
+		/* entries of the path with a value are "path == value" */
+		if (len <= path->len + 4 ||
+			memcmp(str, path->data, path->len) != 0 ||
+			memcmp(str + path->len, " == ", 4) != 0)
+			continue;
+
+		switch (str[path->len + 4])
+		{
+			case 'n':
+				continue;
+			case 't':
+			case 'f':
+				type = jbvBool;
+				break;
+			case '"':
+				type = jbvString;
+				break;
+			default:
+				type = jbvNumeric;
+				break;
+		}
+
+		if (type != scalar->type)
+			selec += stats->numbers[i];
+	}
+
+	CLAMP_PROBABILITY(selec);
+
+	return selec;
+}
+
+/*
+ * bsearch() comparator of an entry and an MCELEM text value, ordered by
+ * length first, as sorted by compute_jsonb_stats().
+ */
+static int
+compare_entry_text(const void *key, const void *value)
+{
+	const StringInfoData *entry = (const StringInfoData *) key;
+	text	   *elem = (text *) DatumGetPointer(*(const Datum *) value);
+	int			len = VARSIZE_ANY_EXHDR(elem);
+
+	if (entry->len != len)
+		return entry->len > len ? 1 : -1;
+
+	return memcmp(entry->data, VARDATA_ANY(elem), len);
+}
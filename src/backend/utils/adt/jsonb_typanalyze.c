@@ -0,0 +1,612 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonb_typanalyze.c
+ *	  Functions for gathering statistics from jsonb columns
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/jsonb_typanalyze.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/tuptoaster.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_operator.h"
+#include "commands/vacuum.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/hashutils.h"
+#include "utils/json.h"
+#include "utils/jsonb.h"
+#include "utils/numeric.h"
+
+
+/*
+ * To avoid consuming too much memory, IO and CPU load during analysis, we
+ * ignore documents that are wider than JSONB_WIDTH_THRESHOLD (after
+ * detoasting!), like array_typanalyze() does for arrays.
+ */
+#define JSONB_WIDTH_THRESHOLD 0x10000
+
+/* Extra data for compute_jsonb_stats function */
+typedef struct
+{
+	/* Saved state from std_typanalyze() */
+	AnalyzeAttrComputeStatsFunc std_compute_stats;
+	void	   *std_extra_data;
+} JsonbAnalyzeExtraData;
+
+/* A hash key for path entries */
+typedef struct
+{
+	char	   *entry;			/* entry (not NULL terminated!) */
+	int			length;			/* its length in bytes */
+} EntryHashKey;
+
+/* A hash table entry for the Lossy Counting algorithm */
+typedef struct
+{
+	EntryHashKey key;			/* This is 'e' from the LC algorithm. */
+	int			frequency;		/* This is 'f'. */
+	int			delta;			/* And this is 'delta'. */
+	int			last_container; /* For de-duplication of document entries. */
+} TrackItem;
+
+/* State of the Lossy Counting algorithm, see compute_jsonb_stats() */
+typedef struct
+{
+	HTAB	   *entries_tab;	/* D */
+	int			b_current;		/* current bucket number */
+	int			bucket_width;	/* w */
+	int64		entry_no;		/* number of entries processed (N) */
+	int			doc_no;			/* number of the current document */
+} JsonbStatsState;
+
+static void compute_jsonb_stats(VacAttrStats *stats,
+					AnalyzeAttrFetchFunc fetchfunc,
+					int samplerows,
+					double totalrows);
+static void jsonb_stats_add_container(JsonbStatsState *state,
+						  JsonbContainer *jc, StringInfo path);
+static void jsonb_stats_add_entry(JsonbStatsState *state, StringInfo entry);
+static void prune_entries_hashtable(HTAB *entries_tab, int b_current);
+static uint32 entry_hash(const void *key, Size keysize);
+static int	entry_match(const void *key1, const void *key2, Size keysize);
+static int	entry_compare(const void *key1, const void *key2);
+static int	trackitem_compare_frequencies_desc(const void *e1, const void *e2);
+static int	trackitem_compare_entries(const void *e1, const void *e2);
+
+
+/*
+ * Append an object key to a statistics path.
+ *
+ * Paths start with "$" and have a ."key" step for every object key, so that
+ * they read like lax jsonpath expressions.  Arrays do not add steps: their
+ * elements are addressed by the path of the array itself, the same way lax
+ * jsonpath unwraps them.
+ */
+void
+JsonbStatsAppendKey(StringInfo path, const char *key, int len)
+{
+	char	   *str = pnstrdup(key, len);
+
+	appendStringInfoChar(path, '.');
+	escape_json(path, str);
+	pfree(str);
+}
+
+/*
+ * Turn a statistics path into the entry for "path == scalar".
+ *
+ * Returns false, leaving 'path' unchanged, for strings longer than
+ * JSONB_STATS_MAX_VALUE_LEN which are not collected.
+ */
+bool
+JsonbStatsAppendValue(StringInfo path, const JsonbValue *scalar)
+{
+	appendStringInfoString(path, " == ");
+
+	switch (scalar->type)
+	{
+		case jbvNull:
+			appendStringInfoString(path, "null");
+			break;
+		case jbvBool:
+			appendStringInfoString(path, scalar->val.boolean ? "true" : "false");
+			break;
+		case jbvNumeric:
+			/* equal numbers must give equal entries */
+			appendStringInfoString(path,
+								   numeric_normalize(scalar->val.numeric));
+			break;
+		case jbvString:
+			{
+				char	   *str;
+
+				if (scalar->val.string.len > JSONB_STATS_MAX_VALUE_LEN)
+				{
+					path->len -= 4;
+					path->data[path->len] = '\0';
+					return false;
+				}
+
+				str = pnstrdup(scalar->val.string.val, scalar->val.string.len);
+				escape_json(path, str);
+				pfree(str);
+				break;
+			}
+		default:
+			elog(ERROR, "unexpected jsonb scalar type: %d", scalar->type);
+	}
+
+	return true;
+}
+
+/*
+ *	jsonb_typanalyze -- typanalyze function for jsonb columns
+ */
+Datum
+jsonb_typanalyze(PG_FUNCTION_ARGS)
+{
+	VacAttrStats *stats = (VacAttrStats *) PG_GETARG_POINTER(0);
+	JsonbAnalyzeExtraData *extra_data;
+
+	/*
+	 * Call the standard typanalyze function.  It may fail to find needed
+	 * operators, in which case we also can't do anything, so just fail.
+	 */
+	if (!std_typanalyze(stats))
+		PG_RETURN_BOOL(false);
+
+	extra_data = (JsonbAnalyzeExtraData *) palloc(sizeof(JsonbAnalyzeExtraData));
+
+	/* Save old compute_stats and extra_data for scalar statistics ... */
+	extra_data->std_compute_stats = stats->compute_stats;
+	extra_data->std_extra_data = stats->extra_data;
+
+	/* ... and replace with our info */
+	stats->compute_stats = compute_jsonb_stats;
+	stats->extra_data = extra_data;
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * compute_jsonb_stats() -- compute statistics for a jsonb column
+ *
+ * This function computes statistics useful for determining selectivity of
+ * the jsonb operators @>, <@, ?, ?|, ?&, @? and @@.  It is invoked by ANALYZE
+ * via the compute_stats hook after sample rows have been collected.
+ *
+ * We also invoke the standard compute_stats function, which will compute
+ * "scalar" statistics relevant to the btree-style comparison operators.  But
+ * whole documents rarely repeat, so in addition we find the most common
+ * path entries of the documents, which are:
+ *
+ *	$."a"."b"			the path exists (an object has the key)
+ *	$."a"."b" == 1		a scalar at the path equals the value
+ *
+ * See JsonbStatsAppendKey() for how paths are formed.  The entries are
+ * stored as a text MCELEM slot, sorted the same way ts_typanalyze() sorts
+ * lexemes, with each entry's frequency as the fraction of non-null rows
+ * having it.
+ *
+ * The most common entries are found with the Lossy Counting algorithm using
+ * the same parameters as compute_array_stats(), see there for details.
+ */
+static void
+compute_jsonb_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+					int samplerows, double totalrows)
+{
+	JsonbAnalyzeExtraData *extra_data;
+	JsonbStatsState state;
+	int			num_mcelem;
+	int			analyzed_rows = 0;
+	HASHCTL		hash_ctl;
+	HASH_SEQ_STATUS scan_status;
+	TrackItem  *item;
+	StringInfoData path;
+	int			slot_idx;
+
+	extra_data = (JsonbAnalyzeExtraData *) stats->extra_data;
+
+	/*
+	 * Invoke analyze.c's standard analysis function to create scalar-style
+	 * stats for the column.  It will expect its own extra_data pointer, so
+	 * temporarily install that.
+	 */
+	stats->extra_data = extra_data->std_extra_data;
+	extra_data->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+	stats->extra_data = extra_data;
+
+	/*
+	 * We want statistics_target * 10 entries in the MCELEM array, as for
+	 * arrays and tsvectors.
+	 */
+	num_mcelem = stats->attr->attstattarget * 10;
+
+	/* bucket width is num_mcelem / 0.007, see compute_array_stats() */
+	state.bucket_width = num_mcelem * 1000 / 7;
+	state.b_current = 1;
+	state.entry_no = 0;
+
+	/*
+	 * Create the hashtable. It will be in local memory, so we don't need to
+	 * worry about overflowing the initial size. Also we don't need to pay any
+	 * attention to locking and memory management.
+	 */
+	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(EntryHashKey);
+	hash_ctl.entrysize = sizeof(TrackItem);
+	hash_ctl.hash = entry_hash;
+	hash_ctl.match = entry_match;
+	hash_ctl.hcxt = CurrentMemoryContext;
+	state.entries_tab = hash_create("Analyzed jsonb entries table",
+									num_mcelem,
+									&hash_ctl,
+									HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	initStringInfo(&path);
+
+	/* Loop over the documents. */
+	for (state.doc_no = 0; state.doc_no < samplerows; state.doc_no++)
+	{
+		Datum		value;
+		bool		isnull;
+		Jsonb	   *jb;
+
+		vacuum_delay_point();
+
+		value = fetchfunc(stats, state.doc_no, &isnull);
+
+		/* Nulls were counted by the standard stats code */
+		if (isnull)
+			continue;
+
+		/* Skip too-large values. */
+		if (toast_raw_datum_size(value) > JSONB_WIDTH_THRESHOLD)
+			continue;
+		else
+			analyzed_rows++;
+
+		jb = DatumGetJsonbP(value);
+
+		resetStringInfo(&path);
+		appendStringInfoChar(&path, '$');
+
+		jsonb_stats_add_container(&state, &jb->root, &path);
+
+		/* If the document was toasted, free the detoasted copy. */
+		if (PointerGetDatum(jb) != value)
+			pfree(jb);
+	}
+
+	/* Skip pg_statistic slots occupied by standard statistics */
+	slot_idx = 0;
+	while (slot_idx < STATISTIC_NUM_SLOTS && stats->stakind[slot_idx] != 0)
+		slot_idx++;
+	if (slot_idx >= STATISTIC_NUM_SLOTS)
+		elog(ERROR, "insufficient pg_statistic slots for jsonb stats");
+
+	/* We can only compute real stats if we found some non-null values. */
+	if (analyzed_rows > 0)
+	{
+		int			nonnull_cnt = analyzed_rows;
+		int			i;
+		TrackItem **sort_table;
+		int			track_len;
+		int64		cutoff_freq;
+		int64		minfreq,
+					maxfreq;
+
+		/*
+		 * We assume the standard stats code already took care of setting
+		 * stats_valid, stanullfrac, stawidth, stadistinct.
+		 *
+		 * Construct an array of the interesting hashtable items, that is,
+		 * those meeting the cutoff frequency (s - epsilon)*N.  Also identify
+		 * the minimum and maximum frequencies among these items.
+		 */
+		cutoff_freq = 9 * state.entry_no / state.bucket_width;
+
+		i = hash_get_num_entries(state.entries_tab);	/* surely enough space */
+		sort_table = (TrackItem **) palloc(sizeof(TrackItem *) * i);
+
+		hash_seq_init(&scan_status, state.entries_tab);
+		track_len = 0;
+		minfreq = state.entry_no;
+		maxfreq = 0;
+		while ((item = (TrackItem *) hash_seq_search(&scan_status)) != NULL)
+		{
+			if (item->frequency > cutoff_freq)
+			{
+				sort_table[track_len++] = item;
+				minfreq = Min(minfreq, item->frequency);
+				maxfreq = Max(maxfreq, item->frequency);
+			}
+		}
+		Assert(track_len <= i);
+
+		/* emit some statistics for debug purposes */
+		elog(DEBUG3, "compute_jsonb_stats: target # mces = %d, "
+			 "bucket width = %d, "
+			 "# entries = " INT64_FORMAT ", hashtable size = %d, "
+			 "usable entries = %d",
+			 num_mcelem, state.bucket_width, state.entry_no, i, track_len);
+
+		/*
+		 * If we obtained more entries than we really want, get rid of those
+		 * with least frequencies.
+		 */
+		if (num_mcelem < track_len)
+		{
+			qsort(sort_table, track_len, sizeof(TrackItem *),
+				  trackitem_compare_frequencies_desc);
+			/* reset minfreq to the smallest frequency we're keeping */
+			minfreq = sort_table[num_mcelem - 1]->frequency;
+		}
+		else
+			num_mcelem = track_len;
+
+		/* Generate MCELEM slot entry */
+		if (num_mcelem > 0)
+		{
+			MemoryContext old_context;
+			Datum	   *mcelem_values;
+			float4	   *mcelem_freqs;
+
+			/*
+			 * Sort the entries by length, then byte-for-byte, so that
+			 * jsonb_sel() can binary search them.
+			 */
+			qsort(sort_table, num_mcelem, sizeof(TrackItem *),
+				  trackitem_compare_entries);
+
+			/* Must copy the target values into anl_context */
+			old_context = MemoryContextSwitchTo(stats->anl_context);
+
+			/*
+			 * Keep the minimal and maximal frequencies in two extra cells of
+			 * mcelem_freqs, as tsvector and array statistics do.
+			 */
+			mcelem_values = (Datum *) palloc(num_mcelem * sizeof(Datum));
+			mcelem_freqs = (float4 *) palloc((num_mcelem + 2) * sizeof(float4));
+
+			for (i = 0; i < num_mcelem; i++)
+			{
+				TrackItem  *item = sort_table[i];
+
+				mcelem_values[i] =
+					PointerGetDatum(cstring_to_text_with_len(item->key.entry,
+															 item->key.length));
+				mcelem_freqs[i] = (double) item->frequency /
+					(double) nonnull_cnt;
+			}
+			mcelem_freqs[i++] = (double) minfreq / (double) nonnull_cnt;
+			mcelem_freqs[i] = (double) maxfreq / (double) nonnull_cnt;
+			MemoryContextSwitchTo(old_context);
+
+			stats->stakind[slot_idx] = STATISTIC_KIND_MCELEM;
+			stats->staop[slot_idx] = TextEqualOperator;
+			stats->stacoll[slot_idx] = DEFAULT_COLLATION_OID;
+			stats->stanumbers[slot_idx] = mcelem_freqs;
+			/* See above comment about two extra frequency fields */
+			stats->numnumbers[slot_idx] = num_mcelem + 2;
+			stats->stavalues[slot_idx] = mcelem_values;
+			stats->numvalues[slot_idx] = num_mcelem;
+			/* We are storing text values */
+			stats->statypid[slot_idx] = TEXTOID;
+			stats->statyplen[slot_idx] = -1;	/* typlen, -1 for varlena */
+			stats->statypbyval[slot_idx] = false;
+			stats->statypalign[slot_idx] = 'i';
+		}
+	}
+
+	/*
+	 * We don't need to bother cleaning up any of our temporary palloc's. The
+	 * hashtable should also go away, as it used a child memory context.
+	 */
+}
+
+/*
+ * Add entries of all paths and scalars of a container, whose path is in
+ * 'path'.
+ */
+static void
+jsonb_stats_add_container(JsonbStatsState *state, JsonbContainer *jc,
+						  StringInfo path)
+{
+	JsonbIterator *it;
+	JsonbIteratorToken r;
+	JsonbValue	v;
+	int			pathlen = path->len;
+
+	check_stack_depth();
+
+	it = JsonbIteratorInit(jc);
+
+	while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		switch (r)
+		{
+			case WJB_KEY:
+				path->len = pathlen;
+				JsonbStatsAppendKey(path, v.val.string.val, v.val.string.len);
+				jsonb_stats_add_entry(state, path);
+				break;
+
+			case WJB_ELEM:
+				/* array elements have the path of the array */
+				path->len = pathlen;
+				path->data[pathlen] = '\0';
+				/* FALLTHROUGH */
+
+			case WJB_VALUE:
+				if (v.type == jbvBinary)
+					jsonb_stats_add_container(state, v.val.binary.data, path);
+				else
+				{
+					int			len = path->len;
+
+					if (JsonbStatsAppendValue(path, &v))
+					{
+						jsonb_stats_add_entry(state, path);
+						path->len = len;
+						path->data[len] = '\0';
+					}
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	path->len = pathlen;
+	path->data[pathlen] = '\0';
+}
+
+/*
+ * Count an entry of the current document.
+ */
+static void
+jsonb_stats_add_entry(JsonbStatsState *state, StringInfo entry)
+{
+	EntryHashKey hash_key;
+	TrackItem  *item;
+	bool		found;
+
+	/*
+	 * The key points into the path buffer, if a new entry is created we make
+	 * a copy of it.
+	 */
+	hash_key.entry = entry->data;
+	hash_key.length = entry->len;
+
+	item = (TrackItem *) hash_search(state->entries_tab,
+									 (const void *) &hash_key,
+									 HASH_ENTER, &found);
+
+	if (found)
+	{
+		/* count a given entry only once per document */
+		if (item->last_container == state->doc_no)
+			return;
+
+		item->frequency++;
+		item->last_container = state->doc_no;
+	}
+	else
+	{
+		item->frequency = 1;
+		item->delta = state->b_current - 1;
+		item->last_container = state->doc_no;
+
+		item->key.entry = palloc(hash_key.length);
+		memcpy(item->key.entry, hash_key.entry, hash_key.length);
+	}
+
+	/* entry_no is the number of entries processed (ie N) */
+	state->entry_no++;
+
+	/* We prune the D structure after processing each bucket */
+	if (state->entry_no % state->bucket_width == 0)
+	{
+		prune_entries_hashtable(state->entries_tab, state->b_current);
+		state->b_current++;
+	}
+}
+
+/*
+ *	A function to prune the D structure from the Lossy Counting algorithm.
+ *	Consult compute_jsonb_stats() for wider explanation.
+ */
+static void
+prune_entries_hashtable(HTAB *entries_tab, int b_current)
+{
+	HASH_SEQ_STATUS scan_status;
+	TrackItem  *item;
+
+	hash_seq_init(&scan_status, entries_tab);
+	while ((item = (TrackItem *) hash_seq_search(&scan_status)) != NULL)
+	{
+		if (item->frequency + item->delta <= b_current)
+		{
+			char	   *entry = item->key.entry;
+
+			if (hash_search(entries_tab, (const void *) &item->key,
+							HASH_REMOVE, NULL) == NULL)
+				elog(ERROR, "hash table corrupted");
+			pfree(entry);
+		}
+	}
+}
+
+/*
+ * Hash function for entries.  They are strings, but not NULL terminated,
+ * so we need a special hash function.
+ */
+static uint32
+entry_hash(const void *key, Size keysize)
+{
+	const EntryHashKey *e = (const EntryHashKey *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) e->entry,
+								   e->length));
+}
+
+/*
+ *	Matching function for entries, to be used in hashtable lookups.
+ */
+static int
+entry_match(const void *key1, const void *key2, Size keysize)
+{
+	/* The keysize parameter is superfluous, the keys store their lengths */
+	return entry_compare(key1, key2);
+}
+
+/*
+ *	Comparison function for entries.
+ */
+static int
+entry_compare(const void *key1, const void *key2)
+{
+	const EntryHashKey *d1 = (const EntryHashKey *) key1;
+	const EntryHashKey *d2 = (const EntryHashKey *) key2;
+
+	/* First, compare by length */
+	if (d1->length > d2->length)
+		return 1;
+	else if (d1->length < d2->length)
+		return -1;
+	/* Lengths are equal, do a byte-by-byte comparison */
+	return memcmp(d1->entry, d2->entry, d1->length);
+}
+
+/*
+ *	qsort() comparator for sorting TrackItems on frequencies (descending sort)
+ */
+static int
+trackitem_compare_frequencies_desc(const void *e1, const void *e2)
+{
+	const TrackItem *const *t1 = (const TrackItem *const *) e1;
+	const TrackItem *const *t2 = (const TrackItem *const *) e2;
+
+	return (*t2)->frequency - (*t1)->frequency;
+}
+
+/*
+ *	qsort() comparator for sorting TrackItems on entries
+ */
+static int
+trackitem_compare_entries(const void *e1, const void *e2)
+{
+	const TrackItem *const *t1 = (const TrackItem *const *) e1;
+	const TrackItem *const *t2 = (const TrackItem *const *) e2;
+
+	return entry_compare(&(*t1)->key, &(*t2)->key);
+}
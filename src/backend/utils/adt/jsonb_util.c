@@ -13,9 +13,14 @@
  */
 #include "postgres.h"
 
+#include "access/tuptoaster.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
 #include "miscadmin.h"
+#include "mb/pg_wchar.h"
+#include "port/pg_bitutils.h"
+#include "port/pg_bswap.h"
+#include "storage/proc.h"
 #include "utils/builtins.h"
 #include "utils/datetime.h"
 #include "utils/hashutils.h"
@@ -36,6 +41,20 @@
 #define JSONB_MAX_ELEMS (Min(MaxAllocSize / sizeof(JsonbValue), JB_CMASK))
 #define JSONB_MAX_PAIRS (Min(MaxAllocSize / sizeof(JsonbPair), JB_CMASK))
 
+/*
+ * Minimum size of an uncompressed out-of-line jsonb datum fetched by slices
+ * for key lookups.  Smaller datums are cheaper to fetch by a single TOAST
+ * index scan.
+ */
+#define JSONB_SLICE_MIN_SIZE	(4 * TOAST_MAX_CHUNK_SIZE)
+
+/*
+ * Minimum number of elements of an lhs array for JsonbDeepContains() to
+ * look up rhs scalars in a hash index of its scalar elements instead of
+ * searching it linearly.
+ */
+#define JSONB_SCALAR_INDEX_MIN_ELEMS	16
+
 static void fillJsonbValue(JsonbContainer *container, int index,
 			   char *base_addr, uint32 offset,
 			   JsonbValue *result);
@@ -408,6 +427,584 @@ findJsonbValueFromContainer(JsonbContainer *container, uint32 flags,
 	return NULL;
 }
 
+/*
+ * Find values of several keys of a jsonb object in a single pass.
+ *
+ * 'keys' are jbvString values without duplicates, sorted in the order of
+ * lengthCompareJsonbStringValue(), which is also the order of object keys.
+ * So each binary search starts where the previous one stopped.  The value of
+ * each found key is stored into the corresponding element of 'values' and its
+ * 'found' flag is set.
+ *
+ * Returns the number of keys found.
+ */
+int
+findJsonbKeysInObject(JsonbContainer *container, const JsonbValue *keys,
+					  int nkeys, JsonbValue *values, bool *found)
+{
+	int			count = JsonContainerSize(container);
+	char	   *base_addr = (char *) (container->children + count * 2);
+	uint32		stopLow = 0;
+	int			nfound = 0;
+	int			i;
+
+	Assert(JsonContainerIsObject(container));
+
+	for (i = 0; i < nkeys; i++)
+	{
+		uint32		stopHigh = count;
+
+		Assert(keys[i].type == jbvString);
+		Assert(i == 0 || lengthCompareJsonbStringValue(&keys[i - 1],
+													   &keys[i]) < 0);
+
+		found[i] = false;
+
+		while (stopLow < stopHigh)
+		{
+			uint32		stopMiddle;
+			int			difference;
+			JsonbValue	candidate;
+
+			stopMiddle = stopLow + (stopHigh - stopLow) / 2;
+
+			candidate.type = jbvString;
+			candidate.val.string.val =
+				base_addr + getJsonbOffset(container, stopMiddle);
+			candidate.val.string.len = getJsonbLength(container, stopMiddle);
+
+			difference = lengthCompareJsonbStringValue(&candidate, &keys[i]);
+
+			if (difference == 0)
+			{
+				int			index = stopMiddle + count;
+
+				fillJsonbValue(container, index, base_addr,
+							   getJsonbOffset(container, index),
+							   &values[i]);
+				found[i] = true;
+				nfound++;
+
+				/* next keys are greater than this one */
+				stopLow = stopMiddle + 1;
+				break;
+			}
+			else if (difference < 0)
+				stopLow = stopMiddle + 1;
+			else
+				stopHigh = stopMiddle;
+		}
+	}
+
+	return nfound;
+}
+
+/*
+ * Find the position of a key among the pairs of a jsonb object.
+ *
+ * Returns true if the object has the key, setting *index to the index of its
+ * pair and filling *value with its value, if 'value' is not NULL.  Otherwise
+ * returns false, and *index is the index the pair would take if the key were
+ * added to the object.
+ */
+bool
+findJsonbKeyPosition(JsonbContainer *container, const char *key, int len,
+					 int *index, JsonbValue *value)
+{
+	int			count = JsonContainerSize(container);
+	char	   *base_addr = (char *) (container->children + count * 2);
+	uint32		stopLow = 0,
+				stopHigh = count;
+	JsonbValue	target;
+
+	Assert(JsonContainerIsObject(container));
+
+	target.type = jbvString;
+	target.val.string.val = (char *) key;
+	target.val.string.len = len;
+
+	while (stopLow < stopHigh)
+	{
+		uint32		stopMiddle;
+		int			difference;
+		JsonbValue	candidate;
+
+		stopMiddle = stopLow + (stopHigh - stopLow) / 2;
+
+		candidate.type = jbvString;
+		candidate.val.string.val =
+			base_addr + getJsonbOffset(container, stopMiddle);
+		candidate.val.string.len = getJsonbLength(container, stopMiddle);
+
+		difference = lengthCompareJsonbStringValue(&candidate, &target);
+
+		if (difference == 0)
+		{
+			*index = stopMiddle;
+
+			if (value)
+				fillJsonbValue(container, stopMiddle + count, base_addr,
+							   getJsonbOffset(container, stopMiddle + count),
+							   value);
+
+			return true;
+		}
+		else if (difference < 0)
+			stopLow = stopMiddle + 1;
+		else
+			stopHigh = stopMiddle;
+	}
+
+	*index = stopLow;
+
+	return false;
+}
+
+/*
+ * Key index of a large jsonb object.
+ *
+ * Binary search of an object's keys has to call getJsonbOffset() on every
+ * probe, which walks back up to JB_OFFSET_STRIDE JEntries, so a lookup costs
+ * O(log n * stride).  The index resolves all child offsets once and hashes
+ * the keys, so that each further lookup is O(1).
+ */
+struct JsonbKeyIndex
+{
+	JsonbContainer *container;	/* indexed object */
+	uint32		count;			/* number of pairs */
+	uint32		mask;			/* number of buckets - 1 */
+	uint32	   *offsets;		/* offsets of all 2 * count children */
+	uint32	   *buckets;		/* key index + 1, or 0 if empty */
+};
+
+/*
+ * Cache of key lookups done by one caller, see JsonbLookupCacheFindKey().
+ *
+ * It optionally also holds a detoasted copy of an external jsonb datum,
+ * identified by its TOAST pointer, so that repeated calls over the same
+ * stored document reuse both the copy and the key index of its root.
+ */
+struct JsonbLookupCache
+{
+	MemoryContext mcxt;			/* context of the cache */
+
+	/* detoasted copy of an external datum, or NULL */
+	Jsonb	   *jb;
+	struct varatt_external toast;	/* its TOAST pointer */
+	LocalTransactionId lxid;	/* transaction it was fetched in */
+
+	/* object the lookups below were done in, or NULL */
+	JsonbContainer *container;
+	uint32		cost;			/* binary search probes spent in it */
+	JsonbKeyIndex *index;		/* its key index, or NULL */
+
+	/* TOAST pointer of the last datum searched by slices */
+	struct varatt_external sliced;
+};
+
+static uint32
+hashJsonbKey(const char *key, int len)
+{
+	return DatumGetUInt32(hash_any((const unsigned char *) key, len));
+}
+
+/*
+ * Build a key index of a jsonb object in the given memory context.
+ */
+JsonbKeyIndex *
+buildJsonbKeyIndex(JsonbContainer *container, MemoryContext mcxt)
+{
+	JsonbKeyIndex *index;
+	uint32		count = JsonContainerSize(container);
+	char	   *base_addr = (char *) (container->children + count * 2);
+	uint32		nbuckets;
+	uint32		offset = 0;
+	uint32		i;
+
+	Assert(JsonContainerIsObject(container));
+
+	/* keep the load factor at or below 1/2 */
+	nbuckets = (uint32) 1 << (pg_leftmost_one_pos32(Max(count, 1)) + 2);
+
+	index = MemoryContextAlloc(mcxt, sizeof(JsonbKeyIndex));
+	index->container = container;
+	index->count = count;
+	index->mask = nbuckets - 1;
+	index->offsets = MemoryContextAlloc(mcxt, sizeof(uint32) * count * 2);
+	index->buckets = MemoryContextAllocZero(mcxt, sizeof(uint32) * nbuckets);
+
+	for (i = 0; i < count * 2; i++)
+	{
+		index->offsets[i] = offset;
+		JBE_ADVANCE_OFFSET(offset, container->children[i]);
+	}
+
+	/* keys are unique, so they can be inserted without comparisons */
+	for (i = 0; i < count; i++)
+	{
+		uint32		len = index->offsets[i + 1] - index->offsets[i];
+		uint32		bucket = hashJsonbKey(base_addr + index->offsets[i], len);
+
+		for (bucket &= index->mask;
+			 index->buckets[bucket];
+			 bucket = (bucket + 1) & index->mask)
+			;
+
+		index->buckets[bucket] = i + 1;
+	}
+
+	return index;
+}
+
+void
+freeJsonbKeyIndex(JsonbKeyIndex *index)
+{
+	pfree(index->offsets);
+	pfree(index->buckets);
+	pfree(index);
+}
+
+/*
+ * Find the value of a key using a key index.
+ *
+ * Same as findJsonbValueFromContainer() for JB_FOBJECT on the indexed object,
+ * returns palloc()'d value or NULL if the key is not found.
+ */
+JsonbValue *
+findJsonbValueFromKeyIndex(JsonbKeyIndex *index, JsonbValue *key)
+{
+	JsonbContainer *container = index->container;
+	char	   *base_addr = (char *) (container->children + index->count * 2);
+	uint32		bucket;
+
+	Assert(key->type == jbvString);
+
+	for (bucket = hashJsonbKey(key->val.string.val,
+							   key->val.string.len) & index->mask;
+		 index->buckets[bucket];
+		 bucket = (bucket + 1) & index->mask)
+	{
+		uint32		i = index->buckets[bucket] - 1;
+		uint32		offset = index->offsets[i];
+
+		if (index->offsets[i + 1] - offset == key->val.string.len &&
+			memcmp(base_addr + offset, key->val.string.val,
+				   key->val.string.len) == 0)
+		{
+			JsonbValue *result = palloc(sizeof(JsonbValue));
+			uint32		vindex = i + index->count;
+
+			fillJsonbValue(container, vindex, base_addr,
+						   index->offsets[vindex], result);
+
+			return result;
+		}
+	}
+
+	return NULL;
+}
+
+JsonbLookupCache *
+JsonbLookupCacheCreate(MemoryContext mcxt)
+{
+	JsonbLookupCache *cache = MemoryContextAllocZero(mcxt,
+													 sizeof(JsonbLookupCache));
+
+	cache->mcxt = mcxt;
+
+	return cache;
+}
+
+static void
+JsonbLookupCacheResetIndex(JsonbLookupCache *cache, JsonbContainer *container)
+{
+	if (cache->index)
+		freeJsonbKeyIndex(cache->index);
+
+	cache->container = container;
+	cache->cost = 0;
+	cache->index = NULL;
+}
+
+void
+JsonbLookupCacheFree(JsonbLookupCache *cache)
+{
+	JsonbLookupCacheResetIndex(cache, NULL);
+
+	if (cache->jb)
+		pfree(cache->jb);
+
+	pfree(cache);
+}
+
+/*
+ * Detoast a jsonb datum for lookups through the cache.
+ *
+ * A datum stored out of line is identified by its TOAST pointer, so when the
+ * same document is passed again the copy made by the previous call, and the
+ * key index of its root if one was built, are reused.  The result must not be
+ * freed or returned by the caller.  Other datums are detoasted as usual, and
+ * lookups done in the previous datum are forgotten since its memory can be
+ * reused.
+ *
+ * 'cache' can be NULL, then this is just DatumGetJsonbP().
+ */
+Jsonb *
+JsonbLookupCacheDetoast(JsonbLookupCache *cache, Datum d)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast;
+
+	if (!cache)
+		return DatumGetJsonbP(d);
+
+	if (!VARATT_IS_EXTERNAL_ONDISK(attr))
+	{
+		JsonbLookupCacheResetIndex(cache, NULL);
+		return DatumGetJsonbP(d);
+	}
+
+	VARATT_EXTERNAL_GET_POINTER(toast, attr);
+
+	if (!cache->jb ||
+		cache->lxid != MyProc->lxid ||
+		memcmp(&cache->toast, &toast, sizeof(toast)) != 0)
+	{
+		MemoryContext oldcxt;
+
+		JsonbLookupCacheResetIndex(cache, NULL);
+
+		if (cache->jb)
+		{
+			pfree(cache->jb);
+			cache->jb = NULL;
+		}
+
+		oldcxt = MemoryContextSwitchTo(cache->mcxt);
+		cache->jb = DatumGetJsonbP(d);
+		MemoryContextSwitchTo(oldcxt);
+
+		cache->toast = toast;
+		cache->lxid = MyProc->lxid;
+	}
+
+	return cache->jb;
+}
+
+/*
+ * Find the value of an object key, building a key index of the object once
+ * enough lookups have been done in it.
+ *
+ * The index is built after the binary searches in the object have spent as
+ * many probes as it has keys, so that building it never costs more than the
+ * lookups already done.  Only the last searched object is remembered, and the
+ * caller must ensure that it stays valid (and unchanged) between calls, which
+ * JsonbLookupCacheDetoast() does for the documents it returns.
+ *
+ * 'cache' can be NULL, then this is just findJsonbValueFromContainer().
+ */
+JsonbValue *
+JsonbLookupCacheFindKey(JsonbLookupCache *cache, JsonbContainer *container,
+						JsonbValue *key)
+{
+	uint32		count = JsonContainerSize(container);
+
+	if (!cache || !JsonContainerIsObject(container) ||
+		count < JSONB_KEY_INDEX_MIN_KEYS)
+		return findJsonbValueFromContainer(container, JB_FOBJECT, key);
+
+	if (cache->container != container)
+		JsonbLookupCacheResetIndex(cache, container);
+
+	if (!cache->index)
+	{
+		/* binary search takes about log2(count) + 1 probes */
+		cache->cost += pg_leftmost_one_pos32(count) + 1;
+
+		if (cache->cost < count)
+			return findJsonbValueFromContainer(container, JB_FOBJECT, key);
+
+		cache->index = buildJsonbKeyIndex(container, cache->mcxt);
+	}
+
+	return findJsonbValueFromKeyIndex(cache->index, key);
+}
+
+/*
+ * Fetch a slice of an out-of-line jsonb datum, reusing 'head' holding its
+ * first bytes when the slice is within it.
+ */
+static char *
+getJsonbSlice(struct varlena *attr, struct varlena *head,
+			  int32 offset, int32 length)
+{
+	struct varlena *slice;
+
+	if (offset + length <= VARSIZE(head) - VARHDRSZ)
+		return VARDATA(head) + offset;
+
+	slice = heap_tuple_untoast_attr_slice(attr, offset, length);
+
+	if (VARSIZE(slice) - VARHDRSZ < length)
+		elog(ERROR, "unexpected end of jsonb data");
+
+	return VARDATA(slice);
+}
+
+/*
+ * Find the value of a root object key in an uncompressed out-of-line jsonb
+ * datum without fetching all of it.
+ *
+ * The root header and JEntries come first in the datum, followed by all the
+ * keys of the object and then by its values, so the TOAST chunks holding the
+ * value can be located after reading the keys.  The first chunk usually
+ * holds the header and the JEntries; the keys and the value are fetched by
+ * separate slices unless they are there too.
+ *
+ * Returns palloc()'d value, or NULL if the root is not an object or the key
+ * is not found.
+ */
+static JsonbValue *
+findJsonbValueFromToastedObject(struct varlena *attr, JsonbValue *key)
+{
+	struct varlena *head;
+	JsonbContainer *container;
+	char	   *keys;
+	uint32		count;
+	int32		base_off;
+	uint32		stopLow,
+				stopHigh;
+
+	Assert(key->type == jbvString);
+
+	head = heap_tuple_untoast_attr_slice(attr, 0, TOAST_MAX_CHUNK_SIZE);
+
+	if (VARSIZE(head) - VARHDRSZ < offsetof(JsonbContainer, children))
+		elog(ERROR, "unexpected end of jsonb data");
+
+	container = (JsonbContainer *) VARDATA(head);
+
+	if (!JsonContainerIsObject(container) ||
+		(count = JsonContainerSize(container)) == 0)
+		return NULL;
+
+	/* offset of the keys */
+	base_off = offsetof(JsonbContainer, children) + 2 * count * sizeof(JEntry);
+
+	if (base_off > VARSIZE(head) - VARHDRSZ)
+	{
+		pfree(head);
+		head = heap_tuple_untoast_attr_slice(attr, 0, base_off);
+
+		if (VARSIZE(head) - VARHDRSZ < base_off)
+			elog(ERROR, "unexpected end of jsonb data");
+
+		container = (JsonbContainer *) VARDATA(head);
+	}
+
+	/* the keys end where the first value starts */
+	keys = getJsonbSlice(attr, head, base_off,
+						 getJsonbOffset(container, count));
+
+	/* Binary search on object/pair keys, as findJsonbValueFromContainer() */
+	stopLow = 0;
+	stopHigh = count;
+
+	while (stopLow < stopHigh)
+	{
+		uint32		stopMiddle;
+		int			difference;
+		JsonbValue	candidate;
+
+		stopMiddle = stopLow + (stopHigh - stopLow) / 2;
+
+		candidate.type = jbvString;
+		candidate.val.string.val = keys + getJsonbOffset(container, stopMiddle);
+		candidate.val.string.len = getJsonbLength(container, stopMiddle);
+
+		difference = lengthCompareJsonbStringValue(&candidate, key);
+
+		if (difference == 0)
+		{
+			JsonbValue *result = palloc(sizeof(JsonbValue));
+			int			index = stopMiddle + count;
+			uint32		offset = getJsonbOffset(container, index);
+			uint32		start;
+
+			/*
+			 * Start the slice at an int-aligned offset, so that the alignment
+			 * padding of containers and numerics is the same as in the
+			 * whole datum.
+			 */
+			start = TYPEALIGN_DOWN(ALIGNOF_INT, offset);
+
+			fillJsonbValue(container, index,
+						   getJsonbSlice(attr, head, base_off + start,
+										 offset - start +
+										 getJsonbLength(container, index)),
+						   offset - start, result);
+
+			return result;
+		}
+		else if (difference < 0)
+			stopLow = stopMiddle + 1;
+		else
+			stopHigh = stopMiddle;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the value of a root object key of a jsonb datum, fetching only the
+ * needed parts of a large uncompressed out-of-line datum.
+ *
+ * Slices of a compressed datum cannot be fetched without decompressing all
+ * of it before the slice, so only the datums stored with STORAGE EXTERNAL
+ * can be read this way.  Each slice is fetched by a separate TOAST index
+ * scan, so the datum is fetched by slices only if it is large enough and it
+ * is searched for the first time.  When it is searched again, it is rather
+ * detoasted and cached as by JsonbLookupCacheDetoast().
+ *
+ * Returns false if the datum should be detoasted as usual by the caller.
+ * Otherwise *result is set to the palloc()'d value, or NULL if the root is
+ * not an object or the key is not found.
+ *
+ * 'cache' can be NULL, then the datum is fetched by slices every time.
+ */
+bool
+JsonbLookupCacheFindToastedKey(JsonbLookupCache *cache, Datum d,
+							   JsonbValue *key, JsonbValue **result)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast;
+
+	if (!VARATT_IS_EXTERNAL_ONDISK(attr))
+		return false;
+
+	VARATT_EXTERNAL_GET_POINTER(toast, attr);
+
+	if (VARATT_EXTERNAL_IS_COMPRESSED(toast) ||
+		toast.va_extsize < JSONB_SLICE_MIN_SIZE)
+		return false;
+
+	if (cache)
+	{
+		/* already cached or searched */
+		if ((cache->jb &&
+			 cache->lxid == MyProc->lxid &&
+			 memcmp(&cache->toast, &toast, sizeof(toast)) == 0) ||
+			memcmp(&cache->sliced, &toast, sizeof(toast)) == 0)
+			return false;
+
+		cache->sliced = toast;
+	}
+
+	*result = findJsonbValueFromToastedObject(attr, key);
+
+	return true;
+}
+
 /*
  * Get i-th value of a Jsonb array.
  *
@@ -948,9 +1545,178 @@ freeAndGetParent(JsonbIterator *it)
 }
 
 /*
- * Worker for "contains" operator's function
- *
- * Formally speaking, containment is top-down, unordered subtree isomorphism.
+ * Hash index of the scalar elements of a jsonb array.
+ *
+ * JsonbDeepContains() builds it when several rhs scalars are to be found in
+ * a large lhs array, so that each of them is found in O(1) instead of by a
+ * linear search of the array.
+ */
+typedef struct JsonbScalarIndex
+{
+	JsonbContainer *container;	/* indexed array */
+	uint32		mask;			/* number of buckets - 1 */
+	uint32	   *offsets;		/* offsets of the elements */
+	uint32	   *hashes;			/* hashes of the scalar elements */
+	uint32	   *buckets;		/* element index + 1, or 0 if empty */
+} JsonbScalarIndex;
+
+static JsonbScalarIndex *
+buildJsonbScalarIndex(JsonbContainer *container)
+{
+	JsonbScalarIndex *index;
+	uint32		count = JsonContainerSize(container);
+	char	   *base_addr = (char *) (container->children + count);
+	uint32		nbuckets;
+	uint32		offset = 0;
+	uint32		i;
+
+	Assert(JsonContainerIsArray(container));
+
+	/* keep the load factor at or below 1/2 */
+	nbuckets = (uint32) 1 << (pg_leftmost_one_pos32(Max(count, 1)) + 2);
+
+	index = palloc(sizeof(JsonbScalarIndex));
+	index->container = container;
+	index->mask = nbuckets - 1;
+	index->offsets = palloc(sizeof(uint32) * count);
+	index->hashes = palloc(sizeof(uint32) * count);
+	index->buckets = palloc0(sizeof(uint32) * nbuckets);
+
+	for (i = 0; i < count; i++)
+	{
+		JsonbValue	elem;
+		uint32		hash = 0;
+		uint32		bucket;
+
+		index->offsets[i] = offset;
+		fillJsonbValue(container, i, base_addr, offset, &elem);
+		JBE_ADVANCE_OFFSET(offset, container->children[i]);
+
+		if (!IsAJsonbScalar(&elem))
+			continue;
+
+		JsonbHashScalarValue(&elem, &hash);
+		index->hashes[i] = hash;
+
+		for (bucket = hash & index->mask;
+			 index->buckets[bucket];
+			 bucket = (bucket + 1) & index->mask)
+			;
+
+		index->buckets[bucket] = i + 1;
+	}
+
+	return index;
+}
+
+/*
+ * Does the indexed array have a scalar element equal to 'scalar'?
+ */
+static bool
+findJsonbScalarInIndex(JsonbScalarIndex *index, JsonbValue *scalar)
+{
+	JsonbContainer *container = index->container;
+	char	   *base_addr = (char *) (container->children +
+									  JsonContainerSize(container));
+	uint32		hash = 0;
+	uint32		bucket;
+
+	JsonbHashScalarValue(scalar, &hash);
+
+	for (bucket = hash & index->mask;
+		 index->buckets[bucket];
+		 bucket = (bucket + 1) & index->mask)
+	{
+		uint32		i = index->buckets[bucket] - 1;
+		JsonbValue	elem;
+
+		if (index->hashes[i] != hash)
+			continue;
+
+		fillJsonbValue(container, i, base_addr, index->offsets[i], &elem);
+
+		if (elem.type == scalar->type && equalsJsonbScalarValue(scalar, &elem))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Signature of the direct children of a jsonb container, used by
+ * JsonbDeepContains() to skip the nested containers that cannot contain a
+ * given one without comparing them.
+ *
+ * Every scalar element of an array, and every key of an object combined with
+ * its value if that is a scalar, sets one bit of the signature.  Since all of
+ * them must have their equals in a container that contains another, only
+ * a container whose signature has all the bits of the other's can contain it.
+ */
+static uint64
+getJsonbContainerSignature(JsonbContainer *container)
+{
+	uint32		count = JsonContainerSize(container);
+	JEntry	   *children = container->children;
+	uint64		signature = 0;
+	uint32		i;
+
+	if (JsonContainerIsArray(container))
+	{
+		char	   *base_addr = (char *) (children + count);
+		uint32		offset = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			JsonbValue	elem;
+
+			fillJsonbValue(container, i, base_addr, offset, &elem);
+			JBE_ADVANCE_OFFSET(offset, children[i]);
+
+			if (IsAJsonbScalar(&elem))
+			{
+				uint32		hash = 0;
+
+				JsonbHashScalarValue(&elem, &hash);
+				signature |= UINT64CONST(1) << (hash % 64);
+			}
+		}
+	}
+	else
+	{
+		char	   *base_addr = (char *) (children + count * 2);
+		uint32		keyoff = 0;
+		uint32		valoff = getJsonbOffset(container, count);
+
+		Assert(JsonContainerIsObject(container));
+
+		for (i = 0; i < count; i++)
+		{
+			JsonbValue	val;
+			uint32		keyend = keyoff;
+			uint32		hash;
+
+			JBE_ADVANCE_OFFSET(keyend, children[i]);
+			hash = hashJsonbKey(base_addr + keyoff, keyend - keyoff);
+
+			fillJsonbValue(container, i + count, base_addr, valoff, &val);
+
+			if (IsAJsonbScalar(&val))
+				JsonbHashScalarValue(&val, &hash);
+
+			signature |= UINT64CONST(1) << (hash % 64);
+
+			keyoff = keyend;
+			JBE_ADVANCE_OFFSET(valoff, children[i + count]);
+		}
+	}
+
+	return signature;
+}
+
+/*
+ * Worker for "contains" operator's function
+ *
+ * Formally speaking, containment is top-down, unordered subtree isomorphism.
  *
  * Takes iterators that belong to some container type.  These iterators
  * "belong" to those values in the sense that they've just been initialized in
@@ -1091,7 +1857,11 @@ JsonbDeepContains(JsonbIterator **val, JsonbIterator **mContained)
 	else if (rcont == WJB_BEGIN_ARRAY)
 	{
 		JsonbValue *lhsConts = NULL;
+		uint64	   *lhsSigs = NULL;
 		uint32		nLhsElems = vval.val.array.nElems;
+		uint32		nCompared = 0;
+		JsonbScalarIndex *scalarIndex = NULL;
+		bool		scalarSearched = false;
 
 		Assert(vval.type == jbvArray);
 		Assert(vcontained.type == jbvArray);
@@ -1126,13 +1896,31 @@ JsonbDeepContains(JsonbIterator **val, JsonbIterator **mContained)
 
 			if (IsAJsonbScalar(&vcontained))
 			{
-				if (!findJsonbValueFromContainer((*val)->container,
-												 JB_FARRAY,
-												 &vcontained))
+				/*
+				 * The first scalar is searched linearly.  If there are more of
+				 * them and the lhs array is large, index its scalars.
+				 */
+				if (!scalarIndex && scalarSearched &&
+					JsonContainerSize((*val)->container) >=
+					JSONB_SCALAR_INDEX_MIN_ELEMS)
+					scalarIndex = buildJsonbScalarIndex((*val)->container);
+
+				if (scalarIndex)
+				{
+					if (!findJsonbScalarInIndex(scalarIndex, &vcontained))
+						return false;
+				}
+				else if (!findJsonbValueFromContainer((*val)->container,
+													  JB_FARRAY,
+													  &vcontained))
 					return false;
+
+				scalarSearched = true;
 			}
 			else
 			{
+				JsonbContainer *rhsCont = vcontained.val.binary.data;
+				uint64		rhsSig = 0;
 				uint32		i;
 
 				/*
@@ -1164,16 +1952,42 @@ JsonbDeepContains(JsonbIterator **val, JsonbIterator **mContained)
 					nLhsElems = j;
 				}
 
-				/* XXX: Nested array containment is O(N^2) */
+				/*
+				 * Nested array containment is O(N^2), so once as many
+				 * containers have been compared as there are lhs containers,
+				 * use the signatures of the containers to skip the lhs ones
+				 * that cannot contain the rhs one.
+				 */
+				if (!lhsSigs && nCompared >= nLhsElems)
+				{
+					lhsSigs = palloc(sizeof(uint64) * nLhsElems);
+
+					for (i = 0; i < nLhsElems; i++)
+						lhsSigs[i] =
+							getJsonbContainerSignature(lhsConts[i].val.binary.data);
+				}
+
+				if (lhsSigs)
+					rhsSig = getJsonbContainerSignature(rhsCont);
+
 				for (i = 0; i < nLhsElems; i++)
 				{
 					/* Nested container value (object or array) */
+					JsonbContainer *lhsCont = lhsConts[i].val.binary.data;
 					JsonbIterator *nestval,
 							   *nestContained;
 					bool		contains;
 
-					nestval = JsonbIteratorInit(lhsConts[i].val.binary.data);
-					nestContained = JsonbIteratorInit(vcontained.val.binary.data);
+					if (lhsSigs &&
+						(JsonContainerIsObject(lhsCont) !=
+						 JsonContainerIsObject(rhsCont) ||
+						 (rhsSig & ~lhsSigs[i]) != 0))
+						continue;
+
+					nCompared++;
+
+					nestval = JsonbIteratorInit(lhsCont);
+					nestContained = JsonbIteratorInit(rhsCont);
 
 					contains = JsonbDeepContains(&nestval, &nestContained);
 
@@ -1754,6 +2568,601 @@ convertJsonbScalar(StringInfo buffer, JEntry *jentry, JsonbValue *scalarVal)
 	}
 }
 
+/*
+ * Direct Jsonb encoder.
+ *
+ * pushJsonbValue() builds the whole in-memory JsonbValue tree, which is then
+ * walked once more by convertToJsonb().  When the values arrive in document
+ * order, as they do while parsing text, the encoder below writes them
+ * straight into the output buffer instead.
+ *
+ * The data of the children of a container is appended to the buffer right
+ * after the container's aligned start, and the container's header and
+ * JEntries are inserted in front of it when the container ends.  They take a
+ * multiple of 4 bytes, so the alignment of the already written children is
+ * preserved by the move.  Object keys are collected in a separate buffer;
+ * pairs are sorted and de-duplicated ("last observed wins") at the end of the
+ * object, when keys and then values are copied into their final places.
+ */
+typedef struct JsonbEncoderEntry
+{
+	JEntry		meta;			/* type and length including padding */
+	int			offset;			/* offset of the unpadded data in buffer */
+	int			len;			/* length of the unpadded data */
+	int			keyOffset;		/* offset of the pair's key in key buffer */
+	int			keyLen;			/* length of the pair's key */
+	uint32		order;			/* pair's index in original sequence */
+} JsonbEncoderEntry;
+
+typedef struct JsonbEncoderLevel
+{
+	bool		isObject;
+	bool		rawScalar;		/* top-level "raw scalar" array? */
+	int			base;			/* offset of the container incl. padding */
+	int			start;			/* offset of the container's aligned start */
+	int			firstEntry;		/* index of the first child's entry */
+	int			keysStart;		/* length of key buffer at container start */
+	int			keyOffset;		/* offset of the current key in key buffer */
+	int			keyLen;			/* length of the current key */
+} JsonbEncoderLevel;
+
+struct JsonbEncoder
+{
+	StringInfoData buffer;		/* output Jsonb */
+	StringInfoData keys;		/* keys of all the open objects */
+	JsonbEncoderEntry *entries; /* children of all the open containers */
+	int			nentries;
+	int			entriesAllocated;
+	JsonbEncoderLevel *levels;	/* stack of the open containers */
+	int			nlevels;
+	int			levelsAllocated;
+};
+
+/*
+ * Create a new Jsonb encoder.
+ */
+JsonbEncoder *
+JsonbEncoderInit(void)
+{
+	JsonbEncoder *enc = palloc(sizeof(*enc));
+
+	initStringInfo(&enc->buffer);
+	initStringInfo(&enc->keys);
+
+	/* Make room for the varlena header */
+	reserveFromBuffer(&enc->buffer, VARHDRSZ);
+
+	enc->nentries = 0;
+	enc->entriesAllocated = 16;
+	enc->entries = palloc(sizeof(JsonbEncoderEntry) * enc->entriesAllocated);
+
+	enc->nlevels = 0;
+	enc->levelsAllocated = 8;
+	enc->levels = palloc(sizeof(JsonbEncoderLevel) * enc->levelsAllocated);
+
+	return enc;
+}
+
+/*
+ * Add an entry for the value just written to the buffer at 'offset' to the
+ * current container.
+ */
+static void
+jsonbEncoderAddEntry(JsonbEncoder *enc, JEntry meta, int offset)
+{
+	JsonbEncoderLevel *level = &enc->levels[enc->nlevels - 1];
+	JsonbEncoderEntry *entry;
+
+	if (!level->isObject &&
+		enc->nentries - level->firstEntry >= JSONB_MAX_ELEMS)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("number of jsonb array elements exceeds the maximum allowed (%zu)",
+						JSONB_MAX_ELEMS)));
+
+	if (enc->nentries >= enc->entriesAllocated)
+	{
+		enc->entriesAllocated *= 2;
+		enc->entries = repalloc_huge(enc->entries,
+									 sizeof(JsonbEncoderEntry) *
+									 enc->entriesAllocated);
+	}
+
+	entry = &enc->entries[enc->nentries];
+	entry->meta = meta;
+	entry->offset = offset;
+	entry->len = enc->buffer.len - offset;
+	entry->keyOffset = level->keyOffset;
+	entry->keyLen = level->keyLen;
+	entry->order = enc->nentries - level->firstEntry;
+
+	enc->nentries++;
+}
+
+/*
+ * Start a new array or object.
+ */
+static void
+jsonbEncoderPushLevel(JsonbEncoder *enc, bool isObject, bool rawScalar)
+{
+	JsonbEncoderLevel *level;
+
+	check_stack_depth();
+
+	if (enc->nlevels >= enc->levelsAllocated)
+	{
+		enc->levelsAllocated *= 2;
+		enc->levels = repalloc(enc->levels,
+							   sizeof(JsonbEncoderLevel) * enc->levelsAllocated);
+	}
+
+	level = &enc->levels[enc->nlevels++];
+	level->isObject = isObject;
+	level->rawScalar = rawScalar;
+	level->base = enc->buffer.len;
+
+	/* Align to 4-byte boundary (any padding counts as part of my data) */
+	padBufferToInt(&enc->buffer);
+
+	level->start = enc->buffer.len;
+	level->firstEntry = enc->nentries;
+	level->keysStart = enc->keys.len;
+	level->keyOffset = 0;
+	level->keyLen = 0;
+}
+
+/*
+ * Start a new array or object, nested into the current container if any.
+ */
+void
+JsonbEncoderBeginContainer(JsonbEncoder *enc, bool isObject)
+{
+	jsonbEncoderPushLevel(enc, isObject, false);
+}
+
+/*
+ * Set the key of the next pair of the current object.
+ */
+void
+JsonbEncoderKey(JsonbEncoder *enc, const char *key, int len)
+{
+	JsonbEncoderLevel *level = &enc->levels[enc->nlevels - 1];
+
+	Assert(level->isObject);
+
+	if (enc->nentries - level->firstEntry >= JSONB_MAX_PAIRS)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("number of jsonb object pairs exceeds the maximum allowed (%zu)",
+						JSONB_MAX_PAIRS)));
+
+	level->keyOffset = enc->keys.len;
+	level->keyLen = len;
+	appendBinaryStringInfo(&enc->keys, key, len);
+}
+
+/*
+ * Add a scalar element or pair value to the current container.  A scalar
+ * outside of any container becomes a raw scalar pseudo-array.
+ */
+void
+JsonbEncoderScalar(JsonbEncoder *enc, JsonbValue *scalarVal)
+{
+	JEntry		meta;
+	int			offset = enc->buffer.len;
+
+	Assert(IsAJsonbScalar(scalarVal));
+
+	if (!enc->nlevels)
+	{
+		jsonbEncoderPushLevel(enc, false, true);
+		JsonbEncoderScalar(enc, scalarVal);
+		JsonbEncoderEndContainer(enc);
+		return;
+	}
+
+	convertJsonbScalar(&enc->buffer, &meta, scalarVal);
+
+	/* numerics are preceded by alignment padding */
+	if (JBE_ISNUMERIC(meta))
+		offset = INTALIGN(offset);
+
+	jsonbEncoderAddEntry(enc, meta, offset);
+}
+
+/*
+ * Add an already encoded value to the current container.  'data' is the
+ * unpadded variable-length part of the value of type 'type' (one of the
+ * JENTRY_IS* values), and 'len' is its length.
+ */
+static void
+jsonbEncoderAddEncoded(JsonbEncoder *enc, JEntry type, const char *data,
+					   int len)
+{
+	short		padlen = 0;
+	int			offset;
+
+	/* Containers and numerics need to be aligned */
+	if (type == JENTRY_ISNUMERIC || type == JENTRY_ISCONTAINER)
+		padlen = padBufferToInt(&enc->buffer);
+
+	offset = enc->buffer.len;
+
+	if (len > 0)
+		appendToBuffer(&enc->buffer, data, len);
+
+	jsonbEncoderAddEntry(enc, type | (padlen + len), offset);
+}
+
+/*
+ * Add a Jsonb datum as an element or a pair value of the current container.
+ * The encoded value is copied as is, so nothing is decoded.
+ */
+void
+JsonbEncoderJsonb(JsonbEncoder *enc, Jsonb *jb)
+{
+	Assert(enc->nlevels > 0);
+
+	if (JB_ROOT_IS_SCALAR(jb))
+	{
+		/* the data of the only element follows its JEntry unpadded */
+		jsonbEncoderAddEncoded(enc, jb->root.children[0] & JENTRY_TYPEMASK,
+							   (char *) &jb->root.children[1],
+							   getJsonbLength(&jb->root, 0));
+	}
+	else
+		jsonbEncoderAddEncoded(enc, JENTRY_ISCONTAINER, (char *) &jb->root,
+							   VARSIZE(jb) - VARHDRSZ);
+}
+
+/*
+ * Add the children number 'first' to 'first + count - 1' of an encoded
+ * container to the current container: elements of an array or pairs of an
+ * object.  The keys and values are copied as is, so nothing is decoded.
+ */
+void
+JsonbEncoderContainerChildren(JsonbEncoder *enc, JsonbContainer *container,
+							  int first, int count)
+{
+	int			nchildren = JsonContainerSize(container);
+	bool		isObject = JsonContainerIsObject(container);
+	char	   *base_addr;
+	int			index = first;
+	uint32		offset;
+	uint32		keyOffset = 0;
+	int			i;
+
+	Assert(enc->nlevels > 0);
+	Assert(enc->levels[enc->nlevels - 1].isObject == isObject);
+	Assert(first >= 0 && count >= 0 && first + count <= nchildren);
+
+	if (count == 0)
+		return;
+
+	if (isObject)
+	{
+		/* the values follow all the keys */
+		base_addr = (char *) &container->children[nchildren * 2];
+		keyOffset = getJsonbOffset(container, first);
+		index += nchildren;
+	}
+	else
+		base_addr = (char *) &container->children[nchildren];
+
+	offset = getJsonbOffset(container, index);
+
+	for (i = 0; i < count; i++, index++)
+	{
+		JEntry		entry = container->children[index];
+		uint32		start = offset;
+
+		if (isObject)
+		{
+			uint32		keyStart = keyOffset;
+
+			JBE_ADVANCE_OFFSET(keyOffset, container->children[first + i]);
+			JsonbEncoderKey(enc, base_addr + keyStart, keyOffset - keyStart);
+		}
+
+		JBE_ADVANCE_OFFSET(offset, entry);
+
+		/* skip the alignment padding, it is added again if needed */
+		if (JBE_ISNUMERIC(entry) || JBE_ISCONTAINER(entry))
+			start = INTALIGN(start);
+
+		jsonbEncoderAddEncoded(enc, entry & JENTRY_TYPEMASK,
+							   base_addr + start, offset - start);
+	}
+}
+
+/*
+ * Add all the elements of an encoded array to the current container.
+ */
+void
+JsonbEncoderArrayElements(JsonbEncoder *enc, JsonbContainer *array)
+{
+	Assert(JsonContainerIsArray(array));
+
+	JsonbEncoderContainerChildren(enc, array, 0, JsonContainerSize(array));
+}
+
+/*
+ * qsort_arg() comparator for the object pairs in the encoder.  'arg' points
+ * to the key buffer.  Equal keys are ordered so that the last observed pair
+ * goes first.
+ */
+static int
+jsonbEncoderComparePairs(const void *a, const void *b, void *arg)
+{
+	const JsonbEncoderEntry *pa = (const JsonbEncoderEntry *) a;
+	const JsonbEncoderEntry *pb = (const JsonbEncoderEntry *) b;
+	const char *keys = (const char *) arg;
+	int			res;
+
+	if (pa->keyLen != pb->keyLen)
+		return pa->keyLen > pb->keyLen ? 1 : -1;
+
+	res = memcmp(keys + pa->keyOffset, keys + pb->keyOffset, pa->keyLen);
+
+	if (res == 0)
+		res = (pa->order > pb->order) ? -1 : 1;
+
+	return res;
+}
+
+/*
+ * Write the header and the JEntries of an array with the given elements.
+ */
+static void
+jsonbEncoderArrayHeader(JsonbEncoderEntry *elems, int nElems, bool rawScalar,
+						JsonbContainer *container)
+{
+	int			totallen;
+	int			i;
+
+	container->header = nElems | JB_FARRAY;
+	if (rawScalar)
+	{
+		Assert(nElems == 1);
+		container->header |= JB_FSCALAR;
+	}
+
+	totallen = 0;
+	for (i = 0; i < nElems; i++)
+	{
+		JEntry		meta = elems[i].meta;
+
+		totallen += JBE_OFFLENFLD(meta);
+
+		if (totallen > JENTRY_OFFLENMASK)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("total size of jsonb array elements exceeds the maximum of %u bytes",
+							JENTRY_OFFLENMASK)));
+
+		/* Convert each JB_OFFSET_STRIDE'th length to an offset. */
+		if ((i % JB_OFFSET_STRIDE) == 0)
+			meta = (meta & JENTRY_TYPEMASK) | totallen | JENTRY_HAS_OFF;
+
+		container->children[i] = meta;
+	}
+}
+
+/*
+ * Insert the header and the JEntries in front of the elements of the array.
+ */
+static void
+jsonbEncoderFinishArray(JsonbEncoder *enc, JsonbEncoderLevel *level)
+{
+	StringInfo	buffer = &enc->buffer;
+	JsonbEncoderEntry *elems = &enc->entries[level->firstEntry];
+	int			nElems = enc->nentries - level->firstEntry;
+	int			datalen = buffer->len - level->start;
+	int			hdrlen = sizeof(uint32) + sizeof(JEntry) * nElems;
+
+	/* Move the elements' data to make room for the header and JEntries. */
+	reserveFromBuffer(buffer, hdrlen);
+	memmove(buffer->data + level->start + hdrlen,
+			buffer->data + level->start, datalen);
+
+	/* the start of the container is int-aligned */
+	jsonbEncoderArrayHeader(elems, nElems, level->rawScalar,
+							(JsonbContainer *) (buffer->data + level->start));
+}
+
+/*
+ * Build a Jsonb of the top-level array of the encoder, which is kept open,
+ * so that more elements can be added to it later.  The result is palloc'd.
+ */
+Jsonb *
+JsonbEncoderBuildArray(JsonbEncoder *enc)
+{
+	JsonbEncoderLevel *level = &enc->levels[0];
+	int			nElems = enc->nentries - level->firstEntry;
+	int			datalen = enc->buffer.len - level->start;
+	int			hdrlen = offsetof(JsonbContainer, children) +
+		sizeof(JEntry) * nElems;
+	Jsonb	   *res;
+
+	Assert(enc->nlevels == 1 && !level->isObject);
+
+	/* the top-level container starts right after the varlena header */
+	Assert(level->start == VARHDRSZ);
+
+	res = palloc(VARHDRSZ + hdrlen + datalen);
+	SET_VARSIZE(res, VARHDRSZ + hdrlen + datalen);
+
+	jsonbEncoderArrayHeader(&enc->entries[level->firstEntry], nElems,
+							level->rawScalar, &res->root);
+	memcpy((char *) &res->root + hdrlen, enc->buffer.data + level->start,
+		   datalen);
+
+	return res;
+}
+
+/*
+ * Sort and de-duplicate pairs of the object, and rewrite its data in the
+ * on-disk order: header, JEntries, keys and values.
+ */
+static void
+jsonbEncoderFinishObject(JsonbEncoder *enc, JsonbEncoderLevel *level)
+{
+	StringInfo	buffer = &enc->buffer;
+	JsonbEncoderEntry *pairs = &enc->entries[level->firstEntry];
+	int			nPairs = enc->nentries - level->firstEntry;
+	int			datalen = buffer->len - level->start;
+	char	   *data;
+	int			jentry_offset;
+	int			totallen;
+	uint32		header;
+	int			i;
+
+	/*
+	 * Pairs copied from encoded objects come in order already, in which case
+	 * there is nothing to sort or remove.
+	 */
+	for (i = 1; i < nPairs; i++)
+	{
+		if (jsonbEncoderComparePairs(&pairs[i - 1], &pairs[i],
+									 enc->keys.data) >= 0)
+			break;
+	}
+
+	if (i < nPairs)
+	{
+		int			j = 0;
+
+		qsort_arg(pairs, nPairs, sizeof(JsonbEncoderEntry),
+				  jsonbEncoderComparePairs, enc->keys.data);
+
+		/* Leave only the first one of the pairs with equal keys */
+		for (i = 1; i < nPairs; i++)
+		{
+			if (pairs[i].keyLen != pairs[j].keyLen ||
+				memcmp(enc->keys.data + pairs[i].keyOffset,
+					   enc->keys.data + pairs[j].keyOffset,
+					   pairs[i].keyLen))
+				pairs[++j] = pairs[i];
+		}
+
+		nPairs = j + 1;
+	}
+
+	/* Save the values' data and rewrite the object from its start. */
+	data = palloc(datalen);
+	memcpy(data, buffer->data + level->start, datalen);
+	buffer->len = level->start;
+
+	header = nPairs | JB_FOBJECT;
+	appendToBuffer(buffer, (char *) &header, sizeof(uint32));
+
+	jentry_offset = reserveFromBuffer(buffer, sizeof(JEntry) * nPairs * 2);
+
+	totallen = 0;
+	for (i = 0; i < nPairs * 2; i++)
+	{
+		JsonbEncoderEntry *pair = &pairs[i % nPairs];
+		JEntry		meta;
+
+		if (i < nPairs)
+		{
+			appendToBuffer(buffer, enc->keys.data + pair->keyOffset,
+						   pair->keyLen);
+			meta = JENTRY_ISSTRING | pair->keyLen;
+		}
+		else
+		{
+			short		padlen = 0;
+
+			/* Containers and numerics need to be realigned */
+			if (JBE_ISNUMERIC(pair->meta) || JBE_ISCONTAINER(pair->meta))
+				padlen = padBufferToInt(buffer);
+
+			appendToBuffer(buffer, data + pair->offset - level->start,
+						   pair->len);
+			meta = (pair->meta & JENTRY_TYPEMASK) | (padlen + pair->len);
+		}
+
+		totallen += JBE_OFFLENFLD(meta);
+
+		if (totallen > JENTRY_OFFLENMASK)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("total size of jsonb object elements exceeds the maximum of %u bytes",
+							JENTRY_OFFLENMASK)));
+
+		/* Convert each JB_OFFSET_STRIDE'th length to an offset. */
+		if ((i % JB_OFFSET_STRIDE) == 0)
+			meta = (meta & JENTRY_TYPEMASK) | totallen | JENTRY_HAS_OFF;
+
+		copyToBuffer(buffer, jentry_offset, (char *) &meta, sizeof(JEntry));
+		jentry_offset += sizeof(JEntry);
+	}
+
+	pfree(data);
+}
+
+/*
+ * Finish the current array or object and add it to its parent container.
+ */
+void
+JsonbEncoderEndContainer(JsonbEncoder *enc)
+{
+	JsonbEncoderLevel level = enc->levels[enc->nlevels - 1];
+	int			totallen;
+
+	if (level.isObject)
+		jsonbEncoderFinishObject(enc, &level);
+	else
+		jsonbEncoderFinishArray(enc, &level);
+
+	/* Total data size is everything we've appended to buffer */
+	totallen = enc->buffer.len - level.base;
+
+	/* Check length again, since we didn't include the metadata above */
+	if (totallen > JENTRY_OFFLENMASK)
+	{
+		if (level.isObject)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("total size of jsonb object elements exceeds the maximum of %u bytes",
+							JENTRY_OFFLENMASK)));
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("total size of jsonb array elements exceeds the maximum of %u bytes",
+							JENTRY_OFFLENMASK)));
+	}
+
+	/* Forget the children and the keys of the container */
+	enc->nentries = level.firstEntry;
+	enc->keys.len = level.keysStart;
+	enc->nlevels--;
+
+	if (enc->nlevels > 0)
+		jsonbEncoderAddEntry(enc, JENTRY_ISCONTAINER | totallen, level.start);
+}
+
+/*
+ * Return the encoded Jsonb and release the encoder.  The result is palloc'd.
+ */
+Jsonb *
+JsonbEncoderFinish(JsonbEncoder *enc)
+{
+	Jsonb	   *res = (Jsonb *) enc->buffer.data;
+
+	Assert(enc->nlevels == 0);
+
+	SET_VARSIZE(res, enc->buffer.len);
+
+	pfree(enc->keys.data);
+	pfree(enc->entries);
+	pfree(enc->levels);
+	pfree(enc);
+
+	return res;
+}
+
 /*
  * Compare two jbvString JsonbValue values, a and b.
  *
@@ -1857,3 +3266,297 @@ uniqueifyJsonbObject(JsonbValue *object)
 		object->val.object.nPairs = res + 1 - object->val.object.pairs;
 	}
 }
+
+/*
+ * Wire format of jsonb values
+ *
+ * Version 2 of the binary send/receive format of jsonb is the on-disk
+ * layout of the root container, with every container header, JEntry and
+ * numeric varlena header turned into a 4-byte integer in network byte order,
+ * and the rest of the numeric words into 2-byte integers in network byte
+ * order.  Strings are in the server encoding.  Alignment padding is kept,
+ * and must be zeroes.
+ *
+ * On big-endian machines sending is a plain copy, and receiving only has to
+ * validate the value; elsewhere both are a single pass swapping bytes.
+ */
+
+static inline uint32
+jsonbWireGet32(const char *ptr)
+{
+	uint32		val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+static inline void
+jsonbWirePut32(char *ptr, uint32 val)
+{
+	memcpy(ptr, &val, sizeof(val));
+}
+
+/*
+ * Convert the 2-byte words of a numeric following its varlena header between
+ * network and host byte order (the conversion is the same both ways, and a
+ * no-op on big-endian machines)
+ */
+static inline void
+jsonbWireSwapNumericWords(char *num, uint32 len)
+{
+#ifndef WORDS_BIGENDIAN
+	uint32		i;
+
+	for (i = VARHDRSZ; i + sizeof(uint16) <= len; i += sizeof(uint16))
+	{
+		uint16		word;
+
+		memcpy(&word, num + i, sizeof(word));
+		word = pg_ntoh16(word);
+		memcpy(num + i, &word, sizeof(word));
+	}
+#endif
+}
+
+#ifndef WORDS_BIGENDIAN
+/*
+ * Convert a container of 'len' bytes, possibly misaligned, from host to
+ * network byte order in place.
+ */
+static void
+jsonbContainerToWire(char *base, uint32 len)
+{
+	uint32		header = jsonbWireGet32(base);
+	uint32		nchildren = header & JB_CMASK;
+	char	   *data;
+	uint32		offset = 0;
+	uint32		i;
+
+	check_stack_depth();
+
+	if (header & JB_FOBJECT)
+		nchildren *= 2;
+
+	data = base + sizeof(uint32) + sizeof(JEntry) * nchildren;
+
+	jsonbWirePut32(base, pg_hton32(header));
+
+	for (i = 0; i < nchildren; i++)
+	{
+		char	   *ptr = base + sizeof(uint32) + sizeof(JEntry) * i;
+		JEntry		entry = jsonbWireGet32(ptr);
+		uint32		end = offset;
+
+		JBE_ADVANCE_OFFSET(end, entry);
+		jsonbWirePut32(ptr, pg_hton32(entry));
+
+		if (JBE_ISNUMERIC(entry))
+		{
+			char	   *num = data + INTALIGN(offset);
+			uint32		numlen = end - INTALIGN(offset);
+
+			/* the varlena header is sent as the plain length */
+			jsonbWirePut32(num, pg_hton32(numlen));
+			jsonbWireSwapNumericWords(num, numlen);
+		}
+		else if (JBE_ISCONTAINER(entry))
+			jsonbContainerToWire(data + INTALIGN(offset),
+								 end - INTALIGN(offset));
+
+		offset = end;
+	}
+}
+#endif
+
+static void
+jsonbWireError(const char *detail) pg_attribute_noreturn();
+
+static void
+jsonbWireError(const char *detail)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+			 errmsg("invalid binary jsonb value"),
+			 errdetail_internal("%s", detail)));
+}
+
+/*
+ * Validate a received container of 'len' bytes and convert it from network
+ * to host byte order in place.  The container must be int-aligned.
+ */
+static void
+jsonbContainerFromWire(char *base, uint32 len, bool isroot)
+{
+	uint32		header;
+	uint32		count;
+	uint64		nchildren;
+	bool		isobject = false;
+	char	   *data;
+	uint32		datalen;
+	uint32		offset = 0;
+	char	   *prevkey = NULL;
+	uint32		prevkeylen = 0;
+	uint32		i;
+
+	check_stack_depth();
+
+	if (len < sizeof(uint32))
+		jsonbWireError("Container header is truncated.");
+
+	header = pg_ntoh32(jsonbWireGet32(base));
+	jsonbWirePut32(base, header);
+	count = header & JB_CMASK;
+
+	switch (header & ~JB_CMASK)
+	{
+		case JB_FOBJECT:
+			isobject = true;
+			break;
+		case JB_FARRAY:
+			break;
+		case JB_FARRAY | JB_FSCALAR:
+			if (!isroot || count != 1)
+				jsonbWireError("Invalid scalar pseudo-array.");
+			break;
+		default:
+			jsonbWireError("Invalid container flags.");
+	}
+
+	nchildren = isobject ? (uint64) count * 2 : count;
+
+	if (sizeof(uint32) + sizeof(JEntry) * nchildren > len)
+		jsonbWireError("Container entries are truncated.");
+
+	data = base + sizeof(uint32) + sizeof(JEntry) * nchildren;
+	datalen = len - (data - base);
+
+	for (i = 0; i < nchildren; i++)
+	{
+		char	   *ptr = base + sizeof(uint32) + sizeof(JEntry) * i;
+		JEntry		entry = pg_ntoh32(jsonbWireGet32(ptr));
+		uint32		start = offset;
+		uint32		end = offset;
+		char	   *child;
+
+		jsonbWirePut32(ptr, entry);
+
+		/* offsets are where the lookup code expects them, and only there */
+		if (JBE_HAS_OFF(entry) != (i % JB_OFFSET_STRIDE == 0))
+			jsonbWireError("Misplaced offset entry.");
+
+		JBE_ADVANCE_OFFSET(end, entry);
+
+		if (end < offset || end > datalen)
+			jsonbWireError("Entry points outside of its container.");
+
+		if (JBE_ISNUMERIC(entry) || JBE_ISCONTAINER(entry))
+		{
+			start = INTALIGN(offset);
+
+			if (start > end)
+				jsonbWireError("Entry is too short for its alignment.");
+
+			for (; offset < start; offset++)
+				if (data[offset] != 0)
+					jsonbWireError("Alignment padding is not zero.");
+		}
+
+		child = data + start;
+
+		if (isobject && i < count)
+		{
+			/* keys are strings in strictly ascending jsonb key order */
+			if (!JBE_ISSTRING(entry))
+				jsonbWireError("Object key is not a string.");
+
+			if (prevkey &&
+				(prevkeylen > end - start ||
+				 (prevkeylen == end - start &&
+				  memcmp(prevkey, child, prevkeylen) >= 0)))
+				jsonbWireError("Object keys are not sorted or not unique.");
+
+			prevkey = child;
+			prevkeylen = end - start;
+		}
+
+		switch (entry & JENTRY_TYPEMASK)
+		{
+			case JENTRY_ISSTRING:
+				if (!pg_verify_mbstr(GetDatabaseEncoding(), child, end - start,
+									 true))
+					jsonbWireError("String is not valid in the server encoding.");
+				break;
+
+			case JENTRY_ISNUMERIC:
+				if (end - start < VARHDRSZ ||
+					pg_ntoh32(jsonbWireGet32(child)) != end - start)
+					jsonbWireError("Invalid numeric length.");
+
+				SET_VARSIZE(child, end - start);
+				jsonbWireSwapNumericWords(child, end - start);
+
+				if (!numeric_is_well_formed((Numeric) child) ||
+					numeric_is_nan((Numeric) child))
+					jsonbWireError("Invalid numeric.");
+				break;
+
+			case JENTRY_ISBOOL_FALSE:
+			case JENTRY_ISBOOL_TRUE:
+			case JENTRY_ISNULL:
+				if (end != start)
+					jsonbWireError("Entry of a fixed value has data.");
+				break;
+
+			case JENTRY_ISCONTAINER:
+				if (header & JB_FSCALAR)
+					jsonbWireError("Invalid scalar pseudo-array.");
+
+				jsonbContainerFromWire(child, end - start, false);
+				break;
+
+			default:
+				jsonbWireError("Invalid entry type.");
+		}
+
+		offset = end;
+	}
+
+	if (offset != datalen)
+		jsonbWireError("Container has trailing data.");
+}
+
+/*
+ * JsonbToWireFormat: append a jsonb value to 'buf' in version 2 of the
+ * binary send format
+ */
+void
+JsonbToWireFormat(StringInfo buf, Jsonb *jb)
+{
+	uint32		len = VARSIZE(jb) - VARHDRSZ;
+#ifndef WORDS_BIGENDIAN
+	int			start = buf->len;
+#endif
+
+	appendBinaryStringInfo(buf, (char *) &jb->root, len);
+
+#ifndef WORDS_BIGENDIAN
+	jsonbContainerToWire(buf->data + start, len);
+#endif
+}
+
+/*
+ * JsonbFromWireFormat: make a jsonb value of 'len' bytes received at 'data'
+ * in version 2 of the binary send format, validating it thoroughly
+ */
+Jsonb *
+JsonbFromWireFormat(const char *data, int len)
+{
+	Jsonb	   *jb = (Jsonb *) palloc(VARHDRSZ + len);
+
+	SET_VARSIZE(jb, VARHDRSZ + len);
+	memcpy(&jb->root, data, len);
+
+	jsonbContainerFromWire((char *) &jb->root, len, true);
+
+	return jb;
+}
@@ -458,23 +458,25 @@ static Datum populate_domain(DomainIOData *io, Oid typid, const char *colname,
 static JsonbValue *findJsonbValueFromContainerLen(JsonbContainer *container,
 							   uint32 flags,
 							   char *key,
-							   uint32 keylen);
+							   uint32 keylen,
+							   JsonbLookupCache *cache);
+static JsonbLookupCache *getJsonbLookupCache(FunctionCallInfo fcinfo);
+static JsonbValue *findJsonbObjectField(JsonbLookupCache *cache, Datum jsonb,
+					 text *key);
 
 /* functions supporting jsonb_delete, jsonb_set and jsonb_concat */
-static JsonbValue *IteratorConcat(JsonbIterator **it1, JsonbIterator **it2,
-			   JsonbParseState **state);
-static JsonbValue *setPath(JsonbIterator **it, Datum *path_elems,
-		bool *path_nulls, int path_len,
-		JsonbParseState **st, int level, Jsonb *newval,
-		int op_type);
-static void setPathObject(JsonbIterator **it, Datum *path_elems,
-			  bool *path_nulls, int path_len, JsonbParseState **st,
-			  int level,
-			  Jsonb *newval, uint32 npairs, int op_type);
-static void setPathArray(JsonbIterator **it, Datum *path_elems,
-			 bool *path_nulls, int path_len, JsonbParseState **st,
-			 int level, Jsonb *newval, uint32 nelems, int op_type);
-static void addJsonbToParseState(JsonbParseState **jbps, Jsonb *jb);
+static Jsonb *concatJsonb(Jsonb *jb1, Jsonb *jb2);
+static void mergeJsonbObjects(JsonbEncoder *enc, JsonbContainer *obj1,
+				  JsonbContainer *obj2);
+static void setPath(JsonbEncoder *enc, JsonbValue *val, Datum *path_elems,
+		bool *path_nulls, int path_len, int level,
+		Jsonb *newval, int op_type);
+static void setPathObject(JsonbEncoder *enc, JsonbContainer *container,
+			  Datum *path_elems, bool *path_nulls, int path_len,
+			  int level, Jsonb *newval, int op_type);
+static void setPathArray(JsonbEncoder *enc, JsonbContainer *container,
+			 Datum *path_elems, bool *path_nulls, int path_len,
+			 int level, Jsonb *newval, int op_type);
 
 /* function supporting iterate_json_values */
 static void iterate_values_scalar(void *state, char *token, JsonTokenType tokentype);
@@ -715,16 +717,11 @@ json_object_field(PG_FUNCTION_ARGS)
 Datum
 jsonb_object_field(PG_FUNCTION_ARGS)
 {
-	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
+	JsonbLookupCache *cache = getJsonbLookupCache(fcinfo);
 	text	   *key = PG_GETARG_TEXT_PP(1);
 	JsonbValue *v;
 
-	if (!JB_ROOT_IS_OBJECT(jb))
-		PG_RETURN_NULL();
-
-	v = findJsonbValueFromContainerLen(&jb->root, JB_FOBJECT,
-									   VARDATA_ANY(key),
-									   VARSIZE_ANY_EXHDR(key));
+	v = findJsonbObjectField(cache, PG_GETARG_DATUM(0), key);
 
 	if (v != NULL)
 		PG_RETURN_JSONB_P(JsonbValueToJsonb(v));
@@ -751,16 +748,11 @@ json_object_field_text(PG_FUNCTION_ARGS)
 Datum
 jsonb_object_field_text(PG_FUNCTION_ARGS)
 {
-	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
+	JsonbLookupCache *cache = getJsonbLookupCache(fcinfo);
 	text	   *key = PG_GETARG_TEXT_PP(1);
 	JsonbValue *v;
 
-	if (!JB_ROOT_IS_OBJECT(jb))
-		PG_RETURN_NULL();
-
-	v = findJsonbValueFromContainerLen(&jb->root, JB_FOBJECT,
-									   VARDATA_ANY(key),
-									   VARSIZE_ANY_EXHDR(key));
+	v = findJsonbObjectField(cache, PG_GETARG_DATUM(0), key);
 
 	if (v != NULL)
 	{
@@ -1387,7 +1379,8 @@ jsonb_extract_path_text(PG_FUNCTION_ARGS)
 static Datum
 get_jsonb_path_all(FunctionCallInfo fcinfo, bool as_text)
 {
-	Jsonb	   *jb = PG_GETARG_JSONB_P(0);
+	JsonbLookupCache *cache = getJsonbLookupCache(fcinfo);
+	Jsonb	   *jb = JsonbLookupCacheDetoast(cache, PG_GETARG_DATUM(0));
 	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(1);
 	Jsonb	   *res;
 	Datum	   *pathtext;
@@ -1446,8 +1439,11 @@ get_jsonb_path_all(FunctionCallInfo fcinfo, bool as_text)
 		}
 		else
 		{
-			/* not text mode - just hand back the jsonb */
-			PG_RETURN_JSONB_P(jb);
+			/*
+			 * not text mode - just hand back the jsonb, which must not be
+			 * the cached copy
+			 */
+			PG_RETURN_JSONB_P(PG_GETARG_JSONB_P(0));
 		}
 	}
 
@@ -1455,10 +1451,12 @@ get_jsonb_path_all(FunctionCallInfo fcinfo, bool as_text)
 	{
 		if (have_object)
 		{
+			/* only the root object is looked up through the cache */
 			jbvp = findJsonbValueFromContainerLen(container,
 												  JB_FOBJECT,
 												  VARDATA(pathtext[i]),
-												  VARSIZE(pathtext[i]) - VARHDRSZ);
+												  VARSIZE(pathtext[i]) - VARHDRSZ,
+												  i == 0 ? cache : NULL);
 		}
 		else if (have_array)
 		{
@@ -3136,7 +3134,7 @@ JsObjectGetField(JsObject *obj, char *field, JsValue *jsv)
 	{
 		jsv->val.jsonb = !obj->val.jsonb_cont ? NULL :
 			findJsonbValueFromContainerLen(obj->val.jsonb_cont, JB_FOBJECT,
-										   field, strlen(field));
+										   field, strlen(field), NULL);
 
 		return jsv->val.jsonb != NULL;
 	}
@@ -3950,10 +3948,13 @@ populate_recordset_object_field_end(void *state, char *fname, bool isnull)
 
 /*
  * findJsonbValueFromContainer() wrapper that sets up JsonbValue key string.
+ *
+ * Object keys are looked up through 'cache' when it is given.
  */
 static JsonbValue *
 findJsonbValueFromContainerLen(JsonbContainer *container, uint32 flags,
-							   char *key, uint32 keylen)
+							   char *key, uint32 keylen,
+							   JsonbLookupCache *cache)
 {
 	JsonbValue	k;
 
@@ -3961,9 +3962,63 @@ findJsonbValueFromContainerLen(JsonbContainer *container, uint32 flags,
 	k.val.string.val = key;
 	k.val.string.len = keylen;
 
+	if (cache && flags == JB_FOBJECT)
+		return JsonbLookupCacheFindKey(cache, container, &k);
+
 	return findJsonbValueFromContainer(container, flags, &k);
 }
 
+/*
+ * Find the value of a root object key of a jsonb datum for the field
+ * accessors, fetching only the needed parts of large out-of-line datums
+ * when possible.
+ *
+ * Returns NULL if the root is not an object or the key is not found.
+ */
+static JsonbValue *
+findJsonbObjectField(JsonbLookupCache *cache, Datum jsonb, text *key)
+{
+	Jsonb	   *jb;
+	JsonbValue	k;
+	JsonbValue *v;
+
+	k.type = jbvString;
+	k.val.string.val = VARDATA_ANY(key);
+	k.val.string.len = VARSIZE_ANY_EXHDR(key);
+
+	if (JsonbLookupCacheFindToastedKey(cache, jsonb, &k, &v))
+		return v;
+
+	jb = JsonbLookupCacheDetoast(cache, jsonb);
+
+	if (!JB_ROOT_IS_OBJECT(jb))
+		return NULL;
+
+	return findJsonbValueFromContainerLen(&jb->root, JB_FOBJECT,
+										  VARDATA_ANY(key),
+										  VARSIZE_ANY_EXHDR(key),
+										  cache);
+}
+
+/*
+ * Get the key lookup cache of a jsonb field accessor, kept in fn_extra.
+ *
+ * Returns NULL when called without FmgrInfo.
+ */
+static JsonbLookupCache *
+getJsonbLookupCache(FunctionCallInfo fcinfo)
+{
+	FmgrInfo   *flinfo = fcinfo->flinfo;
+
+	if (!flinfo)
+		return NULL;
+
+	if (!flinfo->fn_extra)
+		flinfo->fn_extra = JsonbLookupCacheCreate(flinfo->fn_mcxt);
+
+	return flinfo->fn_extra;
+}
+
 /*
  * Semantic actions for json_strip_nulls.
  *
@@ -4151,58 +4206,6 @@ jsonb_strip_nulls(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(JsonbValueToJsonb(res));
 }
 
-/*
- * Add values from the jsonb to the parse state.
- *
- * If the parse state container is an object, the jsonb is pushed as
- * a value, not a key.
- *
- * This needs to be done using an iterator because pushJsonbValue doesn't
- * like getting jbvBinary values, so we can't just push jb as a whole.
- */
-static void
-addJsonbToParseState(JsonbParseState **jbps, Jsonb *jb)
-{
-	JsonbIterator *it;
-	JsonbValue *o = &(*jbps)->contVal;
-	JsonbValue	v;
-	JsonbIteratorToken type;
-
-	it = JsonbIteratorInit(&jb->root);
-
-	Assert(o->type == jbvArray || o->type == jbvObject);
-
-	if (JB_ROOT_IS_SCALAR(jb))
-	{
-		(void) JsonbIteratorNext(&it, &v, false);	/* skip array header */
-		Assert(v.type == jbvArray);
-		(void) JsonbIteratorNext(&it, &v, false);	/* fetch scalar value */
-
-		switch (o->type)
-		{
-			case jbvArray:
-				(void) pushJsonbValue(jbps, WJB_ELEM, &v);
-				break;
-			case jbvObject:
-				(void) pushJsonbValue(jbps, WJB_VALUE, &v);
-				break;
-			default:
-				elog(ERROR, "unexpected parent of nested structure");
-		}
-	}
-	else
-	{
-		while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
-		{
-			if (type == WJB_KEY || type == WJB_VALUE || type == WJB_ELEM)
-				(void) pushJsonbValue(jbps, type, &v);
-			else
-				(void) pushJsonbValue(jbps, type, NULL);
-		}
-	}
-
-}
-
 /*
  * SQL function jsonb_pretty (jsonb)
  *
@@ -4229,10 +4232,6 @@ jsonb_concat(PG_FUNCTION_ARGS)
 {
 	Jsonb	   *jb1 = PG_GETARG_JSONB_P(0);
 	Jsonb	   *jb2 = PG_GETARG_JSONB_P(1);
-	JsonbParseState *state = NULL;
-	JsonbValue *res;
-	JsonbIterator *it1,
-			   *it2;
 
 	/*
 	 * If one of the jsonb is empty, just return the other if it's not scalar
@@ -4248,14 +4247,7 @@ jsonb_concat(PG_FUNCTION_ARGS)
 			PG_RETURN_JSONB_P(jb1);
 	}
 
-	it1 = JsonbIteratorInit(&jb1->root);
-	it2 = JsonbIteratorInit(&jb2->root);
-
-	res = IteratorConcat(&it1, &it2, &state);
-
-	Assert(res != NULL);
-
-	PG_RETURN_JSONB_P(JsonbValueToJsonb(res));
+	PG_RETURN_JSONB_P(concatJsonb(jb1, jb2));
 }
 
 
@@ -4477,12 +4469,11 @@ jsonb_set(PG_FUNCTION_ARGS)
 	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(1);
 	Jsonb	   *newval = PG_GETARG_JSONB_P(2);
 	bool		create = PG_GETARG_BOOL(3);
-	JsonbValue *res = NULL;
+	JsonbValue	root;
 	Datum	   *path_elems;
 	bool	   *path_nulls;
 	int			path_len;
-	JsonbIterator *it;
-	JsonbParseState *st = NULL;
+	JsonbEncoder *enc;
 
 	if (ARR_NDIM(path) > 1)
 		ereport(ERROR,
@@ -4503,14 +4494,16 @@ jsonb_set(PG_FUNCTION_ARGS)
 	if (path_len == 0)
 		PG_RETURN_JSONB_P(in);
 
-	it = JsonbIteratorInit(&in->root);
+	root.type = jbvBinary;
+	root.val.binary.data = &in->root;
+	root.val.binary.len = VARSIZE(in) - VARHDRSZ;
 
-	res = setPath(&it, path_elems, path_nulls, path_len, &st,
-				  0, newval, create ? JB_PATH_CREATE : JB_PATH_REPLACE);
+	enc = JsonbEncoderInit();
 
-	Assert(res != NULL);
+	setPath(enc, &root, path_elems, path_nulls, path_len, 0,
+			newval, create ? JB_PATH_CREATE : JB_PATH_REPLACE);
 
-	PG_RETURN_JSONB_P(JsonbValueToJsonb(res));
+	PG_RETURN_JSONB_P(JsonbEncoderFinish(enc));
 }
 
 
@@ -4522,12 +4515,11 @@ jsonb_delete_path(PG_FUNCTION_ARGS)
 {
 	Jsonb	   *in = PG_GETARG_JSONB_P(0);
 	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(1);
-	JsonbValue *res = NULL;
+	JsonbValue	root;
 	Datum	   *path_elems;
 	bool	   *path_nulls;
 	int			path_len;
-	JsonbIterator *it;
-	JsonbParseState *st = NULL;
+	JsonbEncoder *enc;
 
 	if (ARR_NDIM(path) > 1)
 		ereport(ERROR,
@@ -4548,14 +4540,16 @@ jsonb_delete_path(PG_FUNCTION_ARGS)
 	if (path_len == 0)
 		PG_RETURN_JSONB_P(in);
 
-	it = JsonbIteratorInit(&in->root);
+	root.type = jbvBinary;
+	root.val.binary.data = &in->root;
+	root.val.binary.len = VARSIZE(in) - VARHDRSZ;
 
-	res = setPath(&it, path_elems, path_nulls, path_len, &st,
-				  0, NULL, JB_PATH_DELETE);
+	enc = JsonbEncoderInit();
 
-	Assert(res != NULL);
+	setPath(enc, &root, path_elems, path_nulls, path_len, 0,
+			NULL, JB_PATH_DELETE);
 
-	PG_RETURN_JSONB_P(JsonbValueToJsonb(res));
+	PG_RETURN_JSONB_P(JsonbEncoderFinish(enc));
 }
 
 /*
@@ -4569,12 +4563,11 @@ jsonb_insert(PG_FUNCTION_ARGS)
 	ArrayType  *path = PG_GETARG_ARRAYTYPE_P(1);
 	Jsonb	   *newval = PG_GETARG_JSONB_P(2);
 	bool		after = PG_GETARG_BOOL(3);
-	JsonbValue *res = NULL;
+	JsonbValue	root;
 	Datum	   *path_elems;
 	bool	   *path_nulls;
 	int			path_len;
-	JsonbIterator *it;
-	JsonbParseState *st = NULL;
+	JsonbEncoder *enc;
 
 	if (ARR_NDIM(path) > 1)
 		ereport(ERROR,
@@ -4592,125 +4585,147 @@ jsonb_insert(PG_FUNCTION_ARGS)
 	if (path_len == 0)
 		PG_RETURN_JSONB_P(in);
 
-	it = JsonbIteratorInit(&in->root);
+	root.type = jbvBinary;
+	root.val.binary.data = &in->root;
+	root.val.binary.len = VARSIZE(in) - VARHDRSZ;
 
-	res = setPath(&it, path_elems, path_nulls, path_len, &st, 0, newval,
-				  after ? JB_PATH_INSERT_AFTER : JB_PATH_INSERT_BEFORE);
+	enc = JsonbEncoderInit();
 
-	Assert(res != NULL);
+	setPath(enc, &root, path_elems, path_nulls, path_len, 0,
+			newval, after ? JB_PATH_INSERT_AFTER : JB_PATH_INSERT_BEFORE);
 
-	PG_RETURN_JSONB_P(JsonbValueToJsonb(res));
+	PG_RETURN_JSONB_P(JsonbEncoderFinish(enc));
 }
 
 /*
- * Iterate over all jsonb objects and merge them into one.
- * The logic of this function copied from the same hstore function,
- * except the case, when it1 & it2 represents jbvObject.
- * In that case we just append the content of it2 to it1 without any
- * verifications.
+ * Concatenate two jsonb values.
+ *
+ * Two objects are merged, the pairs of the second one replacing the pairs
+ * of the first one with the same keys.  Otherwise, the elements of the
+ * arrays (with scalars taken as one-element arrays) or the objects are
+ * put into a new array.  The children of both values are copied as they
+ * are, without being decoded.
  */
-static JsonbValue *
-IteratorConcat(JsonbIterator **it1, JsonbIterator **it2,
-			   JsonbParseState **state)
+static Jsonb *
+concatJsonb(Jsonb *jb1, Jsonb *jb2)
 {
-	JsonbValue	v1,
-				v2,
-			   *res = NULL;
-	JsonbIteratorToken r1,
-				r2,
-				rk1,
-				rk2;
-
-	r1 = rk1 = JsonbIteratorNext(it1, &v1, false);
-	r2 = rk2 = JsonbIteratorNext(it2, &v2, false);
+	JsonbEncoder *enc;
 
 	/*
-	 * Both elements are objects.
+	 * array || object or object || array make an array, but scalar ||
+	 * object or object || scalar make no sense, so error out.
 	 */
-	if (rk1 == WJB_BEGIN_OBJECT && rk2 == WJB_BEGIN_OBJECT)
-	{
-		/*
-		 * Append the all tokens from v1 to res, except last WJB_END_OBJECT
-		 * (because res will not be finished yet).
-		 */
-		pushJsonbValue(state, r1, NULL);
-		while ((r1 = JsonbIteratorNext(it1, &v1, true)) != WJB_END_OBJECT)
-			pushJsonbValue(state, r1, &v1);
+	if (JB_ROOT_IS_OBJECT(jb1) != JB_ROOT_IS_OBJECT(jb2) &&
+		(JB_ROOT_IS_SCALAR(jb1) || JB_ROOT_IS_SCALAR(jb2)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid concatenation of jsonb objects")));
 
-		/*
-		 * Append the all tokens from v2 to res, include last WJB_END_OBJECT
-		 * (the concatenation will be completed).
-		 */
-		while ((r2 = JsonbIteratorNext(it2, &v2, true)) != WJB_DONE)
-			res = pushJsonbValue(state, r2, r2 != WJB_END_OBJECT ? &v2 : NULL);
-	}
+	enc = JsonbEncoderInit();
 
-	/*
-	 * Both elements are arrays (either can be scalar).
-	 */
-	else if (rk1 == WJB_BEGIN_ARRAY && rk2 == WJB_BEGIN_ARRAY)
+	if (JB_ROOT_IS_OBJECT(jb1) && JB_ROOT_IS_OBJECT(jb2))
 	{
-		pushJsonbValue(state, r1, NULL);
+		JsonbEncoderBeginContainer(enc, true);
+		mergeJsonbObjects(enc, &jb1->root, &jb2->root);
+		JsonbEncoderEndContainer(enc);
+	}
+	else
+	{
+		JsonbEncoderBeginContainer(enc, false);
 
-		while ((r1 = JsonbIteratorNext(it1, &v1, true)) != WJB_END_ARRAY)
-		{
-			Assert(r1 == WJB_ELEM);
-			pushJsonbValue(state, r1, &v1);
-		}
+		if (JB_ROOT_IS_OBJECT(jb1))
+			JsonbEncoderJsonb(enc, jb1);
+		else
+			JsonbEncoderArrayElements(enc, &jb1->root);
 
-		while ((r2 = JsonbIteratorNext(it2, &v2, true)) != WJB_END_ARRAY)
-		{
-			Assert(r2 == WJB_ELEM);
-			pushJsonbValue(state, WJB_ELEM, &v2);
-		}
+		if (JB_ROOT_IS_OBJECT(jb2))
+			JsonbEncoderJsonb(enc, jb2);
+		else
+			JsonbEncoderArrayElements(enc, &jb2->root);
 
-		res = pushJsonbValue(state, WJB_END_ARRAY, NULL /* signal to sort */ );
+		JsonbEncoderEndContainer(enc);
 	}
-	/* have we got array || object or object || array? */
-	else if (((rk1 == WJB_BEGIN_ARRAY && !(*it1)->isScalar) && rk2 == WJB_BEGIN_OBJECT) ||
-			 (rk1 == WJB_BEGIN_OBJECT && (rk2 == WJB_BEGIN_ARRAY && !(*it2)->isScalar)))
+
+	return JsonbEncoderFinish(enc);
+}
+
+/*
+ * Add the pairs of two objects to the current object of 'enc', leaving out
+ * the pairs of 'obj1' whose keys are also in 'obj2'.
+ *
+ * The keys of both objects are sorted, so a single merge pass finds the
+ * duplicates and adds the pairs in order.  Consecutive pairs taken from the
+ * same object are added as one run.
+ */
+static void
+mergeJsonbObjects(JsonbEncoder *enc, JsonbContainer *obj1,
+				  JsonbContainer *obj2)
+{
+	int			n1 = JsonContainerSize(obj1);
+	int			n2 = JsonContainerSize(obj2);
+	char	   *base_addr1 = (char *) &obj1->children[n1 * 2];
+	char	   *base_addr2 = (char *) &obj2->children[n2 * 2];
+	uint32		offset1 = 0,
+				offset2 = 0;
+	int			i = 0,
+				j = 0;
+	int			start1 = 0,
+				start2 = 0;
+
+	while (i < n1 && j < n2)
 	{
+		JsonbValue	key1,
+					key2;
+		uint32		end1 = offset1,
+					end2 = offset2;
+		int			difference;
 
-		JsonbIterator **it_array = rk1 == WJB_BEGIN_ARRAY ? it1 : it2;
-		JsonbIterator **it_object = rk1 == WJB_BEGIN_OBJECT ? it1 : it2;
+		JBE_ADVANCE_OFFSET(end1, obj1->children[i]);
+		JBE_ADVANCE_OFFSET(end2, obj2->children[j]);
 
-		bool		prepend = (rk1 == WJB_BEGIN_OBJECT);
+		key1.type = jbvString;
+		key1.val.string.val = base_addr1 + offset1;
+		key1.val.string.len = end1 - offset1;
+		key2.type = jbvString;
+		key2.val.string.val = base_addr2 + offset2;
+		key2.val.string.len = end2 - offset2;
 
-		pushJsonbValue(state, WJB_BEGIN_ARRAY, NULL);
+		difference = lengthCompareJsonbStringValue(&key1, &key2);
 
-		if (prepend)
+		if (difference < 0)
 		{
-			pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
-			while ((r1 = JsonbIteratorNext(it_object, &v1, true)) != WJB_DONE)
-				pushJsonbValue(state, r1, r1 != WJB_END_OBJECT ? &v1 : NULL);
+			/* the pair of obj1 goes next, after the pending ones of obj2 */
+			JsonbEncoderContainerChildren(enc, obj2, start2, j - start2);
+			start2 = j;
 
-			while ((r2 = JsonbIteratorNext(it_array, &v2, true)) != WJB_DONE)
-				res = pushJsonbValue(state, r2, r2 != WJB_END_ARRAY ? &v2 : NULL);
+			i++;
+			offset1 = end1;
 		}
 		else
 		{
-			while ((r1 = JsonbIteratorNext(it_array, &v1, true)) != WJB_END_ARRAY)
-				pushJsonbValue(state, r1, &v1);
+			/* the pair of obj2 goes next, after the pending ones of obj1 */
+			JsonbEncoderContainerChildren(enc, obj1, start1, i - start1);
+
+			/* the pair of obj1 with the same key is replaced */
+			if (difference == 0)
+			{
+				i++;
+				offset1 = end1;
+			}
 
-			pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
-			while ((r2 = JsonbIteratorNext(it_object, &v2, true)) != WJB_DONE)
-				pushJsonbValue(state, r2, r2 != WJB_END_OBJECT ? &v2 : NULL);
+			start1 = i;
 
-			res = pushJsonbValue(state, WJB_END_ARRAY, NULL);
+			j++;
+			offset2 = end2;
 		}
 	}
-	else
-	{
-		/*
-		 * This must be scalar || object or object || scalar, as that's all
-		 * that's left. Both of these make no sense, so error out.
-		 */
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("invalid concatenation of jsonb objects")));
-	}
 
-	return res;
+	/* Pending pairs of one object go before the rest of the other one */
+	JsonbEncoderContainerChildren(enc, obj1, start1, i - start1);
+	JsonbEncoderContainerChildren(enc, obj2, start2, j - start2);
+
+	JsonbEncoderContainerChildren(enc, obj1, i, n1 - i);
+	JsonbEncoderContainerChildren(enc, obj2, j, n2 - j);
 }
 
 /*
@@ -4726,15 +4741,17 @@ IteratorConcat(JsonbIterator **it1, JsonbIterator **it2,
  *
  * All path elements before the last must already exist
  * whatever bits in op_type are set, or nothing is done.
+ *
+ * The result is written by 'enc' straight from the binary input: only the
+ * containers on the path are rebuilt, while their other children are copied
+ * as they are, without being decoded.
  */
-static JsonbValue *
-setPath(JsonbIterator **it, Datum *path_elems,
-		bool *path_nulls, int path_len,
-		JsonbParseState **st, int level, Jsonb *newval, int op_type)
+static void
+setPath(JsonbEncoder *enc, JsonbValue *val, Datum *path_elems,
+		bool *path_nulls, int path_len, int level,
+		Jsonb *newval, int op_type)
 {
-	JsonbValue	v;
-	JsonbIteratorToken r;
-	JsonbValue *res;
+	JsonbContainer *container;
 
 	check_stack_depth();
 
@@ -4744,157 +4761,97 @@ setPath(JsonbIterator **it, Datum *path_elems,
 				 errmsg("path element at position %d is null",
 						level + 1)));
 
-	r = JsonbIteratorNext(it, &v, false);
-
-	switch (r)
+	if (val->type != jbvBinary)
 	{
-		case WJB_BEGIN_ARRAY:
-			(void) pushJsonbValue(st, r, NULL);
-			setPathArray(it, path_elems, path_nulls, path_len, st, level,
-						 newval, v.val.array.nElems, op_type);
-			r = JsonbIteratorNext(it, &v, false);
-			Assert(r == WJB_END_ARRAY);
-			res = pushJsonbValue(st, r, NULL);
-			break;
-		case WJB_BEGIN_OBJECT:
-			(void) pushJsonbValue(st, r, NULL);
-			setPathObject(it, path_elems, path_nulls, path_len, st, level,
-						  newval, v.val.object.nPairs, op_type);
-			r = JsonbIteratorNext(it, &v, true);
-			Assert(r == WJB_END_OBJECT);
-			res = pushJsonbValue(st, r, NULL);
-			break;
-		case WJB_ELEM:
-		case WJB_VALUE:
-			res = pushJsonbValue(st, r, &v);
-			break;
-		default:
-			elog(ERROR, "unrecognized iterator result: %d", (int) r);
-			res = NULL;			/* keep compiler quiet */
-			break;
+		/* the path goes through a scalar, leave it as it is */
+		JsonbEncoderScalar(enc, val);
+		return;
 	}
 
-	return res;
+	container = val->val.binary.data;
+
+	if (JsonContainerIsArray(container))
+		setPathArray(enc, container, path_elems, path_nulls, path_len,
+					 level, newval, op_type);
+	else
+		setPathObject(enc, container, path_elems, path_nulls, path_len,
+					  level, newval, op_type);
 }
 
 /*
  * Object walker for setPath
  */
 static void
-setPathObject(JsonbIterator **it, Datum *path_elems, bool *path_nulls,
-			  int path_len, JsonbParseState **st, int level,
-			  Jsonb *newval, uint32 npairs, int op_type)
+setPathObject(JsonbEncoder *enc, JsonbContainer *container,
+			  Datum *path_elems, bool *path_nulls, int path_len,
+			  int level, Jsonb *newval, int op_type)
 {
+	int			npairs = JsonContainerSize(container);
+	char	   *key = VARDATA_ANY(path_elems[level]);
+	int			keylen = VARSIZE_ANY_EXHDR(path_elems[level]);
 	JsonbValue	v;
-	int			i;
-	JsonbValue	k;
-	bool		done = false;
-
-	if (level >= path_len || path_nulls[level])
-		done = true;
+	int			pos;
+	bool		found;
 
-	/* empty object is a special case for create */
-	if ((npairs == 0) && (op_type & JB_PATH_CREATE_OR_INSERT) &&
-		(level == path_len - 1))
-	{
-		JsonbValue	newkey;
+	found = findJsonbKeyPosition(container, key, keylen, &pos, &v);
 
-		newkey.type = jbvString;
-		newkey.val.string.len = VARSIZE_ANY_EXHDR(path_elems[level]);
-		newkey.val.string.val = VARDATA_ANY(path_elems[level]);
+	JsonbEncoderBeginContainer(enc, true);
 
-		(void) pushJsonbValue(st, WJB_KEY, &newkey);
-		addJsonbToParseState(st, newval);
-	}
+	/* the pairs sorted before the key are unaffected */
+	JsonbEncoderContainerChildren(enc, container, 0, pos);
 
-	for (i = 0; i < npairs; i++)
+	if (found)
 	{
-		JsonbIteratorToken r = JsonbIteratorNext(it, &k, true);
-
-		Assert(r == WJB_KEY);
-
-		if (!done &&
-			k.val.string.len == VARSIZE_ANY_EXHDR(path_elems[level]) &&
-			memcmp(k.val.string.val, VARDATA_ANY(path_elems[level]),
-				   k.val.string.len) == 0)
+		if (level == path_len - 1)
 		{
-			if (level == path_len - 1)
-			{
-				/*
-				 * called from jsonb_insert(), it forbids redefining an
-				 * existing value
-				 */
-				if (op_type & (JB_PATH_INSERT_BEFORE | JB_PATH_INSERT_AFTER))
-					ereport(ERROR,
-							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-							 errmsg("cannot replace existing key"),
-							 errhint("Try using the function jsonb_set "
-									 "to replace key value.")));
+			/*
+			 * called from jsonb_insert(), it forbids redefining an existing
+			 * value
+			 */
+			if (op_type & (JB_PATH_INSERT_BEFORE | JB_PATH_INSERT_AFTER))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("cannot replace existing key"),
+						 errhint("Try using the function jsonb_set "
+								 "to replace key value.")));
 
-				r = JsonbIteratorNext(it, &v, true);	/* skip value */
-				if (!(op_type & JB_PATH_DELETE))
-				{
-					(void) pushJsonbValue(st, WJB_KEY, &k);
-					addJsonbToParseState(st, newval);
-				}
-				done = true;
-			}
-			else
+			if (!(op_type & JB_PATH_DELETE))
 			{
-				(void) pushJsonbValue(st, r, &k);
-				setPath(it, path_elems, path_nulls, path_len,
-						st, level + 1, newval, op_type);
+				JsonbEncoderKey(enc, key, keylen);
+				JsonbEncoderJsonb(enc, newval);
 			}
 		}
 		else
 		{
-			if ((op_type & JB_PATH_CREATE_OR_INSERT) && !done &&
-				level == path_len - 1 && i == npairs - 1)
-			{
-				JsonbValue	newkey;
-
-				newkey.type = jbvString;
-				newkey.val.string.len = VARSIZE_ANY_EXHDR(path_elems[level]);
-				newkey.val.string.val = VARDATA_ANY(path_elems[level]);
-
-				(void) pushJsonbValue(st, WJB_KEY, &newkey);
-				addJsonbToParseState(st, newval);
-			}
-
-			(void) pushJsonbValue(st, r, &k);
-			r = JsonbIteratorNext(it, &v, false);
-			(void) pushJsonbValue(st, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
-			if (r == WJB_BEGIN_ARRAY || r == WJB_BEGIN_OBJECT)
-			{
-				int			walking_level = 1;
+			JsonbEncoderKey(enc, key, keylen);
+			setPath(enc, &v, path_elems, path_nulls, path_len,
+					level + 1, newval, op_type);
+		}
 
-				while (walking_level != 0)
-				{
-					r = JsonbIteratorNext(it, &v, false);
+		pos++;
+	}
+	else if ((op_type & JB_PATH_CREATE_OR_INSERT) &&
+			 level == path_len - 1)
+	{
+		JsonbEncoderKey(enc, key, keylen);
+		JsonbEncoderJsonb(enc, newval);
+	}
 
-					if (r == WJB_BEGIN_ARRAY || r == WJB_BEGIN_OBJECT)
-						++walking_level;
-					if (r == WJB_END_ARRAY || r == WJB_END_OBJECT)
-						--walking_level;
+	JsonbEncoderContainerChildren(enc, container, pos, npairs - pos);
 
-					(void) pushJsonbValue(st, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
-				}
-			}
-		}
-	}
+	JsonbEncoderEndContainer(enc);
 }
 
 /*
  * Array walker for setPath
  */
 static void
-setPathArray(JsonbIterator **it, Datum *path_elems, bool *path_nulls,
-			 int path_len, JsonbParseState **st, int level,
-			 Jsonb *newval, uint32 nelems, int op_type)
+setPathArray(JsonbEncoder *enc, JsonbContainer *container,
+			 Datum *path_elems, bool *path_nulls, int path_len,
+			 int level, Jsonb *newval, int op_type)
 {
-	JsonbValue	v;
-	int			idx,
-				i;
+	int			nelems = JsonContainerSize(container);
+	int			idx;
 	bool		done = false;
 
 	/* pick correct index */
@@ -4928,6 +4885,8 @@ setPathArray(JsonbIterator **it, Datum *path_elems, bool *path_nulls,
 	if (idx > 0 && idx > nelems)
 		idx = nelems;
 
+	JsonbEncoderBeginContainer(enc, false);
+
 	/*
 	 * if we're creating, and idx == INT_MIN, we prepend the new value to the
 	 * array also if the array is empty - in which case we don't really care
@@ -4938,71 +4897,54 @@ setPathArray(JsonbIterator **it, Datum *path_elems, bool *path_nulls,
 		(op_type & JB_PATH_CREATE_OR_INSERT))
 	{
 		Assert(newval != NULL);
-		addJsonbToParseState(st, newval);
+		JsonbEncoderJsonb(enc, newval);
 		done = true;
 	}
 
-	/* iterate over the array elements */
-	for (i = 0; i < nelems; i++)
+	if (idx >= 0 && idx < nelems)
 	{
-		JsonbIteratorToken r;
+		/* the elements before and after idx are unaffected */
+		JsonbEncoderContainerChildren(enc, container, 0, idx);
 
-		if (i == idx && level < path_len)
+		if (level == path_len - 1)
 		{
-			if (level == path_len - 1)
-			{
-				r = JsonbIteratorNext(it, &v, true);	/* skip */
-
-				if (op_type & (JB_PATH_INSERT_BEFORE | JB_PATH_CREATE))
-					addJsonbToParseState(st, newval);
+			if (op_type & (JB_PATH_INSERT_BEFORE | JB_PATH_CREATE))
+				JsonbEncoderJsonb(enc, newval);
 
-				/*
-				 * We should keep current value only in case of
-				 * JB_PATH_INSERT_BEFORE or JB_PATH_INSERT_AFTER because
-				 * otherwise it should be deleted or replaced
-				 */
-				if (op_type & (JB_PATH_INSERT_AFTER | JB_PATH_INSERT_BEFORE))
-					(void) pushJsonbValue(st, r, &v);
+			/*
+			 * We should keep current value only in case of
+			 * JB_PATH_INSERT_BEFORE or JB_PATH_INSERT_AFTER because otherwise
+			 * it should be deleted or replaced
+			 */
+			if (op_type & (JB_PATH_INSERT_AFTER | JB_PATH_INSERT_BEFORE))
+				JsonbEncoderContainerChildren(enc, container, idx, 1);
 
-				if (op_type & (JB_PATH_INSERT_AFTER | JB_PATH_REPLACE))
-					addJsonbToParseState(st, newval);
+			if (op_type & (JB_PATH_INSERT_AFTER | JB_PATH_REPLACE))
+				JsonbEncoderJsonb(enc, newval);
 
-				done = true;
-			}
-			else
-				(void) setPath(it, path_elems, path_nulls, path_len,
-							   st, level + 1, newval, op_type);
+			done = true;
 		}
 		else
 		{
-			r = JsonbIteratorNext(it, &v, false);
-
-			(void) pushJsonbValue(st, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
-
-			if (r == WJB_BEGIN_ARRAY || r == WJB_BEGIN_OBJECT)
-			{
-				int			walking_level = 1;
-
-				while (walking_level != 0)
-				{
-					r = JsonbIteratorNext(it, &v, false);
+			JsonbValue *v = getIthJsonbValueFromContainer(container, idx);
 
-					if (r == WJB_BEGIN_ARRAY || r == WJB_BEGIN_OBJECT)
-						++walking_level;
-					if (r == WJB_END_ARRAY || r == WJB_END_OBJECT)
-						--walking_level;
+			setPath(enc, v, path_elems, path_nulls, path_len,
+					level + 1, newval, op_type);
+		}
 
-					(void) pushJsonbValue(st, r, r < WJB_BEGIN_ARRAY ? &v : NULL);
-				}
-			}
+		JsonbEncoderContainerChildren(enc, container, idx + 1,
+									  nelems - idx - 1);
+	}
+	else
+		JsonbEncoderContainerChildren(enc, container, 0, nelems);
 
-			if ((op_type & JB_PATH_CREATE_OR_INSERT) && !done &&
-				level == path_len - 1 && i == nelems - 1)
-			{
-				addJsonbToParseState(st, newval);
-			}
-		}
+	if ((op_type & JB_PATH_CREATE_OR_INSERT) && !done &&
+		level == path_len - 1)
+	{
+		JsonbEncoderJsonb(enc, newval);
 	}
+
+	JsonbEncoderEndContainer(enc);
 }
 
 /*
@@ -0,0 +1,197 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonkeyset.c
+ *	  Sets of json object keys for key uniqueness checks.
+ *
+ * The keys are kept in an open-addressing hash table generated by
+ * simplehash.h, which stores the hashes of the keys so that the keys
+ * themselves are compared only on hash matches.  The texts of the keys are
+ * copied into an arena of blocks owned by the set.  Both the table and the
+ * arena survive JsonKeySetReset(), so checking many objects with one set,
+ * as IS JSON does with a set per nesting level, allocates memory only for
+ * the widest object seen.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/jsonkeyset.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "utils/jsonkeyset.h"
+#include "utils/memutils.h"
+
+/* initial and maximum sizes of the arena blocks */
+#define JSON_KEY_SET_INIT_BLOCK_SIZE	1024
+#define JSON_KEY_SET_MAX_BLOCK_SIZE		(64 * 1024)
+
+typedef struct JsonKey
+{
+	const char *str;
+	int			len;
+} JsonKey;
+
+typedef struct JsonKeySetEntry
+{
+	JsonKey		key;
+	uint32		hash;			/* hash of the key */
+	char		status;			/* hash status */
+} JsonKeySetEntry;
+
+#define SH_PREFIX jsonkeys
+#define SH_ELEMENT_TYPE JsonKeySetEntry
+#define SH_KEY_TYPE JsonKey
+#define SH_KEY key
+#define SH_HASH_KEY(tb, key) \
+	DatumGetUInt32(hash_any((const unsigned char *) (key).str, (key).len))
+#define SH_EQUAL(tb, a, b) \
+	((a).len == (b).len && memcmp((a).str, (b).str, (a).len) == 0)
+#define SH_SCOPE static inline
+#define SH_STORE_HASH
+#define SH_GET_HASH(tb, a) a->hash
+#define SH_DEFINE
+#define SH_DECLARE
+#include "lib/simplehash.h"
+
+/* Arena block for the texts of the keys */
+typedef struct JsonKeySetBlock
+{
+	struct JsonKeySetBlock *next;	/* previous block */
+	Size		size;			/* size of data */
+	Size		used;			/* bytes of data in use */
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} JsonKeySetBlock;
+
+struct JsonKeySet
+{
+	MemoryContext mcxt;			/* context holding the set */
+	jsonkeys_hash *hash;		/* keys */
+	JsonKeySetBlock *blocks;	/* arena blocks, the current one first */
+};
+
+/*
+ * JsonKeySetCreate: create an empty key set in memory context 'mcxt', with
+ * room for about 'nkeys' keys before it has to grow
+ */
+JsonKeySet *
+JsonKeySetCreate(MemoryContext mcxt, int nkeys)
+{
+	JsonKeySet *set = MemoryContextAlloc(mcxt, sizeof(JsonKeySet));
+
+	set->mcxt = mcxt;
+	set->hash = jsonkeys_create(mcxt, Max(nkeys, 8), NULL);
+	set->blocks = NULL;
+
+	return set;
+}
+
+/*
+ * Copy a key into the arena of the set.
+ */
+static const char *
+json_key_set_copy(JsonKeySet *set, const char *key, int len)
+{
+	JsonKeySetBlock *block = set->blocks;
+	char	   *copy;
+
+	if (!block || block->size - block->used < len)
+	{
+		Size		size = JSON_KEY_SET_INIT_BLOCK_SIZE;
+
+		if (block)
+			size = Min(block->size * 2, JSON_KEY_SET_MAX_BLOCK_SIZE);
+
+		/* keys larger than the block size get a block of their own */
+		size = Max(size, len);
+
+		block = MemoryContextAlloc(set->mcxt,
+								   offsetof(JsonKeySetBlock, data) + size);
+		block->next = set->blocks;
+		block->size = size;
+		block->used = 0;
+		set->blocks = block;
+	}
+
+	copy = &block->data[block->used];
+	memcpy(copy, key, len);
+	block->used += len;
+
+	return copy;
+}
+
+/*
+ * JsonKeySetAdd: add the key of 'len' bytes at 'key' to the set
+ *
+ * Returns false if the set already contains the key.
+ */
+bool
+JsonKeySetAdd(JsonKeySet *set, const char *key, int len)
+{
+	JsonKey		k;
+	JsonKeySetEntry *entry;
+	bool		found;
+
+	k.str = key;
+	k.len = len;
+
+	entry = jsonkeys_insert(set->hash, k, &found);
+
+	if (found)
+		return false;
+
+	entry->key.str = json_key_set_copy(set, key, len);
+
+	return true;
+}
+
+/*
+ * JsonKeySetReset: remove all keys from the set
+ *
+ * The memory of the set is kept for reuse, except for the arena blocks
+ * other than the current one.
+ */
+void
+JsonKeySetReset(JsonKeySet *set)
+{
+	JsonKeySetBlock *block = set->blocks;
+
+	jsonkeys_reset(set->hash);
+
+	if (!block)
+		return;
+
+	while (block->next)
+	{
+		JsonKeySetBlock *next = block->next;
+
+		block->next = next->next;
+		pfree(next);
+	}
+
+	block->used = 0;
+}
+
+/*
+ * JsonKeySetFree: free all memory of the set
+ */
+void
+JsonKeySetFree(JsonKeySet *set)
+{
+	JsonKeySetBlock *block = set->blocks;
+
+	while (block)
+	{
+		JsonKeySetBlock *next = block->next;
+
+		pfree(block);
+		block = next;
+	}
+
+	jsonkeys_destroy(set->hash);
+	pfree(set);
+}
@@ -70,6 +70,7 @@
 #include "utils/builtins.h"
 #include "utils/json.h"
 #include "utils/jsonpath.h"
+#include "utils/memutils.h"
 
 
 static Datum jsonPathFromCstring(char *in, int len);
@@ -955,6 +956,9 @@ void
 jspInitByBuffer(JsonPathItem *v, char *base, int32 pos)
 {
 	v->base = base + pos;
+	v->compiledNext = NULL;
+	v->compiledArgs = NULL;
+	v->compiledVarSlot = -1;
 
 	read_byte(v->type, base, pos);
 	pos = INTALIGN((uintptr_t) (base + pos)) - (uintptr_t) base;
@@ -1051,9 +1055,14 @@ jspGetArg(JsonPathItem *v, JsonPathItem *a)
 		   v->type == jpiExists ||
 		   v->type == jpiPlus ||
 		   v->type == jpiMinus ||
-		   v->type == jpiArray);
+		   v->type == jpiArray ||
+		   v->type == jpiLikeRegex);
 
-	jspInitByBuffer(a, v->base, v->content.arg);
+	if (v->compiledArgs)
+		*a = *v->compiledArgs[0];
+	else
+		jspInitByBuffer(a, v->base, v->type == jpiLikeRegex ?
+						v->content.like_regex.expr : v->content.arg);
 }
 
 bool
@@ -1106,7 +1115,12 @@ jspGetNext(JsonPathItem *v, JsonPathItem *a)
 			   v->type == jpiArray ||
 			   v->type == jpiObject);
 
-		if (a)
+		if (!a)
+			return true;
+
+		if (v->compiledNext)
+			*a = *v->compiledNext;
+		else
 			jspInitByBuffer(a, v->base, v->nextPos);
 		return true;
 	}
@@ -1133,7 +1147,10 @@ jspGetLeftArg(JsonPathItem *v, JsonPathItem *a)
 		   v->type == jpiDatetime ||
 		   v->type == jpiStartsWith);
 
-	jspInitByBuffer(a, v->base, v->content.args.left);
+	if (v->compiledArgs)
+		*a = *v->compiledArgs[0];
+	else
+		jspInitByBuffer(a, v->base, v->content.args.left);
 }
 
 void
@@ -1155,7 +1172,10 @@ jspGetRightArg(JsonPathItem *v, JsonPathItem *a)
 		   v->type == jpiDatetime ||
 		   v->type == jpiStartsWith);
 
-	jspInitByBuffer(a, v->base, v->content.args.right);
+	if (v->compiledArgs)
+		*a = *v->compiledArgs[1];
+	else
+		jspInitByBuffer(a, v->base, v->content.args.right);
 }
 
 bool
@@ -1192,12 +1212,18 @@ jspGetArraySubscript(JsonPathItem *v, JsonPathItem *from, JsonPathItem *to,
 {
 	Assert(v->type == jpiIndexArray);
 
-	jspInitByBuffer(from, v->base, v->content.array.elems[i].from);
+	if (v->compiledArgs)
+		*from = *v->compiledArgs[i * 2];
+	else
+		jspInitByBuffer(from, v->base, v->content.array.elems[i].from);
 
 	if (!v->content.array.elems[i].to)
 		return false;
 
-	jspInitByBuffer(to, v->base, v->content.array.elems[i].to);
+	if (v->compiledArgs)
+		*to = *v->compiledArgs[i * 2 + 1];
+	else
+		jspInitByBuffer(to, v->base, v->content.array.elems[i].to);
 
 	return true;
 }
@@ -1207,13 +1233,202 @@ jspGetSequenceElement(JsonPathItem *v, int i, JsonPathItem *elem)
 {
 	Assert(v->type == jpiSequence);
 
-	jspInitByBuffer(elem, v->base, v->content.sequence.elems[i]);
+	if (v->compiledArgs)
+		*elem = *v->compiledArgs[i];
+	else
+		jspInitByBuffer(elem, v->base, v->content.sequence.elems[i]);
 }
 
 void
 jspGetObjectField(JsonPathItem *v, int i, JsonPathItem *key, JsonPathItem *val)
 {
 	Assert(v->type == jpiObject);
-	jspInitByBuffer(key, v->base, v->content.object.fields[i].key);
-	jspInitByBuffer(val, v->base, v->content.object.fields[i].val);
+
+	if (v->compiledArgs)
+	{
+		*key = *v->compiledArgs[i * 2];
+		*val = *v->compiledArgs[i * 2 + 1];
+	}
+	else
+	{
+		jspInitByBuffer(key, v->base, v->content.object.fields[i].key);
+		jspInitByBuffer(val, v->base, v->content.object.fields[i].val);
+	}
+}
+
+/*
+ * Assign the slot of a variable of a compiled jsonpath, adding it to the
+ * distinct variables of 'cjp' if its name is seen for the first time.
+ */
+static void
+jspCompileVariable(JsonPathCompiled *cjp, JsonPathItem *v)
+{
+	int32		len;
+	char	   *name = jspGetString(v, &len);
+	int			i;
+
+	for (i = 0; i < cjp->nvars; i++)
+	{
+		int32		vlen;
+		char	   *vname = jspGetString(cjp->vars[i], &vlen);
+
+		if (vlen == len && !memcmp(vname, name, len))
+			break;
+	}
+
+	if (i == cjp->nvars)
+	{
+		cjp->vars = cjp->nvars ?
+			repalloc(cjp->vars, sizeof(*cjp->vars) * (cjp->nvars + 1)) :
+			palloc(sizeof(*cjp->vars));
+		cjp->vars[cjp->nvars++] = v;
+	}
+
+	v->compiledVarSlot = i;
+}
+
+/*
+ * Recursively decode path item at position 'pos' of 'base' together with all
+ * its operands and next items, and link them with direct pointers.
+ */
+static JsonPathItem *
+jspCompileItem(JsonPathCompiled *cjp, char *base, int32 pos)
+{
+	JsonPathItem *v = palloc(sizeof(*v));
+	int32		args[2];
+	int32	   *links = NULL;
+	int			nlinks = 0;
+	int			i;
+
+	check_stack_depth();
+
+	jspInitByBuffer(v, base, pos);
+
+	switch (v->type)
+	{
+		case jpiAnd:
+		case jpiOr:
+		case jpiAdd:
+		case jpiSub:
+		case jpiMul:
+		case jpiDiv:
+		case jpiMod:
+		case jpiEqual:
+		case jpiNotEqual:
+		case jpiLess:
+		case jpiGreater:
+		case jpiLessOrEqual:
+		case jpiGreaterOrEqual:
+		case jpiStartsWith:
+		case jpiDatetime:
+			args[0] = v->content.args.left;
+			args[1] = v->content.args.right;
+			links = args;
+			nlinks = 2;
+			break;
+		case jpiLikeRegex:
+			links = &v->content.like_regex.expr;
+			nlinks = 1;
+			break;
+		case jpiNot:
+		case jpiExists:
+		case jpiIsUnknown:
+		case jpiPlus:
+		case jpiMinus:
+		case jpiFilter:
+		case jpiArray:
+			links = &v->content.arg;
+			nlinks = 1;
+			break;
+		case jpiIndexArray:
+			links = (int32 *) v->content.array.elems;
+			nlinks = v->content.array.nelems * 2;
+			break;
+		case jpiSequence:
+			links = v->content.sequence.elems;
+			nlinks = v->content.sequence.nelems;
+			break;
+		case jpiObject:
+			links = (int32 *) v->content.object.fields;
+			nlinks = v->content.object.nfields * 2;
+			break;
+		case jpiVariable:
+			jspCompileVariable(cjp, v);
+			break;
+		default:
+			break;
+	}
+
+	if (nlinks > 0)
+	{
+		JsonPathItem **compiledArgs = palloc(sizeof(*compiledArgs) * nlinks);
+
+		/* zero position means absent optional operand */
+		for (i = 0; i < nlinks; i++)
+			compiledArgs[i] = links[i] ?
+				jspCompileItem(cjp, v->base, links[i]) : NULL;
+
+		v->compiledArgs = compiledArgs;
+	}
+
+	if (jspHasNext(v))
+		v->compiledNext = jspCompileItem(cjp, v->base, v->nextPos);
+
+	return v;
+}
+
+/*
+ * Build compiled form of jsonpath in a private child context of 'mcxt'.
+ *
+ * The jsonpath is copied, so the result does not depend on the lifetime of
+ * the source value.
+ */
+JsonPathCompiled *
+jspCompile(JsonPath *js, MemoryContext mcxt)
+{
+	JsonPathCompiled *cjp;
+	MemoryContext oldcxt;
+
+	Assert((js->header & ~JSONPATH_LAX) == JSONPATH_VERSION);
+
+	mcxt = AllocSetContextCreate(mcxt, "compiled jsonpath",
+								 ALLOCSET_SMALL_SIZES);
+	oldcxt = MemoryContextSwitchTo(mcxt);
+
+	cjp = palloc(sizeof(*cjp));
+	cjp->mcxt = mcxt;
+	cjp->path = palloc(VARSIZE(js));
+	memcpy(cjp->path, js, VARSIZE(js));
+	cjp->nvars = 0;
+	cjp->vars = NULL;
+	cjp->root = jspCompileItem(cjp, cjp->path->data, 0);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	return cjp;
+}
+
+/*
+ * Get compiled form of jsonpath reusing the one cached in '*cache' if it was
+ * built for the same jsonpath value.  Otherwise, the cached value is replaced
+ * with the newly compiled one allocated in 'mcxt'.
+ */
+JsonPathCompiled *
+jspGetCompiled(JsonPathCompiled **cache, JsonPath *js, MemoryContext mcxt)
+{
+	JsonPathCompiled *cjp = *cache;
+
+	if (cjp)
+	{
+		if (VARSIZE(cjp->path) == VARSIZE(js) &&
+			!memcmp(cjp->path, js, VARSIZE(js)))
+			return cjp;
+
+		MemoryContextDelete(cjp->mcxt);
+		*cache = NULL;
+	}
+
+	*cache = cjp = jspCompile(js, mcxt);
+
+	return cjp;
 }
@@ -71,6 +71,7 @@
 #include "utils/date.h"
 #include "utils/datetime.h"
 #include "utils/datum.h"
+#include "utils/expandeddatum.h"
 #include "utils/formatting.h"
 #include "utils/float.h"
 #include "utils/guc.h"
@@ -142,6 +143,18 @@ typedef int (*JsonPathVarCallback) (void *vars, bool isJsonb,
 									char *varName, int varNameLen,
 									JsonItem *val, JsonbValue *baseObject);
 
+/*
+ * Value of a variable of a compiled jsonpath, resolved on its first reference
+ * in an execution (see getJsonPathVariable()).
+ */
+typedef struct JsonPathVarSlot
+{
+	bool		resolved;		/* fields below are set */
+	int			baseObjectId;	/* id of the base object, -1 if not found */
+	JsonItem	baseObject;
+	JsonItem	value;
+} JsonPathVarSlot;
+
 /*
  * Context of jsonpath execution.
  */
@@ -165,6 +178,11 @@ typedef struct JsonPathExecContext
 	bool		throwErrors;	/* with "false" all suppressible errors are
 								 * suppressed */
 	bool		isJsonb;
+	JsonbLookupCache *keyCache; /* for key lookups in large jsonb objects,
+								 * created on demand */
+	JsonPathVarSlot *varSlots;	/* values of variables by compiled slot,
+								 * allocated on demand */
+	int			nvarSlots;
 } JsonPathExecContext;
 
 /* Context for LIKE_REGEX execution. */
@@ -194,12 +212,18 @@ typedef enum JsonPathExecResult
 
 /*
  * List of SQL/JSON items with shortcut for single-value list.
+ *
+ * If 'countOnly' is set, appended items are not stored but only counted.
+ * This allows to evaluate the complete sequence, which is necessary for
+ * checking the absence of errors in strict mode, without materializing
+ * copies of its items.
  */
 typedef struct JsonValueList
 {
 	JsonItem   *head;
 	JsonItem   *tail;
 	int			length;
+	bool		countOnly;
 } JsonValueList;
 
 typedef struct JsonValueListIterator
@@ -222,19 +246,56 @@ typedef struct JsonPathUserFuncContext
 	bool		silent;			/* error suppression flag */
 } JsonPathUserFuncContext;
 
+/*
+ * Read-only expanded object referencing a SQL/JSON item.
+ *
+ * JSON_TABLE passes its current row item to column expressions in this form,
+ * so that column paths are executed directly against the item, which is
+ * usually a jbvBinary pointer into the document, instead of a copy of it.
+ * Consumers that need a flat json[b] datum get one through the standard
+ * expanded object flattening.
+ */
+typedef struct JsonItemRef
+{
+	ExpandedObjectHeader hdr;
+	JsonItem   *item;			/* referenced item */
+	bool		isJsonb;
+	bool		projected;		/* item is a result of leading key accessor
+								 * of the path it is queried with */
+	JsonPathItem *resume;		/* rest of that path, NULL if none */
+	MemoryContext flatcxt;		/* context for the flattened copy */
+	Jsonx	   *flat;			/* flattened item, if it was requested */
+} JsonItemRef;
+
 /* Structures for JSON_TABLE execution  */
 typedef struct JsonTableScanState JsonTableScanState;
 typedef struct JsonTableJoinState JsonTableJoinState;
 
+/*
+ * Leading keys of simple "$.key[.key...]" column paths of a scan, which are
+ * fetched from the row object together in a single pass.
+ */
+typedef struct JsonTableProjection
+{
+	int			nkeys;
+	JsonbValue *keys;			/* distinct keys in jsonb key order */
+	JsonbValue *values;			/* their values in the current row */
+	bool	   *found;			/* which of them are present in the row */
+	bool		valid;			/* values are fetched for the current row */
+} JsonTableProjection;
+
 struct JsonTableScanState
 {
 	JsonTableScanState *parent;
 	JsonTableJoinState *nested;
 	MemoryContext mcxt;
-	JsonPath   *path;
+	JsonPathCompiled *path;
 	List	   *args;
 	JsonValueList found;
 	JsonValueListIterator iter;
+	JsonItem   *currentItem;	/* current row item */
+	JsonItemRef *currentRef;	/* reference to it passed to columns */
+	JsonTableProjection *proj;	/* projection of simple columns, if any */
 	Datum		current;
 	int			ordinal;
 	bool		currentIsNull;
@@ -270,6 +331,11 @@ typedef struct JsonTableContext
 	{
 		ExprState  *expr;
 		JsonTableScanState *scan;
+		int			projKey;	/* index of the leading key in the scan's
+								 * projection, -1 if not projected */
+		JsonItemRef *projRef;	/* projected context item reference */
+		JsonItem	projItem;	/* projected context item */
+		Datum		current;	/* context item passed to 'expr' */
 	}		   *colexprs;
 	JsonTableScanState root;
 	bool		empty;
@@ -310,9 +376,17 @@ static void freeUserFuncContext(JsonPathUserFuncContext *cxt);
 static JsonPathExecResult executeUserFunc(FunctionCallInfo fcinfo,
 				JsonPathUserFuncContext *cxt, bool isJsonb, bool copy);
 
-static JsonPathExecResult executeJsonPath(JsonPath *path, void *vars,
-				JsonPathVarCallback getVar, Jsonx *json, bool isJsonb,
-				bool throwErrors, JsonValueList *result);
+static JsonPathExecResult executeJsonPath(JsonPath *path, JsonPathItem *root,
+				void *vars, JsonPathVarCallback getVar, Jsonx *json,
+				bool isJsonb, bool throwErrors, JsonValueList *result);
+static JsonPathExecResult executeJsonPathItem(JsonPath *path,
+				JsonPathItem *root, void *vars, JsonPathVarCallback getVar,
+				JsonItem *item, bool isJsonb, bool throwErrors,
+				JsonValueList *result);
+static void JsonxInitRootItem(JsonItem *jsi, Jsonx *json, bool isJsonb);
+static JsonPathExecResult executeJsonPathDatum(JsonPathCompiled *jp,
+					 List *vars, Datum jb, bool isJsonb, bool throwErrors,
+					 JsonValueList *result);
 static JsonPathExecResult executeItem(JsonPathExecContext *cxt,
 			JsonPathItem *jsp, JsonItem *jb, JsonValueList *found);
 static JsonPathExecResult executeItemOptUnwrapTarget(JsonPathExecContext *cxt,
@@ -394,6 +468,7 @@ static JsonPathExecResult getArrayIndex(JsonPathExecContext *cxt,
 static JsonBaseObjectInfo setBaseObject(JsonPathExecContext *cxt,
 			  JsonItem *jsi, int32 id);
 static void JsonValueListClear(JsonValueList *jvl);
+static void JsonValueListInitCounter(JsonValueList *jvl);
 static void JsonValueListAppend(JsonValueList *jvl, JsonItem *jbv);
 static int	JsonValueListLength(const JsonValueList *jvl);
 static bool JsonValueListIsEmpty(JsonValueList *jvl);
@@ -414,8 +489,8 @@ static text *JsonItemUnquoteText(JsonItem *jsi, bool isJsonb);
 static JsonItem *wrapJsonObjectOrArray(JsonItem *js, JsonItem *buf,
 					  bool isJsonb);
 
-static JsonItem *getJsonObjectKey(JsonItem *jb, char *keystr, int keylen,
-				 bool isJsonb, JsonItem *val);
+static JsonItem *getJsonObjectKey(JsonPathExecContext *cxt, JsonItem *jb,
+				 char *keystr, int keylen, JsonItem *val);
 static JsonItem *getJsonArrayElement(JsonItem *jb, uint32 index, bool isJsonb,
 					JsonItem *elem);
 
@@ -429,6 +504,8 @@ static Jsonx *JsonbValueToJsonx(JsonbValue *jbv, bool isJsonb);
 static bool tryToParseDatetime(text *fmt, text *datetime, char *tzname,
 				   bool strict, Datum *value, Oid *typid,
 				   int32 *typmod, int *tzp, bool throwErrors);
+static bool tryToParseIsoDatetime(const char *str, int len, Datum *value,
+					  Oid *typid, int *tzp);
 static int compareDatetime(Datum val1, Oid typid1, int tz1,
 				Datum val2, Oid typid2, int tz2,
 				bool *error);
@@ -764,6 +841,7 @@ executeUserFunc(FunctionCallInfo fcinfo, JsonPathUserFuncContext *cxt,
 		PG_DETOAST_DATUM_COPY(js_toasted);
 	Jsonx	   *js = DatumGetJsonxP(js_detoasted, isJsonb);
 	JsonPath   *jp = copy ? PG_GETARG_JSONPATH_P_COPY(1) : PG_GETARG_JSONPATH_P(1);
+	JsonPathItem *root = NULL;
 	struct varlena *vars_detoasted = NULL;
 	Jsonx	   *vars = NULL;
 	bool		silent = true;
@@ -793,7 +871,22 @@ executeUserFunc(FunctionCallInfo fcinfo, JsonPathUserFuncContext *cxt,
 		memset(&cxt->found, 0, sizeof(cxt->found));
 	}
 
-	res = executeJsonPath(jp, vars, getJsonPathVariableFromJsonx,
+	/*
+	 * Compiled jsonpath is cached in fn_extra, so it is built only once per
+	 * query when the same jsonpath is passed in each call.  Set-returning
+	 * functions keep their FuncCallContext there, so they are executed over
+	 * the raw jsonpath.
+	 */
+	if (!copy && fcinfo->flinfo)
+	{
+		JsonPathCompiled *cjp =
+			jspGetCompiled((JsonPathCompiled **) &fcinfo->flinfo->fn_extra,
+						   jp, fcinfo->flinfo->fn_mcxt);
+
+		root = cjp->root;
+	}
+
+	res = executeJsonPath(jp, root, vars, getJsonPathVariableFromJsonx,
 						  js, isJsonb, !silent, cxt ? &cxt->found : NULL);
 
 	if (!cxt && !copy)
@@ -821,6 +914,7 @@ executeUserFunc(FunctionCallInfo fcinfo, JsonPathUserFuncContext *cxt,
  * Interface to jsonpath executor
  *
  * 'path' - jsonpath to be executed
+ * 'root' - pre-decoded root item of compiled 'path', or NULL
  * 'vars' - variables to be substituted to jsonpath
  * 'json' - target document for jsonpath evaluation
  * 'throwErrors' - whether we should throw suppressible errors
@@ -836,29 +930,39 @@ executeUserFunc(FunctionCallInfo fcinfo, JsonPathUserFuncContext *cxt,
  * In other case it tries to find all the satisfied result items.
  */
 static JsonPathExecResult
-executeJsonPath(JsonPath *path, void *vars, JsonPathVarCallback getVar,
-				Jsonx *json, bool isJsonb, bool throwErrors,
-				JsonValueList *result)
+executeJsonPath(JsonPath *path, JsonPathItem *root, void *vars,
+				JsonPathVarCallback getVar, Jsonx *json, bool isJsonb,
+				bool throwErrors, JsonValueList *result)
+{
+	JsonItem	jsi;
+
+	JsonxInitRootItem(&jsi, json, isJsonb);
+
+	return executeJsonPathItem(path, root, vars, getVar, &jsi, isJsonb,
+							   throwErrors, result);
+}
+
+/*
+ * Execute jsonpath against an already decoded root item.
+ *
+ * The item is typically a jbvBinary reference into some enclosing document,
+ * so a nested part of a document can be queried without serializing it.
+ */
+static JsonPathExecResult
+executeJsonPathItem(JsonPath *path, JsonPathItem *root, void *vars,
+					JsonPathVarCallback getVar, JsonItem *item, bool isJsonb,
+					bool throwErrors, JsonValueList *result)
 {
 	JsonPathExecContext cxt;
 	JsonPathExecResult res;
 	JsonPathItem jsp;
-	JsonItem	jsi;
-	JsonbValue *jbv = JsonItemJbv(&jsi);
-	JsonItemStackEntry root;
-
-	jspInit(&jsp, path);
+	JsonItem	jsi = *item;
+	JsonItemStackEntry rootEntry;
 
-	if (isJsonb)
-	{
-		if (!JsonbExtractScalar(&json->jb.root, jbv))
-			JsonbInitBinary(jbv, &json->jb);
-	}
+	if (root)
+		jsp = *root;
 	else
-	{
-		if (!JsonExtractScalar(&json->js.root, jbv))
-			JsonInitBinary(jbv, &json->js);
-	}
+		jspInit(&jsp, path);
 
 	cxt.vars = vars;
 	cxt.getVar = getVar;
@@ -873,28 +977,40 @@ executeJsonPath(JsonPath *path, void *vars, JsonPathVarCallback getVar,
 	cxt.innermostArraySize = -1;
 	cxt.throwErrors = throwErrors;
 	cxt.isJsonb = isJsonb;
+	cxt.keyCache = NULL;
+	cxt.varSlots = NULL;
+	cxt.nvarSlots = 0;
 
-	pushJsonItem(&cxt.stack, &root, cxt.root);
+	pushJsonItem(&cxt.stack, &rootEntry, cxt.root);
 
 	if (jspStrictAbsenseOfErrors(&cxt) && !result)
 	{
 		/*
-		 * In strict mode we must get a complete list of values to check that
-		 * there are no errors at all.
+		 * In strict mode we must evaluate a complete sequence of values to
+		 * check that there are no errors at all, but its items are only
+		 * counted.
 		 */
-		JsonValueList vals = {0};
+		JsonValueList vals;
+
+		JsonValueListInitCounter(&vals);
 
 		res = executeItem(&cxt, &jsp, &jsi, &vals);
 
-		if (jperIsError(res))
-			return res;
+		if (!jperIsError(res))
+			res = JsonValueListIsEmpty(&vals) ? jperNotFound : jperOk;
+	}
+	else
+	{
+		res = executeItem(&cxt, &jsp, &jsi, result);
 
-		return JsonValueListIsEmpty(&vals) ? jperNotFound : jperOk;
+		Assert(!throwErrors || !jperIsError(res));
 	}
 
-	res = executeItem(&cxt, &jsp, &jsi, result);
+	if (cxt.keyCache)
+		JsonbLookupCacheFree(cxt.keyCache);
 
-	Assert(!throwErrors || !jperIsError(res));
+	if (cxt.varSlots)
+		pfree(cxt.varSlots);
 
 	return res;
 }
@@ -963,7 +1079,7 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 				int			keylen;
 				char	   *key = jspGetString(jsp, &keylen);
 
-				jb = getJsonObjectKey(jb, key, keylen, cxt->isJsonb, &val);
+				jb = getJsonObjectKey(cxt, jb, key, keylen, &val);
 
 				if (jb != NULL)
 				{
@@ -1141,9 +1257,9 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 						JsonItem	valbuf;
 						JsonItem   *val;
 
-						val = getJsonObjectKey(jb, JsonItemString(key).val,
+						val = getJsonObjectKey(cxt, jb, JsonItemString(key).val,
 											   JsonItemString(key).len,
-											   cxt->isJsonb, &valbuf);
+											   &valbuf);
 
 						if (val)
 						{
@@ -1581,7 +1697,7 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 			{
 				JsonbValue	jbvbuf;
 				Datum		value;
-				text	   *datetime;
+				text	   *datetime = NULL;
 				Oid			typid;
 				int32		typmod = -1;
 				int			tz = PG_INT32_MIN;
@@ -1644,9 +1760,6 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 													"be applied to a string or number",
 													jspOperationName(jsp->type)))));
 
-				datetime = cstring_to_text_with_len(JsonItemString(jb).val,
-													JsonItemString(jb).len);
-
 				if (jsp->content.args.left)
 				{
 					text	   *template;
@@ -1710,6 +1823,8 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 					{
 						template = cstring_to_text_with_len(template_str,
 															template_len);
+						datetime = cstring_to_text_with_len(JsonItemString(jb).val,
+															JsonItemString(jb).len);
 
 						if (tryToParseDatetime(template, datetime, tzname, false,
 											   &value, &typid, &typmod,
@@ -1720,6 +1835,17 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 					}
 				}
 
+				/*
+				 * Try the fast path for the usual spelling of dated ISO
+				 * formats first.  The default time-zone, if any, is left to the
+				 * generic code below.
+				 */
+				if (res == jperNotFound && !tzname &&
+					tryToParseIsoDatetime(JsonItemString(jb).val,
+										  JsonItemString(jb).len,
+										  &value, &typid, &tz))
+					res = jperOk;
+
 				if (res == jperNotFound)
 				{
 					/* Try to recognize one of ISO formats. */
@@ -1738,6 +1864,9 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 					static text *fmt_txt[lengthof(fmt_str)] = {0};
 					int			i;
 
+					datetime = cstring_to_text_with_len(JsonItemString(jb).val,
+														JsonItemString(jb).len);
+
 					for (i = 0; i < lengthof(fmt_str); i++)
 					{
 						if (!fmt_txt[i])
@@ -1771,7 +1900,8 @@ executeItemOptUnwrapTarget(JsonPathExecContext *cxt, JsonPathItem *jsp,
 				if (tzname)
 					pfree(tzname);
 
-				pfree(datetime);
+				if (datetime)
+					pfree(datetime);
 
 				if (jperIsError(res))
 					break;
@@ -1963,7 +2093,9 @@ executeItemUnwrapTargetArray(JsonPathExecContext *cxt, JsonPathItem *jsp,
 			{
 				if (found)
 				{
-					JsonItem   *jsi = palloc(sizeof(*jsi));
+					JsonItem	buf;
+					JsonItem   *jsi = found->countOnly ? &buf :
+						palloc(sizeof(*jsi));
 
 					JsonValueListAppend(found, JsonbValueToJsonItem(elem, jsi));
 				}
@@ -2006,7 +2138,9 @@ executeNextItem(JsonPathExecContext *cxt,
 		return executeItem(cxt, next, v, found);
 
 	if (found)
-		JsonValueListAppend(found, copy ? copyJsonItem(v) : v);
+		JsonValueListAppend(found,
+							copy && !found->countOnly ?
+							copyJsonItem(v) : v);
 
 	return jperOk;
 }
@@ -2040,7 +2174,7 @@ executeItemOptUnwrapResult(JsonPathExecContext *cxt, JsonPathItem *jsp,
 		if (count == 1 &&
 			JsonbType((item = JsonValueListHead(&seq))) != jbvArray)
 		{
-			if (JsonValueListIsEmpty(found))
+			if (JsonValueListIsEmpty(found) && !found->countOnly)
 				*found = seq;
 			else
 				JsonValueListAppend(found, item);
@@ -2168,8 +2302,7 @@ executeBoolItem(JsonPathExecContext *cxt, JsonPathItem *jsp,
 				 */
 				JsonLikeRegexContext lrcxt = {0};
 
-				jspInitByBuffer(&larg, jsp->base,
-								jsp->content.like_regex.expr);
+				jspGetArg(jsp, &larg);
 
 				return executePredicate(cxt, jsp, &larg, NULL, jb, false,
 										executeLikeRegex, &lrcxt);
@@ -2181,13 +2314,16 @@ executeBoolItem(JsonPathExecContext *cxt, JsonPathItem *jsp,
 			if (jspStrictAbsenseOfErrors(cxt))
 			{
 				/*
-				 * In strict mode we must get a complete list of values to
-				 * check that there are no errors at all.
+				 * In strict mode we must evaluate a complete sequence of
+				 * values to check that there are no errors at all.
 				 */
-				JsonValueList vals = {0};
-				JsonPathExecResult res =
-				executeItemOptUnwrapResultNoThrow(cxt, &larg, jb,
-												  false, &vals);
+				JsonValueList vals;
+				JsonPathExecResult res;
+
+				JsonValueListInitCounter(&vals);
+
+				res = executeItemOptUnwrapResultNoThrow(cxt, &larg, jb,
+														false, &vals);
 
 				if (jperIsError(res))
 					return jpbUnknown;
@@ -2294,7 +2430,9 @@ executeAnyItem(JsonPathExecContext *cxt, JsonPathItem *jsp, JsonbContainer *jbc,
 						break;
 				}
 				else if (found)
-					JsonValueListAppend(found, copyJsonItem(&v));
+					JsonValueListAppend(found,
+										found->countOnly ? &v :
+										copyJsonItem(&v));
 				else
 					return jperOk;
 			}
@@ -2943,6 +3081,10 @@ getJsonPathItem(JsonPathExecContext *cxt, JsonPathItem *item,
 
 /*
  * Get the value of variable passed to jsonpath executor
+ *
+ * Variables of a compiled jsonpath are looked up by name only on their first
+ * reference in the execution, and their values are kept in slots for the
+ * further references.
  */
 static void
 getJsonPathVariable(JsonPathExecContext *cxt, JsonPathItem *variable,
@@ -2952,18 +3094,70 @@ getJsonPathVariable(JsonPathExecContext *cxt, JsonPathItem *variable,
 	int			varNameLength;
 	JsonItem	baseObject;
 	int			baseObjectId;
+	int			slot = variable->compiledVarSlot;
 
 	Assert(variable->type == jpiVariable);
-	varName = jspGetString(variable, &varNameLength);
 
-	if (!cxt->vars ||
-		(baseObjectId = cxt->getVar(cxt->vars, cxt->isJsonb,
-									varName, varNameLength,
-									value, JsonItemJbv(&baseObject))) < 0)
+	if (slot >= 0)
+	{
+		JsonPathVarSlot *var;
+
+		if (slot >= cxt->nvarSlots)
+		{
+			int			nslots = Max(slot + 1, cxt->nvarSlots * 2);
+
+			if (cxt->varSlots)
+			{
+				cxt->varSlots = repalloc(cxt->varSlots,
+										 sizeof(*cxt->varSlots) * nslots);
+				memset(&cxt->varSlots[cxt->nvarSlots], 0,
+					   sizeof(*cxt->varSlots) * (nslots - cxt->nvarSlots));
+			}
+			else
+				cxt->varSlots = palloc0(sizeof(*cxt->varSlots) * nslots);
+
+			cxt->nvarSlots = nslots;
+		}
+
+		var = &cxt->varSlots[slot];
+
+		if (!var->resolved)
+		{
+			varName = jspGetString(variable, &varNameLength);
+
+			var->baseObjectId = !cxt->vars ? -1 :
+				cxt->getVar(cxt->vars, cxt->isJsonb, varName, varNameLength,
+							&var->value, JsonItemJbv(&var->baseObject));
+			var->resolved = true;
+		}
+
+		baseObjectId = var->baseObjectId;
+
+		if (baseObjectId >= 0)
+		{
+			*value = var->value;
+			baseObject = var->baseObject;
+		}
+	}
+	else if (!cxt->vars)
+		baseObjectId = -1;
+	else
+	{
+		varName = jspGetString(variable, &varNameLength);
+		baseObjectId = cxt->getVar(cxt->vars, cxt->isJsonb,
+								   varName, varNameLength,
+								   value, JsonItemJbv(&baseObject));
+	}
+
+	if (baseObjectId < 0)
+	{
+		varName = jspGetString(variable, &varNameLength);
+
 		ereport(ERROR,
 				(errcode(ERRCODE_UNDEFINED_OBJECT),
 				 errmsg("cannot find jsonpath variable '%s'",
 						pnstrdup(varName, varNameLength))));
+	}
 
 	if (baseObjectId > 0)
 		setBaseObject(cxt, &baseObject, baseObjectId);
@@ -3373,9 +3567,26 @@ JsonValueListClear(JsonValueList *jvl)
 	jvl->length = 0;
 }
 
+/*
+ * Initialize an empty list which only counts appended items instead of
+ * storing them, so they need not be copied.
+ */
+static void
+JsonValueListInitCounter(JsonValueList *jvl)
+{
+	JsonValueListClear(jvl);
+	jvl->countOnly = true;
+}
+
 static void
 JsonValueListAppend(JsonValueList *jvl, JsonItem *jsi)
 {
+	if (jvl->countOnly)
+	{
+		jvl->length++;
+		return;
+	}
+
 	jsi->next = NULL;
 
 	if (jvl->tail)
@@ -3607,9 +3818,17 @@ JsonItemUnquoteText(JsonItem *jsi, bool isJsonb)
 		return cstring_to_text_with_len(str, len);
 }
 
+/*
+ * Get the value of an object key.
+ *
+ * Keys of large jsonb objects are looked up through the lookup cache of the
+ * execution, so that an object searched many times (e.g. the root object
+ * referenced from a filter) gets a key index.  The document does not change
+ * while the jsonpath is executed, so the cache can rely on its addresses.
+ */
 static JsonItem *
-getJsonObjectKey(JsonItem *jsi, char *keystr, int keylen, bool isJsonb,
-				 JsonItem *res)
+getJsonObjectKey(JsonPathExecContext *cxt, JsonItem *jsi, char *keystr,
+				 int keylen, JsonItem *res)
 {
 	JsonbContainer *jbc = JsonItemBinary(jsi).data;
 	JsonbValue *val;
@@ -3619,9 +3838,18 @@ getJsonObjectKey(JsonItem *jsi, char *keystr, int keylen, bool isJsonb,
 	key.val.string.val = keystr;
 	key.val.string.len = keylen;
 
-	val = isJsonb ?
-		findJsonbValueFromContainer(jbc, JB_FOBJECT, &key) :
-		findJsonValueFromContainer((JsonContainer *) jbc, JB_FOBJECT, &key);
+	if (!cxt->isJsonb)
+		val = findJsonValueFromContainer((JsonContainer *) jbc, JB_FOBJECT,
+										 &key);
+	else if (JsonContainerSize(jbc) < JSONB_KEY_INDEX_MIN_KEYS)
+		val = findJsonbValueFromContainer(jbc, JB_FOBJECT, &key);
+	else
+	{
+		if (!cxt->keyCache)
+			cxt->keyCache = JsonbLookupCacheCreate(CurrentMemoryContext);
+
+		val = JsonbLookupCacheFindKey(cxt->keyCache, jbc, &key);
+	}
 
 	return val ? JsonbValueToJsonItem(val, res) : NULL;
 }
@@ -3687,6 +3915,140 @@ JsonItemToJsonxDatum(JsonItem *jsi, bool isJsonb)
 	return JsonbValueToJsonxDatum(JsonItemToJsonbValue(jsi, &jbv), isJsonb);
 }
 
+/* Initialize root SQL/JSON item of a json[b] document */
+static void
+JsonxInitRootItem(JsonItem *jsi, Jsonx *json, bool isJsonb)
+{
+	JsonbValue *jbv = JsonItemJbv(jsi);
+
+	if (isJsonb)
+	{
+		if (!JsonbExtractScalar(&json->jb.root, jbv))
+			JsonbInitBinary(jbv, &json->jb);
+	}
+	else
+	{
+		if (!JsonExtractScalar(&json->js.root, jbv))
+			JsonInitBinary(jbv, &json->js);
+	}
+}
+
+static Size JsonItemRefGetFlatSize(ExpandedObjectHeader *eohptr);
+static void JsonItemRefFlattenInto(ExpandedObjectHeader *eohptr,
+					   void *result, Size allocated_size);
+
+static const ExpandedObjectMethods JsonItemRefMethods =
+{
+	JsonItemRefGetFlatSize,
+	JsonItemRefFlattenInto
+};
+
+static Size
+JsonItemRefGetFlatSize(ExpandedObjectHeader *eohptr)
+{
+	JsonItemRef *ref = (JsonItemRef *) eohptr;
+
+	Assert(ref->hdr.eoh_methods == &JsonItemRefMethods);
+
+	if (!ref->flat)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(ref->flatcxt);
+
+		ref->flat = (Jsonx *) DatumGetPointer(
+			JsonItemToJsonxDatum(ref->item, ref->isJsonb));
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	return VARSIZE(ref->flat);
+}
+
+static void
+JsonItemRefFlattenInto(ExpandedObjectHeader *eohptr,
+					   void *result, Size allocated_size)
+{
+	JsonItemRef *ref = (JsonItemRef *) eohptr;
+
+	Assert(ref->flat && allocated_size == VARSIZE(ref->flat));
+
+	memcpy(result, ref->flat, allocated_size);
+}
+
+/* Create a JsonItemRef object in its own context under 'parentcxt' */
+static JsonItemRef *
+JsonItemRefCreate(MemoryContext parentcxt, bool isJsonb)
+{
+	MemoryContext objcxt = AllocSetContextCreate(parentcxt, "JsonItemRef",
+												 ALLOCSET_SMALL_SIZES);
+	JsonItemRef *ref = MemoryContextAllocZero(objcxt, sizeof(*ref));
+
+	EOH_init_header(&ref->hdr, &JsonItemRefMethods, objcxt);
+	ref->isJsonb = isJsonb;
+	ref->flatcxt = AllocSetContextCreate(objcxt, "JsonItemRef flat copy",
+										 ALLOCSET_SMALL_SIZES);
+
+	return ref;
+}
+
+/* Point a JsonItemRef to another item and return its read-only datum */
+static Datum
+JsonItemRefSet(JsonItemRef *ref, JsonItem *item)
+{
+	ref->item = item;
+
+	if (ref->flat)
+	{
+		MemoryContextReset(ref->flatcxt);
+		ref->flat = NULL;
+	}
+
+	return EOHPGetRODatum(&ref->hdr);
+}
+
+/*
+ * Execute compiled jsonpath against a json[b] datum, which can also be a
+ * JsonItemRef.
+ */
+static JsonPathExecResult
+executeJsonPathDatum(JsonPathCompiled *jp, List *vars, Datum jb, bool isJsonb,
+					 bool throwErrors, JsonValueList *result)
+{
+	JsonItem	root;
+
+	if (VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(jb)))
+	{
+		ExpandedObjectHeader *eoh = DatumGetEOHP(jb);
+
+		if (eoh->eoh_methods == &JsonItemRefMethods)
+		{
+			JsonItemRef *ref = (JsonItemRef *) eoh;
+
+			Assert(ref->isJsonb == isJsonb);
+
+			if (!ref->projected)
+				return executeJsonPathItem(jp->path, jp->root, vars,
+										   EvalJsonPathVar, ref->item,
+										   isJsonb, throwErrors, result);
+
+			/* leading key accessor of the path is already applied */
+			if (ref->resume)
+				return executeJsonPathItem(jp->path, ref->resume, vars,
+										   EvalJsonPathVar, ref->item,
+										   isJsonb, throwErrors, result);
+
+			if (result)
+				JsonValueListAppend(result, copyJsonItem(ref->item));
+
+			return jperOk;
+		}
+	}
+
+	JsonxInitRootItem(&root, DatumGetJsonxP(jb, isJsonb), isJsonb);
+
+	return executeJsonPathItem(jp->path, jp->root, vars, EvalJsonPathVar,
+							   &root, isJsonb, throwErrors, result);
+}
+
 /* Get scalar of given type or NULL on type mismatch */
 static JsonItem *
 getScalar(JsonItem *scalar, enum jbvType type)
@@ -3997,6 +4359,151 @@ tryToParseDatetime(text *fmt, text *datetime, char *tzname, bool strict,
 	return !error;
 }
 
+/*
+ * Parse exactly 'ndigits' decimal digits at 'str' into '*result'.
+ */
+static inline bool
+parseIsoDigits(const char *str, int ndigits, int *result)
+{
+	int			val = 0;
+
+	while (ndigits-- > 0)
+	{
+		if (*str < '0' || *str > '9')
+			return false;
+
+		val = val * 10 + (*str++ - '0');
+	}
+
+	*result = val;
+
+	return true;
+}
+
+/*
+ * Try to recognize one of the dated ISO formats used by .datetime() without
+ * a template:
+ *
+ *		yyyy-mm-dd HH24:MI:SS TZH:TZM
+ *		yyyy-mm-dd HH24:MI:SS TZH
+ *		yyyy-mm-dd HH24:MI:SS
+ *		yyyy-mm-dd
+ *
+ * in a single pass over the string, and make the datetime value directly
+ * instead of trying the formats one by one with parse_datetime().  Only the
+ * fixed-width spelling of the formats is recognized, with a signed TZH of
+ * one or two digits.  Returns false for anything else and for out of range
+ * fields, leaving it to parse_datetime(), which is more lenient and knows
+ * how to report errors.
+ *
+ * The formats without a date are not recognized here: the generic code
+ * tries the dated formats first, and they may take a time for a date, so
+ * the result has to come from there to be the same for every spelling.
+ *
+ * As in parse_datetime(), '*tzp' is set to the parsed time-zone offset for
+ * timestamptz and left untouched for the others.  The typmod of the result
+ * is always -1.
+ */
+static bool
+tryToParseIsoDatetime(const char *str, int len, Datum *value, Oid *typid,
+					  int *tzp)
+{
+	const char *end = str + len;
+	struct pg_tm tm;
+	bool		zoned = false;
+	int			tz = 0;
+	Timestamp	result;
+
+	memset(&tm, 0, sizeof(tm));
+
+	if (len < 10 || str[4] != '-' ||
+		!parseIsoDigits(str, 4, &tm.tm_year) ||
+		!parseIsoDigits(str + 5, 2, &tm.tm_mon) || str[7] != '-' ||
+		!parseIsoDigits(str + 8, 2, &tm.tm_mday))
+		return false;
+
+	if (tm.tm_year < 1 ||
+		tm.tm_mon < 1 || tm.tm_mon > MONTHS_PER_YEAR ||
+		tm.tm_mday < 1 ||
+		tm.tm_mday > day_tab[isleap(tm.tm_year)][tm.tm_mon - 1])
+		return false;
+
+	str += 10;
+
+	if (str == end)
+	{
+		*value = DateADTGetDatum(date2j(tm.tm_year, tm.tm_mon, tm.tm_mday) -
+								 POSTGRES_EPOCH_JDATE);
+		*typid = DATEOID;
+
+		return true;
+	}
+
+	if (end - str < 9 || *str++ != ' ' ||
+		!parseIsoDigits(str, 2, &tm.tm_hour) || str[2] != ':' ||
+		!parseIsoDigits(str + 3, 2, &tm.tm_min) || str[5] != ':' ||
+		!parseIsoDigits(str + 6, 2, &tm.tm_sec))
+		return false;
+
+	if (tm.tm_hour >= HOURS_PER_DAY ||
+		tm.tm_min >= MINS_PER_HOUR ||
+		tm.tm_sec >= SECS_PER_MINUTE)
+		return false;
+
+	str += 8;
+
+	if (str < end)
+	{
+		bool		neg;
+		int			tzh;
+		int			tzm = 0;
+
+		/* " +h", " +hh", " +h:mm" or " +hh:mm" */
+		if (end - str < 3 || str[0] != ' ' || (str[1] != '+' && str[1] != '-'))
+			return false;
+
+		neg = str[1] == '-';
+		str += 2;
+
+		if (end - str >= 2 && parseIsoDigits(str, 2, &tzh))
+			str += 2;
+		else if (parseIsoDigits(str, 1, &tzh))
+			str += 1;
+		else
+			return false;
+
+		if (str < end)
+		{
+			if (end - str != 3 || *str != ':' ||
+				!parseIsoDigits(str + 1, 2, &tzm))
+				return false;
+
+			str += 3;
+		}
+
+		if (tzh > MAX_TZDISP_HOUR || tzm >= MINS_PER_HOUR)
+			return false;
+
+		/* offsets are positive west of Greenwich, see DecodeTimezone() */
+		tz = tzh * SECS_PER_HOUR + tzm * SECS_PER_MINUTE;
+		if (!neg)
+			tz = -tz;
+
+		zoned = true;
+	}
+
+	if (tm2timestamp(&tm, 0, zoned ? &tz : NULL, &result) != 0)
+		return false;
+
+	*value = TimestampGetDatum(result);
+	*typid = zoned ? TIMESTAMPTZOID : TIMESTAMPOID;
+
+	if (zoned)
+		*tzp = tz;
+
+	return true;
+}
+
 static void
 JsonItemInitNull(JsonItem *item)
 {
@@ -4047,12 +4554,11 @@ JsonItemInitDouble(JsonItem *item, double val)
 /********************Interface to pgsql's executor***************************/
 
 bool
-JsonPathExists(Datum jb, JsonPath *jp, List *vars, bool isJsonb,
+JsonPathExists(Datum jb, JsonPathCompiled *jp, List *vars, bool isJsonb,
 			   bool *error)
 {
-	Jsonx	   *js = DatumGetJsonxP(jb, isJsonb);
-	JsonPathExecResult res = executeJsonPath(jp, vars, EvalJsonPathVar,
-											 js, isJsonb, !error, NULL);
+	JsonPathExecResult res = executeJsonPathDatum(jp, vars, jb, isJsonb,
+												  !error, NULL);
 
 	Assert(error || !jperIsError(res));
 
@@ -4063,17 +4569,16 @@ JsonPathExists(Datum jb, JsonPath *jp, List *vars, bool isJsonb,
 }
 
 Datum
-JsonPathQuery(Datum jb, JsonPath *jp, JsonWrapper wrapper, bool *empty,
+JsonPathQuery(Datum jb, JsonPathCompiled *jp, JsonWrapper wrapper, bool *empty,
 			  bool *error, List *vars, bool isJsonb)
 {
-	Jsonx	   *js = DatumGetJsonxP(jb, isJsonb);
 	JsonItem   *first;
 	bool		wrap;
 	JsonValueList found = {0};
 	JsonPathExecResult res PG_USED_FOR_ASSERTS_ONLY;
 	int			count;
 
-	res = executeJsonPath(jp, vars, EvalJsonPathVar, js, isJsonb, !error, &found);
+	res = executeJsonPathDatum(jp, vars, jb, isJsonb, !error, &found);
 
 	Assert(error || !jperIsError(res));
 
@@ -4137,17 +4642,15 @@ JsonPathQuery(Datum jb, JsonPath *jp, JsonWrapper wrapper, bool *empty,
 }
 
 JsonItem *
-JsonPathValue(Datum jb, JsonPath *jp, bool *empty, bool *error, List *vars,
-			  bool isJsonb)
+JsonPathValue(Datum jb, JsonPathCompiled *jp, bool *empty, bool *error,
+			  List *vars, bool isJsonb)
 {
-	Jsonx	   *js = DatumGetJsonxP(jb, isJsonb);
 	JsonItem   *res;
 	JsonValueList found = { 0 };
 	JsonPathExecResult jper PG_USED_FOR_ASSERTS_ONLY;
 	int			count;
 
-	jper = executeJsonPath(jp, vars, EvalJsonPathVar, js, isJsonb, !error,
-						   &found);
+	jper = executeJsonPathDatum(jp, vars, jb, isJsonb, !error, &found);
 
 	Assert(error || !jperIsError(jper));
 
@@ -4352,12 +4855,15 @@ JsonTableInitScanState(JsonTableContext *cxt, JsonTableScanState *scan,
 	scan->parent = parent;
 	scan->outerJoin = node->outerJoin;
 	scan->errorOnError = node->errorOnError;
-	scan->path = DatumGetJsonPathP(node->path->constvalue);
+	scan->path = jspCompile(DatumGetJsonPathP(node->path->constvalue), mcxt);
 	scan->args = args;
 	scan->mcxt = AllocSetContextCreate(mcxt, "JsonTableContext",
 									   ALLOCSET_DEFAULT_SIZES);
 	scan->nested = node->child ?
 		JsonTableInitPlanState(cxt, node->child, scan) : NULL;
+	scan->currentRef = JsonItemRefCreate(mcxt, cxt->isJsonb);
+	scan->currentItem = NULL;
+	scan->proj = NULL;
 	scan->current = PointerGetDatum(NULL);
 	scan->currentIsNull = true;
 
@@ -4394,6 +4900,151 @@ JsonTableInitPlanState(JsonTableContext *cxt, Node *plan,
 	return state;
 }
 
+/*
+ * Check whether JSON_TABLE column expression is a JSON_VALUE/QUERY/EXISTS
+ * over the row item with a constant path "$.key[.key...]", and extract
+ * the leading key and the rest of the path from it.
+ */
+static bool
+JsonTableColumnGetLeadingKey(Expr *expr, JsonbValue *key, JsonPathItem **rest)
+{
+	JsonExpr   *jexpr;
+	Const	   *pathspec;
+	JsonPathItem jsp;
+	JsonPathItem next;
+
+	if (!expr || !IsA(expr, JsonExpr))
+		return false;
+
+	jexpr = (JsonExpr *) expr;
+
+	if (jexpr->formatted_expr ||
+		!IsA(jexpr->raw_expr, CaseTestExpr) ||
+		jexpr->passing.values ||
+		!IsA(jexpr->path_spec, Const))
+		return false;
+
+	pathspec = (Const *) jexpr->path_spec;
+
+	if (pathspec->constisnull)
+		return false;
+
+	jspInit(&jsp, DatumGetJsonPathP(pathspec->constvalue));
+
+	if (jsp.type != jpiRoot || !jspGetNext(&jsp, &next) || next.type != jpiKey)
+		return false;
+
+	key->type = jbvString;
+	key->val.string.val = jspGetString(&next, &key->val.string.len);
+
+	*rest = NULL;
+
+	while (jspGetNext(&next, &jsp))
+	{
+		if (jsp.type != jpiKey)
+			return false;
+
+		if (!*rest)
+		{
+			*rest = palloc(sizeof(**rest));
+			**rest = jsp;
+		}
+
+		next = jsp;
+	}
+
+	return true;
+}
+
+/*
+ * Merge leading keys of simple column paths of each scan into a projection,
+ * so that they are fetched from the row object in a single pass.
+ */
+static void
+JsonTableInitProjections(JsonTableContext *cxt, List *colvalexprs)
+{
+	int			ncols = list_length(colvalexprs);
+	JsonbValue *keys = palloc(sizeof(*keys) * ncols);
+	JsonPathItem **rests = palloc(sizeof(*rests) * ncols);
+	bool	   *simple = palloc(sizeof(*simple) * ncols);
+	ListCell   *lc;
+	int			i;
+	int			j;
+
+	i = 0;
+	foreach(lc, colvalexprs)
+	{
+		simple[i] = JsonTableColumnGetLeadingKey(lfirst(lc), &keys[i],
+												 &rests[i]);
+		i++;
+	}
+
+	/* columns of each scan are contiguous */
+	for (i = 0; i < ncols; i = j)
+	{
+		JsonTableScanState *scan = cxt->colexprs[i].scan;
+		JsonTableProjection *proj;
+		int			nsimple = 0;
+		int			k;
+
+		for (j = i; j < ncols && cxt->colexprs[j].scan == scan; j++)
+			if (simple[j])
+				nsimple++;
+
+		/* nothing to merge */
+		if (nsimple < 2)
+			continue;
+
+		proj = palloc(sizeof(*proj));
+		proj->keys = palloc(sizeof(*proj->keys) * nsimple);
+		proj->nkeys = 0;
+
+		for (k = i; k < j; k++)
+			if (simple[k])
+				proj->keys[proj->nkeys++] = keys[k];
+
+		qsort(proj->keys, proj->nkeys, sizeof(*proj->keys),
+			  lengthCompareJsonbStringValue);
+
+		/* remove duplicate keys */
+		nsimple = proj->nkeys;
+		proj->nkeys = 1;
+
+		for (k = 1; k < nsimple; k++)
+			if (lengthCompareJsonbStringValue(&proj->keys[k],
+											  &proj->keys[proj->nkeys - 1]))
+				proj->keys[proj->nkeys++] = proj->keys[k];
+
+		proj->values = palloc(sizeof(*proj->values) * proj->nkeys);
+		proj->found = palloc(sizeof(*proj->found) * proj->nkeys);
+		proj->valid = false;
+
+		for (k = i; k < j; k++)
+		{
+			JsonbValue *key;
+
+			if (!simple[k])
+				continue;
+
+			key = bsearch(&keys[k], proj->keys, proj->nkeys,
+						  sizeof(*proj->keys), lengthCompareJsonbStringValue);
+			Assert(key);
+
+			cxt->colexprs[k].projKey = key - proj->keys;
+			cxt->colexprs[k].projRef =
+				JsonItemRefCreate(CurrentMemoryContext, cxt->isJsonb);
+			cxt->colexprs[k].projRef->projected = true;
+			cxt->colexprs[k].projRef->resume = rests[k];
+		}
+
+		scan->proj = proj;
+	}
+
+	pfree(keys);
+	pfree(rests);
+	pfree(simple);
+}
+
 /*
  * JsonxTableInitOpaque
  *		Fill in TableFuncScanState->opaque for JsonTable processor
@@ -4434,6 +5085,7 @@ JsonxTableInitOpaque(TableFuncScanState *state, int natts, bool isJsonb)
 			var->econtext = ps->ps_ExprContext;
 			var->mcxt = CurrentMemoryContext;
 			var->evaluated = false;
+			var->constant = IsA(expr, Const);
 			var->value = (Datum) 0;
 			var->isnull = true;
 
@@ -4441,22 +5093,32 @@ JsonxTableInitOpaque(TableFuncScanState *state, int natts, bool isJsonb)
 		}
 	}
 
-	cxt->colexprs = palloc(sizeof(*cxt->colexprs) *
-						   list_length(tf->colvalexprs));
+	cxt->colexprs = palloc0(sizeof(*cxt->colexprs) *
+							list_length(tf->colvalexprs));
+
+	for (i = 0; i < list_length(tf->colvalexprs); i++)
+		cxt->colexprs[i].projKey = -1;
 
 	JsonTableInitScanState(cxt, &cxt->root, root, NULL, args,
 						   CurrentMemoryContext);
 
+	/* only jsonb objects have sorted keys */
+	if (isJsonb)
+		JsonTableInitProjections(cxt, tf->colvalexprs);
+
 	i = 0;
 
 	foreach(lc, tf->colvalexprs)
 	{
 		Expr	   *expr = lfirst(lc);
+		JsonTableScanState *scan = cxt->colexprs[i].scan;
 
 		cxt->colexprs[i].expr =
 			ExecInitExprWithCaseValue(expr, ps,
-									  &cxt->colexprs[i].scan->current,
-									  &cxt->colexprs[i].scan->currentIsNull);
+									  cxt->colexprs[i].projKey >= 0 ?
+									  &cxt->colexprs[i].current :
+									  &scan->current,
+									  &scan->currentIsNull);
 
 		i++;
 	}
@@ -4481,19 +5143,26 @@ static void
 JsonTableRescan(JsonTableScanState *scan)
 {
 	JsonValueListInitIterator(&scan->found, &scan->iter);
+	scan->currentItem = NULL;
 	scan->current = PointerGetDatum(NULL);
 	scan->currentIsNull = true;
 	scan->advanceNested = false;
 	scan->ordinal = 0;
 }
 
-/* Reset context item of a scan, execute JSON path and reset a scan */
+/*
+ * Reset context item of a scan, execute JSON path and reset a scan.
+ *
+ * Nested scans get the current row item of their parent, which references
+ * the parent's document directly, so it must not be freed before the scan
+ * is reset again.
+ */
 static void
-JsonTableResetContextItem(JsonTableScanState *scan, Datum item, bool isJsonb)
+JsonTableResetContextItem(JsonTableScanState *scan, JsonItem *item,
+						  bool isJsonb)
 {
 	MemoryContext oldcxt;
 	JsonPathExecResult res;
-	Jsonx	   *js = DatumGetJsonxP(item, isJsonb);
 
 	JsonValueListClear(&scan->found);
 
@@ -4501,8 +5170,9 @@ JsonTableResetContextItem(JsonTableScanState *scan, Datum item, bool isJsonb)
 
 	oldcxt = MemoryContextSwitchTo(scan->mcxt);
 
-	res = executeJsonPath(scan->path, scan->args, EvalJsonPathVar, js, isJsonb,
-						  scan->errorOnError, &scan->found);
+	res = executeJsonPathItem(scan->path->path, scan->path->root, scan->args,
+							  EvalJsonPathVar, item, isJsonb,
+							  scan->errorOnError, &scan->found);
 
 	MemoryContextSwitchTo(oldcxt);
 
@@ -4523,8 +5193,12 @@ static void
 JsonTableSetDocument(TableFuncScanState *state, Datum value)
 {
 	JsonTableContext *cxt = GetJsonTableContext(state, "JsonTableSetDocument");
+	JsonItem	root;
+
+	JsonxInitRootItem(&root, DatumGetJsonxP(value, cxt->isJsonb),
+					  cxt->isJsonb);
 
-	JsonTableResetContextItem(&cxt->root, value, cxt->isJsonb);
+	JsonTableResetContextItem(&cxt->root, &root, cxt->isJsonb);
 }
 
 /* Recursively reset scan and its child nodes */
@@ -4632,7 +5306,7 @@ JsonTableNextRow(JsonTableScanState *scan, bool isJsonb)
 	if (scan->reset)
 	{
 		Assert(!scan->parent->currentIsNull);
-		JsonTableResetContextItem(scan, scan->parent->current, isJsonb);
+		JsonTableResetContextItem(scan, scan->parent->currentItem, isJsonb);
 		scan->reset = false;
 	}
 
@@ -4649,20 +5323,22 @@ JsonTableNextRow(JsonTableScanState *scan, bool isJsonb)
 	{
 		/* fetch next row */
 		JsonItem   *jbv = JsonValueListNext(&scan->found, &scan->iter);
-		MemoryContext oldcxt;
 
 		if (!jbv)
 		{
+			scan->currentItem = NULL;
 			scan->current = PointerGetDatum(NULL);
 			scan->currentIsNull = true;
 			return false;	/* end of scan */
 		}
 
-		/* set current row item */
-		oldcxt = MemoryContextSwitchTo(scan->mcxt);
-		scan->current = JsonItemToJsonxDatum(jbv, isJsonb);
+		/* set current row item, it is passed to columns by reference */
+		scan->currentItem = jbv;
+		scan->current = JsonItemRefSet(scan->currentRef, jbv);
 		scan->currentIsNull = false;
-		MemoryContextSwitchTo(oldcxt);
+
+		if (scan->proj)
+			scan->proj->valid = false;
 
 		scan->ordinal++;
 
@@ -4698,6 +5374,47 @@ JsonTableFetchRow(TableFuncScanState *state)
 	return JsonTableNextRow(&cxt->root, cxt->isJsonb);
 }
 
+/*
+ * Set context item of a projected column for the current row.
+ *
+ * All projected keys of the scan are fetched from the row object on the
+ * first request.  The column path is then resumed from the value of its
+ * leading key, or executed as usual if the key is missing or the row item is
+ * not an object, so that lax/strict mode errors are reported as before.
+ */
+static void
+JsonTableProjectColumn(JsonTableContext *cxt, int colnum)
+{
+	JsonTableScanState *scan = cxt->colexprs[colnum].scan;
+	JsonTableProjection *proj = scan->proj;
+	int			key = cxt->colexprs[colnum].projKey;
+
+	if (!proj->valid)
+	{
+		JsonItem   *item = scan->currentItem;
+
+		if (JsonItemIsBinary(item) &&
+			JsonContainerIsObject(JsonItemBinary(item).data))
+			findJsonbKeysInObject(JsonItemBinary(item).data, proj->keys,
+								  proj->nkeys, proj->values, proj->found);
+		else
+			memset(proj->found, 0, sizeof(*proj->found) * proj->nkeys);
+
+		proj->valid = true;
+	}
+
+	if (proj->found[key])
+	{
+		JsonItem   *item = &cxt->colexprs[colnum].projItem;
+
+		JsonbValueToJsonItem(&proj->values[key], item);
+		cxt->colexprs[colnum].current =
+			JsonItemRefSet(cxt->colexprs[colnum].projRef, item);
+	}
+	else
+		cxt->colexprs[colnum].current = scan->current;
+}
+
 /*
  * JsonTableGetValue
  *		Return the value for column number 'colnum' for the current row.
@@ -4722,6 +5439,9 @@ JsonTableGetValue(TableFuncScanState *state, int colnum,
 	}
 	else if (estate)	/* regular column */
 	{
+		if (cxt->colexprs[colnum].projKey >= 0)
+			JsonTableProjectColumn(cxt, colnum);
+
 		result = ExecEvalExpr(estate, econtext, isnull);
 	}
 	else
@@ -0,0 +1,189 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonstream.c
+ *	  Expanded objects for json text streamed from temporary files.
+ *
+ * json_agg() moves the text of an array that outgrows work_mem to a
+ * temporary file, and its final function returns the text as a json stream
+ * referencing the file.  printtup and COPY TO recognize json streams and
+ * send them in pieces, so that the text is never built in memory as a
+ * whole; everything else sees a regular json datum once the stream is
+ * flattened.
+ *
+ * A json stream does not own its file, which belongs to the aggregate
+ * state, so it is valid only as long as the state is.  This is why the
+ * streams are always passed around by read-only pointers: anything that
+ * keeps the value longer makes a flat copy of it.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/jsonstream.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "utils/jsonstream.h"
+#include "utils/memutils.h"
+
+
+/* "Methods" required for an expanded object */
+static Size JS_get_flat_size(ExpandedObjectHeader *eohptr);
+static void JS_flatten_into(ExpandedObjectHeader *eohptr,
+				void *result, Size allocated_size);
+
+static const ExpandedObjectMethods JS_methods =
+{
+	JS_get_flat_size,
+	JS_flatten_into
+};
+
+
+/*
+ * JsonStreamMake: make a json stream of the first 'filesize' bytes of
+ * 'file' followed by the contents of 'tail' and 'suffix'
+ *
+ * The tail is copied, while the file is only referenced and must stay
+ * unchanged up to 'filesize' for the lifetime of the result.  The stream
+ * is a child of the current memory context, and the result is a read-only
+ * pointer to it, palloc'd in the current memory context too.
+ */
+Datum
+JsonStreamMake(BufFile *file, int64 filesize, StringInfo tail,
+			   const char *suffix)
+{
+	MemoryContext objcxt;
+	JsonStream *js;
+	int			suffixlen = strlen(suffix);
+	char	   *ptr;
+
+	objcxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "json stream",
+								   ALLOCSET_SMALL_SIZES);
+
+	js = (JsonStream *) MemoryContextAlloc(objcxt, sizeof(JsonStream));
+
+	EOH_init_header(&js->hdr, &JS_methods, objcxt);
+
+	js->file = file;
+	js->filesize = filesize;
+	js->taillen = tail->len + suffixlen;
+	js->tail = MemoryContextAlloc(objcxt, js->taillen);
+	memcpy(js->tail, tail->data, tail->len);
+	memcpy(js->tail + tail->len, suffix, suffixlen);
+
+	/*
+	 * Return a separately palloc'd pointer, so that nodeAgg.c does not
+	 * attempt to copy the result into its own memory context.
+	 */
+	ptr = palloc(EXPANDED_POINTER_SIZE);
+	memcpy(ptr, DatumGetPointer(EOHPGetRODatum(&js->hdr)),
+		   EXPANDED_POINTER_SIZE);
+
+	return PointerGetDatum(ptr);
+}
+
+/*
+ * DatumGetJsonStream: return the json stream a datum points to, or NULL
+ * if the datum is anything else
+ */
+JsonStream *
+DatumGetJsonStream(Datum d)
+{
+	ExpandedObjectHeader *eohptr;
+
+	if (!VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(d)))
+		return NULL;
+
+	eohptr = DatumGetEOHP(d);
+
+	if (eohptr->eoh_methods != &JS_methods)
+		return NULL;
+
+	return (JsonStream *) eohptr;
+}
+
+/*
+ * JsonStreamGetSize: return the length of the text of a json stream
+ */
+int64
+JsonStreamGetSize(JsonStream *js)
+{
+	return js->filesize + js->taillen;
+}
+
+/*
+ * JsonStreamRead: copy 'len' bytes of the text of a json stream starting at
+ * 'offset' into 'buf'
+ */
+void
+JsonStreamRead(JsonStream *js, int64 offset, char *buf, int len)
+{
+	Assert(offset >= 0 && len >= 0 &&
+		   offset + len <= JsonStreamGetSize(js));
+
+	if (offset < js->filesize)
+	{
+		int			nread = Min(len, js->filesize - offset);
+
+		/*
+		 * Always seek, since the owner of the file may have written to it
+		 * since the last read.
+		 */
+		if (BufFileSeek(js->file, 0, offset, SEEK_SET) != 0 ||
+			BufFileRead(js->file, buf, nread) != nread)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from json stream temporary file: %m")));
+
+		buf += nread;
+		offset += nread;
+		len -= nread;
+	}
+
+	if (len > 0)
+		memcpy(buf, js->tail + (offset - js->filesize), len);
+}
+
+/*
+ * get_flat_size method for json streams
+ */
+static Size
+JS_get_flat_size(ExpandedObjectHeader *eohptr)
+{
+	JsonStream *js = (JsonStream *) eohptr;
+	int64		size = JsonStreamGetSize(js);
+
+	Assert(js->hdr.eoh_methods == &JS_methods);
+
+	if (size > MaxAllocSize - VARHDRSZ)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("json value is too large to be materialized"),
+				 errdetail("The value has " INT64_FORMAT " bytes, while the maximum is %zu bytes.",
+						   size, MaxAllocSize - VARHDRSZ),
+				 errhint("Values this large can only be sent to the client as query results or by COPY TO in text format.")));
+
+	return VARHDRSZ + size;
+}
+
+/*
+ * flatten_into method for json streams
+ */
+static void
+JS_flatten_into(ExpandedObjectHeader *eohptr,
+				void *result, Size allocated_size)
+{
+	JsonStream *js = (JsonStream *) eohptr;
+	text	   *tresult = (text *) result;
+	int64		size = JsonStreamGetSize(js);
+
+	Assert(js->hdr.eoh_methods == &JS_methods);
+	Assert(allocated_size == VARHDRSZ + size);
+
+	SET_VARSIZE(tresult, allocated_size);
+	JsonStreamRead(js, 0, VARDATA(tresult), size);
+}
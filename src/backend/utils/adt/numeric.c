@@ -477,7 +477,7 @@ static char *get_str_from_var_sci(const NumericVar *var, int rscale);
 static Numeric make_result(const NumericVar *var);
 static Numeric make_result_opt_error(const NumericVar *var, bool *error);
 
-static void apply_typmod(NumericVar *var, int32 typmod);
+static bool apply_typmod(NumericVar *var, int32 typmod, bool *have_error);
 
 static bool numericvar_to_int32(const NumericVar *var, int32 *result);
 static bool numericvar_to_int64(const NumericVar *var, int64 *result);
@@ -636,7 +636,7 @@ numeric_in(PG_FUNCTION_ARGS)
 			cp++;
 		}
 
-		apply_typmod(&value, typmod);
+		apply_typmod(&value, typmod, NULL);
 
 		res = make_result(&value);
 		free_var(&value);
@@ -685,6 +685,63 @@ numeric_is_nan(Numeric num)
 	return NUMERIC_IS_NAN(num);
 }
 
+/*
+ * numeric_is_well_formed() -
+ *
+ *	Is a Numeric value well formed, with the normalized digits and header
+ *	fields make_result() would produce for its value?  Both header formats
+ *	are accepted, since values stored by old releases may use the long one
+ *	where the short one would do.  This is used to validate numerics that
+ *	were received in their storage format, as inside binary jsonb values.
+ *	The value must have a 4-byte varlena header.
+ */
+bool
+numeric_is_well_formed(Numeric num)
+{
+	Size		len = VARSIZE(num);
+	NumericVar	x;
+	Numeric		res;
+	bool		have_error = false;
+	bool		result;
+	int			ndigits;
+	int			i;
+
+	if (len < NUMERIC_HDRSZ_SHORT || len < NUMERIC_HEADER_SIZE(num) ||
+		(len - NUMERIC_HEADER_SIZE(num)) % sizeof(NumericDigit) != 0)
+		return false;
+
+	if (NUMERIC_IS_NAN(num))
+		return len == NUMERIC_HDRSZ_SHORT &&
+			num->choice.n_header == NUMERIC_NAN;
+
+	ndigits = NUMERIC_NDIGITS(num);
+
+	for (i = 0; i < ndigits; i++)
+		if (NUMERIC_DIGITS(num)[i] < 0 || NUMERIC_DIGITS(num)[i] >= NBASE)
+			return false;
+
+	/* reject digits hidden by dscale, and leading or trailing zero digits */
+	init_var(&x);
+	set_var_from_num(num, &x);
+	trunc_var(&x, x.dscale);
+
+	res = make_result_opt_error(&x, &have_error);
+
+	result = !have_error &&
+		NUMERIC_NDIGITS(res) == ndigits &&
+		NUMERIC_SIGN(res) == NUMERIC_SIGN(num) &&
+		NUMERIC_WEIGHT(res) == NUMERIC_WEIGHT(num) &&
+		NUMERIC_DSCALE(res) == NUMERIC_DSCALE(num) &&
+		memcmp(NUMERIC_DIGITS(res), NUMERIC_DIGITS(num),
+			   ndigits * sizeof(NumericDigit)) == 0;
+
+	free_var(&x);
+	if (res)
+		pfree(res);
+
+	return result;
+}
+
 /*
  * numeric_maximum_size() -
  *
@@ -857,7 +914,7 @@ numeric_recv(PG_FUNCTION_ARGS)
 	 */
 	trunc_var(&value, value.dscale);
 
-	apply_typmod(&value, typmod);
+	apply_typmod(&value, typmod, NULL);
 
 	res = make_result(&value);
 	free_var(&value);
@@ -956,6 +1013,19 @@ numeric		(PG_FUNCTION_ARGS)
 {
 	Numeric		num = PG_GETARG_NUMERIC(0);
 	int32		typmod = PG_GETARG_INT32(1);
+
+	PG_RETURN_NUMERIC(numeric_typmod_opt_error(num, typmod, NULL));
+}
+
+/*
+ * numeric_typmod_opt_error() -
+ *
+ *	Apply typmod to a numeric value.  If have_error is not NULL, set it
+ *	instead of throwing an error on overflow.
+ */
+Numeric
+numeric_typmod_opt_error(Numeric num, int32 typmod, bool *have_error)
+{
 	Numeric		new;
 	int32		tmp_typmod;
 	int			precision;
@@ -968,7 +1038,7 @@ numeric		(PG_FUNCTION_ARGS)
 	 * Handle NaN
 	 */
 	if (NUMERIC_IS_NAN(num))
-		PG_RETURN_NUMERIC(make_result(&const_nan));
+		return make_result(&const_nan);
 
 	/*
 	 * If the value isn't a valid type modifier, simply return a copy of the
@@ -978,7 +1048,7 @@ numeric		(PG_FUNCTION_ARGS)
 	{
 		new = (Numeric) palloc(VARSIZE(num));
 		memcpy(new, num, VARSIZE(num));
-		PG_RETURN_NUMERIC(new);
+		return new;
 	}
 
 	/*
@@ -1010,7 +1080,7 @@ numeric		(PG_FUNCTION_ARGS)
 		else
 			new->choice.n_long.n_sign_dscale = NUMERIC_SIGN(new) |
 				((uint16) scale & NUMERIC_DSCALE_MASK);
-		PG_RETURN_NUMERIC(new);
+		return new;
 	}
 
 	/*
@@ -1020,12 +1090,18 @@ numeric		(PG_FUNCTION_ARGS)
 	init_var(&var);
 
 	set_var_from_num(num, &var);
-	apply_typmod(&var, typmod);
+
+	if (!apply_typmod(&var, typmod, have_error))
+	{
+		free_var(&var);
+		return NULL;
+	}
+
 	new = make_result(&var);
 
 	free_var(&var);
 
-	PG_RETURN_NUMERIC(new);
+	return new;
 }
 
 Datum
@@ -3291,28 +3367,55 @@ int8_numeric(PG_FUNCTION_ARGS)
 }
 
 
-Datum
-numeric_int8(PG_FUNCTION_ARGS)
+int64
+numeric_int8_opt_error(Numeric num, bool *have_error)
 {
-	Numeric		num = PG_GETARG_NUMERIC(0);
 	NumericVar	x;
 	int64		result;
 
 	/* XXX would it be better to return NULL? */
 	if (NUMERIC_IS_NAN(num))
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("cannot convert NaN to bigint")));
+	{
+		if (have_error)
+		{
+			*have_error = true;
+			return 0;
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("cannot convert NaN to bigint")));
+		}
+	}
 
 	/* Convert to variable format and thence to int8 */
 	init_var_from_num(num, &x);
 
 	if (!numericvar_to_int64(&x, &result))
-		ereport(ERROR,
-				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
-				 errmsg("bigint out of range")));
+	{
+		if (have_error)
+		{
+			*have_error = true;
+			return 0;
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("bigint out of range")));
+		}
+	}
 
-	PG_RETURN_INT64(result);
+	return result;
+}
+
+Datum
+numeric_int8(PG_FUNCTION_ARGS)
+{
+	Numeric		num = PG_GETARG_NUMERIC(0);
+
+	PG_RETURN_INT64(numeric_int8_opt_error(num, NULL));
 }
 
 
@@ -3335,38 +3438,63 @@ int2_numeric(PG_FUNCTION_ARGS)
 }
 
 
-Datum
-numeric_int2(PG_FUNCTION_ARGS)
+int16
+numeric_int2_opt_error(Numeric num, bool *have_error)
 {
-	Numeric		num = PG_GETARG_NUMERIC(0);
 	NumericVar	x;
 	int64		val;
 	int16		result;
 
 	/* XXX would it be better to return NULL? */
 	if (NUMERIC_IS_NAN(num))
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("cannot convert NaN to smallint")));
+	{
+		if (have_error)
+		{
+			*have_error = true;
+			return 0;
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("cannot convert NaN to smallint")));
+		}
+	}
 
 	/* Convert to variable format and thence to int8 */
 	init_var_from_num(num, &x);
 
 	if (!numericvar_to_int64(&x, &val))
-		ereport(ERROR,
-				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
-				 errmsg("smallint out of range")));
+		val = PG_INT64_MAX;		/* certainly out of int2 range */
 
 	/* Down-convert to int2 */
 	result = (int16) val;
 
 	/* Test for overflow by reverse-conversion. */
 	if ((int64) result != val)
-		ereport(ERROR,
-				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
-				 errmsg("smallint out of range")));
+	{
+		if (have_error)
+		{
+			*have_error = true;
+			return 0;
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("smallint out of range")));
+		}
+	}
 
-	PG_RETURN_INT16(result);
+	return result;
+}
+
+Datum
+numeric_int2(PG_FUNCTION_ARGS)
+{
+	Numeric		num = PG_GETARG_NUMERIC(0);
+
+	PG_RETURN_INT16(numeric_int2_opt_error(num, NULL));
 }
 
 
@@ -3401,24 +3529,32 @@ float8_numeric(PG_FUNCTION_ARGS)
 }
 
 
-Datum
-numeric_float8(PG_FUNCTION_ARGS)
+float8
+numeric_float8_opt_error(Numeric num, bool *have_error)
 {
-	Numeric		num = PG_GETARG_NUMERIC(0);
 	char	   *tmp;
-	Datum		result;
+	float8		result;
 
 	if (NUMERIC_IS_NAN(num))
-		PG_RETURN_FLOAT8(get_float8_nan());
+		return get_float8_nan();
 
 	tmp = DatumGetCString(DirectFunctionCall1(numeric_out,
 											  NumericGetDatum(num)));
 
-	result = DirectFunctionCall1(float8in, CStringGetDatum(tmp));
+	result = float8in_internal_opt_error(tmp, NULL, "double precision", tmp,
+										 have_error);
 
 	pfree(tmp);
 
-	PG_RETURN_DATUM(result);
+	return result;
+}
+
+Datum
+numeric_float8(PG_FUNCTION_ARGS)
+{
+	Numeric		num = PG_GETARG_NUMERIC(0);
+
+	PG_RETURN_FLOAT8(numeric_float8_opt_error(num, NULL));
 }
 
 
@@ -6346,10 +6482,11 @@ make_result(const NumericVar *var)
  * apply_typmod() -
  *
  *	Do bounds checking and rounding according to the attributes
- *	typmod field.
+ *	typmod field.  On overflow, if have_error is not NULL, set it and
+ *	return false instead of throwing an error.
  */
-static void
-apply_typmod(NumericVar *var, int32 typmod)
+static bool
+apply_typmod(NumericVar *var, int32 typmod, bool *have_error)
 {
 	int			precision;
 	int			scale;
@@ -6359,7 +6496,7 @@ apply_typmod(NumericVar *var, int32 typmod)
 
 	/* Do nothing if we have a default typmod (-1) */
 	if (typmod < (int32) (VARHDRSZ))
-		return;
+		return true;
 
 	typmod -= VARHDRSZ;
 	precision = (typmod >> 16) & 0xffff;
@@ -6403,6 +6540,13 @@ apply_typmod(NumericVar *var, int32 typmod)
 #error unsupported NBASE
 #endif
 				if (ddigits > maxdigits)
+				{
+					if (have_error)
+					{
+						*have_error = true;
+						return false;
+					}
+
 					ereport(ERROR,
 							(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
 							 errmsg("numeric field overflow"),
@@ -6412,11 +6556,14 @@ apply_typmod(NumericVar *var, int32 typmod)
 									   maxdigits ? "10^" : "",
 									   maxdigits ? maxdigits : 1
 									   )));
+				}
 				break;
 			}
 			ddigits -= DEC_DIGITS;
 		}
 	}
+
+	return true;
 }
 
 /*
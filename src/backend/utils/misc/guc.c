@@ -84,6 +84,7 @@
 #include "utils/bytea.h"
 #include "utils/guc_tables.h"
 #include "utils/float.h"
+#include "utils/jsonb.h"
 #include "utils/memutils.h"
 #include "utils/pg_locale.h"
 #include "utils/pg_lsn.h"
@@ -3185,6 +3186,18 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"jsonb_send_version", PGC_USERSET, CLIENT_CONN_STATEMENT,
+			gettext_noop("Sets the version of the binary format sent for jsonb."),
+			gettext_noop("Version 1 sends the text of the value, version 2 sends "
+						 "its storage format when the client encoding matches "
+						 "the server encoding.")
+		},
+		&jsonb_send_version,
+		1, 1, 2,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"tcp_user_timeout", PGC_USERSET, CLIENT_CONN_OTHER,
 			gettext_noop("TCP user timeout."),
@@ -19,8 +19,10 @@
 
 /* forward references to avoid circularity */
 struct ExprEvalStep;
+struct ExprVarDetoastCache;
 struct SubscriptingRefState;
 struct JsonItem;
+struct JsonPathCompiled;
 
 /* Bits in ExprState->flags (see also execnodes.h for public flag bits): */
 /* expression's interpreter has been initialized */
@@ -57,6 +59,11 @@ typedef enum ExprEvalOp
 	EEOP_OUTER_VAR,
 	EEOP_SCAN_VAR,
 
+	/* ditto, detoasting the value once for all references to the Var */
+	EEOP_INNER_VAR_DETOAST,
+	EEOP_OUTER_VAR_DETOAST,
+	EEOP_SCAN_VAR_DETOAST,
+
 	/* compute system Var value */
 	EEOP_INNER_SYSVAR,
 	EEOP_OUTER_SYSVAR,
@@ -238,6 +245,28 @@ typedef enum ExprEvalOp
 	EEOP_LAST
 } ExprEvalOp;
 
+/*
+ * SQL/JSON formatting and coercion expressions that can be evaluated without
+ * throwing errors, so that ON ERROR behavior does not need a subtransaction.
+ */
+typedef enum JsonSafeCoercionKind
+{
+	JSC_UNSAFE,					/* can throw errors */
+	JSC_NONE,					/* no coercion */
+	JSC_NUMERIC_INT2,			/* numeric to smallint cast */
+	JSC_NUMERIC_INT4,			/* numeric to integer cast */
+	JSC_NUMERIC_INT8,			/* numeric to bigint cast */
+	JSC_NUMERIC_FLOAT8,			/* numeric to double precision cast */
+	JSC_NUMERIC_TYPMOD,			/* numeric length coercion */
+	JSC_TEXT_JSON				/* json input from text */
+} JsonSafeCoercionKind;
+
+typedef struct JsonSafeCoercion
+{
+	JsonSafeCoercionKind kind;
+	int32		typmod;			/* for JSC_NUMERIC_TYPMOD */
+} JsonSafeCoercion;
+
 
 typedef struct ExprEvalStep
 {
@@ -273,13 +302,15 @@ typedef struct ExprEvalStep
 			const TupleTableSlotOps *kind;
 		}			fetch;
 
-		/* for EEOP_INNER/OUTER/SCAN_[SYS]VAR[_FIRST] */
+		/* for EEOP_INNER/OUTER/SCAN_[SYS]VAR[_FIRST|_DETOAST] */
 		struct
 		{
 			/* attnum is attr number - 1 for regular VAR ... */
 			/* but it's just the normal (negative) attr number for SYSVAR */
 			int			attnum;
 			Oid			vartype;	/* type OID of variable */
+			/* detoasted value shared by the references, for VAR_DETOAST */
+			struct ExprVarDetoastCache *detoast;
 		}			var;
 
 		/* for EEOP_WHOLEROW */
@@ -679,10 +710,13 @@ typedef struct ExprEvalStep
 
 			ExprState  *formatted_expr;		/* formatted context item */
 			ExprState  *result_expr;		/* coerced to output type */
+			JsonSafeCoercion safe_format;	/* error-safe formatted_expr */
+			JsonSafeCoercion safe_result;	/* error-safe result_expr */
 			ExprState  *default_on_empty;	/* ON EMPTY DEFAULT expression */
 			ExprState  *default_on_error;	/* ON ERROR DEFAULT expression */
 			List	   *args;				/* passing arguments */
 
+			struct JsonPathCompiled *compiled_path;	/* compiled path_spec */
 			void	   *cache;				/* cache for json_populate_type() */
 
 			struct JsonCoercionsState
@@ -691,6 +725,7 @@ typedef struct ExprEvalStep
 				{
 					JsonCoercion *coercion;		/* coercion expression */
 					ExprState  *estate;	/* coercion expression state */
+					JsonSafeCoercion safe;	/* error-safe coercion */
 				} 			null,
 							string,
 							numeric,
@@ -710,6 +745,21 @@ typedef struct ExprEvalStep
 } ExprEvalStep;
 
 
+/*
+ * Non-inline data for EEOP_*_VAR_DETOAST, shared by all the steps fetching
+ * the same Var within an expression.  The detoasted value is allocated in
+ * the per-tuple memory of the ExprContext, so a reset callback of that
+ * context marks it invalid.
+ */
+typedef struct ExprVarDetoastCache
+{
+	bool		valid;			/* is 'value' still allocated? */
+	struct varatt_external toast;	/* TOAST pointer 'value' was fetched by */
+	Datum		value;			/* detoasted value */
+	MemoryContext context;		/* memory context holding 'value' */
+	MemoryContextCallback callback; /* resets 'valid' */
+} ExprVarDetoastCache;
+
 /* Non-inline data for container operations */
 typedef struct SubscriptingRefState
 {
@@ -806,6 +856,8 @@ extern void ExecEvalWholeRowVar(ExprState *state, ExprEvalStep *op,
 					ExprContext *econtext);
 extern void ExecEvalSysVar(ExprState *state, ExprEvalStep *op,
 			   ExprContext *econtext, TupleTableSlot *slot);
+extern void ExecEvalVarDetoast(ExprState *state, ExprEvalStep *op,
+				   ExprContext *econtext, TupleTableSlot *slot);
 extern void ExecEvalJson(ExprState *state, ExprEvalStep *op,
 						 ExprContext *econtext);
 extern Datum ExecPrepareJsonItemCoercion(struct JsonItem *item, bool is_jsonb,
@@ -71,6 +71,8 @@ extern int	pq_getbyte(void);
 extern int	pq_peekbyte(void);
 extern int	pq_getbyte_if_available(unsigned char *c);
 extern int	pq_putbytes(const char *s, size_t len);
+extern int	pq_putmessage_start(char msgtype, size_t len);
+extern int	pq_putmessage_bytes(const char *s, size_t len);
 
 /*
  * prototypes for functions in be-secure.c
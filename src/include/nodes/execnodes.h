@@ -112,6 +112,9 @@ typedef struct ExprState
 
 	Datum	   *innermost_domainval;
 	bool	   *innermost_domainnull;
+
+	/* Vars detoasted once for all their references, see ExecInitExprSlots */
+	List	   *detoast_vars;
 } ExprState;
 
 
@@ -1664,6 +1667,8 @@ typedef struct TableFuncScanState
 	int64		ordinal;		/* row number to be output next */
 	MemoryContext perTableCxt;	/* per-table context */
 	Tuplestorestate *tupstore;	/* output tuple store */
+	bool		pipelined;		/* fetch rows on demand, without tupstore? */
+	bool		finished;		/* all rows are fetched in pipelined mode */
 } TableFuncScanState;
 
 /* ----------------
@@ -114,6 +114,8 @@ typedef struct JsonContainerData
 	uint32		header;
 	int			len;
 	char	   *data;
+	struct JsonTape *tape;		/* structural index, built on demand */
+	int			tapeEntry;		/* index of container's entry in the tape */
 } JsonContainerData;
 
 typedef const JsonContainerData JsonContainer;
@@ -185,6 +187,12 @@ extern JsonLexContext *makeJsonLexContextCstringLen(char *json,
  */
 extern bool IsValidJsonNumber(const char *str, int len);
 
+/*
+ * Utility function to check if a text is a valid JSON text.  Invalid JSON
+ * text is reported either by throwing an error or by returning false.
+ */
+extern bool json_validate(text *json, bool throw_error);
+
 /*
  * Flag types for iterate_json(b)_values to specify what elements from a
  * json(b) document we want to iterate.
@@ -67,6 +67,14 @@ typedef enum
 #define JGINFLAG_HASHED 0x10	/* OR'd into flag if value was hashed */
 #define JGIN_MAXLENGTH	125		/* max length of text part before hashing */
 
+/*
+ * The non-default jsonb_path_value_ops GIN opclass stores bytea keys made of
+ * a 4-byte hash of the keys leading to a value, one of the above JGINFLAG_*
+ * flags giving the type of the value, and an order-preserving image of the
+ * value itself (strings are truncated to JGIN_MAXLENGTH bytes).
+ */
+#define JGIN_PATH_VALUE_PREFIXLEN	5	/* length of the path hash and flag */
+
 /* Convenience macros */
 #define DatumGetJsonbP(d)	((Jsonb *) PG_DETOAST_DATUM(d))
 #define DatumGetJsonbPCopy(d)	((Jsonb *) PG_DETOAST_DATUM_COPY(d))
@@ -77,6 +85,9 @@ typedef enum
 
 typedef struct JsonbPair JsonbPair;
 typedef struct JsonbValue JsonbValue;
+typedef struct JsonbEncoder JsonbEncoder;
+typedef struct JsonbKeyIndex JsonbKeyIndex;
+typedef struct JsonbLookupCache JsonbLookupCache;
 
 /*
  * Jsonbs are varlena objects, so must meet the varlena convention that the
@@ -185,6 +196,13 @@ typedef uint32 JEntry;
  */
 #define JB_OFFSET_STRIDE		32
 
+/*
+ * Minimum number of keys of an object for which JsonbLookupCacheFindKey()
+ * considers building a key index.  Smaller objects are found by binary search
+ * in a few probes within a couple of strides.
+ */
+#define JSONB_KEY_INDEX_MIN_KEYS	64
+
 /*
  * A jsonb array or object node, within a Jsonb Datum.
  *
@@ -360,6 +378,9 @@ typedef struct JsonbIterator
 
 
 /* Support functions */
+/* GUC parameter */
+extern int	jsonb_send_version;
+
 extern uint32 getJsonbOffset(const JsonbContainer *jc, int index);
 extern uint32 getJsonbLength(const JsonbContainer *jc, int index);
 extern int lengthCompareJsonbStringValue(const void *a, const void *b);
@@ -368,6 +389,25 @@ extern int	compareJsonbContainers(JsonbContainer *a, JsonbContainer *b);
 extern JsonbValue *findJsonbValueFromContainer(JsonbContainer *sheader,
 							uint32 flags,
 							JsonbValue *key);
+extern int findJsonbKeysInObject(JsonbContainer *container,
+					  const JsonbValue *keys, int nkeys,
+					  JsonbValue *values, bool *found);
+extern bool findJsonbKeyPosition(JsonbContainer *container,
+					 const char *key, int len,
+					 int *index, JsonbValue *value);
+extern JsonbKeyIndex *buildJsonbKeyIndex(JsonbContainer *container,
+				   MemoryContext mcxt);
+extern void freeJsonbKeyIndex(JsonbKeyIndex *index);
+extern JsonbValue *findJsonbValueFromKeyIndex(JsonbKeyIndex *index,
+						   JsonbValue *key);
+extern JsonbLookupCache *JsonbLookupCacheCreate(MemoryContext mcxt);
+extern void JsonbLookupCacheFree(JsonbLookupCache *cache);
+extern Jsonb *JsonbLookupCacheDetoast(JsonbLookupCache *cache, Datum d);
+extern JsonbValue *JsonbLookupCacheFindKey(JsonbLookupCache *cache,
+						JsonbContainer *container,
+						JsonbValue *key);
+extern bool JsonbLookupCacheFindToastedKey(JsonbLookupCache *cache, Datum d,
+							   JsonbValue *key, JsonbValue **result);
 extern JsonbValue *getIthJsonbValueFromContainer(JsonbContainer *sheader,
 							  uint32 i);
 extern JsonbValue *pushJsonbValue(JsonbParseState **pstate,
@@ -378,6 +418,21 @@ extern JsonbIterator *JsonbIteratorInit(JsonbContainer *container);
 extern JsonbIteratorToken JsonbIteratorNext(JsonbIterator **it, JsonbValue *val,
 				  bool skipNested);
 extern Jsonb *JsonbValueToJsonb(JsonbValue *val);
+extern void JsonbToWireFormat(StringInfo buf, Jsonb *jb);
+extern Jsonb *JsonbFromWireFormat(const char *data, int len);
+extern JsonbEncoder *JsonbEncoderInit(void);
+extern void JsonbEncoderBeginContainer(JsonbEncoder *enc, bool isObject);
+extern void JsonbEncoderKey(JsonbEncoder *enc, const char *key, int len);
+extern void JsonbEncoderScalar(JsonbEncoder *enc, JsonbValue *scalarVal);
+extern void JsonbEncoderEndContainer(JsonbEncoder *enc);
+extern void JsonbEncoderJsonb(JsonbEncoder *enc, Jsonb *jb);
+extern void JsonbEncoderContainerChildren(JsonbEncoder *enc,
+							  JsonbContainer *container,
+							  int first, int count);
+extern void JsonbEncoderArrayElements(JsonbEncoder *enc,
+						  JsonbContainer *array);
+extern Jsonb *JsonbEncoderBuildArray(JsonbEncoder *enc);
+extern Jsonb *JsonbEncoderFinish(JsonbEncoder *enc);
 extern bool JsonbDeepContains(JsonbIterator **val,
 				  JsonbIterator **mContained);
 extern void JsonbHashScalarValue(const JsonbValue *scalarVal, uint32 *hash);
@@ -395,5 +450,13 @@ extern char *JsonbUnquote(Jsonb *jb);
 extern bool JsonbExtractScalar(JsonbContainer *jbc, JsonbValue *res);
 extern const char *JsonbTypeName(JsonbValue *jb);
 
+/* jsonb_typanalyze.c support functions */
+
+/* Longest string value collected by jsonb_typanalyze() */
+#define JSONB_STATS_MAX_VALUE_LEN	100
+
+extern void JsonbStatsAppendKey(StringInfo path, const char *key, int len);
+extern bool JsonbStatsAppendValue(StringInfo path, const JsonbValue *scalar);
+
 
 #endif							/* __JSONB_H__ */
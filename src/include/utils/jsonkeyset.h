@@ -0,0 +1,31 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonkeyset.h
+ *	  Declarations for sets of json object keys.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/utils/jsonkeyset.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef JSONKEYSET_H
+#define JSONKEYSET_H
+
+/*
+ * A set of the keys of a json object, used for the key uniqueness checks of
+ * json and jsonb constructors and of IS JSON WITH UNIQUE KEYS.
+ *
+ * The keys are copied into the set, so the callers are free to move or free
+ * their own copies.  Resetting a set forgets its keys but keeps its memory,
+ * which makes it cheap to reuse one set for many objects.
+ */
+typedef struct JsonKeySet JsonKeySet;
+
+extern JsonKeySet *JsonKeySetCreate(MemoryContext mcxt, int nkeys);
+extern bool JsonKeySetAdd(JsonKeySet *set, const char *key, int len);
+extern void JsonKeySetReset(JsonKeySet *set);
+extern void JsonKeySetFree(JsonKeySet *set);
+
+#endif							/* JSONKEYSET_H */
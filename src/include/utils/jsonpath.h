@@ -182,8 +182,34 @@ typedef struct JsonPathItem
 			uint32		flags;
 		}			like_regex;
 	}			content;
+
+	/*
+	 * Already decoded next item and operands.  They are filled only for items
+	 * of a compiled jsonpath (see jspCompile()), so the accessor functions
+	 * below can simply copy them instead of decoding the binary form again.
+	 * Operands are stored in the order of their positions in 'content'.
+	 * Variables of a compiled jsonpath are also numbered by their distinct
+	 * names, so that the executor can keep their values in slots instead of
+	 * looking them up by name on every reference; the slot is -1 otherwise.
+	 */
+	struct JsonPathItem *compiledNext;
+	struct JsonPathItem **compiledArgs;
+	int32		compiledVarSlot;
 } JsonPathItem;
 
+/*
+ * Compiled jsonpath: the tree of pre-decoded path items, built once per query
+ * and cached by the caller (in fn_extra or in the expression step state).
+ */
+typedef struct JsonPathCompiled
+{
+	MemoryContext mcxt;			/* private context holding the whole tree */
+	JsonPath   *path;			/* copy of the source jsonpath */
+	JsonPathItem *root;			/* decoded root item */
+	int			nvars;			/* number of distinct variables */
+	JsonPathItem **vars;		/* first reference to each of them */
+} JsonPathCompiled;
+
 #define jspHasNext(jsp) ((jsp)->nextPos > 0)
 
 extern void jspInit(JsonPathItem *v, JsonPath *js);
@@ -201,6 +227,10 @@ extern void jspGetSequenceElement(JsonPathItem *v, int i, JsonPathItem *elem);
 extern void jspGetObjectField(JsonPathItem *v, int i,
 							  JsonPathItem *key, JsonPathItem *val);
 
+extern JsonPathCompiled *jspCompile(JsonPath *js, MemoryContext mcxt);
+extern JsonPathCompiled *jspGetCompiled(JsonPathCompiled **cache,
+			   JsonPath *js, MemoryContext mcxt);
+
 extern const char *jspOperationName(JsonPathItemType type);
 
 /*
@@ -296,6 +326,7 @@ typedef struct JsonPathVariableEvalContext
 	Datum		value;
 	bool		isnull;
 	bool		evaluated;
+	bool		constant;	/* value is the same for all rows */
 } JsonPathVariableEvalContext;
 
 /* Type of SQL/JSON item */
@@ -385,11 +416,11 @@ extern void JsonItemFromDatum(Datum val, Oid typid, int32 typmod,
 extern Datum JsonItemToJsonxDatum(JsonItem *jsi, bool isJsonb);
 extern Datum JsonbValueToJsonxDatum(JsonbValue *jbv, bool isJsonb);
 
-extern bool JsonPathExists(Datum jb, JsonPath *path,
+extern bool JsonPathExists(Datum jb, JsonPathCompiled *path,
 			   List *vars, bool isJsonb, bool *error);
-extern Datum JsonPathQuery(Datum jb, JsonPath *jp, JsonWrapper wrapper,
+extern Datum JsonPathQuery(Datum jb, JsonPathCompiled *jp, JsonWrapper wrapper,
 			   bool *empty, bool *error, List *vars, bool isJsonb);
-extern JsonItem *JsonPathValue(Datum jb, JsonPath *jp, bool *empty,
+extern JsonItem *JsonPathValue(Datum jb, JsonPathCompiled *jp, bool *empty,
 			   bool *error, List *vars, bool isJsonb);
 
 extern int EvalJsonPathVar(void *vars, bool isJsonb, char *varName,
@@ -0,0 +1,49 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonstream.h
+ *	  Declarations for json values streamed from temporary files.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/utils/jsonstream.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef JSONSTREAM_H
+#define JSONSTREAM_H
+
+#include "lib/stringinfo.h"
+#include "storage/buffile.h"
+#include "utils/expandeddatum.h"
+
+/* size of the pieces the consumers of a json stream are advised to read */
+#define JSON_STREAM_CHUNK_SIZE	65536
+
+/*
+ * A json stream is an expanded object holding json text that is too large
+ * to be kept in memory.  The head of the text is in a temporary file owned
+ * by someone else, typically an aggregate state, and the rest is in memory.
+ *
+ * Consumers that can send the text somewhere in pieces, like printtup and
+ * COPY TO, read it directly from the stream; anything else flattens it
+ * into a regular json datum, which fails if it exceeds MaxAllocSize.
+ */
+typedef struct JsonStream
+{
+	/* Standard header for expanded objects */
+	ExpandedObjectHeader hdr;
+
+	BufFile    *file;			/* file with the head of the text */
+	int64		filesize;		/* length of the head of the text */
+	char	   *tail;			/* rest of the text */
+	int			taillen;		/* length of the rest of the text */
+} JsonStream;
+
+extern Datum JsonStreamMake(BufFile *file, int64 filesize,
+			   StringInfo tail, const char *suffix);
+extern JsonStream *DatumGetJsonStream(Datum d);
+extern int64 JsonStreamGetSize(JsonStream *js);
+extern void JsonStreamRead(JsonStream *js, int64 offset, char *buf, int len);
+
+#endif							/* JSONSTREAM_H */
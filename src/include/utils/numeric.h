@@ -57,6 +57,7 @@ typedef struct NumericData *Numeric;
  * Utility functions in numeric.c
  */
 extern bool numeric_is_nan(Numeric num);
+extern bool numeric_is_well_formed(Numeric num);
 int32		numeric_maximum_size(int32 typmod);
 extern char *numeric_out_sci(Numeric num, int scale);
 extern char *numeric_normalize(Numeric num);
@@ -72,5 +73,10 @@ extern Numeric numeric_div_opt_error(Numeric num1, Numeric num2,
 extern Numeric numeric_mod_opt_error(Numeric num1, Numeric num2,
 					  bool *have_error);
 extern int32 numeric_int4_opt_error(Numeric num, bool *error);
+extern int64 numeric_int8_opt_error(Numeric num, bool *have_error);
+extern int16 numeric_int2_opt_error(Numeric num, bool *have_error);
+extern float8 numeric_float8_opt_error(Numeric num, bool *have_error);
+extern Numeric numeric_typmod_opt_error(Numeric num, int32 typmod,
+						 bool *have_error);
 
 #endif							/* _PG_NUMERIC_H_ */
@@ -7,6 +7,7 @@ SELECT '"abc
 def"'::json;					-- ERROR, unescaped newline in string constant
 SELECT '"\n\"\\"'::json;		-- OK, legal escapes
 SELECT '"\v"'::json;			-- ERROR, not a valid JSON escape
+SELECT '{"a": "abcdefghijklmnopqrstuvwxyz\"0123456789abcdefghij\\klmnopqrstuvwxyz"}'::json ->> 'a' = 'abcdefghijklmnopqrstuvwxyz"0123456789abcdefghij\klmnopqrstuvwxyz';	-- OK, long runs between escapes
 -- see json_encoding test for input with unicode escapes
 
 -- Numbers.
@@ -145,6 +146,23 @@ UPDATE rows SET x = NULL WHERE x = 1;
 SELECT json_agg(q ORDER BY x NULLS FIRST, y)
   FROM rows q;
 
+-- large arrays are spilled to a temporary file
+SET work_mem = '64kB';
+CREATE TEMP TABLE test_json_spill AS
+  SELECT i, i % 2 AS g, repeat('x', 100) || i AS t
+  FROM generate_series(1, 4000) i;
+
+SELECT g, json_agg(t ORDER BY i)::text =
+       '[' || string_agg(to_json(t)::text, ', ' ORDER BY i) || ']' AS ok
+  FROM test_json_spill GROUP BY g ORDER BY g;
+
+-- the result is sent to the client from the file
+SELECT json_agg(t ORDER BY i) AS spilled FROM test_json_spill \gset
+SELECT md5(:'spilled') = md5(json_agg(t ORDER BY i)::text) AS ok
+  FROM test_json_spill;
+
+RESET work_mem;
+
 -- non-numeric output
 SELECT row_to_json(q)
 FROM (SELECT 'NaN'::float8 AS "float8field") q;
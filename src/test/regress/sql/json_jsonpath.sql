@@ -7,6 +7,7 @@ select json '{"a": 12}' @? '$.b + 2';
 select json '{"a": {"a": 12}}' @? '$.a.a';
 select json '{"a": {"a": 12}}' @? '$.*.a';
 select json '{"b": {"a": 12}}' @? '$.*.a';
+select json_path_query('{"a": {"b": {"c": 1}}}', '$.*') -> 'b';
 select json '{"b": {"a": 12}}' @? '$.*.b';
 select json '{"b": {"a": 12}}' @? 'strict $.*.b';
 select json '{}' @? '$.*';
@@ -61,6 +62,11 @@ select json_path_query('[]', 'strict $["a"]');
 
 select json_path_query('{"a": 12, "b": {"a": 13}}', '$.a');
 select json_path_query('{"a": 12, "b": {"a": 13}}', '$.b');
+select json_path_query('{"a": 12, "b": {"c": [1, {"d": 2}]}, "a": 13}', '$.a');
+select json_path_query('{"a": 12, "b": {"c": [1, {"d": 2}]}, "a": 13}', '$.b.c[1].d');
+select json_path_query('{"a\u0062": 12, "x": 13}', '$.ab');
+select json_path_query('[1, [2, 3], {"a": [4]}, "x"]', '$[1]');
+select json_path_query('[1, [2, 3], {"a": [4]}, "x"]', '$[2].a[0]');
 select json_path_query('{"a": 12, "b": {"a": 13}}', '$.*');
 select json_path_query('{"a": 12, "b": {"a": 13}}', 'lax $.*.a');
 select json_path_query('[12, {"a": 13}, {"b": 14}]', 'lax $[*].a');
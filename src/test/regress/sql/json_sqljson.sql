@@ -60,6 +60,8 @@ SELECT JSON_VALUE('' FORMAT JSON, '$');
 SELECT JSON_VALUE('' FORMAT JSON, '$' NULL ON ERROR);
 SELECT JSON_VALUE('' FORMAT JSON, '$' DEFAULT '"default value"' ON ERROR);
 SELECT JSON_VALUE('' FORMAT JSON, '$' ERROR ON ERROR);
+SELECT JSON_VALUE(js FORMAT JSON, '$.a' RETURNING int DEFAULT -1 ON ERROR)
+FROM (VALUES ('{"a": 1}'), ('{"a": '), ('{"a": 1e100}')) vals(js);
 
 SELECT JSON_VALUE(json 'null', '$');
 SELECT JSON_VALUE(json 'null', '$' RETURNING int);
@@ -38,6 +38,7 @@ SELECT '{"abc",1}'::jsonb;		-- ERROR, wrong separator
 SELECT '{"abc"=1}'::jsonb;		-- ERROR, totally wrong separator
 SELECT '{"abc"::1}'::jsonb;		-- ERROR, another wrong separator
 SELECT '{"abc":1,"def":2,"ghi":[3,4],"hij":{"klm":5,"nop":[6]}}'::jsonb; -- OK
+SELECT '{"b":[1,{"c":2.5}],"a":{"x":1},"b":{"d":[3,"e"]},"a":4}'::jsonb; -- OK, last duplicate wins
 SELECT '{"abc":1:2}'::jsonb;		-- ERROR, colon in wrong spot
 SELECT '{"abc":1,3}'::jsonb;		-- ERROR, no value
 
@@ -109,6 +110,23 @@ UPDATE rows SET x = NULL WHERE x = 1;
 SELECT jsonb_agg(q ORDER BY x NULLS FIRST, y)
   FROM rows q;
 
+-- elements of any kind are appended to the array as they are encoded
+SELECT jsonb_agg(j)
+  FROM (VALUES ('1'::jsonb), ('"a"'), (NULL), ('[1, {"a": 2.5}]'),
+               ('{"b": [null, true]}'), ('false')) v(j);
+
+SELECT jsonb_agg(x), jsonb_agg_strict(x)
+  FROM (VALUES (1.5), (NULL), (2)) v(x);
+
+SELECT j -> 0 AS e0, j -> 31 AS e31, j -> 32 AS e32, j -> 34 AS e34,
+       jsonb_array_length(j) AS len
+  FROM (SELECT jsonb_agg(CASE i % 3
+                           WHEN 0 THEN to_jsonb(i)
+                           WHEN 1 THEN to_jsonb('s' || i)
+                           ELSE jsonb_build_array(i, i * 0.5)
+                         END ORDER BY i) j
+          FROM generate_series(1, 40) i) a;
+
 -- jsonb extraction functions
 CREATE TEMP TABLE test_jsonb (
        json_type text,
@@ -293,6 +311,46 @@ SELECT jsonb '{"a":null, "b":"qq"}' ?& ARRAY['c','d'];
 SELECT jsonb '{"a":null, "b":"qq"}' ?& ARRAY['a','a', 'b', 'b', 'b'];
 SELECT jsonb '{"a":null, "b":"qq"}' ?& '{}'::text[];
 
+-- selectivity estimation from path statistics
+create function check_jsonb_estimated_rows(text) returns table (estimated int, actual int)
+language plpgsql as
+$$
+declare
+    ln text;
+    tmp text[];
+    first_row bool := true;
+begin
+    for ln in
+        execute format('explain analyze %s', $1)
+    loop
+        if first_row then
+            first_row := false;
+            tmp := regexp_match(ln, 'rows=(\d*) .* rows=(\d*)');
+            return query select tmp[1]::int, tmp[2]::int;
+        end if;
+    end loop;
+end;
+$$;
+create temp table test_jsonb_stats as
+select jsonb_build_object('id', i,
+                          'type', case when i % 10 = 0 then 'rare' else 'common' end,
+                          'tags', jsonb_build_array('t' || i % 3)) ||
+       (case when i % 100 = 0 then '{"flag": true}' else '{}' end)::jsonb as js
+from generate_series(1, 1000) i;
+analyze test_jsonb_stats;
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @> ''{"type": "rare"}''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @> ''{"type": "common", "tags": ["t1"]}''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where ''{"tags": ["t0"]}'' <@ js');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js ? ''flag''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js ?| array[''flag'', ''nokey'']');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js ?& array[''id'', ''flag'']');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @? ''$.tags[*] ? (@ == "t1")''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @@ ''$.type == "common" && !($.flag == true)''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @@ ''!($.type == 1)''');
+select * from check_jsonb_estimated_rows('select * from test_jsonb_stats where js @@ ''$.id > 500''');
+drop table test_jsonb_stats;
+drop function check_jsonb_estimated_rows(text);
+
 -- typeof
 SELECT jsonb_typeof('{}') AS object;
 SELECT jsonb_typeof('{"c":3,"p":"o"}') AS object;
@@ -495,6 +553,19 @@ select '"foo"'::jsonb #>> array['z'];
 select '42'::jsonb #>> array['f2'];
 select '42'::jsonb #>> array['0'];
 
+-- repeated lookups in a large stored object
+create temp table test_jsonb_large (js jsonb);
+alter table test_jsonb_large alter column js set storage external;
+insert into test_jsonb_large
+select jsonb_object_agg('k' || i, i) from generate_series(1, 1000) i;
+select count(*) from generate_series(1, 1000) i, test_jsonb_large t
+where (t.js ->> ('k' || i))::int = i and t.js -> ('k' || i) = to_jsonb(i);
+select count(*) from generate_series(1, 1000) i, test_jsonb_large t
+where t.js #>> array['k' || i] = i::text and t.js #> array['k' || -i] is null;
+select js -> 'k1', js ->> 'k1000', js #> '{k500}', js -> 'k0' from test_jsonb_large;
+select sum((t.js ->> ('k' || i))::int) from generate_series(1, 1000) i, test_jsonb_large t;
+drop table test_jsonb_large;
+
 -- array_elements
 SELECT jsonb_array_elements('[1,true,[1,[2,3]],null,{"f1":1,"f2":[7,8,9]},false]');
 SELECT * FROM jsonb_array_elements('[1,true,[1,[2,3]],null,{"f1":1,"f2":[7,8,9]},false]') q;
@@ -889,6 +960,34 @@ SELECT count(*) FROM testjsonb WHERE j @? '$.bar';
 RESET enable_seqscan;
 DROP INDEX jidx;
 
+--gin path value opclass
+CREATE INDEX jidx ON testjsonb USING gin (j jsonb_path_value_ops);
+SET enable_seqscan = off;
+
+SELECT count(*) FROM testjsonb WHERE j @> '{"wait":"CC", "public":true}';
+SELECT count(*) FROM testjsonb WHERE j @> '{"age":25.0}';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.array[*] == "bar"';
+
+EXPLAIN (COSTS OFF)
+SELECT count(*) FROM testjsonb WHERE j @@ '$.line > 880';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.line > 880';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.status < 10';
+SELECT count(*) FROM testjsonb WHERE j @@ '10 > $.status';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.pos >= 95 && $.pos <= 97';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.age > 25';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.age >= 25';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.wait < "B"';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.node starts with "CB"';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.node like_regex "^CBA?"';
+SELECT count(*) FROM testjsonb WHERE j @@ '$.node like_regex "^C.A"';
+SELECT count(*) FROM testjsonb WHERE j @@ '!($.status > 10)';
+SELECT count(*) FROM testjsonb WHERE j @? '$.node ? (@ starts with "CB")';
+SELECT count(*) FROM testjsonb WHERE j @? '$.array[*] ? (@ > "bar")';
+SELECT count(*) FROM testjsonb WHERE j @? '$ ? (@.line > 500 && @.wait == "CC")';
+
+RESET enable_seqscan;
+DROP INDEX jidx;
+
 -- nested tests
 SELECT '{"ff":{"a":12,"b":16}}'::jsonb;
 SELECT '{"ff":{"a":12,"b":16},"qq":123}'::jsonb;
@@ -925,6 +1024,18 @@ SELECT '{"a":[1,2,{"c":3,"x":4}],"c":"b"}'::jsonb @> '{"a":[{"x":4}]}';
 SELECT '{"a":[1,2,{"c":3,"x":4}],"c":"b"}'::jsonb @> '{"a":[{"x":4},3]}';
 SELECT '{"a":[1,2,{"c":3,"x":4}],"c":"b"}'::jsonb @> '{"a":[{"x":4},1]}';
 
+-- containment in large arrays
+SELECT (SELECT jsonb_agg(i) FROM generate_series(1, 100) i) @> '[3, 50, 100]';
+SELECT (SELECT jsonb_agg(i) FROM generate_series(1, 100) i) @> '[3, 50.0, 100.00]';
+SELECT (SELECT jsonb_agg(i) FROM generate_series(1, 100) i) @> '[3, 50, 101]';
+SELECT (SELECT jsonb_agg(i) FROM generate_series(1, 100) i) @> '[3, "50"]';
+SELECT '[null, true, false, "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", 1]'::jsonb @> '[1, "l", null, false, true]';
+SELECT (SELECT jsonb_agg(jsonb_build_object('id', i, 'tags', jsonb_build_array(i, i * 2))) FROM generate_series(1, 10) i) @> '[{"id": 9}, {"id": 10, "tags": [20]}, {"tags": [10, 5]}, {"id": 3, "tags": [6]}]';
+SELECT (SELECT jsonb_agg(jsonb_build_object('id', i, 'tags', jsonb_build_array(i, i * 2))) FROM generate_series(1, 10) i) @> '[{"id": 9}, {"id": 10}, {"id": 4, "tags": [9]}]';
+SELECT (SELECT jsonb_agg(jsonb_build_object('id', i, 'tags', jsonb_build_array(i, i * 2))) FROM generate_series(1, 10) i) @> '[{"id": 9}, {"id": 10}, [1]]';
+SELECT (SELECT jsonb_agg(jsonb_build_array(i, -i)) FROM generate_series(1, 10) i) @> '[[9], [10], [-3, 3], [2, -2]]';
+SELECT (SELECT jsonb_agg(jsonb_build_array(i, -i)) FROM generate_series(1, 10) i) @> '[[9], [10], [3, -4]]';
+
 -- check some corner cases for indexed nested containment (bug #13756)
 create temp table nestjsonb (j jsonb);
 insert into nestjsonb (j) values ('{"a":[["b",{"x":1}],["b",{"x":2}]],"c":3}');
@@ -991,6 +1102,41 @@ SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonb ? 'c';
 SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonb ? 'd';
 SELECT '{"n":null,"a":1,"b":[1,2],"c":{"1":2},"d":{"1":[2,3]}}'::jsonb ? 'e';
 
+-- out-of-line values referenced by several operators of an expression
+CREATE TEMP TABLE test_jsonb_toasted (id int, j jsonb);
+ALTER TABLE test_jsonb_toasted ALTER COLUMN j SET STORAGE external;
+INSERT INTO test_jsonb_toasted
+  SELECT i, jsonb_build_object('id', i, 'pad', repeat('x', 5000), 'tag', 'tag' || i)
+  FROM generate_series(1, 3) i;
+SELECT id, j->>'id' AS jid, j->>'tag' AS tag, length(j->>'pad') AS len, j ? 'pad' AS has_pad
+FROM test_jsonb_toasted
+WHERE j->>'tag' <> 'tag2' AND j ? 'id'
+ORDER BY id;
+DROP TABLE test_jsonb_toasted;
+
+-- fetching fields of large uncompressed out-of-line values by slices
+CREATE TEMP TABLE test_jsonb_sliced (id int, j jsonb);
+ALTER TABLE test_jsonb_sliced ALTER COLUMN j SET STORAGE external;
+INSERT INTO test_jsonb_sliced
+  SELECT 1, jsonb_object_agg('k' || i,
+    CASE i % 3
+      WHEN 0 THEN to_jsonb(repeat('x', 1000) || i)
+      WHEN 1 THEN to_jsonb(i * 1.5)
+      ELSE jsonb_build_object('n', i, 'a', jsonb_build_array(i, true, null))
+    END)
+  FROM generate_series(1, 100) i;
+INSERT INTO test_jsonb_sliced
+  SELECT 2, jsonb_agg(repeat('y', 1000)) FROM generate_series(1, 20);
+SELECT j->'k1' AS k1 FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->>'k2' AS k2 FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->'k50' AS k50 FROM test_jsonb_sliced WHERE id = 1;
+SELECT length(j->>'k99') AS k99 FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->'k100' AS k100 FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->'k101' AS k101 FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->'k2'->'a' AS k2a FROM test_jsonb_sliced WHERE id = 1;
+SELECT j->'k1' AS k1 FROM test_jsonb_sliced WHERE id = 2;
+DROP TABLE test_jsonb_sliced;
+
 -- jsonb_strip_nulls
 
 select jsonb_strip_nulls(null);
@@ -1048,6 +1194,7 @@ select pg_column_size('{}'::jsonb || '{}'::jsonb) = pg_column_size('{}'::jsonb);
 select pg_column_size('{"aa":1}'::jsonb || '{"b":2}'::jsonb) = pg_column_size('{"aa":1, "b":2}'::jsonb);
 select pg_column_size('{"aa":1, "b":2}'::jsonb || '{}'::jsonb) = pg_column_size('{"aa":1, "b":2}'::jsonb);
 select pg_column_size('{}'::jsonb || '{"aa":1, "b":2}'::jsonb) = pg_column_size('{"aa":1, "b":2}'::jsonb);
+select '{"a": 1, "c": [1.5], "bb": {"x": 2}, "dd": 4}'::jsonb || '{"b": 2.5, "c": null, "dd": [5], "eee": 6}';
 
 select jsonb_delete('{"a":1 , "b":2, "c":3}'::jsonb, 'a');
 select jsonb_delete('{"a":null , "b":2, "c":3}'::jsonb, 'a');
@@ -1135,6 +1282,29 @@ select jsonb_set('[]','{-99}','{"foo":123}');
 select jsonb_set('{"a": [1, 2, 3]}', '{a, non_integer}', '"new_value"');
 select jsonb_set('{"a": {"b": [1, 2, 3]}}', '{a, b, non_integer}', '"new_value"');
 select jsonb_set('{"a": {"b": [1, 2, 3]}}', '{a, b, NULL}', '"new_value"');
+-- paths through nested containers
+select jsonb_set('{"a": 1.5, "b": [1, {"c": 2, "d": [3.25]}, "x"], "e": {"f": null}}', '{b,1,c}', '{"g": 4.5}');
+select jsonb_insert('{"a": 1.5, "b": [1, {"c": 2, "d": [3.25]}, "x"], "e": {"f": null}}', '{b,1,aa}', 'true');
+select '{"a": 1.5, "b": [1, {"c": 2, "d": [3.25]}, "x"], "e": {"f": null}}'::jsonb #- '{b,1,d}';
+-- jsonb_set, jsonb_insert, #- and || keep the layout of the untouched parts
+set jsonb_send_version = 2;
+select op, jsonb_send(r) = jsonb_send(r::text::jsonb) as same_layout
+from (select jsonb_object_agg('k' || i,
+               case i % 3 when 0 then to_jsonb(i * 1.5)
+                          when 1 then jsonb_build_array(i, 'x', i * 0.5)
+                          else to_jsonb('s' || i) end) as j
+      from generate_series(1, 40) i) d,
+     lateral (values ('set', jsonb_set(j, '{k10,1}', '"y"')),
+                     ('replace', jsonb_set(j, '{k7}', '2.25')),
+                     ('create', jsonb_set(j, '{k0}', '[1.5]')),
+                     ('insert', jsonb_insert(j, '{k4,0}', '1')),
+                     ('delete key', j #- '{k13}'),
+                     ('delete element', j #- '{k16,2}'),
+                     ('concat object', j || jsonb_build_object('k0', 0.5, 'k7', '{}'::jsonb,
+                                                               'k20', 'x', 'k99', 9.5)),
+                     ('concat array', jsonb_build_array(j, 1.5) || jsonb_build_array('x', j)),
+                     ('concat array and object', '[1.5, "x"]'::jsonb || j)) v(op, r);
+reset jsonb_send_version;
 
 
 -- jsonb_insert
@@ -1243,3 +1413,10 @@ select '12345.0000000000000000000000000000000000000000000005'::jsonb::float8;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int2;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int4;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int8;
+
+-- binary send formats
+select jsonb_send('1');
+set jsonb_send_version = 2;
+select jsonb_send('1');
+select jsonb_send('{"a": 1, "b": [true, null, "x"]}');
+reset jsonb_send_version;
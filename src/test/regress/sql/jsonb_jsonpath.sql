@@ -52,6 +52,15 @@ select jsonb_path_exists('[{"a": 1}, {"a": 2}, 3]', 'lax $[*].a', silent => true
 select jsonb_path_exists('[{"a": 1}, {"a": 2}, 3]', 'strict $[*].a', silent => false);
 select jsonb_path_exists('[{"a": 1}, {"a": 2}, 3]', 'strict $[*].a', silent => true);
 
+-- strict mode counts the whole sequence, lax mode stops at the first item
+select jsonb_path_exists(jsonb_agg(i), 'strict $[*] ? (@ > 9999)') from generate_series(1, 10000) i;
+select jsonb_path_exists('{"a": {"b": 1}, "c": [{"b": 2}]}', 'strict $.**.b');
+select jsonb_path_exists('[1, true]', 'lax $[*].double()');
+select jsonb_path_exists('[1, true]', 'strict $[*].double()');
+select jsonb_path_exists('[1, true]', 'strict $[*].double()', silent => true);
+select jsonb_path_exists('[1, true]', 'lax $ ? (exists (@[*].double()))');
+select jsonb_path_exists('[1, true]', 'strict $ ? (exists (@[*].double()))');
+
 select jsonb_path_query('1', 'lax $.a');
 select jsonb_path_query('1', 'strict $.a');
 select jsonb_path_query('1', 'strict $.*');
@@ -441,6 +450,11 @@ select jsonb_path_query('"12:34:56 +3"', '$.datetime().type()');
 select jsonb_path_query('"12:34:56 +3"', '$.datetime()');
 select jsonb_path_query('"12:34:56 +3:10"', '$.datetime().type()');
 select jsonb_path_query('"12:34:56 +3:10"', '$.datetime()');
+select jsonb_path_query('"12:10:05"', '$.datetime().type()');
+select jsonb_path_query('"12:10:5"', '$.datetime().type()');
+select jsonb_path_query('"2016-02-29 23:59:59 -05:30"', '$.datetime()');
+select jsonb_path_query('" 2017-03-10"', '$.datetime()');
+select jsonb_path_query('"2017-02-29"', '$.datetime()');
 
 set time zone '+00';
 
@@ -513,6 +527,7 @@ SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}]', '$[*].a ? (@ == 1)');
 SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}]', '$[*].a ? (@ > 10)');
 SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}, {"a": 3}, {"a": 5}]', '$[*].a ? (@ > $min && @ < $max)', vars => '{"min": 1, "max": 4}');
 SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}, {"a": 3}, {"a": 5}]', '$[*].a ? (@ > $min && @ < $max)', vars => '{"min": 3, "max": 4}');
+SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}, {"a": 3}, {"a": 5}]', '$[*].a ? (@ > $min && @ < $max || @ == $min + $max)', vars => '{"min": 1, "max": 4}');
 SELECT jsonb_path_query_array('[{"a": 1}, {"a": 2}]', '[$[*].a]');
 
 SELECT jsonb_path_query_first('[{"a": 1}, {"a": 2}, {}]', 'strict $[*].a');
@@ -584,3 +599,30 @@ select jsonb_path_query('{"a": 1, "b": 2}', 'lax $["b", "c", "b", "a", 0 to 3]')
 
 select jsonb_path_query('null', '{"a": 1}["a"]');
 select jsonb_path_query('null', '{"a": 1}["b"]');
+
+-- repeated key lookups in a large object
+select jsonb_path_query(jsonb_object_agg('k' || i, i), '$.* ? (@ == $.k500 || @ == $["k1000"])')
+from generate_series(1, 1000) i;
+
+-- compiled jsonpath, with the path changing between rows, gives the same
+-- results as the raw jsonpath executed by jsonb_path_query()
+select id,
+  jsonb_path_query_array(js, jp) as compiled,
+  jsonb_path_query_array(js, jp) =
+    (select coalesce(jsonb_agg(v), '[]') from jsonb_path_query(js, jp) v) as same,
+  jsonb_path_exists(js, jp) as exists,
+  jsonb_path_query_first(js, jp) as first
+from (values
+  (1, jsonb '{"a": [{"b": 1, "c": ["x", "y1"]}, {"b": 2, "c": ["y2"]}, {"b": 3, "c": []}]}',
+   jsonpath '$.a[*] ? (@.b > 1 && exists (@.c[*] ? (@ starts with "y"))).b'),
+  (2, '{"a": [{"b": 5, "c": ["y"]}, {"b": 0, "c": ["y"]}]}',
+   '$.a[*] ? (@.b > 1 && exists (@.c[*] ? (@ starts with "y"))).b'),
+  (3, '{"a": [{"b": 5, "c": ["y"]}, {"b": 0, "c": ["y"]}]}',
+   '$.a[*].b ? (@ < 3)'),
+  (4, '{"a": [{"b": 2, "c": ["z", "yz"]}]}',
+   '$.a[*] ? (@.b > 1 && exists (@.c[*] ? (@ starts with "y"))).b'),
+  (5, '{"a": [{"b": 2, "c": ["z"]}]}',
+   'strict $.a[*] ? (@.c[*] == "z").b.double() * 2'),
+  (6, '{"a": []}',
+   '$.a[*] ? (@.b > 1 && exists (@.c[*] ? (@ starts with "y"))).b')
+) t(id, js, jp);
@@ -27,6 +27,7 @@ SELECT JSON_EXISTS(jsonb '{"a": 1, "b": 2}', '$.* ? (@ > $x)' PASSING 1 AS x);
 SELECT JSON_EXISTS(jsonb '{"a": 1, "b": 2}', '$.* ? (@ > $x)' PASSING '1' AS x);
 SELECT JSON_EXISTS(jsonb '{"a": 1, "b": 2}', '$.* ? (@ > $x && @ < $y)' PASSING 0 AS x, 2 AS y);
 SELECT JSON_EXISTS(jsonb '{"a": 1, "b": 2}', '$.* ? (@ > $x && @ < $y)' PASSING 0 AS x, 1 AS y);
+SELECT JSON_EXISTS(jsonb '{"a": 1, "b": 2}', '$.* ? (@ > $x && @ < $xy)' PASSING 2 AS xy, 0 AS x);
 
 -- extension: boolean expressions
 SELECT JSON_EXISTS(jsonb '1', '$ > 2');
@@ -52,6 +53,11 @@ SELECT JSON_VALUE(jsonb '1.23', '$');
 SELECT JSON_VALUE(jsonb '1.23', '$' RETURNING int);
 SELECT JSON_VALUE(jsonb '"1.23"', '$' RETURNING numeric);
 SELECT JSON_VALUE(jsonb '"1.23"', '$' RETURNING int ERROR ON ERROR);
+SELECT JSON_VALUE(jsonb '1e100', '$' RETURNING int);
+SELECT JSON_VALUE(jsonb '1e100', '$' RETURNING bigint DEFAULT -1 ON ERROR);
+SELECT JSON_VALUE(jsonb '1e100', '$' RETURNING smallint ERROR ON ERROR);
+SELECT JSON_VALUE(jsonb '12.345', '$' RETURNING numeric(4,1));
+SELECT JSON_VALUE(jsonb '123.45', '$' RETURNING numeric(4,1) DEFAULT 0 ON ERROR);
 
 SELECT JSON_VALUE(jsonb '"aaa"', '$');
 SELECT JSON_VALUE(jsonb '"aaa"', '$' RETURNING text);
@@ -397,6 +403,22 @@ SELECT * FROM JSON_TABLE(jsonb '"a"', '$' COLUMNS (a int PATH '$'   DEFAULT 1 ON
 SELECT * FROM JSON_TABLE(jsonb '"a"', '$' COLUMNS (a int PATH 'strict $.a' DEFAULT 1 ON EMPTY DEFAULT 2 ON ERROR)) jt;
 SELECT * FROM JSON_TABLE(jsonb '"a"', '$' COLUMNS (a int PATH 'lax $.a' DEFAULT 1 ON EMPTY DEFAULT 2 ON ERROR)) jt;
 
+-- JSON_TABLE: rows are fetched on demand
+SELECT * FROM JSON_TABLE(jsonb '[1, 2, 3, 4, 5]', '$[*]' COLUMNS (n FOR ORDINALITY, a int PATH '$')) jt LIMIT 2;
+SELECT x, jt.*
+FROM generate_series(1, 2) x,
+	JSON_TABLE(jsonb '[1, 2, 3]', '$[*] ? (@ > $x)' PASSING x AS x COLUMNS (n FOR ORDINALITY, a int PATH '$')) jt;
+
+-- JSON_TABLE: row items are passed to columns and nested paths by reference
+SELECT * FROM JSON_TABLE(jsonb '[{"a": 1, "b": [10, 20]}, {"a": 2, "b": []}, {"a": 3}]', '$[*]'
+	COLUMNS (a int PATH '$.a', js jsonb PATH '$', NESTED PATH '$.b[*]' COLUMNS (b int PATH '$'))) jt;
+
+-- JSON_TABLE: simple column paths are projected together
+SELECT * FROM JSON_TABLE(jsonb '[{"a": 1, "b": {"c": "x"}, "d": [1, 2]}, {"b": {"c": "y"}}, [{"a": 3}], 4]', '$[*]'
+	COLUMNS (a int PATH '$.a', c text PATH '$.b.c', d jsonb PATH '$.d', a2 int PATH '$.a', ex bool EXISTS PATH '$.d')) jt;
+SELECT * FROM JSON_TABLE(jsonb '[{"a": 1, "b": 2}, {"b": 3}]', '$[*]'
+	COLUMNS (a int PATH 'strict $.a' DEFAULT -1 ON ERROR, b int PATH 'strict $.b')) jt;
+
 -- JSON_TABLE: nested paths and plans
 
 -- Should fail (JSON_TABLE columns shall contain explicit AS path
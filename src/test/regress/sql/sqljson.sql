@@ -214,6 +214,57 @@ FROM (VALUES (1, 1), (1, NULL), (2, 2)) foo(k, v);
 SELECT JSON_OBJECTAGG(k: v ABSENT ON NULL WITH UNIQUE KEYS RETURNING jsonb)
 FROM (VALUES (1, 1), (1, NULL), (2, 2)) foo(k, v);
 
+-- parallel aggregation
+CREATE TABLE test_json_parallel AS
+	SELECT i, i % 10 AS k FROM generate_series(1, 10000) i;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+EXPLAIN (COSTS OFF)
+SELECT
+	json_agg(i),
+	jsonb_agg(i),
+	JSON_OBJECTAGG(i: k WITH UNIQUE KEYS),
+	JSON_OBJECTAGG(i: k WITH UNIQUE KEYS RETURNING jsonb)
+FROM test_json_parallel;
+
+SELECT
+	json_array_length(ja) AS json_len,
+	jsonb_array_length(jba) AS jsonb_len,
+	(SELECT sum(e::int) FROM json_array_elements_text(ja) e) AS json_sum,
+	(SELECT sum(e::int) FROM jsonb_array_elements_text(jba) e) AS jsonb_sum,
+	(SELECT count(*) FROM json_each(jo)) AS json_keys,
+	(SELECT count(*) FROM jsonb_each(jbo)) AS jsonb_keys,
+	jbo->'5000' AS jsonb_5000
+FROM (
+	SELECT
+		json_agg(i) ja,
+		jsonb_agg(i) jba,
+		JSON_OBJECTAGG(i: k WITH UNIQUE KEYS) jo,
+		JSON_OBJECTAGG(i: k WITH UNIQUE KEYS RETURNING jsonb) jbo
+	FROM test_json_parallel
+) s;
+
+SELECT count(*)
+FROM json_each((
+	SELECT JSON_OBJECTAGG(i: NULLIF(k, 0) ABSENT ON NULL WITH UNIQUE KEYS)
+	FROM test_json_parallel
+));
+
+SELECT JSON_OBJECTAGG(CASE WHEN i = 10000 THEN 1 ELSE i END : k WITH UNIQUE KEYS)
+FROM test_json_parallel;
+
+SELECT JSON_OBJECTAGG(CASE WHEN i = 10000 THEN 1 ELSE i END : k WITH UNIQUE KEYS RETURNING jsonb)
+FROM test_json_parallel;
+
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE test_json_parallel;
+
 -- Test JSON_OBJECT deparsing
 EXPLAIN (VERBOSE, COSTS OFF)
 SELECT JSON_OBJECT('foo' : '1' FORMAT JSON, 'bar' : 'baz' RETURNING json);
@@ -366,6 +417,20 @@ SELECT
 FROM
 	(SELECT js::jsonb FROM test_is_json WHERE js IS JSON) foo(js);
 
+-- Wide objects, nested objects sharing keys, and long keys
+SELECT
+	('{' || string_agg(format('"k%s": {"k%s": %s}', i, i, i), ', ') || '}') IS JSON WITH UNIQUE KEYS "unique",
+	('{' || string_agg(format('"k%s": {"k%s": %s}', i % 1000, i, i), ', ') || '}') IS JSON WITH UNIQUE KEYS "duplicate",
+	('{"' || repeat('x', 5000) || '": 1, "' || repeat('x', 5000) || 'y": 2, "' || repeat('x', 5000) || '": 3}') IS JSON WITH UNIQUE KEYS "long keys"
+FROM generate_series(1, 1001) i;
+
+-- Deeply nested values
+SELECT
+	(repeat('[', 1000) || repeat(']', 1000)) IS JSON "arrays",
+	(repeat('{"a": ', 1000) || '1' || repeat('}', 1000)) IS JSON WITH UNIQUE KEYS "objects",
+	(repeat('{"a": [', 100) || repeat('], "a": 1}', 100)) IS JSON WITH UNIQUE KEYS "duplicates",
+	(repeat('[', 1000) || repeat(']', 999)) IS JSON "unbalanced";
+
 -- Test IS JSON deparsing
 EXPLAIN (VERBOSE, COSTS OFF)
 SELECT '1' IS JSON AS "any", ('1' || i) IS JSON SCALAR AS "scalar", '[]' IS NOT JSON ARRAY AS "array", '{}' IS JSON OBJECT WITH UNIQUE AS "object" FROM generate_series(1, 3) i;